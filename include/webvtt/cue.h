@@ -87,7 +87,9 @@ webvtt_cue_t {
   webvtt_string body;
 
   /**
-    * Parsed cue-text (NULL if has not been parsed)
+    * Parsed cue-text (NULL if has not been parsed). Parsers configured with
+    * 'lazy_cuetext' leave this NULL until webvtt_cue_get_node_head() is
+    * called.
     */
   webvtt_node *node_head;
 } webvtt_cue;
@@ -104,6 +106,19 @@ webvtt_release_cue( webvtt_cue **pcue );
 WEBVTT_EXPORT int
 webvtt_validate_cue( webvtt_cue *cue );
 
+/**
+ * Return the parsed cue text of 'cue', parsing it first if that was put off
+ * by the parser. The result is owned by the cue, and is NULL if the cue text
+ * couldn't be parsed, or was parsed into a webvtt_node_tree instead. A cue
+ * text that couldn't be parsed for lack of memory is parsed again by the
+ * next call. It is safe to call these from several threads at once.
+ */
+WEBVTT_EXPORT webvtt_node *
+webvtt_cue_get_node_head( webvtt_cue *cue );
+
+WEBVTT_EXPORT webvtt_node_tree *
+webvtt_cue_get_node_tree( webvtt_cue *cue );
+
 WEBVTT_EXPORT webvtt_status
 webvtt_cue_set_align( webvtt_cue *cue, const char *value );
 
@@ -101,6 +101,8 @@ extern "C" {
     WEBVTT_CUE_CONTAINS_SEPARATOR,
     /* A webvtt cue contains only a cue-id, and no cuetimes or payload. */
     WEBVTT_CUE_INCOMPLETE,
+    /* An HLS segment's X-TIMESTAMP-MAP header couldn't be read */
+    WEBVTT_MALFORMED_TIMESTAMP_MAP,
   };
   typedef enum webvtt_error_t webvtt_error;
 
@@ -128,6 +128,82 @@ webvtt_ref_node( webvtt_node *node );
 WEBVTT_EXPORT void
 webvtt_release_node( webvtt_node **node );
 
+/**
+ * A compact, read-only alternative to the webvtt_node tree.
+ *
+ * The nodes of a cue are stored in one contiguous array in document
+ * (preorder) order, with the head node at index 0, so that a node's
+ * children follow it directly. Text, annotations, languages and classes are
+ * kept in a single shared text blob. The whole tree is one allocation.
+ *
+ * Nodes are referred to by index. Functions returning an index return
+ * WEBVTT_NO_NODE where there is no such node. Functions returning text
+ * return an empty string for nodes without that kind of text, and store its
+ * length in 'len', if not NULL.
+ */
+typedef struct webvtt_node_tree_t webvtt_node_tree;
+
+#define WEBVTT_NO_NODE ( 0xFFFFFFFF )
+
+WEBVTT_EXPORT void
+webvtt_ref_node_tree( webvtt_node_tree *tree );
+
+WEBVTT_EXPORT void
+webvtt_release_node_tree( webvtt_node_tree **tree );
+
+/**
+ * Number of nodes in the tree, including the head node
+ */
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_size( const webvtt_node_tree *tree );
+
+WEBVTT_EXPORT webvtt_node_kind
+webvtt_node_tree_kind( const webvtt_node_tree *tree, webvtt_uint index );
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_parent( const webvtt_node_tree *tree, webvtt_uint index );
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_child_count( const webvtt_node_tree *tree,
+                              webvtt_uint index );
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_first_child( const webvtt_node_tree *tree,
+                              webvtt_uint index );
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_next_sibling( const webvtt_node_tree *tree,
+                               webvtt_uint index );
+
+/**
+ * Text of a WEBVTT_TEXT node
+ */
+WEBVTT_EXPORT const char *
+webvtt_node_tree_text( const webvtt_node_tree *tree, webvtt_uint index,
+                       webvtt_uint *len );
+
+/**
+ * Time of a WEBVTT_TIME_STAMP node
+ */
+WEBVTT_EXPORT webvtt_timestamp
+webvtt_node_tree_timestamp( const webvtt_node_tree *tree, webvtt_uint index );
+
+WEBVTT_EXPORT const char *
+webvtt_node_tree_annotation( const webvtt_node_tree *tree, webvtt_uint index,
+                             webvtt_uint *len );
+
+WEBVTT_EXPORT const char *
+webvtt_node_tree_lang( const webvtt_node_tree *tree, webvtt_uint index,
+                       webvtt_uint *len );
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_class_count( const webvtt_node_tree *tree,
+                              webvtt_uint index );
+
+WEBVTT_EXPORT const char *
+webvtt_node_tree_class( const webvtt_node_tree *tree, webvtt_uint index,
+                        webvtt_uint n, webvtt_uint *len );
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
@@ -48,20 +48,268 @@ typedef int ( WEBVTT_CALLBACK *webvtt_error_fn )( void *userdata,
 typedef void ( WEBVTT_CALLBACK *webvtt_cue_fn )( void *userdata,
                                                  webvtt_cue *cue );
 
+/**
+ * Receives 'count' cues at once, in file order, from a parser created with
+ * webvtt_create_batch_parser(). The application owns a reference to each cue,
+ * as with webvtt_cue_fn, but not the array, which is only valid during the
+ * call.
+ */
+typedef void ( WEBVTT_CALLBACK *webvtt_cues_fn )( void *userdata,
+                                                  webvtt_cue **cues,
+                                                  webvtt_uint count );
+
 
 WEBVTT_EXPORT webvtt_status
 webvtt_create_parser( webvtt_cue_fn on_read, webvtt_error_fn on_error,
                       void * userdata, webvtt_parser *ppout );
 
+/**
+ * Parts of a cue which the parser can be asked to produce. Cue timings are
+ * always produced.
+ */
+typedef enum
+webvtt_projection_t {
+  WEBVTT_PROJECT_TIMINGS = 0x01,
+  WEBVTT_PROJECT_ID = 0x02, /* 'id' */
+  WEBVTT_PROJECT_SETTINGS = 0x04, /* 'settings' and 'snap_to_lines' */
+  WEBVTT_PROJECT_BODY = 0x08, /* 'body' */
+  WEBVTT_PROJECT_NODES = 0x10, /* 'node_head' or 'node_tree' */
+  WEBVTT_PROJECT_ALL = 0x1F
+} webvtt_projection;
+
+/**
+ * Optional parser configuration, for use with
+ * webvtt_create_parser_with_config(). Always initialize it with
+ * webvtt_init_parser_config() before setting any fields, so that fields added
+ * in the future take their default values.
+ */
+typedef struct
+webvtt_parser_config_t {
+  /**
+   * If not NULL, every cue, node and string produced by the parser is
+   * allocated from this arena, and released all at once when the arena is
+   * reset or deleted. The arena must outlive the parser, and must only be
+   * reset once webvtt_finish_parsing() has been called.
+   */
+  webvtt_arena *arena;
+
+  /**
+   * If true (and no arena is given), cues and nodes released by the
+   * application are kept by the parser and reused for later cues, rather than
+   * given back to the allocator. This lets a long running parser produce cues
+   * without allocating cue or node structures once it has warmed up. Cues may
+   * be released on any thread, and after the parser has been deleted.
+   */
+  webvtt_bool pool_objects;
+
+  /**
+   * If true, tag names, classes, annotations and languages in cue text are
+   * interned, so that repeated values share one string, at the cost of
+   * hashing each of them. Each parser then uses a table of its own, unless
+   * 'interns' is set. Strings allocated from an arena are never interned.
+   */
+  webvtt_bool intern_cuetext;
+
+  /**
+   * If not NULL, cue text is interned with this table, which may be shared
+   * between several parsers, as if 'intern_cuetext' was set. The parser keeps
+   * its own reference to the table.
+   */
+  webvtt_intern_table *interns;
+
+  /**
+   * If true, cue text is parsed into a compact webvtt_node_tree, stored in
+   * the cue's 'node_tree' field, instead of a tree of webvtt_node objects.
+   * 'node_head' is then left NULL.
+   */
+  webvtt_bool flat_node_tree;
+
+  /**
+   * If true (and no arena is given), cue text isn't parsed until the
+   * application first asks for it with webvtt_cue_get_node_head() or
+   * webvtt_cue_get_node_tree(), so that applications which only need cue
+   * timings and bodies never pay for it. Cue text parsed this way isn't
+   * interned.
+   */
+  webvtt_bool lazy_cuetext;
+
+  /**
+   * The webvtt_projection flags of the cue parts to produce, or 0 for all of
+   * them. Parts which aren't asked for are skipped rather than parsed, and
+   * are left at their defaults: an empty id or body, default settings, and
+   * no nodes. Errors in skipped cue settings aren't reported. With
+   * 'lazy_cuetext', asking for nodes keeps the body as well, as they are
+   * parsed from it.
+   */
+  webvtt_uint projection;
+
+  /**
+   * The most cues delivered at once by a parser created with
+   * webvtt_create_batch_parser(), or 0 for WEBVTT_DEFAULT_BATCH_SIZE.
+   */
+  webvtt_uint batch_size;
+
+  /**
+   * If true, the input is an HLS segment. An X-TIMESTAMP-MAP=MPEGTS:<ticks>,
+   * LOCAL:<timestamp> line between the signature and the first blank line is
+   * read rather than reported as an error, and every cue timing and
+   * timestamp tag is moved by the offset it gives, so that times come out on
+   * the MPEG-TS timeline, in milliseconds: 'time - LOCAL + ( MPEGTS -
+   * hls_mpegts_base ) / 90'. Times which would be negative become 0. Without
+   * the line, times are left as they are.
+   */
+  webvtt_bool hls_segment;
+
+  /**
+   * MPEG-TS time, in 90 kHz ticks, which HLS segment times are measured
+   * from. MPEGTS values below it are taken to have wrapped around 2^33.
+   */
+  webvtt_uint64 hls_mpegts_base;
+} webvtt_parser_config;
+
+#define WEBVTT_DEFAULT_BATCH_SIZE ( 64 )
+
+WEBVTT_EXPORT void
+webvtt_init_parser_config( webvtt_parser_config *config );
+
+WEBVTT_EXPORT webvtt_status
+webvtt_create_parser_with_config( webvtt_cue_fn on_read,
+                                  webvtt_error_fn on_error, void *userdata,
+                                  const webvtt_parser_config *config,
+                                  webvtt_parser *ppout );
+
+/**
+ * Like webvtt_create_parser_with_config(), but hand cues to 'on_read' in
+ * batches of up to 'config->batch_size', rather than one at a time. Cues and
+ * errors are still reported in file order: the cues waiting in a batch are
+ * delivered before an error is reported, and when parsing is finished. Cues
+ * still waiting when the parser is deleted are released.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_create_batch_parser( webvtt_cues_fn on_read, webvtt_error_fn on_error,
+                            void *userdata, const webvtt_parser_config *config,
+                            webvtt_parser *ppout );
+
+/**
+ * Create a parser which keeps the cues it finishes, rather than passing them
+ * to a callback, for the application to take with webvtt_parser_next_cue()
+ * when it is ready for them. Errors are still reported to 'on_error'.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_create_pull_parser( webvtt_error_fn on_error, void *userdata,
+                           const webvtt_parser_config *config,
+                           webvtt_parser *ppout );
+
+/**
+ * Take the next cue finished by a parser created with
+ * webvtt_create_pull_parser(). The application owns the cue stored in
+ * 'pcue', and must release it. Returns WEBVTT_UNFINISHED, storing NULL, if
+ * the parser needs more input before it can finish another cue, and
+ * WEBVTT_SUCCESS with NULL once parsing has finished and every cue has been
+ * taken.
+ *
+ * Cues are kept until they are taken, however many a chunk of input yields,
+ * so taking them as each chunk is parsed keeps the parser's memory small.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_parser_next_cue( webvtt_parser self, webvtt_cue **pcue );
+
 WEBVTT_EXPORT void
 webvtt_delete_parser( webvtt_parser parser );
 
 WEBVTT_EXPORT webvtt_status
 webvtt_parse_chunk( webvtt_parser self, const void *buffer, webvtt_uint len );
 
+/**
+ * Like webvtt_parse_chunk(), but parse the 'len' bytes at 'offset' in
+ * 'buffer'. Cue text which lies entirely within the buffer is not copied: the
+ * cue's body (and its text node, if it has no markup) point into the buffer,
+ * and keep it alive for as long as they do.
+ *
+ * The buffer is never written to, and may be parsed again. A view only makes
+ * a NUL terminated copy of its text when webvtt_string_text() is first called
+ * on it. Parsers using an arena always copy.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_chunk_from_buffer( webvtt_parser self, webvtt_buffer *buffer,
+                                webvtt_uint offset, webvtt_uint len );
+
 WEBVTT_EXPORT webvtt_status
 webvtt_finish_parsing( webvtt_parser self );
 
+/**
+ * Parse 'len' bytes which are the whole of the remaining input, and finish
+ * parsing, as webvtt_finish_parsing() would. Knowing that no line continues
+ * in a later chunk, the parser takes cue text lines straight out of
+ * 'buffer' instead of collecting them first.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_buffer( webvtt_parser self, const void *buffer, webvtt_uint len );
+
+/**
+ * Like webvtt_parse_buffer(), but split the input into segments at blank
+ * lines which are known to end a cue (or skipped block), and parse the
+ * segments on up to 'threads' threads at once, each with a parser of its
+ * own. 'threads' is 0 for one thread per processor.
+ *
+ * Cues and errors are reported from the calling thread, in file order, with
+ * the same line numbers webvtt_parse_buffer() would report. If the error
+ * callback returns a negative value, parsing stops just as it would have,
+ * and nothing from later in the file is reported. The status returned is a
+ * failure then, though not necessarily the same one. Parsers which intern
+ * cue text give each thread a table of its own, so values are only shared
+ * between cues parsed on the same thread.
+ *
+ * Small inputs, parsers using an arena, HLS segment parsers, and parsers
+ * which have already been given some input are parsed on the calling thread,
+ * as by webvtt_parse_buffer(). So is everything when there is only one
+ * thread to use, on platforms without threads, and in builds with
+ * non-atomic reference counts.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_buffer_parallel( webvtt_parser self, const void *buffer,
+                              webvtt_uint len, webvtt_uint threads );
+
+/**
+ * Parse the whole of the file at 'path', and finish parsing. Where the
+ * platform allows it, the file is mapped into memory rather than read, and
+ * parsed as one buffer, so that cue text can point into the mapping as with
+ * webvtt_parse_chunk_from_buffer(). The mapping is private, and stays alive
+ * for as long as anything points into it.
+ *
+ * Returns WEBVTT_UNSUCCESSFUL, with errno set, if the file can't be read.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_file( webvtt_parser self, const char *path );
+
+/**
+ * Save the state of a parser between chunks of input, including any cue it
+ * has partly read, so that parsing can later carry on from the same place
+ * in the input with webvtt_parser_restore(), in this or another process.
+ *
+ * The snapshot is written to 'buffer', and its length stored in 'length'. If
+ * 'size' is too small for it (for instance 0), WEBVTT_OUT_OF_MEMORY is
+ * returned, and 'length' still tells how much is needed. Cues waiting in a
+ * batch are delivered first; cues waiting to be taken from a pull parser are
+ * not part of the snapshot. The parser's configuration and callbacks are not
+ * saved either. Returns WEBVTT_UNFINISHED if called from one of the parser's
+ * callbacks while it is parsing a buffer.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_parser_snapshot( webvtt_parser self, void *buffer, webvtt_uint size,
+                        webvtt_uint *length );
+
+/**
+ * Give a parser which hasn't been given any input the state saved by
+ * webvtt_parser_snapshot(). The parser should have the same configuration as
+ * the one the snapshot was taken from. Returns WEBVTT_NOT_SUPPORTED for a
+ * snapshot from an incompatible version of the library, and
+ * WEBVTT_INVALID_PARAM for one that is damaged, leaving the parser as it was.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_parser_restore( webvtt_parser self, const void *snapshot,
+                       webvtt_uint length );
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
@@ -39,6 +39,7 @@ extern "C" {
 typedef struct webvtt_string_t webvtt_string;
 typedef struct webvtt_string_data_t webvtt_string_data;
 typedef struct webvtt_stringlist_t webvtt_stringlist;
+typedef struct webvtt_buffer_t webvtt_buffer;
 struct webvtt_string_data_t;
 
 struct
@@ -127,7 +128,8 @@ webvtt_copy_string( webvtt_string *left, const webvtt_string *right );
 /**
  * webvtt_string_text
  *
- * return the text contents of a string
+ * return the text contents of a string, NUL terminated. the first call on a
+ * string which is a view of a buffer makes a terminated copy of its text.
  */
 WEBVTT_EXPORT const char *
 webvtt_string_text( const webvtt_string *str );
@@ -228,6 +230,123 @@ webvtt_string_collect_word( const webvtt_string *buffer, webvtt_string *out,
 WEBVTT_EXPORT int
 webvtt_string_skip_whitespace( const webvtt_string *buffer, int *pos );
 
+/**
+ * buffers
+ *
+ * a reference counted block of input text. strings produced by the parser
+ * from a buffer may point into it ("string views") rather than holding a copy
+ * of their text, and keep it alive for as long as they do.
+ *
+ * the library never writes to a buffer's data. 'free_fn', if not NULL, is
+ * called once the last reference to the buffer is released.
+ */
+typedef void ( WEBVTT_CALLBACK *webvtt_buffer_free_fn )( void *userdata,
+                                                         char *data,
+                                                         webvtt_uint length );
+
+/**
+ * webvtt_create_buffer
+ *
+ * wrap 'length' bytes at 'data' in a new buffer, without copying them
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_create_buffer( char *data, webvtt_uint length,
+                      webvtt_buffer_free_fn free_fn, void *userdata,
+                      webvtt_buffer **ppout );
+
+/**
+ * webvtt_ref_buffer
+ *
+ * increase the reference count of a buffer
+ */
+WEBVTT_EXPORT void
+webvtt_ref_buffer( webvtt_buffer *buffer );
+
+/**
+ * webvtt_release_buffer
+ *
+ * decrease the reference count of a buffer, and free it if the reference
+ * count is 0
+ */
+WEBVTT_EXPORT void
+webvtt_release_buffer( webvtt_buffer **buffer );
+
+/**
+ * webvtt_buffer_data
+ *
+ * return the contents of a buffer
+ */
+WEBVTT_EXPORT char *
+webvtt_buffer_data( const webvtt_buffer *buffer );
+
+/**
+ * webvtt_buffer_length
+ *
+ * return the length of a buffer
+ */
+WEBVTT_EXPORT webvtt_uint
+webvtt_buffer_length( const webvtt_buffer *buffer );
+
+/**
+ * webvtt_string_is_same
+ *
+ * return true if 'a' and 'b' share the same string data. strings interned
+ * with the same intern table are equal if, and only if, they are the same.
+ */
+WEBVTT_EXPORT webvtt_bool
+webvtt_string_is_same( const webvtt_string *a, const webvtt_string *b );
+
+/**
+ * intern tables
+ *
+ * an intern table maps short strings to a single shared instance, so that
+ * values which are repeated over and over (tag names, classes, voice
+ * annotations and languages in cue text) share one reference counted copy,
+ * and can be compared with webvtt_string_is_same().
+ *
+ * a table may be shared by several parsers, on several threads, unless the
+ * library was built with --disable-atomic-refcount. interned strings are
+ * immutable: modifying one makes a private copy first.
+ */
+typedef struct webvtt_intern_table_t webvtt_intern_table;
+
+/**
+ * webvtt_create_intern_table
+ *
+ * allocate a new, empty intern table
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_create_intern_table( webvtt_intern_table **ppout );
+
+/**
+ * webvtt_ref_intern_table
+ *
+ * increase the reference count of an intern table
+ */
+WEBVTT_EXPORT void
+webvtt_ref_intern_table( webvtt_intern_table *table );
+
+/**
+ * webvtt_release_intern_table
+ *
+ * decrease the reference count of an intern table, and delete it if the
+ * reference count is 0. strings interned with the table remain valid.
+ */
+WEBVTT_EXPORT void
+webvtt_release_intern_table( webvtt_intern_table **table );
+
+/**
+ * webvtt_intern_string
+ *
+ * replace the data of 'str' with the table's instance of the same text,
+ * adding 'str' to the table if it's not there yet. strings which are too
+ * long to be worth sharing, and strings allocated from an arena, are left
+ * alone. views of a buffer are copied, so that the table doesn't keep the
+ * buffer alive.
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_intern_string( webvtt_intern_table *table, webvtt_string *str );
+
 /**
  * basic dynamic array of strings
  */
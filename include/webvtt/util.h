@@ -156,14 +156,28 @@ extern "C" {
 
   /**
    * Allocation functions. webvtt_set_allocator() should really be the first
-   * function called. However, it will do nothing (and not report error) if
-   * objects have already been allocated and not freed. Therefore, it is NOT
-   * safe to assume that it worked and use the supplied
-   * function pointers directly.
+   * function called. It fails with WEBVTT_UNSUCCESSFUL, leaving the allocator
+   * unchanged, if objects have already been allocated and not freed. Passing
+   * NULL for both callbacks restores the default allocator.
    *
-   * Currently, set_allocator (and the other allocation functions) do not use
-   * any locking mechanism, so the library cannot be considered to be
-   * thread-safe at this time if changing the allocator is used.
+   * The allocation functions may be called from any number of threads. Each
+   * thread keeps a small cache of recently freed blocks, which is returned to
+   * the allocator when the thread exits, or when the thread calls
+   * webvtt_flush_alloc_cache(). webvtt_set_allocator() flushes the calling
+   * thread's cache, but blocks cached by other, still running threads will
+   * keep it from taking effect. The supplied callbacks must themselves be
+   * safe to call from every thread that uses the library.
+   *
+   * webvtt_set_allocator() may only be called while no other thread is using
+   * the library: it can't see allocations which are still in progress on
+   * other threads.
+   *
+   * Every block handed out by webvtt_alloc() and webvtt_alloc0() is preceded
+   * by a small header of the library's own, so the pointer returned is not
+   * one the allocator callbacks returned. Such blocks must be freed with
+   * webvtt_free(), never with free() or the 'free' callback, and
+   * webvtt_free() must only be given blocks from webvtt_alloc() or
+   * webvtt_alloc0().
    *
    * I don't believe there is much of a reason to worry about the overhead of
    * using function pointers for allocation, as it is negligible compared to the
@@ -173,9 +187,7 @@ extern "C" {
   WEBVTT_EXPORT void *webvtt_alloc( webvtt_uint nb );
   WEBVTT_EXPORT void *webvtt_alloc0( webvtt_uint nb );
   WEBVTT_EXPORT void webvtt_free( void *data );
-  WEBVTT_EXPORT void webvtt_set_allocator( webvtt_alloc_fn_ptr alloc,
-                                           webvtt_free_fn_ptr free,
-                                           void *userdata );
+  WEBVTT_EXPORT void webvtt_flush_alloc_cache( void );
 
   enum
   webvtt_status_t {
@@ -244,11 +256,98 @@ extern "C" {
 
   typedef enum webvtt_status_t webvtt_status;
 
+  /**
+   * See the allocation functions above
+   */
+  WEBVTT_EXPORT webvtt_status webvtt_set_allocator( webvtt_alloc_fn_ptr alloc,
+                                                    webvtt_free_fn_ptr free,
+                                                    void *userdata );
+
   /**
    * Macros to filter out webvtt status returns.
    */
 # define WEBVTT_FAILED(status) ( (status) != WEBVTT_SUCCESS )
 
+  /**
+   * Allocation statistics.
+   *
+   * When enabled with webvtt_enable_alloc_stats(), the library keeps track of
+   * the number of live blocks and bytes it has allocated, broken down by what
+   * they are used for, along with the largest number of bytes live at any one
+   * time. Objects allocated from an arena are not tracked individually;
+   * instead, the arena's blocks are reported under WEBVTT_MEM_ARENA.
+   *
+   * Statistics are process-wide, and only cover blocks allocated while they
+   * were enabled. Keeping them costs a few atomic operations per allocation,
+   * so they are disabled by default.
+   */
+  typedef enum
+  webvtt_mem_category_t {
+    WEBVTT_MEM_OTHER = 0, /* anything allocated with webvtt_alloc() */
+    WEBVTT_MEM_STRING, /* string data */
+    WEBVTT_MEM_STRINGLIST, /* string lists and their items */
+    WEBVTT_MEM_CUE, /* webvtt_cue structures */
+    WEBVTT_MEM_NODE, /* webvtt_node structures and internal node data */
+    WEBVTT_MEM_CHILDREN, /* arrays of child nodes */
+    WEBVTT_MEM_TOKEN, /* cue text tokens */
+    WEBVTT_MEM_PARSER, /* parser objects */
+    WEBVTT_MEM_PARSER_STACK, /* parser state stacks which outgrew the parser */
+    WEBVTT_MEM_INTERN, /* intern tables */
+    WEBVTT_MEM_ARENA, /* arena blocks */
+    WEBVTT_MEM_CATEGORIES
+  } webvtt_mem_category;
+
+  typedef struct
+  webvtt_mem_stat_t {
+    webvtt_uint64 count; /* live blocks */
+    webvtt_uint64 bytes; /* live bytes */
+    webvtt_uint64 peak_bytes; /* high-water mark of 'bytes' */
+  } webvtt_mem_stat;
+
+  typedef struct
+  webvtt_alloc_stats_t {
+    webvtt_mem_stat total;
+    webvtt_mem_stat category[ WEBVTT_MEM_CATEGORIES ];
+  } webvtt_alloc_stats;
+
+  WEBVTT_EXPORT void webvtt_enable_alloc_stats( webvtt_bool enable );
+  WEBVTT_EXPORT void webvtt_get_alloc_stats( webvtt_alloc_stats *stats );
+
+  /**
+   * Reset the high-water marks to the current number of live bytes
+   */
+  WEBVTT_EXPORT void webvtt_reset_alloc_peaks( void );
+
+  /**
+   * Arena allocation.
+   *
+   * An arena hands out memory by bumping a pointer through large blocks, and
+   * gives all of it back at once in webvtt_reset_arena() or
+   * webvtt_delete_arena(). A parser created with an arena (see
+   * webvtt_create_parser_with_config()) allocates the cues, nodes and strings
+   * it produces from that arena, and webvtt_release_cue() and
+   * webvtt_release_node() do nothing for such objects.
+   *
+   * Objects allocated from an arena must not be used after the arena has been
+   * reset or deleted. An arena must not be used by more than one parser at a
+   * time, but separate parsers on separate threads may each use their own.
+   *
+   * A parser allocates from its arena by installing it for the calling
+   * thread while it runs, and removes it again before returning or calling
+   * back into the application. webvtt_delete_arena() can only see the
+   * calling thread, so an arena must not be deleted while a parser using it
+   * is running on another thread: delete the parser first.
+   *
+   * 'block_size' is the size of the blocks the arena carves allocations out
+   * of. Passing 0 selects a default suitable for typical caption files.
+   */
+  typedef struct webvtt_arena_t webvtt_arena;
+
+  WEBVTT_EXPORT webvtt_status webvtt_create_arena( webvtt_uint block_size,
+                                                   webvtt_arena **parena );
+  WEBVTT_EXPORT void webvtt_reset_arena( webvtt_arena *arena );
+  WEBVTT_EXPORT void webvtt_delete_arena( webvtt_arena **parena );
+
   struct
   webvtt_refcount_t {
 # if WEBVTT_OS_WIN32
@@ -268,28 +367,30 @@ extern "C" {
 # define WEBVTT_REF_INIT(Value) { (Value) }
 
   /**
-   * TODO: Replace these with atomic instructions for systems that provide it
+   * Reference counts are updated atomically, so that cues, nodes and strings
+   * can be handed to other threads, unless the library was configured with
+   * --disable-atomic-refcount. These are functions rather than inline code
+   * so that callers always agree with the library on which it is. Both
+   * return the new count.
+   */
+  WEBVTT_EXPORT int webvtt_ref( struct webvtt_refcount_t *ref );
+  WEBVTT_EXPORT int webvtt_deref( struct webvtt_refcount_t *ref );
+
+  /**
+   * Deprecated: use webvtt_ref() and webvtt_deref(), which these forward to.
+   * WEBVTT_ATOMIC_INC and WEBVTT_ATOMIC_DEC take the 'value' of a
+   * webvtt_refcount_t.
    */
 # ifndef WEBVTT_ATOMIC_INC
-#   define WEBVTT_ATOMIC_INC(x) ( ++(x) )
+#   define WEBVTT_ATOMIC_INC(x) \
+      ( webvtt_ref( (struct webvtt_refcount_t *)&(x) ) )
 # endif
 # ifndef WEBVTT_ATOMIC_DEC
-#   define WEBVTT_ATOMIC_DEC(x) ( --(x) )
-# endif
-
-# if defined(WEBVTT_INLINE)
-  static WEBVTT_INLINE int webvtt_ref( struct webvtt_refcount_t *ref )
-  {
-    return WEBVTT_ATOMIC_INC(ref->value);
-  }
-  static WEBVTT_INLINE int webvtt_deref( struct webvtt_refcount_t *ref )
-  {
-    return WEBVTT_ATOMIC_DEC(ref->value);
-  }
-# else
-#   define webvtt_inc_ref(ref) ( WEBVTT_ATOMIC_INC((ref)->value) )
-#   define webvtt_dec_ref(ref) ( WEBVTT_ATOMIC_DEC((ref)->value) )
+#   define WEBVTT_ATOMIC_DEC(x) \
+      ( webvtt_deref( (struct webvtt_refcount_t *)&(x) ) )
 # endif
+# define webvtt_inc_ref(ref) ( webvtt_ref( ref ) )
+# define webvtt_dec_ref(ref) ( webvtt_deref( ref ) )
 
 #if defined(__cplusplus) || defined(c_plusplus)
 }
@@ -28,20 +28,196 @@
 #include <webvtt/util.h>
 #include <stdlib.h>
 #include <string.h>
+#include "alloc_internal.h"
+#if WEBVTT_OS_WIN32
+# include <windows.h>
+#elif defined(HAVE_PTHREAD)
+# include <pthread.h>
+#endif
+
+/**
+ * Size classes. Allocations of up to (1 << MAX_CLASS) bytes (including the
+ * block header) are rounded up to a power of two, so that freed chunks can be
+ * recycled through per-size free lists.
+ */
+#define MIN_CLASS ( 5 )
+#define MAX_CLASS ( 12 )
+#define NUM_CLASSES ( MAX_CLASS - MIN_CLASS + 1 )
+
+/**
+ * Arena tuning. Arenas recycle chunks of every size class, which matters for
+ * the transient strings the parser builds while reading a line, which would
+ * otherwise eat up the arena.
+ */
+#define ARENA_DEFAULT_BLOCK ( 0x10000 )
+#define ARENA_MIN_BLOCK ( 0x1000 )
+#define ARENA_ALIGN ( sizeof( webvtt_alloc_header ) )
+#define ARENA_ROUND(n) ( ( (n) + ARENA_ALIGN - 1 ) & ~( ARENA_ALIGN - 1 ) )
+#define ARENA_BLOCK_DATA(b) ( (char *)(b) + ARENA_ROUND( sizeof( *(b) ) ) )
+
+/**
+ * Maximum number of released objects of each size class a pool holds on to
+ */
+#define POOL_DEPTH ( 1024 )
+
+/**
+ * Thread cache tuning. Each thread keeps up to CACHE_DEPTH freed heap blocks
+ * of each size class up to (1 << CACHE_MAX_CLASS) bytes, so that the small
+ * strings, nodes and cues which are constantly created and released while
+ * parsing don't go back to the allocator (and its locks) every time.
+ */
+#define CACHE_MAX_CLASS ( 10 )
+#define CACHE_NUM_CLASSES ( CACHE_MAX_CLASS - MIN_CLASS + 1 )
+#define CACHE_DEPTH ( 64 )
+
+#if WEBVTT_CC_MSVC
+# define THREAD_LOCAL __declspec(thread)
+#elif WEBVTT_CC_GCC
+# define THREAD_LOCAL __thread
+#endif
+
+#if defined(THREAD_LOCAL) && ( WEBVTT_OS_WIN32 || defined(HAVE_PTHREAD) )
+# define HAVE_THREAD_CACHE 1
+#endif
+
+/**
+ * 64 bit atomics for the statistics counters, which only need to be
+ * eventually consistent, and are never used to synchronize anything.
+ */
+#if WEBVTT_CC_MSVC
+# define ATOMIC_ADD64(p,n) \
+  ( InterlockedExchangeAdd64( (volatile LONGLONG *)(p), (LONGLONG)(n) ) )
+# define ATOMIC_CAS64(p,o,n) \
+  ( InterlockedCompareExchange64( (volatile LONGLONG *)(p), (LONGLONG)(n), \
+                                  (LONGLONG)(o) ) == (LONGLONG)(o) )
+#elif WEBVTT_CC_GCC
+# define ATOMIC_ADD64(p,n) ( __sync_fetch_and_add( (p), (n) ) )
+# define ATOMIC_CAS64(p,o,n) ( __sync_bool_compare_and_swap( (p), (o), (n) ) )
+#else
+# define ATOMIC_ADD64(p,n) ( *(p) += (n) )
+# define ATOMIC_CAS64(p,o,n) ( *(p) = (n), 1 )
+#endif
 
 static void *default_alloc( void *unused, webvtt_uint nb );
 static void default_free( void *unused, void *ptr );
 
-struct {
-  /**
-   * Number of allocated objects. Forbid changing the allocator if this is not
-   * equal to 0 
-   */
-  webvtt_uint n_alloc;
+typedef struct
+webvtt_alloc_hooks_t {
   webvtt_alloc_fn_ptr alloc;
   webvtt_free_fn_ptr free;
   void *alloc_data;
-} allocator = { 0, default_alloc, default_free, 0 };
+} webvtt_alloc_hooks;
+
+static webvtt_alloc_hooks default_hooks = { default_alloc, default_free, 0 };
+
+typedef struct webvtt_alloc_cache_t webvtt_alloc_cache;
+
+struct {
+  /**
+   * The callbacks in use. webvtt_set_allocator() fills in whichever of
+   * 'user_hooks' isn't in use and then publishes it with a single pointer
+   * store, so that nothing ever sees half of one allocator and half of
+   * another.
+   */
+  webvtt_alloc_hooks *volatile hooks;
+  webvtt_alloc_hooks user_hooks[ 2 ];
+  /**
+   * Blocks obtained from the callbacks and not yet given back. Each thread
+   * with a cache counts its own blocks without any atomic operations, and
+   * the counts are only added up by webvtt_set_allocator(). 'n_alloc' holds
+   * the blocks counted by threads without a cache, along with those left
+   * behind by threads which have exited. A block freed on a different thread
+   * from the one which allocated it leaves one count too high and the other
+   * too low, which evens out in the sum.
+   */
+  volatile long n_alloc;
+  webvtt_alloc_cache *threads;
+  /**
+   * Serializes webvtt_set_allocator(), and guards 'threads'
+   */
+  volatile webvtt_uint lock;
+} allocator = { &default_hooks, { { 0, 0, 0 }, { 0, 0, 0 } }, 0, 0, 0 };
+
+/**
+ * Statistics, indexed by category, with the totals at the end
+ */
+typedef struct
+webvtt_mem_counter_t {
+  volatile webvtt_uint64 count;
+  volatile webvtt_uint64 bytes;
+  volatile webvtt_uint64 peak_bytes;
+} webvtt_mem_counter;
+
+static webvtt_mem_counter stats[ WEBVTT_MEM_CATEGORIES + 1 ];
+static volatile int stats_enabled = 0;
+
+typedef struct
+webvtt_arena_block_t {
+  struct webvtt_arena_block_t *next;
+  webvtt_uint size; /* usable bytes following the block header */
+  webvtt_bool counted; /* included in the statistics */
+} webvtt_arena_block;
+
+struct
+webvtt_arena_t {
+  /**
+   * Blocks owned by the arena. The block currently being carved up (if any)
+   * is always at the head of the list.
+   */
+  webvtt_arena_block *blocks;
+  char *cursor;
+  char *limit;
+  webvtt_uint block_size;
+  /**
+   * Recycled chunks, indexed by size class. The first word of each chunk
+   * points to the next one.
+   */
+  void *free_chunks[ NUM_CLASSES ];
+};
+
+struct
+webvtt_pool_t {
+  /**
+   * One reference for the owner, plus one for every block allocated from the
+   * heap on behalf of the pool, whether in use or sitting in 'free_chunks'
+   */
+  struct webvtt_refcount_t refs;
+  volatile webvtt_uint lock;
+  webvtt_bool closed; /* the owner has released the pool */
+  void *free_chunks[ NUM_CLASSES ];
+  webvtt_uint count[ NUM_CLASSES ];
+};
+
+#ifdef HAVE_THREAD_CACHE
+struct
+webvtt_alloc_cache_t {
+  void *free_chunks[ CACHE_NUM_CLASSES ];
+  webvtt_uint count[ CACHE_NUM_CLASSES ];
+  /**
+   * 0 until the thread exit handler has been registered, and -1 once the
+   * thread is exiting and the cache must no longer be used.
+   */
+  int state;
+  /**
+   * This thread's share of 'allocator.n_alloc', and the next thread in
+   * 'allocator.threads'
+   */
+  volatile long n_alloc;
+  webvtt_alloc_cache *next;
+};
+
+static THREAD_LOCAL webvtt_alloc_cache thread_cache;
+#endif
+
+/**
+ * Where webvtt_alloc() currently allocates from on this thread. Allocations go
+ * to the heap if neither an arena nor a pool is installed.
+ */
+#ifdef THREAD_LOCAL
+static THREAD_LOCAL webvtt_alloc_context current = { 0, 0 };
+#else
+static webvtt_alloc_context current = { 0, 0 };
+#endif
 
 static void *WEBVTT_CALLBACK
 default_alloc( void *unused, webvtt_uint nb )
@@ -57,27 +233,566 @@ default_free( void *unused, void *ptr )
   free( ptr );
 }
 
-WEBVTT_EXPORT void
+#ifdef HAVE_THREAD_CACHE
+static webvtt_alloc_cache *get_cache( void );
+#endif
+
+/**
+ * Count 'n' blocks obtained from (or, if negative, given back to) the
+ * allocator callbacks
+ */
+static void
+count_blocks( long n )
+{
+#ifdef HAVE_THREAD_CACHE
+  webvtt_alloc_cache *cache = get_cache();
+  if( cache ) {
+    cache->n_alloc += n;
+    return;
+  }
+#endif
+  ATOMIC_ADD( &allocator.n_alloc, n );
+}
+
+/**
+ * Allocate and free blocks with the allocator callbacks. The hooks pointer is
+ * read once, so a block is always handled by a matching pair of callbacks.
+ */
+static void *
+sys_alloc( webvtt_uint nb )
+{
+  webvtt_alloc_hooks *hooks = allocator.hooks;
+  void *ptr = hooks->alloc( hooks->alloc_data, nb );
+  if( ptr ) {
+    count_blocks( 1 );
+  }
+  return ptr;
+}
+
+static void
+sys_free( void *ptr )
+{
+  webvtt_alloc_hooks *hooks = allocator.hooks;
+  hooks->free( hooks->alloc_data, ptr );
+  count_blocks( -1 );
+}
+
+WEBVTT_EXPORT webvtt_status
 webvtt_set_allocator( webvtt_alloc_fn_ptr alloc, webvtt_free_fn_ptr free,
                       void *userdata )
 {
+  webvtt_alloc_hooks *hooks = &default_hooks;
+  webvtt_status status = WEBVTT_UNSUCCESSFUL;
+  long n_alloc;
+#ifdef HAVE_THREAD_CACHE
+  webvtt_alloc_cache *cache;
+#endif
+
+  if( !alloc != !free ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
   /**
-   * TODO:
-   * This really needs a lock. But then, so does all the allocation/free
-   * functions...
-   * that could be a problem.
+   * Blocks sitting in this thread's cache still count as allocated, so give
+   * them back first. Caches belonging to other threads must have been flushed
+   * by those threads (or their threads must have exited).
    */
-  if( allocator.n_alloc == 0 ) {
-    if( alloc && free ) {
-      allocator.alloc = alloc;
-      allocator.free = free;
-      allocator.alloc_data = userdata;
-    } else if( !alloc && !free ) {
-      allocator.alloc = &default_alloc;
-      allocator.free = &default_free;
-      allocator.alloc_data = 0;
+  webvtt_flush_alloc_cache();
+
+  SPIN_LOCK( &allocator.lock );
+  n_alloc = allocator.n_alloc;
+#ifdef HAVE_THREAD_CACHE
+  for( cache = allocator.threads; cache; cache = cache->next ) {
+    n_alloc += cache->n_alloc;
+  }
+#endif
+  if( n_alloc == 0 ) {
+    if( alloc ) {
+      hooks = allocator.user_hooks +
+              ( allocator.hooks == allocator.user_hooks ? 1 : 0 );
+      hooks->alloc = alloc;
+      hooks->free = free;
+      hooks->alloc_data = userdata;
+    }
+    /* A full barrier, so that the callbacks are visible before the pointer */
+    (void)ATOMIC_CAS_PTR( &allocator.hooks, allocator.hooks, hooks );
+    status = WEBVTT_SUCCESS;
+  }
+  SPIN_UNLOCK( &allocator.lock );
+  return status;
+}
+
+static void
+raise_peak( webvtt_mem_counter *counter, webvtt_uint64 bytes )
+{
+  webvtt_uint64 peak = counter->peak_bytes;
+  while( bytes > peak && !ATOMIC_CAS64( &counter->peak_bytes, peak, bytes ) ) {
+    peak = counter->peak_bytes;
+  }
+}
+
+static void
+stats_add( webvtt_mem_category category, webvtt_uint nb )
+{
+  webvtt_mem_counter *counter = stats + category;
+  webvtt_mem_counter *total = stats + WEBVTT_MEM_CATEGORIES;
+  ATOMIC_ADD64( &counter->count, 1 );
+  ATOMIC_ADD64( &total->count, 1 );
+  raise_peak( counter, ATOMIC_ADD64( &counter->bytes, nb ) + nb );
+  raise_peak( total, ATOMIC_ADD64( &total->bytes, nb ) + nb );
+}
+
+static void
+stats_sub( webvtt_mem_category category, webvtt_uint nb )
+{
+  webvtt_mem_counter *counter = stats + category;
+  webvtt_mem_counter *total = stats + WEBVTT_MEM_CATEGORIES;
+  ATOMIC_ADD64( &counter->count, (webvtt_uint64)-1 );
+  ATOMIC_ADD64( &total->count, (webvtt_uint64)-1 );
+  ATOMIC_ADD64( &counter->bytes, (webvtt_uint64)0 - nb );
+  ATOMIC_ADD64( &total->bytes, (webvtt_uint64)0 - nb );
+}
+
+/**
+ * Record the category of a freshly allocated block, and account for it if
+ * statistics are enabled
+ */
+static void *
+track( void *ptr, webvtt_mem_category category )
+{
+  webvtt_alloc_header *hdr;
+  if( ptr ) {
+    hdr = WEBVTT_ALLOC_HEADER( ptr );
+    hdr->h.flags |= (webvtt_uint32)category << WEBVTT_ALLOC_CATEGORY_SHIFT;
+    if( stats_enabled && !( hdr->h.flags & WEBVTT_ALLOC_ARENA ) ) {
+      hdr->h.flags |= WEBVTT_ALLOC_COUNTED;
+      stats_add( category, hdr->h.size );
+    }
+  }
+  return ptr;
+}
+
+/**
+ * Return the size class of a chunk of 'nb' bytes, or -1 if it is too large to
+ * be recycled
+ */
+static int
+size_class( webvtt_uint nb )
+{
+  int cls = MIN_CLASS;
+  if( nb > ( 1u << MAX_CLASS ) ) {
+    return -1;
+  }
+  while( ( 1u << cls ) < nb ) {
+    ++cls;
+  }
+  return cls;
+}
+
+static webvtt_arena_block *
+arena_new_block( webvtt_uint size )
+{
+  webvtt_arena_block *block;
+  webvtt_uint total = ARENA_ROUND( sizeof( *block ) ) + size;
+  if( total < size ) {
+    return 0;
+  }
+  block = (webvtt_arena_block *)sys_alloc( total );
+  if( block ) {
+    block->next = 0;
+    block->size = size;
+    if( ( block->counted = stats_enabled ) ) {
+      stats_add( WEBVTT_MEM_ARENA, size );
+    }
+  }
+  return block;
+}
+
+static void
+arena_free_block( webvtt_arena_block *block )
+{
+  if( block->counted ) {
+    stats_sub( WEBVTT_MEM_ARENA, block->size );
+  }
+  sys_free( block );
+}
+
+static void *
+arena_alloc( webvtt_arena *arena, webvtt_uint nb )
+{
+  webvtt_alloc_header *hdr;
+  webvtt_uint total = sizeof( webvtt_alloc_header ) + nb;
+  int cls;
+  if( total < nb ) {
+    return 0;
+  }
+
+  if( ( cls = size_class( total ) ) >= 0 ) {
+    void **list = &arena->free_chunks[ cls - MIN_CLASS ];
+    total = 1u << cls;
+    if( *list ) {
+      hdr = (webvtt_alloc_header *)*list;
+      *list = *(void **)hdr;
+      goto have_chunk;
+    }
+  } else {
+    total = ARENA_ROUND( total );
+    if( total < nb ) {
+      return 0;
+    }
+  }
+
+  if( total > (webvtt_uint)( arena->limit - arena->cursor ) ) {
+    webvtt_arena_block *block;
+    if( total > arena->block_size / 4 ) {
+      /**
+       * Big allocations get a block of their own, so that the remainder of the
+       * current block is not wasted.
+       */
+      if( !( block = arena_new_block( total ) ) ) {
+        return 0;
+      }
+      if( arena->blocks ) {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+      } else {
+        arena->blocks = block;
+      }
+      hdr = (webvtt_alloc_header *)ARENA_BLOCK_DATA( block );
+      goto have_chunk;
+    }
+    if( !( block = arena_new_block( arena->block_size ) ) ) {
+      return 0;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->cursor = ARENA_BLOCK_DATA( block );
+    arena->limit = arena->cursor + block->size;
+  }
+
+  hdr = (webvtt_alloc_header *)arena->cursor;
+  arena->cursor += total;
+
+have_chunk:
+  hdr->h.owner = arena;
+  hdr->h.size = nb;
+  hdr->h.flags = WEBVTT_ALLOC_ARENA;
+  return hdr + 1;
+}
+
+static void
+arena_free( webvtt_arena *arena, webvtt_alloc_header *hdr )
+{
+  int cls = size_class( sizeof( webvtt_alloc_header ) + hdr->h.size );
+  if( cls >= 0 ) {
+    void **list = &arena->free_chunks[ cls - MIN_CLASS ];
+    *(void **)hdr = *list;
+    *list = hdr;
+  }
+}
+
+#ifdef HAVE_THREAD_CACHE
+static void
+flush_cache( webvtt_alloc_cache *cache )
+{
+  int i;
+  for( i = 0; i < CACHE_NUM_CLASSES; ++i ) {
+    void *chunk;
+    while( ( chunk = cache->free_chunks[ i ] ) ) {
+      cache->free_chunks[ i ] = *(void **)chunk;
+      sys_free( chunk );
+    }
+    cache->count[ i ] = 0;
+  }
+}
+
+/**
+ * Give back the cached blocks of an exiting thread, and hand its share of
+ * the block count over to 'allocator.n_alloc'
+ */
+static void
+retire_cache( webvtt_alloc_cache *cache )
+{
+  webvtt_alloc_cache **link;
+  flush_cache( cache );
+  cache->state = -1;
+
+  SPIN_LOCK( &allocator.lock );
+  for( link = &allocator.threads; *link; link = &(*link)->next ) {
+    if( *link == cache ) {
+      *link = cache->next;
+      break;
+    }
+  }
+  ATOMIC_ADD( &allocator.n_alloc, cache->n_alloc );
+  cache->n_alloc = 0;
+  SPIN_UNLOCK( &allocator.lock );
+}
+
+/**
+ * Thread exit handlers, which return the exiting thread's cached blocks to
+ * the allocator.
+ */
+# if WEBVTT_OS_WIN32
+static DWORD cache_key = FLS_OUT_OF_INDEXES;
+static volatile webvtt_uint cache_key_lock = 0;
+
+static void WINAPI
+cache_destructor( void *data )
+{
+  webvtt_alloc_cache *cache = (webvtt_alloc_cache *)data;
+  if( cache ) {
+    retire_cache( cache );
+  }
+}
+
+static int
+register_cache( webvtt_alloc_cache *cache )
+{
+  if( cache_key == FLS_OUT_OF_INDEXES ) {
+    SPIN_LOCK( &cache_key_lock );
+    if( cache_key == FLS_OUT_OF_INDEXES ) {
+      cache_key = FlsAlloc( &cache_destructor );
+    }
+    SPIN_UNLOCK( &cache_key_lock );
+  }
+  return cache_key != FLS_OUT_OF_INDEXES &&
+         FlsSetValue( cache_key, cache );
+}
+# else
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static int cache_key_ok = 0;
+
+static void
+cache_destructor( void *data )
+{
+  webvtt_alloc_cache *cache = (webvtt_alloc_cache *)data;
+  if( cache ) {
+    retire_cache( cache );
+  }
+}
+
+static void
+create_cache_key( void )
+{
+  cache_key_ok = pthread_key_create( &cache_key, &cache_destructor ) == 0;
+}
+
+static int
+register_cache( webvtt_alloc_cache *cache )
+{
+  pthread_once( &cache_key_once, &create_cache_key );
+  return cache_key_ok && pthread_setspecific( cache_key, cache ) == 0;
+}
+# endif
+
+/**
+ * Return this thread's cache, or NULL if it is not available
+ */
+static webvtt_alloc_cache *
+get_cache( void )
+{
+  webvtt_alloc_cache *cache = &thread_cache;
+  if( cache->state == 0 ) {
+    cache->state = register_cache( cache ) ? 1 : -1;
+    if( cache->state > 0 ) {
+      SPIN_LOCK( &allocator.lock );
+      cache->next = allocator.threads;
+      allocator.threads = cache;
+      SPIN_UNLOCK( &allocator.lock );
     }
   }
+  return cache->state > 0 ? cache : 0;
+}
+#endif
+
+static void *
+heap_alloc( webvtt_uint nb )
+{
+  webvtt_alloc_header *hdr;
+  webvtt_uint total = sizeof( webvtt_alloc_header ) + nb;
+  int cls;
+  if( total < nb ) {
+    return 0;
+  }
+
+  if( ( cls = size_class( total ) ) >= 0 && cls <= CACHE_MAX_CLASS ) {
+    /**
+     * Round small blocks up to their size class, so that they can be cached
+     * when freed.
+     */
+#ifdef HAVE_THREAD_CACHE
+    webvtt_alloc_cache *cache = get_cache();
+    int i = cls - MIN_CLASS;
+    if( cache && cache->free_chunks[ i ] ) {
+      hdr = (webvtt_alloc_header *)cache->free_chunks[ i ];
+      cache->free_chunks[ i ] = *(void **)hdr;
+      --cache->count[ i ];
+      goto have_block;
+    }
+#endif
+    total = 1u << cls;
+  }
+
+  hdr = (webvtt_alloc_header *)sys_alloc( total );
+  if( !hdr ) {
+    return 0;
+  }
+
+#ifdef HAVE_THREAD_CACHE
+have_block:
+#endif
+  hdr->h.owner = 0;
+  hdr->h.size = nb;
+  hdr->h.flags = 0;
+  return hdr + 1;
+}
+
+static void
+heap_free( webvtt_alloc_header *hdr )
+{
+#ifdef HAVE_THREAD_CACHE
+  int cls = size_class( sizeof( webvtt_alloc_header ) + hdr->h.size );
+  if( cls >= 0 && cls <= CACHE_MAX_CLASS ) {
+    webvtt_alloc_cache *cache = get_cache();
+    int i = cls - MIN_CLASS;
+    if( cache && cache->count[ i ] < CACHE_DEPTH ) {
+      *(void **)hdr = cache->free_chunks[ i ];
+      cache->free_chunks[ i ] = hdr;
+      ++cache->count[ i ];
+      return;
+    }
+  }
+#endif
+  sys_free( hdr );
+}
+
+WEBVTT_EXPORT void
+webvtt_flush_alloc_cache( void )
+{
+#ifdef HAVE_THREAD_CACHE
+  if( thread_cache.state > 0 ) {
+    flush_cache( &thread_cache );
+  }
+#endif
+}
+
+/**
+ * Pools
+ */
+static void
+pool_deref( webvtt_pool *pool )
+{
+  if( webvtt_deref( &pool->refs ) == 0 ) {
+    sys_free( pool );
+  }
+}
+
+static void *
+pool_alloc( webvtt_pool *pool, webvtt_uint nb )
+{
+  webvtt_alloc_header *hdr = 0;
+  webvtt_uint total = sizeof( webvtt_alloc_header ) + nb;
+  int cls = size_class( total );
+  if( total < nb || cls < 0 ) {
+    return heap_alloc( nb );
+  }
+
+  SPIN_LOCK( &pool->lock );
+  if( pool->free_chunks[ cls - MIN_CLASS ] ) {
+    hdr = (webvtt_alloc_header *)pool->free_chunks[ cls - MIN_CLASS ];
+    pool->free_chunks[ cls - MIN_CLASS ] = *(void **)hdr;
+    --pool->count[ cls - MIN_CLASS ];
+  }
+  SPIN_UNLOCK( &pool->lock );
+
+  if( !hdr ) {
+    hdr = (webvtt_alloc_header *)sys_alloc( 1u << cls );
+    if( !hdr ) {
+      return 0;
+    }
+    webvtt_ref( &pool->refs );
+  }
+
+  hdr->h.owner = pool;
+  hdr->h.size = nb;
+  hdr->h.flags = WEBVTT_ALLOC_POOL;
+  return hdr + 1;
+}
+
+static void
+pool_free( webvtt_pool *pool, webvtt_alloc_header *hdr )
+{
+  int i = size_class( sizeof( webvtt_alloc_header ) + hdr->h.size )
+          - MIN_CLASS;
+  SPIN_LOCK( &pool->lock );
+  if( !pool->closed && pool->count[ i ] < POOL_DEPTH ) {
+    *(void **)hdr = pool->free_chunks[ i ];
+    pool->free_chunks[ i ] = hdr;
+    ++pool->count[ i ];
+    SPIN_UNLOCK( &pool->lock );
+    return;
+  }
+  SPIN_UNLOCK( &pool->lock );
+
+  sys_free( hdr );
+  pool_deref( pool );
+}
+
+WEBVTT_INTERN webvtt_status
+webvtt_create_pool( webvtt_pool **ppool )
+{
+  webvtt_pool *pool;
+  if( !ppool ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  pool = (webvtt_pool *)sys_alloc( sizeof( *pool ) );
+  if( !pool ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+  memset( pool, 0, sizeof( *pool ) );
+  pool->refs.value = 1;
+  *ppool = pool;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_INTERN void
+webvtt_release_pool( webvtt_pool **ppool )
+{
+  webvtt_pool *pool;
+  void *chunks[ NUM_CLASSES ];
+  int i;
+  if( !ppool || !( pool = *ppool ) ) {
+    return;
+  }
+  *ppool = 0;
+
+  SPIN_LOCK( &pool->lock );
+  pool->closed = 1;
+  memcpy( chunks, pool->free_chunks, sizeof( chunks ) );
+  memset( pool->free_chunks, 0, sizeof( pool->free_chunks ) );
+  memset( pool->count, 0, sizeof( pool->count ) );
+  SPIN_UNLOCK( &pool->lock );
+
+  for( i = 0; i < NUM_CLASSES; ++i ) {
+    void *chunk;
+    while( ( chunk = chunks[ i ] ) ) {
+      chunks[ i ] = *(void **)chunk;
+      sys_free( chunk );
+      pool_deref( pool );
+    }
+  }
+  pool_deref( pool );
+}
+
+static void *
+alloc_from_context( webvtt_uint nb )
+{
+  if( current.arena ) {
+    return arena_alloc( current.arena, nb );
+  }
+  return heap_alloc( nb );
 }
 
 /**
@@ -86,18 +801,43 @@ webvtt_set_allocator( webvtt_alloc_fn_ptr alloc, webvtt_free_fn_ptr free,
 WEBVTT_EXPORT void *
 webvtt_alloc( webvtt_uint nb )
 {
-  void *ret = allocator.alloc( allocator.alloc_data, nb );
-  if( ret )
-  { ++allocator.n_alloc; }
-  return ret;
+  return track( alloc_from_context( nb ), WEBVTT_MEM_OTHER );
 }
 
 WEBVTT_EXPORT void *
 webvtt_alloc0( webvtt_uint nb )
 {
-  void *ret = allocator.alloc( allocator.alloc_data, nb );
+  return webvtt_alloc0_as( nb, WEBVTT_MEM_OTHER );
+}
+
+WEBVTT_INTERN void *
+webvtt_alloc_as( webvtt_uint nb, webvtt_mem_category category )
+{
+  return track( alloc_from_context( nb ), category );
+}
+
+WEBVTT_INTERN void *
+webvtt_alloc0_as( webvtt_uint nb, webvtt_mem_category category )
+{
+  void *ret = track( alloc_from_context( nb ), category );
   if( ret ) {
-    ++allocator.n_alloc;
+    memset( ret, 0, nb );
+  }
+  return ret;
+}
+
+WEBVTT_INTERN void *
+webvtt_alloc_object0( webvtt_uint nb, webvtt_mem_category category )
+{
+  void *ret;
+  if( current.arena ) {
+    ret = arena_alloc( current.arena, nb );
+  } else if( current.pool ) {
+    ret = pool_alloc( current.pool, nb );
+  } else {
+    ret = heap_alloc( nb );
+  }
+  if( ( ret = track( ret, category ) ) ) {
     memset( ret, 0, nb );
   }
   return ret;
@@ -106,8 +846,175 @@ webvtt_alloc0( webvtt_uint nb )
 WEBVTT_EXPORT void
 webvtt_free( void *data )
 {
-  if( data && allocator.n_alloc ) {
-    allocator.free( allocator.alloc_data, data );
-    --allocator.n_alloc;
+  webvtt_alloc_header *hdr;
+  if( !data ) {
+    return;
+  }
+  hdr = WEBVTT_ALLOC_HEADER( data );
+  if( hdr->h.flags & WEBVTT_ALLOC_COUNTED ) {
+    stats_sub( WEBVTT_ALLOC_CATEGORY( hdr ), hdr->h.size );
+  }
+  if( hdr->h.flags & WEBVTT_ALLOC_ARENA ) {
+    arena_free( (webvtt_arena *)hdr->h.owner, hdr );
+  } else if( hdr->h.flags & WEBVTT_ALLOC_POOL ) {
+    pool_free( (webvtt_pool *)hdr->h.owner, hdr );
+  } else {
+    heap_free( hdr );
+  }
+}
+
+/**
+ * Statistics
+ */
+WEBVTT_EXPORT void
+webvtt_enable_alloc_stats( webvtt_bool enable )
+{
+  stats_enabled = enable ? 1 : 0;
+}
+
+WEBVTT_EXPORT void
+webvtt_get_alloc_stats( webvtt_alloc_stats *out )
+{
+  int i;
+  if( !out ) {
+    return;
+  }
+  for( i = 0; i <= WEBVTT_MEM_CATEGORIES; ++i ) {
+    webvtt_mem_stat *stat = i < WEBVTT_MEM_CATEGORIES ? out->category + i
+                                                      : &out->total;
+    stat->count = stats[ i ].count;
+    stat->bytes = stats[ i ].bytes;
+    stat->peak_bytes = stats[ i ].peak_bytes;
+  }
+}
+
+WEBVTT_EXPORT void
+webvtt_reset_alloc_peaks( void )
+{
+  int i;
+  for( i = 0; i <= WEBVTT_MEM_CATEGORIES; ++i ) {
+    stats[ i ].peak_bytes = stats[ i ].bytes;
+  }
+}
+
+/**
+ * Arenas
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_create_arena( webvtt_uint block_size, webvtt_arena **parena )
+{
+  webvtt_arena *arena;
+  if( !parena ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  if( block_size == 0 ) {
+    block_size = ARENA_DEFAULT_BLOCK;
+  } else if( block_size < ARENA_MIN_BLOCK ) {
+    block_size = ARENA_MIN_BLOCK;
+  }
+
+  /**
+   * The arena itself always lives on the heap
+   */
+  arena = (webvtt_arena *)sys_alloc( sizeof( *arena ) );
+  if( !arena ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+  memset( arena, 0, sizeof( *arena ) );
+  arena->block_size = ARENA_ROUND( block_size );
+  *parena = arena;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_EXPORT void
+webvtt_reset_arena( webvtt_arena *arena )
+{
+  webvtt_arena_block *block, *next, *keep = 0;
+  if( !arena ) {
+    return;
+  }
+
+  /**
+   * Hold on to one regular sized block, so that reusing the arena for another
+   * document does not immediately go back to the allocator.
+   */
+  for( block = arena->blocks; block; block = next ) {
+    next = block->next;
+    if( !keep && block->size == arena->block_size ) {
+      keep = block;
+      keep->next = 0;
+    } else {
+      arena_free_block( block );
+    }
+  }
+
+  memset( arena->free_chunks, 0, sizeof( arena->free_chunks ) );
+  arena->blocks = keep;
+  if( keep ) {
+    arena->cursor = ARENA_BLOCK_DATA( keep );
+    arena->limit = arena->cursor + keep->size;
+  } else {
+    arena->cursor = arena->limit = 0;
+  }
+}
+
+WEBVTT_EXPORT void
+webvtt_delete_arena( webvtt_arena **parena )
+{
+  webvtt_arena *arena;
+  webvtt_arena_block *block, *next;
+  if( !parena || !( arena = *parena ) ) {
+    return;
+  }
+  *parena = 0;
+
+  /**
+   * Only this thread's context can be reset here. Other threads may only
+   * have the arena installed while a parser using it runs, which the
+   * caller must not allow (see include/webvtt/util.h).
+   */
+  if( current.arena == arena ) {
+    current.arena = 0;
+  }
+  for( block = arena->blocks; block; block = next ) {
+    next = block->next;
+    arena_free_block( block );
+  }
+  sys_free( arena );
+}
+
+/**
+ * The names are parenthesized so that the macros in alloc_internal.h aren't
+ * expanded here
+ */
+WEBVTT_EXPORT int
+(webvtt_ref)( struct webvtt_refcount_t *ref )
+{
+  return webvtt_ref( ref );
+}
+
+WEBVTT_EXPORT int
+(webvtt_deref)( struct webvtt_refcount_t *ref )
+{
+  return webvtt_deref( ref );
+}
+
+WEBVTT_INTERN void
+webvtt_swap_alloc_context( webvtt_alloc_context *ctx )
+{
+  webvtt_alloc_context prev = current;
+  current = *ctx;
+  *ctx = prev;
+}
+
+WEBVTT_INTERN webvtt_bool
+webvtt_is_arena_owned( const void *ptr )
+{
+  const webvtt_alloc_header *hdr;
+  if( !ptr ) {
+    return 0;
   }
+  hdr = ( (const webvtt_alloc_header *)ptr ) - 1;
+  return ( hdr->h.flags & WEBVTT_ALLOC_ARENA ) != 0;
 }
@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __INTERN_ALLOC_H__
+# define __INTERN_ALLOC_H__
+# include <webvtt/util.h>
+
+/**
+ * Atomic operations on counters, and spin locks for the allocator and other
+ * structures shared between threads. ATOMIC_LOAD_ACQUIRE and
+ * ATOMIC_STORE_RELEASE are plain loads and stores on x86, for flags that are
+ * read far more often than they are written.
+ */
+#if WEBVTT_CC_MSVC
+# include <intrin.h>
+# define ATOMIC_ADD(p,n) ( _InterlockedExchangeAdd( (volatile long *)(p), \
+                                                    (long)(n) ) )
+# define ATOMIC_LOAD(p) ( _InterlockedExchangeAdd( (volatile long *)(p), 0 ) )
+# define SPIN_LOCK(p) \
+  do { } while( _InterlockedExchange( (volatile long *)(p), 1 ) )
+# define SPIN_UNLOCK(p) ( _InterlockedExchange( (volatile long *)(p), 0 ) )
+# define ATOMIC_CAS_PTR(p,o,n) \
+  ( _InterlockedCompareExchangePointer( (void *volatile *)(p), (n), (o) ) \
+    == (o) )
+# define ATOMIC_LOAD_ACQUIRE(p) ( *(volatile long *)(p) )
+# define ATOMIC_STORE_RELEASE(p,v) \
+  ( _InterlockedExchange( (volatile long *)(p), (long)(v) ) )
+#elif WEBVTT_CC_GCC
+# define ATOMIC_ADD(p,n) ( __sync_fetch_and_add( (p), (n) ) )
+# define ATOMIC_LOAD(p) ( __sync_fetch_and_add( (p), 0 ) )
+# define SPIN_LOCK(p) do { } while( __sync_lock_test_and_set( (p), 1 ) )
+# define SPIN_UNLOCK(p) ( __sync_lock_release( (p) ) )
+# define ATOMIC_CAS_PTR(p,o,n) ( __sync_bool_compare_and_swap( (p), (o), (n) ) )
+# if defined(__ATOMIC_ACQUIRE)
+#   define ATOMIC_LOAD_ACQUIRE(p) ( __atomic_load_n( (p), __ATOMIC_ACQUIRE ) )
+#   define ATOMIC_STORE_RELEASE(p,v) \
+  ( __atomic_store_n( (p), (v), __ATOMIC_RELEASE ) )
+# else
+#   define ATOMIC_LOAD_ACQUIRE(p) ( __sync_fetch_and_add( (p), 0 ) )
+#   define ATOMIC_STORE_RELEASE(p,v) ( __sync_synchronize(), *(p) = (v) )
+# endif
+#else
+# define ATOMIC_ADD(p,n) ( *(p) += (n) )
+# define ATOMIC_LOAD(p) ( *(p) )
+# define SPIN_LOCK(p) ( *(p) = 1 )
+# define SPIN_UNLOCK(p) ( *(p) = 0 )
+# define ATOMIC_CAS_PTR(p,o,n) ( *(p) == (o) ? ( *(p) = (n), 1 ) : 0 )
+# define ATOMIC_LOAD_ACQUIRE(p) ( *(p) )
+# define ATOMIC_STORE_RELEASE(p,v) ( *(p) = (v) )
+#endif
+
+/**
+ * Reference counts. Plain increments and decrements are used when the library
+ * is configured with --disable-atomic-refcount, for single-threaded
+ * applications. Decrements use acquire-release ordering, so that whoever
+ * drops the last reference sees every write made through the other
+ * references.
+ */
+#if !defined(WEBVTT_NO_ATOMICS)
+# if WEBVTT_CC_MSVC
+#   define REF_INC(x) ( _InterlockedIncrement( &(x) ) )
+#   define REF_DEC(x) ( _InterlockedDecrement( &(x) ) )
+# elif defined(__ATOMIC_RELAXED)
+#   define REF_INC(x) ( __atomic_add_fetch( &(x), 1, __ATOMIC_RELAXED ) )
+#   define REF_DEC(x) ( __atomic_sub_fetch( &(x), 1, __ATOMIC_ACQ_REL ) )
+# elif WEBVTT_CC_GCC
+#   define REF_INC(x) ( __sync_add_and_fetch( &(x), 1 ) )
+#   define REF_DEC(x) ( __sync_sub_and_fetch( &(x), 1 ) )
+# elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+       !defined(__STDC_NO_ATOMICS__)
+#   include <stdatomic.h>
+#   define REF_INC(x) \
+      ( atomic_fetch_add_explicit( (_Atomic int *)&(x), 1, \
+                                   memory_order_relaxed ) + 1 )
+#   define REF_DEC(x) \
+      ( atomic_fetch_sub_explicit( (_Atomic int *)&(x), 1, \
+                                   memory_order_acq_rel ) - 1 )
+# endif
+#endif
+#ifndef REF_INC
+# define REF_INC(x) ( ++(x) )
+# define REF_DEC(x) ( --(x) )
+#endif
+
+/**
+ * The library itself updates reference counts inline, rather than calling
+ * the exported webvtt_ref() and webvtt_deref()
+ */
+#define webvtt_ref(ref) ( REF_INC( (ref)->value ) )
+#define webvtt_deref(ref) ( REF_DEC( (ref)->value ) )
+
+/**
+ * Flags stored in the header of each allocated block
+ */
+enum {
+  WEBVTT_ALLOC_ARENA = (1 << 0), /* block belongs to an arena */
+  WEBVTT_ALLOC_POOL = (1 << 1), /* block belongs to an object pool */
+  WEBVTT_ALLOC_COUNTED = (1 << 2), /* block is included in the statistics */
+};
+
+/**
+ * The block's webvtt_mem_category is stored in bits 8-15 of its flags
+ */
+# define WEBVTT_ALLOC_CATEGORY_SHIFT ( 8 )
+# define WEBVTT_ALLOC_CATEGORY(hdr) \
+  ( (webvtt_mem_category)( ( (hdr)->h.flags >> WEBVTT_ALLOC_CATEGORY_SHIFT ) \
+                           & 0xFF ) )
+
+/**
+ * Object pools keep released cues and nodes around for reuse by the parser
+ * that created them. Objects may be released on any thread, and may outlive
+ * the pool's owner: the pool is only destroyed once every object allocated
+ * from it has been released.
+ */
+typedef struct webvtt_pool_t webvtt_pool;
+
+/**
+ * Where allocations made on the current thread go. Parsers install their own
+ * context for the duration of each call into the parser.
+ */
+typedef struct
+webvtt_alloc_context_t {
+  webvtt_arena *arena; /* if set, all allocations */
+  webvtt_pool *pool; /* if set, webvtt_alloc_object() allocations */
+} webvtt_alloc_context;
+
+/**
+ * Every block returned by webvtt_alloc() is preceded by this header, so that
+ * webvtt_free() can tell where a block came from without being told.
+ *
+ * The union keeps the header 16 bytes wide on both 32 and 64 bit targets, so
+ * that the block following it keeps the alignment of the underlying
+ * allocator.
+ */
+typedef union
+webvtt_alloc_header_t {
+  struct {
+    void *owner; /* arena or pool owning the block, NULL for heap blocks */
+    webvtt_uint32 size; /* size requested by the caller */
+    webvtt_uint32 flags;
+  } h;
+  webvtt_uint64 align[2];
+} webvtt_alloc_header;
+
+# define WEBVTT_ALLOC_HEADER(ptr) ( ( ( webvtt_alloc_header * )( ptr ) ) - 1 )
+
+/**
+ * Exchange 'ctx' with the current thread's allocation context. Calling it a
+ * second time with the same 'ctx' restores the previous context.
+ */
+WEBVTT_INTERN void
+webvtt_swap_alloc_context( webvtt_alloc_context *ctx );
+
+/**
+ * Like webvtt_alloc() and webvtt_alloc0(), but account the block to 'category'
+ * rather than WEBVTT_MEM_OTHER
+ */
+WEBVTT_INTERN void *
+webvtt_alloc_as( webvtt_uint nb, webvtt_mem_category category );
+
+WEBVTT_INTERN void *
+webvtt_alloc0_as( webvtt_uint nb, webvtt_mem_category category );
+
+/**
+ * Allocate a fixed size object (cue, node or node data), taking it from the
+ * current pool if there is one
+ */
+WEBVTT_INTERN void *
+webvtt_alloc_object0( webvtt_uint nb, webvtt_mem_category category );
+
+WEBVTT_INTERN webvtt_status
+webvtt_create_pool( webvtt_pool **ppool );
+
+/**
+ * Give up the owner's reference to a pool. Objects still in use keep the pool
+ * alive, but are no longer recycled once released.
+ */
+WEBVTT_INTERN void
+webvtt_release_pool( webvtt_pool **ppool );
+
+/**
+ * Return true if 'ptr' (which must have come from webvtt_alloc()) is owned by
+ * an arena, rather than the heap.
+ */
+WEBVTT_INTERN webvtt_bool
+webvtt_is_arena_owned( const void *ptr );
+
+#endif
@@ -28,6 +28,9 @@
 #include <string.h>
 #include "parser_internal.h"
 #include "cue_internal.h"
+#include "cuetext_internal.h"
+#include "alloc_internal.h"
+#include "scan_internal.h"
 
 WEBVTT_EXPORT webvtt_status
 webvtt_create_cue( webvtt_cue **pcue )
@@ -36,7 +39,8 @@ webvtt_create_cue( webvtt_cue **pcue )
   if( !pcue ) {
     return WEBVTT_INVALID_PARAM;
   }
-  cue = (webvtt_cue *)webvtt_alloc0( sizeof(*cue) );
+  cue = (webvtt_cue *)webvtt_alloc_object0( sizeof(webvtt_cue_ext),
+                                            WEBVTT_MEM_CUE );
   if( !cue ) {
     return WEBVTT_OUT_OF_MEMORY;
   }
@@ -83,10 +87,15 @@ webvtt_release_cue( webvtt_cue **pcue )
   if( pcue && *pcue ) {
     webvtt_cue *cue = *pcue;
     *pcue = 0;
+    if( webvtt_is_arena_owned( cue ) ) {
+      /* Released along with the arena */
+      return;
+    }
     if( webvtt_deref( &cue->refs ) == 0 ) {
       webvtt_release_string( &cue->id );
       webvtt_release_string( &cue->body );
       webvtt_release_node( &cue->node_head );
+      webvtt_release_node_tree( &CUE_EXT( cue )->node_tree );
       webvtt_free( cue );
     }
   }
@@ -119,29 +128,85 @@ error:
   return 0;
 }
 
+/**
+ * Parse cue text that the parser left for later. CUE_TEXT_PENDING is cleared
+ * with release ordering once the result is in place, so a cue whose text has
+ * been parsed is recognized without taking the lock. On failure the partial
+ * result is dropped and the flag left set, so that the next call tries again.
+ */
+static webvtt_status
+parse_pending_cuetext( webvtt_cue *cue )
+{
+  webvtt_cue_ext *ext = CUE_EXT( cue );
+  webvtt_status status = WEBVTT_SUCCESS;
+  webvtt_uint flags;
+
+  if( !( ATOMIC_LOAD_ACQUIRE( &cue->flags ) & CUE_TEXT_PENDING ) ) {
+    return WEBVTT_SUCCESS;
+  }
+
+  SPIN_LOCK( &ext->text_lock );
+  flags = cue->flags;
+  if( flags & CUE_TEXT_PENDING ) {
+    if( flags & CUE_TEXT_FLAT ) {
+      status = webvtt_parse_cuetext_flat( cue, &cue->body, 0 );
+    } else if( WEBVTT_FAILED( status = webvtt_parse_cuetext( 0, cue,
+                                                           &cue->body, 1 ) ) ) {
+      webvtt_release_node( &cue->node_head );
+    }
+    if( !WEBVTT_FAILED( status ) ) {
+      ATOMIC_STORE_RELEASE( &cue->flags, flags & ~CUE_TEXT_PENDING );
+    }
+  }
+  SPIN_UNLOCK( &ext->text_lock );
+  return status;
+}
+
+WEBVTT_EXPORT webvtt_node *
+webvtt_cue_get_node_head( webvtt_cue *cue )
+{
+  if( !cue || WEBVTT_FAILED( parse_pending_cuetext( cue ) ) ) {
+    return 0;
+  }
+  return cue->node_head;
+}
+
+WEBVTT_EXPORT webvtt_node_tree *
+webvtt_cue_get_node_tree( webvtt_cue *cue )
+{
+  if( !cue || WEBVTT_FAILED( parse_pending_cuetext( cue ) ) ) {
+    return 0;
+  }
+  return CUE_EXT( cue )->node_tree;
+}
+
 WEBVTT_INTERN webvtt_bool
 cue_is_incomplete( const webvtt_cue *cue ) {
   return !cue || ( cue->flags & CUE_HEADER_MASK ) == CUE_HAVE_ID;
 }
 
-WEBVTT_EXPORT webvtt_status
-webvtt_cue_set_align( webvtt_cue *cue, const char *value )
+/**
+ * Cue setting values are parsed in place: 'value' is the 'len' bytes of a
+ * setting following its ':', and needn't be NUL-terminated as long as the
+ * byte after it isn't a digit.
+ */
+static webvtt_status
+set_align( webvtt_cue *cue, const char *value, webvtt_uint len )
 {
   unsigned i;
-  static const char *values[] = {
-    "start",
-    "middle",
-    "end",
-    "left",
-    "right",
+  static const struct {
+    const char *text;
+    webvtt_uint length;
+  } values[] = {
+    { "start", 5 },
+    { "middle", 6 },
+    { "end", 3 },
+    { "left", 4 },
+    { "right", 5 },
   };
 
-  if( !cue || !value ) {
-    return WEBVTT_INVALID_PARAM;
-  }
-
   for( i=0 ; i < sizeof(values)/sizeof(*values) ; ++i ) {
-    if( !strcmp( value, values[i] ) ) {
+    if( len == values[i].length && !memcmp( value, values[i].text, len ) ) {
       cue->settings.align = (webvtt_align_type)i;
       if( cue->flags & CUE_HAVE_ALIGN ) {
         return WEBVTT_ALREADY_ALIGN;
@@ -153,26 +218,30 @@ webvtt_cue_set_align( webvtt_cue *cue, const char *value )
   return WEBVTT_BAD_ALIGN;
 }
 
-WEBVTT_EXPORT webvtt_status
-webvtt_cue_set_line( webvtt_cue *cue, const char *value )
+static webvtt_status
+set_line( webvtt_cue *cue, const char *value, webvtt_uint len )
 {
   webvtt_int64 number;
   int digits = 0;
-  const char *c;
-
-  if( !cue || !value ) {
-    return WEBVTT_INVALID_PARAM;
-  }
+  const char *c, *percent = 0;
+  const char *end = value + len;
 
   /**
    * 1. If value contains any characters other than U+002D HYPHEN-MINUS
    * characters (-), U+0025 PERCENT SIGN characters (%), and ASCII digits,
    * then jump to the step labeled next setting
+   *
+   * 3. If any character in value other than the first character is a U+002D
+   * HYPHEN-MINUS character (-), then jump to the step labeled next setting.
    */
-  for( c = value; *c; ++c ) {
+  for( c = value; c < end; ++c ) {
     if( webvtt_isdigit( *c ) ) {
       ++digits;
-    } else if( *c == '-' || *c == '%' ) {
+    } else if( *c == '-' && c == value ) {
+    } else if( *c == '%' ) {
+      if( !percent ) {
+        percent = c;
+      }
     } else {
       return WEBVTT_BAD_LINE;
     }
@@ -186,15 +255,7 @@ webvtt_cue_set_line( webvtt_cue *cue, const char *value )
     return WEBVTT_BAD_LINE;
   }
 
-  if( strchr( value + 1, '-' ) ) {
-    /**
-     * 3. If any character in value other than the first character is a U+002D
-     * HYPHEN-MINUS character (-), then jump to the step labeled next setting.
-     */
-    return WEBVTT_BAD_LINE;
-  }
-
-  if( ( c = strchr( value, '%' ) ) && ( ( c[1] != '\0' ) || *value == '-' ) ) {
+  if( percent && ( ( percent != end - 1 ) || *value == '-' ) ) {
     /**
      * 4. If any character in value other than the last character is a U+0025
      * PERCENT SIGN character (%), then jump to the step labeled next setting.
@@ -213,7 +274,7 @@ webvtt_cue_set_line( webvtt_cue *cue, const char *value )
   c = value;
   number = webvtt_parse_int( &c, &digits );
 
-  if( *c == '%' ) {
+  if( percent ) {
     /**
      * 7. If the last character in value is a U+0025 PERCENT SIGN character (%),
      * but number is not in the range 0 < number < 100, then jump to the step
@@ -242,53 +303,43 @@ webvtt_cue_set_line( webvtt_cue *cue, const char *value )
   return WEBVTT_SUCCESS;
 }
 
-WEBVTT_EXPORT webvtt_status
-webvtt_cue_set_position( webvtt_cue *cue, const char *value )
+/**
+ * Parse a percentage for the position and size settings, following the same
+ * steps for both. Returns -1 if 'value' isn't one.
+ */
+static int
+parse_percentage( const char *value, webvtt_uint len )
 {
   int digits = 0;
   webvtt_int64 number;
   const char *c;
-
-  if( !cue || !value ) {
-    return WEBVTT_INVALID_PARAM;
-  }
+  const char *end = value + len;
 
   /**
    * 1. If value contains any characters other than U+0025 PERCENT SIGN
    * characters (%) and ASCII digits, then jump to the step labeled next
    * setting.
+   *
+   * 3. If any character in value other than the last character is a U+0025
+   * PERCENT SIGN character (%), then jump to the step labeled next setting.
    */
-  for( c = value; *c; ++c ) {
+  for( c = value; c < end; ++c ) {
     if( webvtt_isdigit( *c ) ) {
       ++digits;
-    } else if( *c == '%' ) {
-    } else {
-      return WEBVTT_BAD_POSITION;
+    } else if( *c != '%' || c != end - 1 ) {
+      return -1;
     }
   }
 
   /**
    * 2. If value does not contain at least one ASCII digit, then jump to the
    * step labeled next setting.
-   */
-  if( !digits ) {
-    return WEBVTT_BAD_POSITION;
-  }
-
-  /**
-   * 3. If any character in value other than the last character is a U+0025
-   * PERCENT SIGN character (%), then jump to the step labeled next setting.
-   */
-  if( ( c = strchr( value, '%' ) ) && ( c[1] != '\0' ) ) {
-    return WEBVTT_BAD_POSITION;
-  }
-
-  /**
+   *
    * 4. If the last character in value is not a U+0025 PERCENT SIGN character
    * (%), then jump to the step labeled next setting.
    */
-  if( !c ) {
-    return WEBVTT_BAD_POSITION;
+  if( !digits || end[ -1 ] != '%' ) {
+    return -1;
   }
 
   /**
@@ -303,11 +354,21 @@ webvtt_cue_set_position( webvtt_cue *cue, const char *value )
    * labeled next setting.
    */
   if( number > 100 ) {
+    return -1;
+  }
+  return (int)number;
+}
+
+static webvtt_status
+set_position( webvtt_cue *cue, const char *value, webvtt_uint len )
+{
+  int number = parse_percentage( value, len );
+  if( number < 0 ) {
     return WEBVTT_BAD_POSITION;
   }
 
   /* 7. Let cue's text track cue text position be number */
-  cue->settings.position = (int)number;
+  cue->settings.position = number;
   if( cue->flags & CUE_HAVE_POSITION ) {
     return WEBVTT_ALREADY_POSITION;
   }
@@ -315,71 +376,16 @@ webvtt_cue_set_position( webvtt_cue *cue, const char *value )
   return WEBVTT_SUCCESS;
 }
 
-WEBVTT_EXPORT webvtt_status
-webvtt_cue_set_size( webvtt_cue *cue, const char *value )
+static webvtt_status
+set_size( webvtt_cue *cue, const char *value, webvtt_uint len )
 {
-  int digits = 0;
-  webvtt_int64 number;
-  const char *c;
-  if( !cue || !value ) {
-    return WEBVTT_INVALID_PARAM;
-  }
-
-  /**
-   * 1. If value contains any characters other than U+0025 PERCENT SIGN
-   * characters (%) and ASCII digits, then jump to the step labeled next
-   * setting.
-   */
-  for( c = value; *c; ++c ) {
-    if( webvtt_isdigit( *c ) ) {
-      ++digits;
-    } else if( *c == '%' ) {
-    } else {
-      return WEBVTT_BAD_SIZE;
-    }
-  }
-
-  /**
-   * 2. If value does not contain at least one ASCII digit, then jump to the
-   * step labeled next setting.
-   */
-  if( !digits ) {
-    return WEBVTT_BAD_SIZE;
-  }
-
-  /**
-   * 3. If any character in value other than the last character is a U+0025
-   * PERCENT SIGN character (%), then jump to the step labeled next setting.
-   */
-  if( ( c = strchr( value, '%' ) ) && ( c[1] != '\0' ) ) {
-    return WEBVTT_BAD_SIZE;
-  }
-
-  /**
-   * 4. If the last character in value is not a U+0025 PERCENT SIGN character
-   * (%), then jump to the step labeled next setting.
-   */
-  if( !c ) {
-    return WEBVTT_BAD_SIZE;
-  }
-
-  /**
-   * 5. Ignoring the trailing percent sign, interpret value as an integer, and
-   * let number be that number.
-   */
-  c = value;
-  number = webvtt_parse_int( &c, &digits );
-
-  /**
-   * 6. If number is not in the range 0 <= number <= 100, then jump to the step
-   * labeled next setting.
-   */
-  if( number > 100 ) {
+  int number = parse_percentage( value, len );
+  if( number < 0 ) {
     return WEBVTT_BAD_SIZE;
   }
 
   /* 7. Let cue's text track cue size be number */
-  cue->settings.size = (int)number;
+  cue->settings.size = number;
   if( cue->flags & CUE_HAVE_SIZE ) {
     return WEBVTT_ALREADY_SIZE;
   }
@@ -387,8 +393,8 @@ webvtt_cue_set_size( webvtt_cue *cue, const char *value )
   return WEBVTT_SUCCESS;
 }
 
-WEBVTT_EXPORT webvtt_status
-webvtt_cue_set_vertical( webvtt_cue *cue, const char *value )
+static webvtt_status
+set_vertical( webvtt_cue *cue, const char *value, webvtt_uint len )
 {
   unsigned i;
   static const char *values[] = {
@@ -396,12 +402,8 @@ webvtt_cue_set_vertical( webvtt_cue *cue, const char *value )
     "rl",
   };
 
-  if( !cue || !value ) {
-    return WEBVTT_INVALID_PARAM;
-  }
-
   for( i=0 ; i < sizeof(values)/sizeof(*values) ; ++i ) {
-    if( !strcmp( value, values[i] ) ) {
+    if( len == 2 && !memcmp( value, values[i], 2 ) ) {
       cue->settings.vertical = (webvtt_align_type)i+1;
       if( cue->flags & CUE_HAVE_VERTICAL ) {
         return WEBVTT_ALREADY_VERTICAL;
@@ -413,18 +415,111 @@ webvtt_cue_set_vertical( webvtt_cue *cue, const char *value )
   return WEBVTT_BAD_VERTICAL;
 }
 
-static struct
+WEBVTT_EXPORT webvtt_status
+webvtt_cue_set_align( webvtt_cue *cue, const char *value )
+{
+  if( !cue || !value ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return set_align( cue, value, (webvtt_uint)strlen( value ) );
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_cue_set_line( webvtt_cue *cue, const char *value )
+{
+  if( !cue || !value ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return set_line( cue, value, (webvtt_uint)strlen( value ) );
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_cue_set_position( webvtt_cue *cue, const char *value )
+{
+  if( !cue || !value ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return set_position( cue, value, (webvtt_uint)strlen( value ) );
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_cue_set_size( webvtt_cue *cue, const char *value )
+{
+  if( !cue || !value ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return set_size( cue, value, (webvtt_uint)strlen( value ) );
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_cue_set_vertical( webvtt_cue *cue, const char *value )
+{
+  if( !cue || !value ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return set_vertical( cue, value, (webvtt_uint)strlen( value ) );
+}
+
+/**
+ * The setting names all begin with a different letter, and the low three
+ * bits of that letter are enough to tell them apart: 'p' = 0, 'a' = 1,
+ * 's' = 3, 'l' = 4 and 'v' = 6. A keyword is looked up in this table by that
+ * hash, and then compared with the one entry it could be.
+ */
+#define CUESETTING_HASH( c ) ( (unsigned char)( c ) & 7 )
+
+static const struct
 {
   const char *keyword;
-  webvtt_status (*setValue)( webvtt_cue *cue, const char *value );
-} cuesettings[] = {
-  { "align", &webvtt_cue_set_align },
-  { "line", &webvtt_cue_set_line },
-  { "position", &webvtt_cue_set_position },
-  { "size", &webvtt_cue_set_size },
-  { "vertical", &webvtt_cue_set_vertical },
+  webvtt_uint length;
+  webvtt_status (*setValue)( webvtt_cue *cue, const char *value,
+                             webvtt_uint len );
+} cuesettings[ 8 ] = {
+  { "position", 8, &set_position },
+  { "align", 5, &set_align },
+  { 0, 0, 0 },
+  { "size", 4, &set_size },
+  { "line", 4, &set_line },
+  { 0, 0, 0 },
+  { "vertical", 8, &set_vertical },
+  { 0, 0, 0 }
 };
 
+static webvtt_status
+set_setting( webvtt_cue *cue, const char *key, webvtt_uint keylen,
+             const char *value, webvtt_uint len )
+{
+  unsigned i;
+  if( !keylen ) {
+    return WEBVTT_BAD_CUESETTING;
+  }
+  i = CUESETTING_HASH( *key );
+  if( keylen != cuesettings[i].length ||
+      memcmp( key, cuesettings[i].keyword, keylen ) ) {
+    return WEBVTT_BAD_CUESETTING;
+  }
+  if( !cue ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return cuesettings[i].setValue( cue, value, len );
+}
+
+/**
+ * Separate the 'len' bytes of 'word' into key and value (delimited by ':'),
+ * and set the named setting to that value
+ */
+static webvtt_status
+set_setting_from_word( webvtt_cue *cue, const char *word, webvtt_uint len )
+{
+  const char *colon = (const char *)memchr( word, ':', len );
+  webvtt_uint keylen;
+  if( !colon || colon == word || colon == word + len - 1 ) {
+    return WEBVTT_BAD_CUESETTING;
+  }
+  keylen = (webvtt_uint)( colon - word );
+  return set_setting( cue, word, keylen, colon + 1, len - keylen - 1 );
+}
+
 /**
  * Set a cuesetting from key-value pairs (as C strings)
  */
@@ -432,16 +527,11 @@ WEBVTT_EXPORT webvtt_status
 webvtt_cue_set_setting( webvtt_cue *cue,
                         const char *key, const char *value )
 {
-  unsigned i;
   if( !key || !value ) {
     return WEBVTT_INVALID_PARAM;
   }
-  for( i=0 ; i<sizeof(cuesettings)/sizeof(*cuesettings) ; ++i ) {
-    if( !strcmp( key, cuesettings[i].keyword ) ) {
-      return cuesettings[i].setValue( cue, value );
-    }
-  }
-  return WEBVTT_BAD_CUESETTING;
+  return set_setting( cue, key, (webvtt_uint)strlen( key ), value,
+                      (webvtt_uint)strlen( value ) );
 }
 
 WEBVTT_EXPORT webvtt_status
@@ -458,47 +548,20 @@ webvtt_cue_set_settings( webvtt_cue *cue, const webvtt_string *settings )
 WEBVTT_INTERN webvtt_status
 webvtt_cue_set_setting_from_string( webvtt_cue *cue, const char *word )
 {
-  char keyword[32] = "";
-  char *value;
-  int idx;
   if( !cue || !word ) {
     return WEBVTT_INVALID_PARAM;
   }
-
-  value = strchr( word, ':' );
-  if( !value || value == word || *(++value) == '\0' ) {
-    return WEBVTT_BAD_CUESETTING;
-  }
-
-  idx = ( value - word ) - 1;
-  if( idx > 31 ) {
-    return WEBVTT_BAD_CUESETTING;
-  }
-
-  memcpy( keyword, word, idx );
-  keyword[idx] = '\0';
-
-  return webvtt_cue_set_setting( cue, (const char *)keyword, value );
+  return set_setting_from_word( cue, word, (webvtt_uint)strlen( word ) );
 }
 
-WEBVTT_EXPORT webvtt_status
-webvtt_cue_validate_set_settings( webvtt_parser self, webvtt_cue *cue,
-                                  const webvtt_string *settings )
+WEBVTT_INTERN void
+webvtt_cue_apply_settings( webvtt_parser self, webvtt_cue *cue,
+                           const char *text, webvtt_uint length )
 {
+  const char *p = text, *end = text + length;
   int line = 1;
   int column = 0;
-  int length;
-  const char *eol;
-  int position = 0;
   webvtt_status s;
-  if( !cue || !settings ) {
-    return WEBVTT_INVALID_PARAM;
-  }
-  length = (int)webvtt_string_length( settings );
-  if( ( eol = strchr( webvtt_string_text( settings ), '\r' ) )
-      || ( eol = strchr( webvtt_string_text( settings ), '\n' ) ) ) {
-    length = (int)( eol - webvtt_string_text( settings ) );
-  }
 
   if( self ) {
     line = self->line;
@@ -509,28 +572,22 @@ webvtt_cue_validate_set_settings( webvtt_parser self, webvtt_cue *cue,
    * http://www.w3.org/html/wg/drafts/html/master/single-page.html#split-a-string-on-spaces
    * 4. Skip whitespace
    */
-  column += webvtt_string_skip_whitespace( settings, &position );
+  p = webvtt_scan_whitespace( p, end );
+  column += (int)( p - text );
 
-  while( position < length ) {
-    webvtt_string word;
-    const char *keyword;
-    const char *end;
-    int nwhite, ncol;
+  while( p < end ) {
+    const char *word = p, *word_end;
+    int nwhite;
     /* Collect word (sequence of non-space characters terminated by space) */
-    if( WEBVTT_FAILED( webvtt_string_collect_word( settings, &word,
-                       &position ) ) ) {
-      return WEBVTT_OUT_OF_MEMORY;
+    while( p < end && !webvtt_isspace( *p ) ) {
+      ++p;
     }
+    word_end = p;
     /* skip trailing whitespace */
-    nwhite = webvtt_string_skip_whitespace( settings, &position );
-    /* Get the word text */
-    keyword = webvtt_string_text( &word );
-    /* Get pointer to end of the word. (for chcount()) */
-    end = keyword + webvtt_string_length( &word );
-    /* Get the column count that needs to be skipped. */
-    ncol = webvtt_utf8_chcount( keyword, end );
-    if( WEBVTT_FAILED( s = webvtt_cue_set_setting_from_string( cue,
-                       keyword ) ) ) {
+    p = webvtt_scan_whitespace( p, end );
+    nwhite = (int)( p - word_end );
+    if( WEBVTT_FAILED( s = set_setting_from_word( cue, word,
+                             (webvtt_uint)( word_end - word ) ) ) ) {
       if( self ) {
         /* Figure out which error to emit */
         webvtt_error error;
@@ -543,13 +600,28 @@ webvtt_cue_validate_set_settings( webvtt_parser self, webvtt_cue *cue,
       }
     }
     /* Move column pointer beyond word and trailing whitespace */
-    column += ncol + nwhite;
-    webvtt_release_string( &word );
+    column += webvtt_utf8_chcount( word, word_end ) + nwhite;
   }
 
   if( self ) {
     self->column = column;
   }
-  return WEBVTT_SUCCESS;
 }
 
+WEBVTT_EXPORT webvtt_status
+webvtt_cue_validate_set_settings( webvtt_parser self, webvtt_cue *cue,
+                                  const webvtt_string *settings )
+{
+  webvtt_uint length;
+  const char *text, *eol;
+  if( !cue || !settings ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  text = webvtt_string_text( settings );
+  length = webvtt_string_length( settings );
+  if( ( eol = strchr( text, '\r' ) ) || ( eol = strchr( text, '\n' ) ) ) {
+    length = (webvtt_uint)( eol - text );
+  }
+  webvtt_cue_apply_settings( self, cue, text, length );
+  return WEBVTT_SUCCESS;
+}
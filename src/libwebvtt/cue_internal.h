@@ -42,15 +42,52 @@ enum {
   CUE_HAVE_SETTINGS = (CUE_HAVE_VERTICAL | CUE_HAVE_SIZE
     | CUE_HAVE_POSITION | CUE_HAVE_LINE | CUE_HAVE_ALIGN),
 
+  /**
+   * The cue text hasn't been parsed yet, and will be the first time the
+   * application asks for it, as a webvtt_node_tree if CUE_TEXT_FLAT is set
+   */
+  CUE_TEXT_PENDING = (1 << 5),
+  CUE_TEXT_FLAT = (1 << 6),
+
   CUE_HAVE_CUEPARAMS = 0x40000000,
   CUE_HAVE_ID = 0x80000000,
   CUE_HEADER_MASK = CUE_HAVE_CUEPARAMS|CUE_HAVE_ID,
 };
 
+/**
+ * What webvtt_create_cue() actually allocates: the public webvtt_cue, followed
+ * by fields that aren't part of its layout.
+ */
+typedef struct
+webvtt_cue_ext_t {
+  webvtt_cue cue;
+
+  /**
+   * Held while the cue text is parsed lazily
+   */
+  volatile webvtt_uint text_lock;
+
+  /**
+   * Parsed cue-text, when the parser was configured to produce a
+   * webvtt_node_tree (NULL otherwise)
+   */
+  webvtt_node_tree *node_tree;
+} webvtt_cue_ext;
+
+# define CUE_EXT(c) ( (webvtt_cue_ext *)(c) )
+
 WEBVTT_INTERN webvtt_bool
 cue_is_incomplete( const webvtt_cue *cue );
 
 WEBVTT_INTERN webvtt_status
 webvtt_cue_set_setting_from_string( webvtt_cue *cue, const char *word );
 
+/**
+ * Apply the cue settings in the 'length' bytes at 'text', in one pass and
+ * without copying them, reporting errors through 'self' if it isn't NULL
+ */
+WEBVTT_INTERN void
+webvtt_cue_apply_settings( struct webvtt_parser_t *self, webvtt_cue *cue,
+                           const char *text, webvtt_uint length );
+
 #endif
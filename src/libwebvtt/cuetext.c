@@ -32,6 +32,7 @@
 #include "node_internal.h"
 #include "cue_internal.h"
 #include "string_internal.h"
+#include "scan_internal.h"
 
 #ifdef min
 # undef min
@@ -59,18 +60,12 @@ do \
   if( status != WEBVTT_SUCCESS ) \
     return status; \
 
-#define CHECK_MEMORY_OP_JUMP(status_var, returned_status) \
-  if( returned_status != WEBVTT_SUCCESS) \
-  { \
-    status_var = returned_status; \
-    goto dealloc; \
-  } \
-
 WEBVTT_INTERN webvtt_status
 webvtt_create_token( webvtt_cuetext_token **token, webvtt_token_type token_type )
 {
   webvtt_cuetext_token *temp_token =
-    (webvtt_cuetext_token *)webvtt_alloc0( sizeof(*temp_token) );
+    (webvtt_cuetext_token *)webvtt_alloc0_as( sizeof(*temp_token),
+                                              WEBVTT_MEM_TOKEN );
 
   if( !temp_token ) {
     return WEBVTT_OUT_OF_MEMORY;
@@ -162,23 +157,41 @@ webvtt_delete_token( webvtt_cuetext_token **token )
   t = *token;
 
   /**
-   * Note that time stamp tokens do not need to free any internal data because
-   * they do not allocate anything.
+   * A reused token may still hold strings from tokens of other kinds, so
+   * everything is released whatever kind of token it is now.
    */
-  if( t->token_type == START_TOKEN ) {
-    data = t->start_token_data;
-    webvtt_release_stringlist( &data.css_classes );
-    webvtt_release_string( &data.annotations );
-    webvtt_release_string( &t->tag_name );
-  } else if( t->token_type == END_TOKEN ) {
-    webvtt_release_string( &t->tag_name );
-  } else if( t->token_type == TEXT_TOKEN ) {
-    webvtt_release_string( &t->text );
-  }
+  data = t->start_token_data;
+  webvtt_release_stringlist( &data.css_classes );
+  webvtt_release_string( &data.annotations );
+  webvtt_release_string( &t->tag_name );
+  webvtt_release_string( &t->text );
   webvtt_free( t );
   *token = 0;
 }
 
+WEBVTT_INTERN webvtt_status
+webvtt_intern_token( webvtt_intern_table *interns, webvtt_cuetext_token *token )
+{
+  webvtt_stringlist *classes;
+  webvtt_uint i;
+
+  if( !interns || !token ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  if( token->token_type != START_TOKEN ) {
+    return WEBVTT_SUCCESS;
+  }
+
+  CHECK_MEMORY_OP( webvtt_intern_string( interns, &token->tag_name ) );
+  classes = token->start_token_data.css_classes;
+  for( i = 0; classes && i < classes->length; i++ ) {
+    CHECK_MEMORY_OP( webvtt_intern_string( interns, classes->items + i ) );
+  }
+  return webvtt_intern_string( interns,
+                               &token->start_token_data.annotations );
+}
+
 WEBVTT_INTERN int
 tag_accepts_annotation( webvtt_string *tag_name )
 {
@@ -272,27 +285,38 @@ webvtt_create_node_from_token( webvtt_cuetext_token *token, webvtt_node **node,
 }
 
 WEBVTT_INTERN webvtt_status
-webvtt_data_state( const char **position, webvtt_token_state *token_state,
-                   webvtt_string *result )
+webvtt_data_state( const char **position, const char *end,
+                   webvtt_token_state *token_state, webvtt_string *result )
 {
-  for ( ; *token_state == DATA; (*position)++ ) {
+  webvtt_status status;
+  const char *run;
+  while( *token_state == DATA ) {
+    /* Copy everything up to the next character of interest in one go */
+    run = webvtt_scan_markup( *position, end );
+    if( run != *position ) {
+      if( WEBVTT_FAILED( status =
+            webvtt_string_append( result, *position,
+                                  (int)( run - *position ) ) ) ) {
+        return status;
+      }
+      *position = run;
+    }
     switch( **position ) {
       case '&':
         *token_state = ESCAPE;
+        (*position)++;
         break;
       case '<':
         if( webvtt_string_length(result) == 0 ) {
           *token_state = TAG;
+          (*position)++;
         } else {
           return WEBVTT_SUCCESS;
         }
         break;
-      case '\0':
-        return WEBVTT_SUCCESS;
-        break;
       default:
-        CHECK_MEMORY_OP( webvtt_string_putc( result, *position[0] ) );
-        break;
+        /* '\0' */
+        return WEBVTT_SUCCESS;
     }
   }
 
@@ -306,109 +330,143 @@ webvtt_data_state( const char **position, webvtt_token_state *token_state,
 #define LRM_LENGTH    3
 #define NBSP_LENGTH   2
 
-char rlm_replace[RLM_LENGTH] = { UTF8_RIGHT_TO_LEFT_1, UTF8_RIGHT_TO_LEFT_2,
-                                 UTF8_RIGHT_TO_LEFT_3 };
-char lrm_replace[LRM_LENGTH] = { UTF8_LEFT_TO_RIGHT_1, UTF8_LEFT_TO_RIGHT_2,
-                                 UTF8_LEFT_TO_RIGHT_3 };
-char nbsp_replace[NBSP_LENGTH] = { UTF8_NO_BREAK_SPACE_1,
-                                   UTF8_NO_BREAK_SPACE_2 };
+static const char rlm_replace[RLM_LENGTH] = { UTF8_RIGHT_TO_LEFT_1,
+                                              UTF8_RIGHT_TO_LEFT_2,
+                                              UTF8_RIGHT_TO_LEFT_3 };
+static const char lrm_replace[LRM_LENGTH] = { UTF8_LEFT_TO_RIGHT_1,
+                                              UTF8_LEFT_TO_RIGHT_2,
+                                              UTF8_LEFT_TO_RIGHT_3 };
+static const char nbsp_replace[NBSP_LENGTH] = { UTF8_NO_BREAK_SPACE_1,
+                                                UTF8_NO_BREAK_SPACE_2 };
+
+/**
+ * Look up the escape sequence named by the 'len' bytes at 'name' (without
+ * the leading '&' and trailing ';'). Returns its replacement text and stores
+ * the replacement's length in 'out_len', or returns NULL if the name is not
+ * one we know. Names are distinguished by their length and first character,
+ * so at most one comparison is made.
+ */
+static const char *
+lookup_escape( const char *name, int len, int *out_len )
+{
+  switch( len ) {
+    case 2:
+      if( name[ 1 ] != 't' ) {
+        break;
+      }
+      *out_len = 1;
+      if( name[ 0 ] == 'l' ) {
+        return "<";
+      } else if( name[ 0 ] == 'g' ) {
+        return ">";
+      }
+      break;
+    case 3:
+      if( name[ 0 ] == 'a' && memcmp( name, "amp", 3 ) == 0 ) {
+        *out_len = 1;
+        return "&";
+      } else if( name[ 0 ] == 'l' && memcmp( name, "lrm", 3 ) == 0 ) {
+        *out_len = LRM_LENGTH;
+        return lrm_replace;
+      } else if( name[ 0 ] == 'r' && memcmp( name, "rlm", 3 ) == 0 ) {
+        *out_len = RLM_LENGTH;
+        return rlm_replace;
+      }
+      break;
+    case 4:
+      if( memcmp( name, "nbsp", 4 ) == 0 ) {
+        *out_len = NBSP_LENGTH;
+        return nbsp_replace;
+      }
+      break;
+  }
+  return 0;
+}
+
+/**
+ * Append a sequence that turned out not to be an escape: the '&' that started
+ * it (consumed by the DATA state), followed by the 'len' bytes at 'name'
+ */
+static webvtt_status
+append_unescaped( webvtt_string *result, const char *name, int len )
+{
+  webvtt_status status = webvtt_string_putc( result, '&' );
+  if( status == WEBVTT_SUCCESS && len > 0 ) {
+    status = webvtt_string_append( result, name, len );
+  }
+  return status;
+}
 
+/**
+ * The characters of the escape sequence are scanned in place, rather than
+ * collected in a buffer, and only the decoded (or preserved) text is
+ * appended to 'result'.
+ */
 WEBVTT_INTERN webvtt_status
 webvtt_escape_state( const char **position, webvtt_token_state *token_state,
                      webvtt_string *result )
 {
-  webvtt_string buffer;
-  webvtt_status status = WEBVTT_SUCCESS;
-
-  CHECK_MEMORY_OP_JUMP( status, webvtt_create_string( 1, &buffer ) );
+  const char *name = *position, *p = *position, *replacement;
+  int len, replacement_len;
 
-  /**
-   * Append ampersand here because the algorithm is not able to add it to the
-   * buffer when it reads it in the DATA state tokenizer.
-   */
-  CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( &buffer, '&' ) );
-
-  for( ; *token_state == ESCAPE; (*position)++ ) {
-    /**
-     * We have encountered a token termination point.
-     * Append buffer to result and return success.
-     */
-    if( **position == '\0' || **position == '<' ) {
-      CHECK_MEMORY_OP_JUMP( status, webvtt_string_append_string( result,
-                                                                 &buffer ) );
-      goto dealloc;
-    }
+  for( ;; ) {
     /**
-     * This means we have enocuntered a malformed escape character sequence.
-     * This means that we need to add that malformed text to the result and
-     * recreate the buffer to prepare for a new escape sequence.
+     * Character is alphanumeric. This means we are in the body of the escape
+     * sequence.
      */
-    else if( **position == '&' ) {
-      CHECK_MEMORY_OP_JUMP( status, webvtt_string_append_string( result,
-                                                                 &buffer ) );
-      webvtt_release_string( &buffer );
-      CHECK_MEMORY_OP_JUMP( status, webvtt_create_string( 1, &buffer ) );
-      CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( &buffer,
-                                                        *position[0] ) );
+    while( webvtt_isalphanum( *p ) ) {
+      ++p;
     }
+    len = (int)( p - name );
+
     /**
      * We've encountered the semicolon which is the end of an escape sequence.
-     * Check if buffer contains a valid escape sequence and if it does append
-     * the interpretation to result and change the state to DATA.
+     * If it names a valid escape sequence append its interpretation to
+     * result, otherwise append the text as it was. Either way, change the
+     * state to DATA.
      */
-    else if( **position == ';' ) {
-      if( webvtt_string_is_equal( &buffer, "&amp", 4 ) ) {
-        CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( result, '&' ) );
-      } else if( webvtt_string_is_equal( &buffer, "&lt", 3 ) ) {
-        CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( result, '<' ) );
-      } else if( webvtt_string_is_equal( &buffer, "&gt", 3 ) ) {
-        CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( result, '>' ) );
-      } else if( webvtt_string_is_equal( &buffer, "&rlm", 4 ) ) {
-        CHECK_MEMORY_OP_JUMP( status, webvtt_string_append( result, rlm_replace,
-                                                            RLM_LENGTH ) );
-      } else if( webvtt_string_is_equal( &buffer, "&lrm", 4 ) ) {
-        CHECK_MEMORY_OP_JUMP( status, webvtt_string_append( result, lrm_replace,
-                                                            LRM_LENGTH ) );
-      } else if( webvtt_string_is_equal( &buffer, "&nbsp", 5 ) ) {
-        CHECK_MEMORY_OP_JUMP( status, webvtt_string_append( result,
-                                                            nbsp_replace,
-                                                            NBSP_LENGTH ) );
+    if( *p == ';' ) {
+      replacement = lookup_escape( name, len, &replacement_len );
+      if( replacement ) {
+        CHECK_MEMORY_OP( webvtt_string_append( result, replacement,
+                                               replacement_len ) );
       } else {
-        CHECK_MEMORY_OP_JUMP( status, webvtt_string_append_string( result,
-                                                                   &buffer ) );
-        CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( result,
-                                                          **position ) );
+        CHECK_MEMORY_OP( append_unescaped( result, name, len + 1 ) );
       }
-
       *token_state = DATA;
-      status = WEBVTT_UNFINISHED;
+      *position = p + 1;
+      return WEBVTT_UNFINISHED;
     }
+
+    CHECK_MEMORY_OP( append_unescaped( result, name, len ) );
+
     /**
-     * Character is alphanumeric. This means we are in the body of the escape
+     * We have encountered a token termination point.
+     */
+    if( *p == '\0' || *p == '<' ) {
+      *position = p;
+      return WEBVTT_SUCCESS;
+    }
+    /**
+     * This means we have encountered a malformed escape character sequence,
+     * which has been added to the result. Start again with a new escape
      * sequence.
      */
-    else if( webvtt_isalphanum( **position ) ) {
-      CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( &buffer, **position ) );
+    else if( *p == '&' ) {
+      name = ++p;
     }
     /**
      * If we have not found an alphanumeric character then we have encountered
-     * a malformed escape sequence. Add buffer to result and continue to parse
-     * in DATA state.
+     * a malformed escape sequence. Add the character to result and continue
+     * to parse in DATA state.
      */
     else {
-      CHECK_MEMORY_OP_JUMP( status, webvtt_string_append_string( result,
-                                                                 &buffer ) );
-      CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( result,
-                                                        **position ) );
-      status = WEBVTT_UNFINISHED;
+      CHECK_MEMORY_OP( webvtt_string_putc( result, *p ) );
       *token_state = DATA;
+      *position = p + 1;
+      return WEBVTT_UNFINISHED;
     }
   }
-
-dealloc:
-  webvtt_release_string( &buffer );
-
-  return status;
 }
 
 WEBVTT_INTERN webvtt_status
@@ -447,32 +505,63 @@ webvtt_tag_state( const char **position, webvtt_token_state *token_state,
   return WEBVTT_UNFINISHED;
 }
 
+/**
+ * Characters ending the runs of text collected by the tag states. NUL ends
+ * every run, so scanning always stops at the end of the payload.
+ */
+#define CT_SPACE ( 0x01 ) /* tab, LF, FF, CR and space */
+#define CT_DOT ( 0x02 )   /* '.' */
+#define CT_END ( 0x04 )   /* '>' and NUL */
+
+static const unsigned char tag_char_class[ 256 ] = {
+  /* 0x00 */ CT_END, 0, 0, 0, 0, 0, 0, 0,
+             0, CT_SPACE, CT_SPACE, 0, CT_SPACE, CT_SPACE, 0, 0,
+  /* 0x10 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0x20 */ CT_SPACE, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, CT_DOT, 0,
+  /* 0x30 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, CT_END, 0
+  /* The remaining characters are all zero */
+};
+
+/**
+ * Return the first character at or after 'p' in any of the 'stop' classes
+ */
+static const char *
+scan_tag_run( const char *p, unsigned char stop )
+{
+  while( !( tag_char_class[ (unsigned char)*p ] & stop ) ) {
+    ++p;
+  }
+  return p;
+}
+
+/**
+ * Append the run of text from '*position' to 'end' to 'result' in one go,
+ * and move '*position' to its end
+ */
+static webvtt_status
+append_tag_run( const char **position, const char *end, webvtt_string *result )
+{
+  webvtt_status status = WEBVTT_SUCCESS;
+  if( end != *position ) {
+    status = webvtt_string_append( result, *position,
+                                   (int)( end - *position ) );
+    *position = end;
+  }
+  return status;
+}
+
 WEBVTT_INTERN webvtt_status
 webvtt_start_tag_state( const char **position, webvtt_token_state *token_state,
                         webvtt_string *result )
 {
-  for( ; *token_state == START_TAG; (*position)++ ) {
-    if( **position == '\t' || **position == '\f' ||
-        **position == ' ' || **position == '\n' ||
-        **position == '\r' ) {
-      *token_state = START_TAG_ANNOTATION;
-    } else {
-      switch( **position ) {
-        case '.':
-          *token_state = START_TAG_CLASS;
-          break;
-        case '\0':
-          return WEBVTT_SUCCESS;
-        case '>':
-          return WEBVTT_SUCCESS;
-          break;
-        default:
-          CHECK_MEMORY_OP( webvtt_string_putc( result, **position ) );
-          break;
-      }
-    }
-  }
+  const char *end = scan_tag_run( *position, CT_SPACE | CT_DOT | CT_END );
+  CHECK_MEMORY_OP( append_tag_run( position, end, result ) );
 
+  if( tag_char_class[ (unsigned char)**position ] & CT_END ) {
+    return WEBVTT_SUCCESS;
+  }
+  *token_state = **position == '.' ? START_TAG_CLASS : START_TAG_ANNOTATION;
+  (*position)++;
   return WEBVTT_UNFINISHED;
 }
 
@@ -481,104 +570,150 @@ webvtt_class_state( const char **position, webvtt_token_state *token_state,
                     webvtt_stringlist *css_classes )
 {
   webvtt_string buffer;
-  webvtt_status status = WEBVTT_SUCCESS;
+  webvtt_status status;
 
-  CHECK_MEMORY_OP( webvtt_create_string( 1, &buffer ) );
+  for( ;; ) {
+    const char *end = scan_tag_run( *position, CT_SPACE | CT_DOT | CT_END );
+    char c = *end;
+    int n = (int)( end - *position );
+    CHECK_MEMORY_OP( webvtt_create_string_with_text( &buffer, *position, n ) );
+    *position = end;
+    /* Classes are only pushed before whitespace if they aren't empty */
+    if( !( tag_char_class[ (unsigned char)c ] & CT_SPACE ) ||
+        webvtt_string_length( &buffer ) > 0 ) {
+      status = webvtt_stringlist_push( css_classes, &buffer );
+    } else {
+      status = WEBVTT_SUCCESS;
+    }
+    webvtt_release_string( &buffer );
+    if( WEBVTT_FAILED( status ) ) {
+      return status;
+    }
 
-  for( ; *token_state == START_TAG_CLASS; (*position)++ ) {
-    if( **position == '\t' || **position == '\f' ||
-        **position == ' ' || **position == '\n' ||
-        **position == '\r') {
-      if( webvtt_string_length( &buffer ) > 0 ) {
-        CHECK_MEMORY_OP_JUMP( status, webvtt_stringlist_push( css_classes,
-                                                              &buffer ) );
+    if( c != '.' ) {
+      if( tag_char_class[ (unsigned char)c ] & CT_SPACE ) {
+        *token_state = START_TAG_ANNOTATION;
       }
-      *token_state = START_TAG_ANNOTATION;
-      webvtt_release_string( &buffer );
-      return WEBVTT_SUCCESS;
-    } else if( **position == '>' || **position == '\0' ) {
-      CHECK_MEMORY_OP_JUMP( status, webvtt_stringlist_push( css_classes,
-                                                            &buffer ) );
-      webvtt_release_string( &buffer );
       return WEBVTT_SUCCESS;
-    } else if( **position == '.' ) {
-      CHECK_MEMORY_OP_JUMP( status, webvtt_stringlist_push( css_classes,
-                                                            &buffer ) );
-      webvtt_release_string( &buffer );
-      CHECK_MEMORY_OP( webvtt_create_string( 1, &buffer ) );
-    } else {
-      CHECK_MEMORY_OP_JUMP( status, webvtt_string_putc( &buffer, **position ) );
     }
+    (*position)++;
   }
-
-dealloc:
-  webvtt_release_string( &buffer );
-
-  return status;
 }
 
 WEBVTT_INTERN webvtt_status
 webvtt_annotation_state( const char **position, webvtt_token_state *token_state,
                          webvtt_string *annotation )
 {
-  for( ; *token_state == START_TAG_ANNOTATION; (*position)++ ) {
-    if( **position == '\0' || **position == '>' ) {
-      return WEBVTT_SUCCESS;
-    }
-    CHECK_MEMORY_OP( webvtt_string_putc( annotation, **position ) );
-  }
-
-  return WEBVTT_UNFINISHED;
+  (void)token_state;
+  CHECK_MEMORY_OP( append_tag_run( position, scan_tag_run( *position, CT_END ),
+                                   annotation ) );
+  return WEBVTT_SUCCESS;
 }
 
 WEBVTT_INTERN webvtt_status
 webvtt_end_tag_state( const char **position, webvtt_token_state *token_state,
                       webvtt_string *result )
 {
-  for( ; *token_state == END_TAG; (*position)++ ) {
-    if( **position == '>' || **position == '\0' ) {
-      return WEBVTT_SUCCESS;
-    }
-    CHECK_MEMORY_OP( webvtt_string_putc( result, **position ) );
-  }
-
-  return WEBVTT_UNFINISHED;
+  (void)token_state;
+  CHECK_MEMORY_OP( append_tag_run( position, scan_tag_run( *position, CT_END ),
+                                   result ) );
+  return WEBVTT_SUCCESS;
 }
 
 WEBVTT_INTERN webvtt_status
 webvtt_timestamp_state( const char **position, webvtt_token_state *token_state,
                         webvtt_string *result )
 {
-  for( ; *token_state == TIME_STAMP_TAG; (*position)++ ) {
-    if( **position == '>' || **position == '\0' ) {
-      return WEBVTT_SUCCESS;
-    }
-    CHECK_MEMORY_OP( webvtt_string_putc( result, **position ) );
-  }
+  (void)token_state;
+  CHECK_MEMORY_OP( append_tag_run( position, scan_tag_run( *position, CT_END ),
+                                   result ) );
+  return WEBVTT_SUCCESS;
+}
 
-  return WEBVTT_UNFINISHED;
+/**
+ * Return the end of the text token starting at 'p', which is the next '<' or
+ * the end of the payload
+ */
+static const char *
+scan_text_token( const char *p, const char *end )
+{
+  while( *( p = webvtt_scan_markup( p, end ) ) == '&' ) {
+    ++p;
+  }
+  return p;
 }
 
 /**
- * Need to set up differently.
- * Get a status in order to return at end and release memeory.
+ * Empty the class list of a reused token, keeping it if nothing else
+ * references it
  */
+static void
+reset_css_classes( webvtt_stringlist **css_classes )
+{
+  webvtt_stringlist *list = *css_classes;
+  if( list && list->refs.value == 1 ) {
+    while( list->length > 0 ) {
+      webvtt_release_string( list->items + --list->length );
+    }
+  } else {
+    webvtt_release_stringlist( css_classes );
+  }
+}
+
 WEBVTT_INTERN webvtt_status
-webvtt_cuetext_tokenizer( const char **position, webvtt_cuetext_token **token )
+webvtt_cuetext_tokenizer( const char **position, const char *end,
+                          webvtt_cuetext_token **token,
+                          webvtt_int64 time_offset )
 {
   webvtt_token_state token_state = DATA;
-  webvtt_string result, annotation;
-  webvtt_stringlist *css_classes;
+  webvtt_cuetext_token *t;
+  webvtt_string *result, *annotation;
+  webvtt_stringlist **css_classes;
+  const char *run;
   webvtt_timestamp time_stamp = 0;
   webvtt_status status = WEBVTT_UNFINISHED;
 
-  if( !position ) {
+  if( !position || !token ) {
     return WEBVTT_INVALID_PARAM;
   }
 
-  webvtt_create_string( 10, &result );
-  webvtt_create_string( 10, &annotation );
-  webvtt_create_stringlist( &css_classes );
+  if( !*token ) {
+    CHECK_MEMORY_OP( webvtt_create_token( token, TEXT_TOKEN ) );
+  }
+  t = *token;
+  annotation = &t->start_token_data.annotations;
+  css_classes = &t->start_token_data.css_classes;
+
+  /**
+   * The strings of the previous token are emptied and reused, unless a node
+   * or intern table has taken a reference to them. Escapes never make text
+   * longer, so a text token is given all the space it needs up front, from
+   * the distance to the next tag. The runs of a tag are each appended in one
+   * piece once their extent is known, which sizes them just as well, and
+   * lets one character tag names share the immortal single character
+   * strings.
+   */
+  if( **position == '<' ) {
+    result = &t->tag_name;
+    CHECK_MEMORY_OP( webvtt_string_reset( result, 0 ) );
+    CHECK_MEMORY_OP( webvtt_string_reset( annotation, 0 ) );
+    reset_css_classes( css_classes );
+  } else {
+    result = &t->text;
+    run = webvtt_scan_markup( *position, end );
+    if( *run != '&' ) {
+      /* Text without escapes, the usual case, is copied in one go */
+      CHECK_MEMORY_OP( webvtt_string_reset( result,
+                         (webvtt_uint)( run - *position ) ) );
+      CHECK_MEMORY_OP( webvtt_string_append( result, *position,
+                                             (int)( run - *position ) ) );
+      *position = run;
+      t->token_type = TEXT_TOKEN;
+      return WEBVTT_SUCCESS;
+    }
+    CHECK_MEMORY_OP( webvtt_string_reset( result,
+      (webvtt_uint)( scan_text_token( run, end ) - *position ) ) );
+  }
 
   /**
    * Loop while the tokenizer is not finished.
@@ -589,28 +724,34 @@ webvtt_cuetext_tokenizer( const char **position, webvtt_cuetext_token **token )
   while( status == WEBVTT_UNFINISHED ) {
     switch( token_state ) {
       case DATA :
-        status = webvtt_data_state( position, &token_state, &result );
+        status = webvtt_data_state( position, end, &token_state, result );
         break;
       case ESCAPE:
-        status = webvtt_escape_state( position, &token_state, &result );
+        status = webvtt_escape_state( position, &token_state, result );
         break;
       case TAG:
-        status = webvtt_tag_state( position, &token_state, &result );
+        status = webvtt_tag_state( position, &token_state, result );
         break;
       case START_TAG:
-        status = webvtt_start_tag_state( position, &token_state, &result );
+        status = webvtt_start_tag_state( position, &token_state, result );
         break;
       case START_TAG_CLASS:
-        status = webvtt_class_state( position, &token_state, css_classes );
+        if( !*css_classes ) {
+          status = webvtt_create_stringlist( css_classes );
+          if( WEBVTT_FAILED( status ) ) {
+            break;
+          }
+        }
+        status = webvtt_class_state( position, &token_state, *css_classes );
         break;
       case START_TAG_ANNOTATION:
-        status = webvtt_annotation_state( position, &token_state, &annotation );
+        status = webvtt_annotation_state( position, &token_state, annotation );
         break;
       case END_TAG:
-        status = webvtt_end_tag_state( position, &token_state, &result );
+        status = webvtt_end_tag_state( position, &token_state, result );
         break;
       case TIME_STAMP_TAG:
-        status = webvtt_timestamp_state( position, &token_state, &result );
+        status = webvtt_timestamp_state( position, &token_state, result );
         break;
     }
   }
@@ -624,37 +765,118 @@ webvtt_cuetext_tokenizer( const char **position, webvtt_cuetext_token **token )
      * needs to be made.
      */
     if( token_state == DATA || token_state == ESCAPE ) {
-      status = webvtt_create_text_token( token, &result );
+      t->token_type = TEXT_TOKEN;
     } else if( token_state == TAG || token_state == START_TAG ||
                token_state == START_TAG_CLASS ||
               token_state == START_TAG_ANNOTATION) {
       /**
-      * If the tag does not accept an annotation then release the current
-      * annotation and intialize annotation to a safe empty state
+      * If the tag does not accept an annotation then empty the annotation
       */
-      if( !tag_accepts_annotation( &result ) ) {
-        webvtt_release_string( &annotation );
-        webvtt_init_string( &annotation );
+      if( !tag_accepts_annotation( result ) ) {
+        webvtt_string_reset( annotation, 0 );
+      }
+      if( !*css_classes ) {
+        status = webvtt_create_stringlist( css_classes );
       }
-      status = webvtt_create_start_token( token, &result, css_classes,
-                                          &annotation );
+      t->token_type = START_TOKEN;
     } else if( token_state == END_TAG ) {
-      status = webvtt_create_end_token( token, &result );
+      t->token_type = END_TOKEN;
     } else if( token_state == TIME_STAMP_TAG ) {
-      webvtt_parse_timestamp( webvtt_string_text( &result ), 0, &time_stamp );
-      status = webvtt_create_timestamp_token( token, time_stamp );
+      webvtt_parse_timestamp_n( webvtt_string_text( result ),
+                                webvtt_string_length( result ), 0,
+                                &time_stamp );
+      t->time_stamp = webvtt_offset_timestamp( time_stamp, time_offset );
+      t->token_type = TIME_STAMP_TOKEN;
     } else {
       status = WEBVTT_INVALID_TOKEN_STATE;
     }
   }
 
-  webvtt_release_stringlist( &css_classes );
-  webvtt_release_string( &result );
-  webvtt_release_string( &annotation );
-
   return status;
 }
 
+/**
+ * The same routine as webvtt_parse_cuetext(), building a webvtt_node_tree
+ * rather than webvtt_node objects. Languages are inherited from the enclosing
+ * node by the builder, so no stack of them is needed here.
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_parse_cuetext_flat( webvtt_cue *cue, webvtt_string *payload,
+                           webvtt_int64 time_offset )
+{
+  webvtt_node_tree_builder builder;
+  webvtt_cuetext_token *token = 0;
+  webvtt_node_kind kind, current;
+  /* Go by length, so that a view of the input isn't copied to terminate it */
+  const char *position = payload->d->text, *end;
+  webvtt_uint length = webvtt_string_length( payload );
+  webvtt_status status = WEBVTT_SUCCESS;
+
+  webvtt_init_node_tree_builder( &builder );
+
+  if( length &&
+      webvtt_scan_markup( position, position + length ) == position + length ) {
+    status = webvtt_node_tree_builder_add_text( &builder, position, length );
+    position = end = "";
+  } else if( !( position = webvtt_string_text( payload ) ) ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  } else {
+    end = position + length;
+  }
+
+  while( *position != '\0' && status != WEBVTT_OUT_OF_MEMORY ) {
+    if( WEBVTT_FAILED( status = webvtt_cuetext_tokenizer( &position, end,
+                                                          &token,
+                                                          time_offset ) ) ) {
+      if( status == WEBVTT_OUT_OF_MEMORY ) {
+        /* The position hasn't moved, so there's no going on */
+        break;
+      }
+      continue;
+    }
+
+    current = WEBVTT_NODE_TREE_BUILDER_KIND( &builder );
+    switch( token->token_type ) {
+      case END_TOKEN:
+        if( current != WEBVTT_HEAD_NODE &&
+            webvtt_node_kind_from_tag_name( &token->tag_name, &kind ) ==
+              WEBVTT_SUCCESS &&
+            ( current == kind ||
+              ( current == WEBVTT_RUBY_TEXT && kind == WEBVTT_RUBY ) ) ) {
+          webvtt_node_tree_builder_close( &builder );
+        }
+        break;
+      case START_TOKEN:
+        if( webvtt_node_kind_from_tag_name( &token->tag_name, &kind ) !=
+              WEBVTT_SUCCESS ||
+            ( kind == WEBVTT_RUBY_TEXT && current != WEBVTT_RUBY ) ) {
+          break;
+        }
+        status = webvtt_node_tree_builder_open( &builder, kind,
+                   token->start_token_data.css_classes,
+                   &token->start_token_data.annotations );
+        break;
+      case TEXT_TOKEN:
+        status = webvtt_node_tree_builder_add_text( &builder,
+                   webvtt_string_text( &token->text ),
+                   webvtt_string_length( &token->text ) );
+        break;
+      case TIME_STAMP_TOKEN:
+        status = webvtt_node_tree_builder_add_timestamp( &builder,
+                                                         token->time_stamp );
+        break;
+    }
+  }
+  webvtt_delete_token( &token );
+
+  if( status == WEBVTT_OUT_OF_MEMORY ) {
+    webvtt_discard_node_tree_builder( &builder );
+    return status;
+  }
+  return webvtt_finish_node_tree_builder( &builder,
+                                         &CUE_EXT( cue )->node_tree );
+}
+
 /**
  * Currently line and len are not being kept track of.
  * Don't think pnode_length is needed as nodes track there list count
@@ -667,7 +889,7 @@ webvtt_parse_cuetext( webvtt_parser self, webvtt_cue *cue,
 
   const char *cue_text;
   webvtt_status status;
-  const char *position;
+  const char *position, *end;
   webvtt_node *node_head;
   webvtt_node *current_node;
   webvtt_node *temp_node;
@@ -675,6 +897,8 @@ webvtt_parse_cuetext( webvtt_parser self, webvtt_cue *cue,
   webvtt_node_kind kind;
   webvtt_stringlist *lang_stack;
   webvtt_string temp;
+  webvtt_uint length;
+  webvtt_int64 time_offset = 0;
 
   /**
    *  TODO: Use these parameters! 'finished' isn't really important
@@ -690,21 +914,49 @@ webvtt_parse_cuetext( webvtt_parser self, webvtt_cue *cue,
     return WEBVTT_INVALID_PARAM;
   }
 
-  cue_text = webvtt_string_text( payload );
-
-  if( !cue_text ) {
+  if( !payload || !payload->d ) {
     return WEBVTT_INVALID_PARAM;
   }
 
+  if( self ) {
+    time_offset = self->time_offset;
+    if( self->flat_node_tree ) {
+      return webvtt_parse_cuetext_flat( cue, payload, time_offset );
+    }
+  }
+
   if ( WEBVTT_FAILED(status = webvtt_create_head_node( &cue->node_head ) ) ) {
     return status;
   }
 
-  position = cue_text;
   node_head = cue->node_head;
   current_node = node_head;
   temp_node = NULL;
   token = NULL;
+
+  /**
+   * Cue text without any tags or escapes is a single text node, which can
+   * simply share the payload rather than copying it. This goes by length, so
+   * that a view of the input isn't copied to terminate it.
+   */
+  cue_text = payload->d->text;
+  length = webvtt_string_length( payload );
+  if( length &&
+      webvtt_scan_markup( cue_text, cue_text + length ) == cue_text + length ) {
+    if( WEBVTT_FAILED( status = webvtt_create_text_node( &temp_node,
+                                                         node_head,
+                                                         payload ) ) ) {
+      return status;
+    }
+    webvtt_attach_node( node_head, temp_node );
+    webvtt_release_node( &temp_node );
+    return WEBVTT_SUCCESS;
+  }
+  if( !( position = webvtt_string_text( payload ) ) ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+  end = position + length;
+
   webvtt_create_stringlist( &lang_stack );
 
   /**
@@ -712,15 +964,19 @@ webvtt_parse_cuetext( webvtt_parser self, webvtt_cue *cue,
    * http://dev.w3.org/html5/webvtt/#webvtt-cue-text-parsing-rules
    */
   while( *position != '\0' ) {
-    webvtt_status status = WEBVTT_SUCCESS;
-    webvtt_delete_token( &token );
-
     /* Step 7. */
-    if( WEBVTT_FAILED( status = webvtt_cuetext_tokenizer( &position,
-                                                          &token ) ) ) {
-      /* Error here. */
+    if( WEBVTT_FAILED( status = webvtt_cuetext_tokenizer( &position, end,
+                                                          &token,
+                                                          time_offset ) ) ) {
+      if( status == WEBVTT_OUT_OF_MEMORY ) {
+        /* The position hasn't moved, so there's no going on */
+        break;
+      }
     } else {
       /* Succeeded... Process token */
+      if( self && self->interns ) {
+        webvtt_intern_token( self->interns, token );
+      }
       if( token->token_type == END_TOKEN ) {
         /**
          * If we've found an end token which has a valid end token tag name and
@@ -766,9 +1022,12 @@ webvtt_parse_cuetext( webvtt_parser self, webvtt_cue *cue,
          * also set current to the newly created node if it is an internal
          * node type.
          */
-        if( webvtt_create_node_from_token( token, &temp_node, current_node ) !=
+        if( ( status = webvtt_create_node_from_token( token, &temp_node,
+                                                      current_node ) ) !=
             WEBVTT_SUCCESS ) {
-          /* Do something here? */
+          if( status == WEBVTT_OUT_OF_MEMORY ) {
+            break;
+          }
         } else {
           /**
            * If the parsed node is ruby text and we are not currently on a ruby
@@ -780,7 +1039,11 @@ webvtt_parse_cuetext( webvtt_parser self, webvtt_cue *cue,
             continue;
           }
 
-          webvtt_attach_node( current_node, temp_node );
+          if( ( status = webvtt_attach_node( current_node, temp_node ) ) ==
+              WEBVTT_OUT_OF_MEMORY ) {
+            webvtt_release_node( &temp_node );
+            break;
+          }
 
           /**
            * If the child node is a leaf node then we are done.
@@ -810,5 +1073,5 @@ webvtt_parse_cuetext( webvtt_parser self, webvtt_cue *cue,
   webvtt_delete_token( &token );
   webvtt_release_stringlist( &lang_stack );
 
-  return WEBVTT_SUCCESS;
+  return status == WEBVTT_OUT_OF_MEMORY ? status : WEBVTT_SUCCESS;
 }
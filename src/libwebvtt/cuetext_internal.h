@@ -76,18 +76,18 @@ webvtt_start_token_data_t {
 };
 
 /**
- * Contains a void pointer to a concrete token as well as a token type enum that
- * identifies what kind of token it is.
+ * Contains the data of a token as well as a token type enum that identifies
+ * what kind of token it is. The members aren't shared in a union, so that a
+ * token reused by webvtt_cuetext_tokenizer() keeps the storage of its text
+ * across the tags in between text tokens.
  */
 struct
 webvtt_cuetext_token_t {
   webvtt_token_type token_type;
   webvtt_string tag_name; // Only used for start token and end token types.
-  union {
-    webvtt_string text;
-    webvtt_timestamp time_stamp;
-    webvtt_start_token_data start_token_data;
-  };
+  webvtt_string text;
+  webvtt_timestamp time_stamp;
+  webvtt_start_token_data start_token_data;
 };
 
 /**
@@ -121,6 +121,15 @@ webvtt_create_timestamp_token( webvtt_cuetext_token **token,
 WEBVTT_INTERN int
 tag_accepts_annotation( webvtt_string *tag_name );
 
+/**
+ * Replaces the tag name, classes and annotation of a start token with their
+ * interned instances, so that the nodes built from it share them with every
+ * other node using the same values.
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_intern_token( webvtt_intern_table *interns,
+                     webvtt_cuetext_token *token );
+
 /**
  * Routines for deleting cue text tokens.
  */
@@ -146,11 +155,17 @@ webvtt_create_node_from_token( webvtt_cuetext_token *token, webvtt_node **node,
 
 /**
  * Tokenizes the cue text into something that can be easily understood by the
- * cue text parser.
+ * cue text parser. 'end' is the terminating NUL of the cue text. Timestamp
+ * tags are moved by 'time_offset' milliseconds.
+ * If '*token' is a token from an earlier call, it is reused rather than a new
+ * one being created, so callers should keep it until they have finished
+ * tokenizing and then delete it.
  * Referenced from - http://dev.w3.org/html5/webvtt/#webvtt-cue-text-tokenizer
  */
 WEBVTT_INTERN webvtt_status
-webvtt_tokenizer( const char **position, webvtt_cuetext_token **token );
+webvtt_cuetext_tokenizer( const char **position, const char *end,
+                          webvtt_cuetext_token **token,
+                          webvtt_int64 time_offset );
 
 /**
  * Routines that take care of certain states in the webvtt cue text tokenizer.
@@ -158,10 +173,12 @@ webvtt_tokenizer( const char **position, webvtt_cuetext_token **token );
 
 /**
  * Referenced from http://dev.w3.org/html5/webvtt/#webvtt-data-state
+ * Unlike the other states, it is given the terminating NUL in 'end', so that
+ * it can copy text in runs.
  */
 WEBVTT_INTERN webvtt_status
-webvtt_data_state( const char **position, webvtt_token_state *token_state,
-                   webvtt_string *result );
+webvtt_data_state( const char **position, const char *end,
+                   webvtt_token_state *token_state, webvtt_string *result );
 
 /**
  * Referenced from http://dev.w3.org/html5/webvtt/#webvtt-escape-state
@@ -217,4 +234,12 @@ WEBVTT_INTERN webvtt_status
 webvtt_parse_cuetext( webvtt_parser self, webvtt_cue *cue,
                       webvtt_string *payload, int finished );
 
+/**
+ * Parse 'payload' into a webvtt_node_tree, stored in cue->node_tree, moving
+ * timestamp tags by 'time_offset' milliseconds
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_parse_cuetext_flat( webvtt_cue *cue, webvtt_string *payload,
+                           webvtt_int64 time_offset );
+
 #endif
@@ -57,6 +57,7 @@ static const char *errstr[] = {
   /* WEBVTT_ALIGN_BAD_VALUE */ "'align' cue-setting must have a value of either 'start', 'middle', or 'end'",
   /* WEBVTT_CUE_CONTAINS_SEPARATOR */ "cue-text line contains unescaped timestamp separator '-->'",
   /* WEBVTT_CUE_INCOMPLETE */ "cue contains cue-id, but is missing cuetimes or cue text",
+  /* WEBVTT_MALFORMED_TIMESTAMP_MAP */ "malformed X-TIMESTAMP-MAP header",
 };
 
 /**
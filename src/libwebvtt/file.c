@@ -0,0 +1,165 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "parser_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(HAVE_MMAP)
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+/**
+ * Parse a file read into memory with stdio, where it can't be mapped
+ */
+static void WEBVTT_CALLBACK
+free_file_data( void *userdata, char *data, webvtt_uint length )
+{
+  (void)userdata;
+  (void)length;
+  free( data );
+}
+
+static webvtt_status
+parse_read_file( webvtt_parser self, const char *path )
+{
+  webvtt_status status;
+  webvtt_buffer *buffer;
+  FILE *fh;
+  char *data = 0;
+  webvtt_uint length = 0, alloc = 0;
+
+  if( !( fh = fopen( path, "rb" ) ) ) {
+    return WEBVTT_UNSUCCESSFUL;
+  }
+
+  do {
+    size_t n;
+    if( length == alloc ) {
+      char *grown;
+      alloc = alloc ? alloc * 2 : 0x10000;
+      if( alloc <= length || !( grown = (char *)realloc( data, alloc ) ) ) {
+        free( data );
+        fclose( fh );
+        return WEBVTT_OUT_OF_MEMORY;
+      }
+      data = grown;
+    }
+    n = fread( data + length, 1, alloc - length, fh );
+    length += (webvtt_uint)n;
+  } while( !feof( fh ) && !ferror( fh ) );
+
+  if( ferror( fh ) ) {
+    free( data );
+    fclose( fh );
+    return WEBVTT_UNSUCCESSFUL;
+  }
+  fclose( fh );
+
+  if( WEBVTT_FAILED( status = webvtt_create_buffer( data, length,
+                                                    &free_file_data, 0,
+                                                    &buffer ) ) ) {
+    free( data );
+    return status;
+  }
+  status = webvtt_parse_complete( self, buffer, data, length );
+  webvtt_release_buffer( &buffer );
+  return status;
+}
+
+#if defined(HAVE_MMAP)
+static void WEBVTT_CALLBACK
+unmap_file( void *userdata, char *data, webvtt_uint length )
+{
+  (void)userdata;
+  munmap( data, length );
+}
+
+/**
+ * Map the file into memory, and parse it as a single buffer. String views
+ * never write to the buffer, so the mapping is read-only.
+ */
+static webvtt_status
+parse_mapped_file( webvtt_parser self, const char *path )
+{
+  webvtt_status status;
+  webvtt_buffer *buffer;
+  struct stat st;
+  void *data;
+  int fd;
+
+  if( ( fd = open( path, O_RDONLY ) ) < 0 ) {
+    return WEBVTT_UNSUCCESSFUL;
+  }
+  if( fstat( fd, &st ) < 0 ) {
+    close( fd );
+    return WEBVTT_UNSUCCESSFUL;
+  }
+  if( !S_ISREG( st.st_mode ) || st.st_size == 0 ||
+      (off_t)(webvtt_uint)st.st_size != st.st_size ) {
+    /* Pipes and the like can't be mapped, and empty files needn't be */
+    close( fd );
+    return parse_read_file( self, path );
+  }
+
+  data = mmap( 0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if( data == MAP_FAILED ) {
+    return parse_read_file( self, path );
+  }
+# if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+  madvise( data, (size_t)st.st_size, MADV_SEQUENTIAL );
+# endif
+
+  if( WEBVTT_FAILED( status = webvtt_create_buffer( (char *)data,
+                                                    (webvtt_uint)st.st_size,
+                                                    &unmap_file, 0,
+                                                    &buffer ) ) ) {
+    munmap( data, (size_t)st.st_size );
+    return status;
+  }
+  status = webvtt_parse_complete( self, buffer, (const char *)data,
+                                  (webvtt_uint)st.st_size );
+  webvtt_release_buffer( &buffer );
+  return status;
+}
+#endif
+
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_file( webvtt_parser self, const char *path )
+{
+  if( !self || !path ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+#if defined(HAVE_MMAP)
+  return parse_mapped_file( self, path );
+#else
+  return parse_read_file( self, path );
+#endif
+}
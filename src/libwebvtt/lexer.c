@@ -26,137 +26,109 @@
  */
 
 #include "parser_internal.h"
+#include <string.h>
 
 /**
- * There are probably enough jumps and stack pops here to fill up quite a few
- * caches but it may still
- * be much smaller than a gigantic table-based solution.
- *
- * TODO: Replace all char literals with hex values, just in case compiling on a
- * machine which uses an
- * incompatible character set
+ * The lexer is a DFA over byte classes, following the token states listed at
+ * the end of this file. Every byte is mapped to its class by lexer_class, and
+ * lexer_next gives, for each state and class, either the next state or (for
+ * values of LX_ACTION and above) the action which completes the token.
  */
-
-#define U_DIGIT case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: \
-                case 0x35: case 0x36: case 0x37: case 0x38: case 0x39:
-#define U_WHITESPACE case 0x0D: case 0x0A: case 0x20: case 0x09:
-#define U_SPACE case 0x20:
-#define U_TAB case 0x09:
-#define U_CR case 0x0D:
-#define U_LF case 0x0A:
-
-#define U_DASH case 0x2D:
-#define U_PERIOD case 0x2E:
-#define U_GT case 0x3E:
-#define U_COLON case 0x3A:
-#define U_PERCENT case 0x25:
-
-#define U_0 case 0x30:
-#define U_1 case 0x31:
-#define U_2 case 0x32:
-#define U_3 case 0x33:
-#define U_4 case 0x34:
-#define U_5 case 0x35:
-#define U_6 case 0x36:
-#define U_7 case 0x37:
-#define U_8 case 0x38:
-#define U_9 case 0x39:
-
-#define U_a case 0x61:
-#define U_b case 0x62:
-#define U_c case 0x63:
-#define U_d case 0x64:
-#define U_e case 0x65:
-#define U_f case 0x66:
-#define U_g case 0x67:
-#define U_h case 0x68:
-#define U_i case 0x69:
-#define U_j case 0x6A:
-#define U_k case 0x6B:
-#define U_l case 0x6C:
-#define U_m case 0x6D:
-#define U_n case 0x6E:
-#define U_o case 0x6F:
-#define U_p case 0x70:
-#define U_q case 0x71:
-#define U_r case 0x72:
-#define U_s case 0x73:
-#define U_t case 0x74:
-#define U_u case 0x75:
-#define U_v case 0x76:
-#define U_w case 0x77:
-#define U_x case 0x78:
-#define U_y case 0x79:
-#define U_z case 0x7A:
-
-#define U_A case 0x41:
-#define U_B case 0x42:
-#define U_C case 0x43:
-#define U_D case 0x44:
-#define U_E case 0x45:
-#define U_F case 0x46:
-#define U_G case 0x47:
-#define U_H case 0x48:
-#define U_I case 0x49:
-#define U_J case 0x4A:
-#define U_K case 0x4B:
-#define U_L case 0x4C:
-#define U_M case 0x4D:
-#define U_N case 0x4E:
-#define U_O case 0x4F:
-#define U_P case 0x50:
-#define U_Q case 0x51:
-#define U_R case 0x52:
-#define U_S case 0x53:
-#define U_T case 0x54:
-#define U_U case 0x55:
-#define U_V case 0x56:
-#define U_W case 0x57:
-#define U_X case 0x58:
-#define U_Y case 0x59:
-#define U_Z case 0x5A:
-
-#define U_BOM0 case 0xEF:
-#define U_BOM1 case 0xBB:
-#define U_BOM2 case 0xBF:
-
-#define DEFAULT default:
+enum
+webvtt_lexer_class_t {
+  C_OTHER = 0, C_W, C_E, C_B, C_V, C_T, C_LF, C_CR, C_BLANK, C_BOM0, C_BOM1,
+  C_BOM2,
+  C_CLASS_COUNT
+};
+
+enum
+webvtt_lexer_action_t {
+  LX_ACTION = 0x10,
+  LX_BADTOKEN = LX_ACTION, /* back up and return BADTOKEN */
+  LX_NEWLINE,              /* return NEWLINE */
+  LX_BACKUP_NEWLINE,       /* back up and return NEWLINE (lone CR) */
+  LX_BACKUP_WHITESPACE,    /* back up and return WHITESPACE */
+  LX_WEBVTT,               /* return WEBVTT */
+  LX_BOM                   /* skip a leading BOM, otherwise return BOM */
+};
 
 /**
- * Just for semantic clarity
+ * Bytes in each row which aren't named are C_OTHER
  */
-#define OR
-#define AND
-
-#define IF_OVERFLOW(X) \
-  if( self->token_pos >= (sizeof(self->token) - 1 ) ) \
-  { \
-    RETURN(X) \
-  }
-
-#define BEGIN_STATE(state) case state: { switch(c) {
-#define END_STATE DEFAULT BACKUP return BADTOKEN; } } break;
-#define END_STATE_EX } } break;
-#define SET_STATE(X) self->tstate = X; break;
-#define RETURN(X) self->tstate = L_START; return X;
-#define SET_NEWLINE self->line++; self->column = 1; RETURN(NEWLINE)
-#define CONTINUE continue;
-#define BREAK break;
-
-#define BACKUP (*pos)--; \
-               --self->column; \
-               self->token[--self->token_pos] = 0; \
-               self->tstate = L_START;
-#define RESET self->column = 1; \
-              self->bytes = self->token_pos = 0; \
-              self->tstate = L_START;
+#define O C_OTHER
+#define ROW_OTHER O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O
+static const unsigned char lexer_class[ 256 ] = {
+  /* 0x00 */ O, O, O, O, O, O, O, O, O, C_BLANK, C_LF, O, O, C_CR, O, O,
+  /* 0x10 */ ROW_OTHER,
+  /* 0x20 */ C_BLANK, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+  /* 0x30 */ ROW_OTHER,
+  /* 0x40 */ O, O, C_B, O, O, C_E, O, O, O, O, O, O, O, O, O, O,
+  /* 0x50 */ O, O, O, O, C_T, O, C_V, C_W, O, O, O, O, O, O, O, O,
+  /* 0x60 */ ROW_OTHER,
+  /* 0x70 */ ROW_OTHER,
+  /* 0x80 */ ROW_OTHER,
+  /* 0x90 */ ROW_OTHER,
+  /* 0xA0 */ ROW_OTHER,
+  /* 0xB0 */ O, O, O, O, O, O, O, O, O, O, O, C_BOM1, O, O, O, C_BOM2,
+  /* 0xC0 */ ROW_OTHER,
+  /* 0xD0 */ ROW_OTHER,
+  /* 0xE0 */ O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, C_BOM0,
+  /* 0xF0 */ ROW_OTHER
+};
+#undef ROW_OTHER
+#undef O
 
-#define CHECK_BROKEN_TIMESTAMP \
-if(self->token_pos == sizeof(self->token) - 1 ) \
-{ \
-  ERROR(WEBVTT_MALFORMED_TIMESTAMP); \
-  return BADTOKEN; \
-}
+/**
+ * The columns of lexer_next are in the order of webvtt_lexer_class_t, which
+ * this fails to compile without
+ */
+typedef char lexer_class_order[ C_OTHER == 0 && C_W == 1 && C_E == 2 &&
+                                C_B == 3 && C_V == 4 && C_T == 5 &&
+                                C_LF == 6 && C_CR == 7 && C_BLANK == 8 &&
+                                C_BOM0 == 9 && C_BOM1 == 10 && C_BOM2 == 11 &&
+                                C_CLASS_COUNT == 12 ? 1 : -1 ];
+
+#define BAD LX_BADTOKEN
+static const unsigned char lexer_next[ L_STATE_COUNT ][ C_CLASS_COUNT ] = {
+  /*               OTHER W          E          B          V          T
+                   LF          CR          BLANK         BOM0     BOM1
+                   BOM2 */
+  /* L_START */    { BAD, L_WEBVTT0, BAD,       BAD,       BAD,       BAD,
+                     LX_NEWLINE, L_NEWLINE0, L_WHITESPACE, L_BOM0,  BAD,
+                     BAD },
+  /* L_BOM0 */     { BAD, BAD,       BAD,       BAD,       BAD,       BAD,
+                     BAD,        BAD,        BAD,          BAD,     L_BOM1,
+                     BAD },
+  /* L_BOM1 */     { BAD, BAD,       BAD,       BAD,       BAD,       BAD,
+                     BAD,        BAD,        BAD,          BAD,     BAD,
+                     LX_BOM },
+  /* L_WEBVTT0 */  { BAD, BAD,       L_WEBVTT1, BAD,       BAD,       BAD,
+                     BAD,        BAD,        BAD,          BAD,     BAD,
+                     BAD },
+  /* L_WEBVTT1 */  { BAD, BAD,       BAD,       L_WEBVTT2, BAD,       BAD,
+                     BAD,        BAD,        BAD,          BAD,     BAD,
+                     BAD },
+  /* L_WEBVTT2 */  { BAD, BAD,       BAD,       BAD,       L_WEBVTT3, BAD,
+                     BAD,        BAD,        BAD,          BAD,     BAD,
+                     BAD },
+  /* L_WEBVTT3 */  { BAD, BAD,       BAD,       BAD,       BAD,       L_WEBVTT4,
+                     BAD,        BAD,        BAD,          BAD,     BAD,
+                     BAD },
+  /* L_WEBVTT4 */  { BAD, BAD,       BAD,       BAD,       BAD,       LX_WEBVTT,
+                     BAD,        BAD,        BAD,          BAD,     BAD,
+                     BAD },
+  /* L_NEWLINE0 */ { LX_BACKUP_NEWLINE, LX_BACKUP_NEWLINE, LX_BACKUP_NEWLINE,
+                     LX_BACKUP_NEWLINE, LX_BACKUP_NEWLINE, LX_BACKUP_NEWLINE,
+                     LX_NEWLINE, LX_BACKUP_NEWLINE, LX_BACKUP_NEWLINE,
+                     LX_BACKUP_NEWLINE, LX_BACKUP_NEWLINE, LX_BACKUP_NEWLINE },
+  /* L_WHITESPACE */ { LX_BACKUP_WHITESPACE, LX_BACKUP_WHITESPACE,
+                     LX_BACKUP_WHITESPACE, LX_BACKUP_WHITESPACE,
+                     LX_BACKUP_WHITESPACE, LX_BACKUP_WHITESPACE,
+                     LX_BACKUP_WHITESPACE, LX_BACKUP_WHITESPACE, L_WHITESPACE,
+                     LX_BACKUP_WHITESPACE, LX_BACKUP_WHITESPACE,
+                     LX_BACKUP_WHITESPACE }
+};
+#undef BAD
 
 WEBVTT_INTERN webvtt_status
 webvtt_lex_word( webvtt_parser self, webvtt_string *str, const char *buffer,
@@ -218,8 +190,7 @@ webvtt_lex_newline( webvtt_parser self, const
 
   while( p < length ) {
     unsigned char c = (unsigned char)buffer[ p++ ];
-    self->token[ self->token_pos++ ] = c;
-    self->token[ self->token_pos ] = 0;
+    self->token_pos++;
     self->bytes++;
 
     switch( self->tstate ) {
@@ -267,7 +238,7 @@ webvtt_lex_newline( webvtt_parser self, const
     return BADTOKEN;
   }
 backup:
-  self->token[ --self->token_pos ] = 0;
+  --self->token_pos;
   --self->bytes;
   *pos = --p;
   if( self->tstate == L_NEWLINE0 ) {
@@ -281,67 +252,93 @@ WEBVTT_INTERN webvtt_token
 webvtt_lex( webvtt_parser self, const char *buffer, webvtt_uint *pos,
             webvtt_uint length, webvtt_bool finish )
 {
-  while( *pos < length ) {
-    unsigned char c = (unsigned char)buffer[(*pos)++];
-    self->token[ self->token_pos++ ] = c;
-    self->token[ self->token_pos ] = 0;
-    self->column++;
-    self->bytes++;
-    switch( self->tstate ) {
-        BEGIN_STATE(L_START)
-          U_W  { SET_STATE(L_WEBVTT0) }
-          U_BOM0 { SET_STATE(L_BOM0) }
-          U_LF { SET_NEWLINE }
-          U_CR { SET_STATE(L_NEWLINE0) }
-          U_SPACE OR U_TAB { SET_STATE(L_WHITESPACE) }
-        END_STATE
-
-        BEGIN_STATE(L_BOM0)
-          U_BOM1 { SET_STATE(L_BOM1) }
-        END_STATE
-
-        BEGIN_STATE(L_BOM1)
-          U_BOM2 {
-          if( self->bytes == 3 ) {
-            RESET
-            BREAK
-          }
-          RETURN(BOM)
-        }
-        END_STATE
-
-        BEGIN_STATE(L_WEBVTT0)
-          U_E { SET_STATE(L_WEBVTT1) }
-        END_STATE
-
-        BEGIN_STATE(L_WEBVTT1)
-          U_B { SET_STATE(L_WEBVTT2) }
-        END_STATE
-
-        BEGIN_STATE(L_WEBVTT2)
-          U_V { SET_STATE(L_WEBVTT3) }
-        END_STATE
+  webvtt_uint p = *pos;
+  webvtt_uint state = self->tstate;
+  webvtt_uint begin;
 
-        BEGIN_STATE(L_WEBVTT3)
-          U_T { SET_STATE(L_WEBVTT4) }
-        END_STATE
+  if( state == L_START ) {
+    self->token_pos = self->token_saved = 0;
+  }
+  begin = p;
 
-        BEGIN_STATE(L_WEBVTT4)
-          U_T { RETURN(WEBVTT) }
-        END_STATE
+  while( p < length ) {
+    unsigned char c = (unsigned char)buffer[ p++ ];
+    state = lexer_next[ state ][ lexer_class[ c ] ];
+    if( state < LX_ACTION ) {
+      /* Only whitespace tokens can grow this long */
+      if( p - begin + self->token_saved >= sizeof( self->token ) - 1 ) {
+        self->column += p - begin;
+        self->bytes += p - begin;
+        self->token_pos = self->token_saved + p - begin;
+        self->tstate = L_START;
+        *pos = p;
+        return WHITESPACE;
+      }
+      continue;
+    }
 
-        BEGIN_STATE(L_NEWLINE0)
-          U_LF { SET_NEWLINE }
-        DEFAULT { BACKUP AND SET_NEWLINE }
-        END_STATE_EX
+    switch( state ) {
+      case LX_NEWLINE:
+        self->column += p - begin;
+        self->bytes += p - begin;
+        self->token_pos = self->token_saved + p - begin;
+        self->line++;
+        self->column = 1;
+        self->tstate = L_START;
+        *pos = p;
+        return NEWLINE;
+
+      case LX_WEBVTT:
+        self->column += p - begin;
+        self->bytes += p - begin;
+        self->token_pos = self->token_saved + p - begin;
+        self->tstate = L_START;
+        *pos = p;
+        return WEBVTT;
+
+      case LX_BOM:
+        self->column += p - begin;
+        self->bytes += p - begin;
+        self->tstate = L_START;
+        if( self->bytes == 3 ) {
+          /* Skip the byte order mark at the start of the file */
+          self->column = 1;
+          self->bytes = self->token_pos = self->token_saved = 0;
+          state = L_START;
+          begin = p;
+          continue;
+        }
+        self->token_pos = self->token_saved + p - begin;
+        *pos = p;
+        return BOM;
 
-        BEGIN_STATE(L_WHITESPACE)
-          U_SPACE OR U_TAB { IF_OVERFLOW(WHITESPACE) SET_STATE(L_WHITESPACE) }
-        DEFAULT { BACKUP RETURN(WHITESPACE) }
-        END_STATE_EX
+      default:
+        /**
+         * Back up over the byte which didn't fit. It still counts towards
+         * 'bytes', as it always has.
+         */
+        self->column += p - begin - 1;
+        self->bytes += p - begin;
+        self->token_pos = self->token_saved + p - begin - 1;
+        self->tstate = L_START;
+        *pos = p - 1;
+        if( state == LX_BACKUP_NEWLINE ) {
+          self->line++;
+          self->column = 1;
+          return NEWLINE;
+        } else if( state == LX_BACKUP_WHITESPACE ) {
+          return WHITESPACE;
+        }
+        return BADTOKEN;
     }
   }
 
+  self->column += p - begin;
+  self->bytes += p - begin;
+  self->token_pos = self->token_saved + p - begin;
+  self->tstate = (webvtt_lexer_state)state;
+  *pos = p;
+
   /**
    * If we got here, we've reached the end of the buffer.
    * We therefore can attempt to finish up
@@ -349,14 +346,39 @@ webvtt_lex( webvtt_parser self, const char *buffer, webvtt_uint *pos,
   if( finish && self->token_pos ) {
     switch( self->tstate ) {
       case L_WHITESPACE:
-        RETURN(WHITESPACE)
+        self->tstate = L_START;
+        return WHITESPACE;
       default:
-        RESET
+        self->column = 1;
+        self->bytes = self->token_pos = self->token_saved = 0;
+        self->tstate = L_START;
         return BADTOKEN;
     }
   }
+
+  /**
+   * The token continues in the next chunk, so hold on to the part of it
+   * that is in this one.
+   */
+  memcpy( self->token + self->token_saved, buffer + begin, p - begin );
+  self->token_saved = self->token_pos;
+  self->token[ self->token_pos ] = 0;
   return *pos == length || self->token_pos ? UNFINISHED : BADTOKEN;
 }
+
+WEBVTT_INTERN const char *
+webvtt_lex_token_text( webvtt_parser self, const char *buffer,
+                       webvtt_uint pos )
+{
+  webvtt_uint rest = self->token_pos - self->token_saved;
+  if( !self->token_saved ) {
+    return buffer + pos - rest;
+  }
+  memcpy( self->token + self->token_saved, buffer + pos - rest, rest );
+  self->token[ self->token_pos ] = 0;
+  return self->token;
+}
+
 /**
  * token states
 L_START    + 'W' = L_WEBVTT0
@@ -28,6 +28,7 @@
  #include <string.h>
  #include <stdlib.h>
  #include "node_internal.h"
+ #include "alloc_internal.h"
 
  static webvtt_node empty_node = {
   { 1 }, /* init ref count */
@@ -66,7 +67,9 @@ webvtt_create_node( webvtt_node **node, webvtt_node_kind kind,
     return WEBVTT_INVALID_PARAM;
   }
 
-  if( !( temp_node = (webvtt_node *)webvtt_alloc0(sizeof(*temp_node)) ) )
+  if( !( temp_node =
+         (webvtt_node *)webvtt_alloc_object0( sizeof(*temp_node),
+                                              WEBVTT_MEM_NODE ) ) )
   {
     return WEBVTT_OUT_OF_MEMORY;
   }
@@ -92,8 +95,8 @@ webvtt_create_internal_node( webvtt_node **node, webvtt_node *parent,
     return status;
   }
 
-  if ( !( node_data =
-         (webvtt_internal_node_data *)webvtt_alloc0( sizeof(*node_data) ) ) )
+  if ( !( node_data = (webvtt_internal_node_data *)
+           webvtt_alloc_object0( sizeof(*node_data), WEBVTT_MEM_NODE ) ) )
   {
     return WEBVTT_OUT_OF_MEMORY;
   }
@@ -192,6 +195,12 @@ webvtt_release_node( webvtt_node **node )
   }
   n = *node;
 
+  if( n != &empty_node && webvtt_is_arena_owned( n ) ) {
+    /* Released along with the arena */
+    *node = 0;
+    return;
+  }
+
   if( webvtt_deref( &n->refs )  == 0 ) {
     if( n->kind == WEBVTT_TEXT ) {
         webvtt_release_string( &n->data.text );
@@ -223,7 +232,8 @@ webvtt_attach_node( webvtt_node *parent, webvtt_node *to_attach )
   nd = parent->data.internal_data;
 
   if( nd->alloc == 0 ) {
-    next = (webvtt_node **)webvtt_alloc0( sizeof( webvtt_node * ) * 8 );
+    next = (webvtt_node **)webvtt_alloc0_as( sizeof( webvtt_node * ) * 8,
+                                             WEBVTT_MEM_CHILDREN );
 
     if( !next ) {
       return WEBVTT_OUT_OF_MEMORY;
@@ -235,7 +245,8 @@ webvtt_attach_node( webvtt_node *parent, webvtt_node *to_attach )
 
   if( nd->length + 1 >= ( nd->alloc / 3 ) * 2 ) {
 
-    next = (webvtt_node **)webvtt_alloc0( sizeof( *next ) * nd->alloc * 2 );
+    next = (webvtt_node **)webvtt_alloc0_as( sizeof( *next ) * nd->alloc * 2,
+                                             WEBVTT_MEM_CHILDREN );
 
     if( !next ) {
       return WEBVTT_OUT_OF_MEMORY;
@@ -252,3 +263,477 @@ webvtt_attach_node( webvtt_node *parent, webvtt_node *to_attach )
 
   return WEBVTT_SUCCESS;
 }
+
+/**
+ * Flattened node trees
+ */
+static webvtt_status
+grow_builder_array( void **items, const void *store, webvtt_uint length,
+                    webvtt_uint new_alloc, webvtt_uint size )
+{
+  /**
+   * The builder's scratch space is always taken from the heap, so that it
+   * can be given back once the tree is built, even when the parser is
+   * allocating from an arena.
+   */
+  webvtt_alloc_context heap = { 0, 0 };
+  void *next;
+
+  webvtt_swap_alloc_context( &heap );
+  next = webvtt_alloc_as( new_alloc * size, WEBVTT_MEM_NODE );
+  webvtt_swap_alloc_context( &heap );
+  if( !next ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+
+  memcpy( next, *items, length * size );
+  if( *items != store ) {
+    webvtt_free( *items );
+  }
+  *items = next;
+  return WEBVTT_SUCCESS;
+}
+
+static webvtt_uint
+next_alloc( webvtt_uint alloc, webvtt_uint needed )
+{
+  while( alloc < needed ) {
+    alloc *= 2;
+  }
+  return alloc;
+}
+
+static webvtt_status
+append_tree_text( webvtt_node_tree_builder *builder, const char *text,
+                  webvtt_uint length, webvtt_text_ref *ref )
+{
+  webvtt_status status;
+  webvtt_uint alloc;
+
+  if( !length ) {
+    /* Share the empty string at the start of the blob */
+    ref->offset = ref->length = 0;
+    return WEBVTT_SUCCESS;
+  }
+
+  if( builder->text_length + length + 1 > builder->text_alloc ) {
+    alloc = next_alloc( builder->text_alloc,
+                        builder->text_length + length + 1 );
+    if( WEBVTT_FAILED( status =
+          grow_builder_array( (void **)&builder->text, builder->atext,
+                              builder->text_length, alloc, 1 ) ) ) {
+      return status;
+    }
+    builder->text_alloc = alloc;
+  }
+
+  ref->offset = builder->text_length;
+  ref->length = length;
+  memcpy( builder->text + builder->text_length, text, length );
+  builder->text[ builder->text_length + length ] = '\0';
+  builder->text_length += length + 1;
+  return WEBVTT_SUCCESS;
+}
+
+/**
+ * Append a node of 'kind' as the last child of the current node
+ */
+static webvtt_status
+append_tree_node( webvtt_node_tree_builder *builder, webvtt_node_kind kind,
+                  webvtt_flat_node **pnode )
+{
+  webvtt_status status;
+  webvtt_uint alloc, index, parent;
+  webvtt_flat_node *node;
+
+  if( builder->length + 1 > builder->alloc ) {
+    alloc = next_alloc( builder->alloc, builder->length + 1 );
+    if( WEBVTT_FAILED( status =
+          grow_builder_array( (void **)&builder->nodes, builder->anodes,
+                              builder->length, alloc,
+                              sizeof( *builder->nodes ) ) ) ||
+        WEBVTT_FAILED( status =
+          grow_builder_array( (void **)&builder->last_child,
+                              builder->alast_child, builder->length, alloc,
+                              sizeof( *builder->last_child ) ) ) ) {
+      return status;
+    }
+    builder->alloc = alloc;
+  }
+
+  index = builder->length++;
+  parent = builder->current;
+  node = builder->nodes + index;
+  memset( node, 0, sizeof( *node ) );
+  node->kind = kind;
+  node->parent = parent;
+  node->next_sibling = WEBVTT_NO_NODE;
+  builder->last_child[ index ] = WEBVTT_NO_NODE;
+
+  if( builder->last_child[ parent ] != WEBVTT_NO_NODE ) {
+    builder->nodes[ builder->last_child[ parent ] ].next_sibling = index;
+  }
+  builder->last_child[ parent ] = index;
+  builder->nodes[ parent ].child_count++;
+
+  *pnode = node;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_INTERN void
+webvtt_init_node_tree_builder( webvtt_node_tree_builder *builder )
+{
+  webvtt_flat_node *head = builder->anodes;
+
+  builder->nodes = builder->anodes;
+  builder->last_child = builder->alast_child;
+  builder->alloc = WEBVTT_TREE_BUILDER_NODES;
+  builder->classes = builder->aclasses;
+  builder->class_count = 0;
+  builder->class_alloc = WEBVTT_TREE_BUILDER_CLASSES;
+  builder->text = builder->atext;
+  builder->text[ 0 ] = '\0';
+  builder->text_length = 1;
+  builder->text_alloc = WEBVTT_TREE_BUILDER_TEXT;
+
+  memset( head, 0, sizeof( *head ) );
+  head->kind = WEBVTT_HEAD_NODE;
+  head->parent = WEBVTT_NO_NODE;
+  head->next_sibling = WEBVTT_NO_NODE;
+  builder->last_child[ 0 ] = WEBVTT_NO_NODE;
+  builder->length = 1;
+  builder->current = 0;
+}
+
+WEBVTT_INTERN void
+webvtt_discard_node_tree_builder( webvtt_node_tree_builder *builder )
+{
+  if( builder->nodes != builder->anodes ) {
+    webvtt_free( builder->nodes );
+  }
+  if( builder->last_child != builder->alast_child ) {
+    webvtt_free( builder->last_child );
+  }
+  if( builder->classes != builder->aclasses ) {
+    webvtt_free( builder->classes );
+  }
+  if( builder->text != builder->atext ) {
+    webvtt_free( builder->text );
+  }
+  builder->nodes = builder->anodes;
+  builder->last_child = builder->alast_child;
+  builder->classes = builder->aclasses;
+  builder->text = builder->atext;
+  builder->length = builder->class_count = builder->text_length = 0;
+}
+
+WEBVTT_INTERN webvtt_status
+webvtt_node_tree_builder_open( webvtt_node_tree_builder *builder,
+                               webvtt_node_kind kind,
+                               webvtt_stringlist *css_classes,
+                               webvtt_string *annotation )
+{
+  webvtt_status status;
+  webvtt_flat_node *node;
+  webvtt_text_ref ref, lang;
+  webvtt_uint i, n, alloc, first_class, text_length;
+
+  if( !builder || !WEBVTT_IS_VALID_INTERNAL_NODE( kind ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  /* Language is inherited unless this node sets it */
+  lang = builder->nodes[ builder->current ].data.internal.lang;
+
+  n = css_classes ? css_classes->length : 0;
+  if( builder->class_count + n > builder->class_alloc ) {
+    alloc = next_alloc( builder->class_alloc, builder->class_count + n );
+    if( WEBVTT_FAILED( status =
+          grow_builder_array( (void **)&builder->classes, builder->aclasses,
+                              builder->class_count, alloc, sizeof( *builder->classes ) ) ) ) {
+      return status;
+    }
+    builder->class_alloc = alloc;
+  }
+  first_class = builder->class_count;
+  text_length = builder->text_length;
+  for( i = 0; i < n; i++ ) {
+    if( WEBVTT_FAILED( status =
+          append_tree_text( builder,
+                            webvtt_string_text( css_classes->items + i ),
+                            webvtt_string_length( css_classes->items + i ),
+                            &ref ) ) ) {
+      goto error;
+    }
+    builder->classes[ builder->class_count++ ] = ref;
+  }
+
+  if( WEBVTT_FAILED( status =
+        append_tree_text( builder, webvtt_string_text( annotation ),
+                          webvtt_string_length( annotation ), &ref ) ) ) {
+    goto error;
+  }
+  if( kind == WEBVTT_LANG ) {
+    lang = ref;
+    ref.offset = ref.length = 0;
+  }
+
+  if( WEBVTT_FAILED( status = append_tree_node( builder, kind, &node ) ) ) {
+    goto error;
+  }
+  node->data.internal.annotation = ref;
+  node->data.internal.lang = lang;
+  node->data.internal.first_class = first_class;
+  node->data.internal.class_count = n;
+  builder->current = builder->length - 1;
+  return WEBVTT_SUCCESS;
+
+error:
+  /* Leave the builder as it was, without the node's classes and text */
+  builder->class_count = first_class;
+  builder->text_length = text_length;
+  return status;
+}
+
+WEBVTT_INTERN void
+webvtt_node_tree_builder_close( webvtt_node_tree_builder *builder )
+{
+  if( builder && builder->current != 0 ) {
+    builder->current = builder->nodes[ builder->current ].parent;
+  }
+}
+
+WEBVTT_INTERN webvtt_status
+webvtt_node_tree_builder_add_text( webvtt_node_tree_builder *builder,
+                                   const char *text, webvtt_uint length )
+{
+  webvtt_status status;
+  webvtt_flat_node *node;
+  webvtt_text_ref ref;
+  webvtt_uint text_length;
+
+  if( !builder || ( length && !text ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  text_length = builder->text_length;
+  if( WEBVTT_FAILED( status = append_tree_text( builder, text, length,
+                                                &ref ) ) ) {
+    return status;
+  }
+  if( WEBVTT_FAILED( status = append_tree_node( builder, WEBVTT_TEXT,
+                                                &node ) ) ) {
+    builder->text_length = text_length;
+    return status;
+  }
+  node->data.text = ref;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_INTERN webvtt_status
+webvtt_node_tree_builder_add_timestamp( webvtt_node_tree_builder *builder,
+                                        webvtt_timestamp time_stamp )
+{
+  webvtt_status status;
+  webvtt_flat_node *node;
+
+  if( !builder ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  if( WEBVTT_FAILED( status = append_tree_node( builder, WEBVTT_TIME_STAMP,
+                                                &node ) ) ) {
+    return status;
+  }
+  node->data.timestamp = time_stamp;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_INTERN webvtt_status
+webvtt_finish_node_tree_builder( webvtt_node_tree_builder *builder,
+                                 webvtt_node_tree **ptree )
+{
+  webvtt_node_tree *tree;
+  webvtt_uint header, nodes, classes;
+
+  if( !builder || !ptree ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  /* Keep the nodes (and their timestamps) 8 byte aligned */
+  header = ( sizeof( *tree ) + 7 ) & ~7;
+  nodes = builder->length * sizeof( *builder->nodes );
+  classes = builder->class_count * sizeof( *builder->classes );
+
+  if( !( tree = (webvtt_node_tree *)
+           webvtt_alloc_as( header + nodes + classes + builder->text_length,
+                            WEBVTT_MEM_NODE ) ) ) {
+    webvtt_discard_node_tree_builder( builder );
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+
+  tree->refs.value = 0;
+  webvtt_ref( &tree->refs );
+  tree->length = builder->length;
+  tree->class_count = builder->class_count;
+  tree->text_length = builder->text_length;
+  tree->nodes = (webvtt_flat_node *)( (char *)tree + header );
+  tree->classes = (webvtt_text_ref *)( (char *)tree->nodes + nodes );
+  tree->text = (char *)tree->classes + classes;
+  memcpy( tree->nodes, builder->nodes, nodes );
+  memcpy( tree->classes, builder->classes, classes );
+  memcpy( tree->text, builder->text, builder->text_length );
+
+  webvtt_discard_node_tree_builder( builder );
+  *ptree = tree;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_EXPORT void
+webvtt_ref_node_tree( webvtt_node_tree *tree )
+{
+  if( tree ) {
+    webvtt_ref( &tree->refs );
+  }
+}
+
+WEBVTT_EXPORT void
+webvtt_release_node_tree( webvtt_node_tree **tree )
+{
+  webvtt_node_tree *t;
+
+  if( !tree || !*tree ) {
+    return;
+  }
+  t = *tree;
+  *tree = 0;
+
+  if( webvtt_is_arena_owned( t ) ) {
+    /* Released along with the arena */
+    return;
+  }
+
+  if( webvtt_deref( &t->refs ) == 0 ) {
+    webvtt_free( t );
+  }
+}
+
+static const webvtt_flat_node *
+tree_node( const webvtt_node_tree *tree, webvtt_uint index )
+{
+  if( !tree || index >= tree->length ) {
+    return 0;
+  }
+  return tree->nodes + index;
+}
+
+static const char *
+tree_text( const webvtt_node_tree *tree, const webvtt_text_ref *ref,
+           webvtt_uint *len )
+{
+  if( len ) {
+    *len = ref ? ref->length : 0;
+  }
+  return ref ? tree->text + ref->offset : "";
+}
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_size( const webvtt_node_tree *tree )
+{
+  return tree ? tree->length : 0;
+}
+
+WEBVTT_EXPORT webvtt_node_kind
+webvtt_node_tree_kind( const webvtt_node_tree *tree, webvtt_uint index )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return node ? node->kind : WEBVTT_EMPTY_NODE;
+}
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_parent( const webvtt_node_tree *tree, webvtt_uint index )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return node ? node->parent : WEBVTT_NO_NODE;
+}
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_child_count( const webvtt_node_tree *tree,
+                              webvtt_uint index )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return node ? node->child_count : 0;
+}
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_first_child( const webvtt_node_tree *tree,
+                              webvtt_uint index )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  /* In preorder, a node's first child comes straight after it */
+  return node && node->child_count ? index + 1 : WEBVTT_NO_NODE;
+}
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_next_sibling( const webvtt_node_tree *tree,
+                               webvtt_uint index )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return node ? node->next_sibling : WEBVTT_NO_NODE;
+}
+
+WEBVTT_EXPORT const char *
+webvtt_node_tree_text( const webvtt_node_tree *tree, webvtt_uint index,
+                       webvtt_uint *len )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return tree_text( tree, node && node->kind == WEBVTT_TEXT ?
+                          &node->data.text : 0, len );
+}
+
+WEBVTT_EXPORT webvtt_timestamp
+webvtt_node_tree_timestamp( const webvtt_node_tree *tree, webvtt_uint index )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return node && node->kind == WEBVTT_TIME_STAMP ? node->data.timestamp : 0;
+}
+
+WEBVTT_EXPORT const char *
+webvtt_node_tree_annotation( const webvtt_node_tree *tree, webvtt_uint index,
+                             webvtt_uint *len )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return tree_text( tree, node && WEBVTT_IS_VALID_INTERNAL_NODE( node->kind ) ?
+                          &node->data.internal.annotation : 0, len );
+}
+
+WEBVTT_EXPORT const char *
+webvtt_node_tree_lang( const webvtt_node_tree *tree, webvtt_uint index,
+                       webvtt_uint *len )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return tree_text( tree, node && WEBVTT_IS_VALID_INTERNAL_NODE( node->kind ) ?
+                          &node->data.internal.lang : 0, len );
+}
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_node_tree_class_count( const webvtt_node_tree *tree,
+                              webvtt_uint index )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  return node && WEBVTT_IS_VALID_INTERNAL_NODE( node->kind ) ?
+         node->data.internal.class_count : 0;
+}
+
+WEBVTT_EXPORT const char *
+webvtt_node_tree_class( const webvtt_node_tree *tree, webvtt_uint index,
+                        webvtt_uint n, webvtt_uint *len )
+{
+  const webvtt_flat_node *node = tree_node( tree, index );
+  if( !node || !WEBVTT_IS_VALID_INTERNAL_NODE( node->kind ) ||
+      n >= node->data.internal.class_count ) {
+    return tree_text( tree, 0, len );
+  }
+  return tree_text( tree, tree->classes + node->data.internal.first_class + n,
+                    len );
+}
@@ -68,4 +68,130 @@ webvtt_create_text_node( webvtt_node **node, webvtt_node *parent,
 WEBVTT_INTERN webvtt_status
 webvtt_attach_node( webvtt_node *parent, webvtt_node *to_attach );
 
+/**
+ * Text of a flattened node: a NUL terminated run of the tree's text blob.
+ * Offset 0 always holds an empty string.
+ */
+typedef struct
+webvtt_text_ref_t {
+  webvtt_uint offset;
+  webvtt_uint length;
+} webvtt_text_ref;
+
+typedef struct
+webvtt_flat_node_t {
+  webvtt_node_kind kind;
+  webvtt_uint parent;
+  webvtt_uint next_sibling;
+  webvtt_uint child_count;
+
+  union {
+    webvtt_text_ref text;
+    webvtt_timestamp timestamp;
+    struct {
+      webvtt_text_ref annotation;
+      webvtt_text_ref lang;
+      webvtt_uint first_class;
+      webvtt_uint class_count;
+    } internal;
+  } data;
+} webvtt_flat_node;
+
+/**
+ * A node tree and everything it refers to live in a single block: this
+ * header, followed by the nodes, the class references and the text blob.
+ */
+struct
+webvtt_node_tree_t {
+  struct webvtt_refcount_t refs;
+  webvtt_uint length;
+  webvtt_uint class_count;
+  webvtt_uint text_length;
+  webvtt_flat_node *nodes;
+  webvtt_text_ref *classes;
+  char *text;
+};
+
+#define WEBVTT_TREE_BUILDER_NODES 16
+#define WEBVTT_TREE_BUILDER_CLASSES 8
+#define WEBVTT_TREE_BUILDER_TEXT 256
+
+/**
+ * Builds a webvtt_node_tree in document order, one node at a time. The
+ * builder is meant to live on the stack; it only allocates once a cue
+ * outgrows its built in storage.
+ */
+typedef struct
+webvtt_node_tree_builder_t {
+  webvtt_flat_node *nodes;
+  webvtt_uint *last_child;
+  webvtt_uint length;
+  webvtt_uint alloc;
+
+  webvtt_text_ref *classes;
+  webvtt_uint class_count;
+  webvtt_uint class_alloc;
+
+  char *text;
+  webvtt_uint text_length;
+  webvtt_uint text_alloc;
+
+  /* The innermost node which hasn't been closed yet */
+  webvtt_uint current;
+
+  webvtt_flat_node anodes[ WEBVTT_TREE_BUILDER_NODES ];
+  webvtt_uint alast_child[ WEBVTT_TREE_BUILDER_NODES ];
+  webvtt_text_ref aclasses[ WEBVTT_TREE_BUILDER_CLASSES ];
+  char atext[ WEBVTT_TREE_BUILDER_TEXT ];
+} webvtt_node_tree_builder;
+
+/**
+ * Start a tree holding just a head node, which is the current node
+ */
+WEBVTT_INTERN void
+webvtt_init_node_tree_builder( webvtt_node_tree_builder *builder );
+
+/**
+ * Free anything the builder allocated, without producing a tree
+ */
+WEBVTT_INTERN void
+webvtt_discard_node_tree_builder( webvtt_node_tree_builder *builder );
+
+/**
+ * Append an internal node to the current node, and make it the current node.
+ * For WEBVTT_LANG nodes the annotation is the language; other nodes inherit
+ * the language of the node they're in. This and the functions adding nodes
+ * leave the builder as it was when they fail.
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_node_tree_builder_open( webvtt_node_tree_builder *builder,
+                               webvtt_node_kind kind,
+                               webvtt_stringlist *css_classes,
+                               webvtt_string *annotation );
+
+/**
+ * Make the parent of the current node the current node
+ */
+WEBVTT_INTERN void
+webvtt_node_tree_builder_close( webvtt_node_tree_builder *builder );
+
+WEBVTT_INTERN webvtt_status
+webvtt_node_tree_builder_add_text( webvtt_node_tree_builder *builder,
+                                   const char *text, webvtt_uint length );
+
+WEBVTT_INTERN webvtt_status
+webvtt_node_tree_builder_add_timestamp( webvtt_node_tree_builder *builder,
+                                        webvtt_timestamp time_stamp );
+
+#define WEBVTT_NODE_TREE_BUILDER_KIND( Builder ) \
+  ( ( Builder )->nodes[ ( Builder )->current ].kind )
+
+/**
+ * Pack the nodes built so far into a new tree. The builder is discarded
+ * either way.
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_finish_node_tree_builder( webvtt_node_tree_builder *builder,
+                                 webvtt_node_tree **ptree );
+
 #endif
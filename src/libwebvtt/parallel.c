@@ -0,0 +1,596 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "parser_internal.h"
+#include "scan_internal.h"
+#include <string.h>
+#if WEBVTT_OS_WIN32
+# include <windows.h>
+#elif defined(HAVE_PTHREAD)
+# include <pthread.h>
+# include <unistd.h>
+#endif
+
+/**
+ * Cues created on one thread are handed to the application on another, and
+ * released there, so this needs atomic reference counts as well as threads.
+ */
+#if !defined(WEBVTT_NO_ATOMICS) && ( WEBVTT_OS_WIN32 || defined(HAVE_PTHREAD) )
+# define HAVE_PARALLEL_PARSE 1
+#endif
+
+/**
+ * Segments are at least PARALLEL_MIN_SEGMENT bytes, so that small files
+ * aren't worth splitting, and there are about SEGMENTS_PER_THREAD of them
+ * per thread, so that threads which finish early can pick up more work.
+ */
+#define PARALLEL_MIN_SEGMENT ( 0x40000 )
+#define SEGMENTS_PER_THREAD ( 4 )
+#define MAX_THREADS ( 64 )
+
+#if HAVE_PARALLEL_PARSE
+
+#if WEBVTT_OS_WIN32
+typedef CRITICAL_SECTION parallel_mutex;
+typedef CONDITION_VARIABLE parallel_cond;
+typedef HANDLE parallel_thread;
+# define THREAD_PROC DWORD WINAPI
+# define THREAD_RETURN ( 0 )
+# define MUTEX_INIT(m) InitializeCriticalSection( m )
+# define MUTEX_DESTROY(m) DeleteCriticalSection( m )
+# define MUTEX_LOCK(m) EnterCriticalSection( m )
+# define MUTEX_UNLOCK(m) LeaveCriticalSection( m )
+# define COND_INIT(c) InitializeConditionVariable( c )
+# define COND_DESTROY(c)
+# define COND_WAIT(c,m) SleepConditionVariableCS( (c), (m), INFINITE )
+# define COND_BROADCAST(c) WakeAllConditionVariable( c )
+# define THREAD_START(t,fn,arg) \
+  ( ( *(t) = CreateThread( 0, 0, (fn), (arg), 0, 0 ) ) != 0 )
+# define THREAD_JOIN(t) \
+  ( WaitForSingleObject( (t), INFINITE ), CloseHandle( t ) )
+#else
+typedef pthread_mutex_t parallel_mutex;
+typedef pthread_cond_t parallel_cond;
+typedef pthread_t parallel_thread;
+# define THREAD_PROC void *
+# define THREAD_RETURN ( 0 )
+# define MUTEX_INIT(m) pthread_mutex_init( (m), 0 )
+# define MUTEX_DESTROY(m) pthread_mutex_destroy( m )
+# define MUTEX_LOCK(m) pthread_mutex_lock( m )
+# define MUTEX_UNLOCK(m) pthread_mutex_unlock( m )
+# define COND_INIT(c) pthread_cond_init( (c), 0 )
+# define COND_DESTROY(c) pthread_cond_destroy( c )
+# define COND_WAIT(c,m) pthread_cond_wait( (c), (m) )
+# define COND_BROADCAST(c) pthread_cond_broadcast( c )
+# define THREAD_START(t,fn,arg) ( pthread_create( (t), 0, (fn), (arg) ) == 0 )
+# define THREAD_JOIN(t) pthread_join( (t), 0 )
+#endif
+
+/**
+ * A cue or error reported by a segment's parser, held until the segments
+ * before it have been reported. 'cue' is NULL for errors.
+ */
+typedef struct
+parse_event_t {
+  webvtt_cue *cue;
+  webvtt_uint line;
+  webvtt_uint column;
+  webvtt_error error;
+} parse_event;
+
+typedef struct
+parse_segment_t {
+  const char *data;
+  webvtt_uint length;
+
+  /**
+   * Set once the segment has been parsed. 'lines' is the number of lines its
+   * parser read, so that the segments following it know where they start.
+   */
+  webvtt_bool done;
+  webvtt_status status;
+  webvtt_uint lines;
+
+  parse_event *events;
+  webvtt_uint count;
+  webvtt_uint alloc;
+  webvtt_bool events_lost;
+} parse_segment;
+
+typedef struct
+parallel_parse_t {
+  webvtt_parser self;
+  parse_segment *segments;
+  webvtt_uint count;
+  webvtt_uint next; /* the next segment no thread has claimed */
+  parallel_mutex mutex;
+  parallel_cond cond; /* signalled whenever a segment is done */
+} parallel_parse;
+
+/**
+ * Return the start of the line following the one 'p' lies in
+ */
+static const char *
+next_line( const char *p, const char *end )
+{
+  p = webvtt_scan_eol( p, end );
+  if( p < end && *p++ == '\r' && p < end && *p == '\n' ) {
+    ++p;
+  }
+  return p;
+}
+
+/**
+ * Return true if the line from 'p' to 'end' contains '-->'
+ */
+static webvtt_bool
+has_separator( const char *p, const char *end )
+{
+  while( end - p >= 3 &&
+         ( p = (const char *)memchr( p, '-', end - p - 2 ) ) ) {
+    if( p[ 1 ] == '-' && p[ 2 ] == '>' ) {
+      return 1;
+    }
+    ++p;
+  }
+  return 0;
+}
+
+/**
+ * Find a point, at or after 'from', at which a parser in the state left by
+ * webvtt_parser_skip_header() can take over from one which has read
+ * everything before it. Returns 'len' if there is none.
+ *
+ * A blank line ends cue text and skipped blocks (NOTE blocks among them), so
+ * the parser is back between blocks after one, unless the block before it
+ * was a lone line without '-->'. That line is taken as a cue id, and the
+ * blank line as the missing timings, and the parser then skips the next
+ * block as well. The state at a blank line depends on the block before it,
+ * which depends on the one before that, so rather than search backwards, a
+ * split is only made after a blank line which follows a whole block, itself
+ * following a blank line, that is not a lone line without '-->'.
+ */
+static webvtt_uint
+find_split( const char *b, webvtt_uint from, webvtt_uint len )
+{
+  const char *end = b + len, *p, *eol;
+  webvtt_bool after_blank = 0, safe = 0;
+  webvtt_uint lines = 0;
+
+  /* 'from' may lie anywhere within a line, so start from the next one */
+  for( p = next_line( b + from, end ); p < end; p = next_line( p, end ) ) {
+    eol = webvtt_scan_eol( p, end );
+    if( eol == p ) {
+      if( after_blank && safe ) {
+        return (webvtt_uint)( next_line( p, end ) - b );
+      }
+      after_blank = 1;
+      safe = 0;
+      lines = 0;
+    } else if( after_blank ) {
+      if( lines++ ) {
+        safe = 1;
+      } else {
+        safe = has_separator( p, eol );
+      }
+    }
+  }
+  return len;
+}
+
+static webvtt_bool
+push_event( parse_segment *segment, webvtt_cue *cue, webvtt_uint line,
+            webvtt_uint column, webvtt_error error )
+{
+  parse_event *e;
+  if( segment->count == segment->alloc ) {
+    webvtt_uint alloc = segment->alloc ? segment->alloc * 2 : 64;
+    parse_event *events = (parse_event *)webvtt_alloc( alloc *
+                                                       sizeof( *events ) );
+    if( !events ) {
+      segment->events_lost = 1;
+      return 0;
+    }
+    if( segment->count ) {
+      memcpy( events, segment->events, segment->count * sizeof( *events ) );
+    }
+    webvtt_free( segment->events );
+    segment->events = events;
+    segment->alloc = alloc;
+  }
+  e = segment->events + segment->count++;
+  e->cue = cue;
+  e->line = line;
+  e->column = column;
+  e->error = error;
+  return 1;
+}
+
+static void WEBVTT_CALLBACK
+record_cue( void *userdata, webvtt_cue *cue )
+{
+  if( !push_event( (parse_segment *)userdata, cue, 0, 0, 0 ) ) {
+    webvtt_release_cue( &cue );
+  }
+}
+
+static int WEBVTT_CALLBACK
+record_error( void *userdata, webvtt_uint line, webvtt_uint column,
+              webvtt_error error )
+{
+  push_event( (parse_segment *)userdata, 0, line, column, error );
+  /**
+   * Carry on whatever the error. If the application wants to stop at this
+   * one, the segment is parsed again when it's reported.
+   */
+  return 0;
+}
+
+static void
+release_events( parse_segment *segment )
+{
+  webvtt_uint i;
+  for( i = 0; i < segment->count; ++i ) {
+    webvtt_release_cue( &segment->events[ i ].cue );
+  }
+  webvtt_free( segment->events );
+  segment->events = 0;
+  segment->count = segment->alloc = 0;
+}
+
+/**
+ * Create a parser with the same configuration as 'self', interning with
+ * 'interns', to parse part of its input
+ */
+static webvtt_status
+create_segment_parser( webvtt_parser self, webvtt_intern_table *interns,
+                       webvtt_cue_fn on_read, webvtt_error_fn on_error,
+                       void *userdata, webvtt_uint line,
+                       webvtt_parser *ppout )
+{
+  webvtt_status status;
+  webvtt_parser_config config;
+
+  webvtt_init_parser_config( &config );
+  config.pool_objects = self->alloc.pool != 0;
+  config.interns = interns;
+  config.flat_node_tree = self->flat_node_tree;
+  config.lazy_cuetext = self->lazy_cuetext;
+  config.projection = self->projection;
+  if( WEBVTT_FAILED( status = webvtt_create_parser_with_config( on_read,
+                       on_error, userdata, &config, ppout ) ) ) {
+    return status;
+  }
+  webvtt_parser_skip_header( *ppout, line );
+  return WEBVTT_SUCCESS;
+}
+
+/**
+ * Parse a segment, holding on to its cues and errors. Line numbers are
+ * counted from the start of the segment, as where it starts isn't known
+ * until the segments before it have been parsed.
+ */
+static void
+parse_segment_events( parallel_parse *pp, parse_segment *segment,
+                      webvtt_intern_table *interns )
+{
+  webvtt_parser parser;
+  segment->status = create_segment_parser( pp->self, interns, &record_cue,
+                                           &record_error, segment, 1,
+                                           &parser );
+  if( WEBVTT_FAILED( segment->status ) ) {
+    return;
+  }
+  segment->status = webvtt_parse_complete( parser, 0, segment->data,
+                                           segment->length );
+  segment->lines = parser->line - 1;
+  webvtt_delete_parser( parser );
+}
+
+/**
+ * Claim the next unclaimed segment and parse it, interning with the calling
+ * thread's 'interns'. The mutex must be held, and is released while parsing.
+ * Returns false if every segment is taken.
+ */
+static webvtt_bool
+parse_next_segment( parallel_parse *pp, webvtt_intern_table *interns )
+{
+  parse_segment *segment;
+  if( pp->next >= pp->count ) {
+    return 0;
+  }
+  segment = pp->segments + pp->next++;
+  MUTEX_UNLOCK( &pp->mutex );
+  parse_segment_events( pp, segment, interns );
+  MUTEX_LOCK( &pp->mutex );
+  segment->done = 1;
+  COND_BROADCAST( &pp->cond );
+  return 1;
+}
+
+/**
+ * Workers intern with a table of their own, if 'self' interns at all, so that
+ * they don't wait on each other for one table's lock
+ */
+static THREAD_PROC
+parallel_worker( void *arg )
+{
+  parallel_parse *pp = (parallel_parse *)arg;
+  webvtt_intern_table *interns = 0;
+  if( pp->self->interns ) {
+    webvtt_create_intern_table( &interns );
+  }
+  MUTEX_LOCK( &pp->mutex );
+  while( parse_next_segment( pp, interns ) ) {
+  }
+  MUTEX_UNLOCK( &pp->mutex );
+  webvtt_release_intern_table( &interns );
+  return THREAD_RETURN;
+}
+
+/**
+ * Parsing a segment again, once the application has asked to stop at one of
+ * its errors. Everything up to that error has already been reported, so is
+ * dropped, the error callback's answer is repeated for that error, and
+ * anything after it (reported while finishing parsing) is passed on.
+ */
+typedef struct
+replay_t {
+  webvtt_parser self;
+  webvtt_uint index; /* of the next event */
+  webvtt_uint stop; /* index of the error to stop at */
+  int result; /* the error callback's answer for it */
+} replay;
+
+static void WEBVTT_CALLBACK
+replay_cue( void *userdata, webvtt_cue *cue )
+{
+  replay *r = (replay *)userdata;
+  if( r->index++ < r->stop ) {
+    webvtt_release_cue( &cue );
+  } else {
+    webvtt_deliver_cue( r->self, cue );
+  }
+}
+
+static int WEBVTT_CALLBACK
+replay_error( void *userdata, webvtt_uint line, webvtt_uint column,
+              webvtt_error error )
+{
+  replay *r = (replay *)userdata;
+  webvtt_uint index = r->index++;
+  if( index < r->stop ) {
+    return 0;
+  } else if( index == r->stop ) {
+    return r->result;
+  }
+  webvtt_flush_cues( r->self );
+  return r->self->error( r->self->userdata, line, column, error );
+}
+
+static webvtt_status
+replay_segment( webvtt_parser self, parse_segment *segment, webvtt_uint line,
+                webvtt_uint stop, int result )
+{
+  webvtt_status status;
+  webvtt_parser parser;
+  replay r;
+
+  r.self = self;
+  r.index = 0;
+  r.stop = stop;
+  r.result = result;
+  if( WEBVTT_FAILED( status = create_segment_parser( self, self->interns,
+                                                     &replay_cue,
+                                                     &replay_error, &r, line,
+                                                     &parser ) ) ) {
+    return status;
+  }
+  status = webvtt_parse_complete( parser, 0, segment->data, segment->length );
+  webvtt_delete_parser( parser );
+  return status;
+}
+
+/**
+ * Hand a segment's cues and errors to the application. 'line' is the number
+ * of the segment's first line. Returns the status parsing the rest of the
+ * file as one would have returned at the end of the segment: a failure if it
+ * would have stopped there.
+ */
+static webvtt_status
+report_segment( webvtt_parser self, parse_segment *segment, webvtt_uint line )
+{
+  webvtt_uint i;
+  int result;
+
+  for( i = 0; i < segment->count; ++i ) {
+    parse_event *e = segment->events + i;
+    if( e->cue ) {
+      webvtt_cue *cue = e->cue;
+      e->cue = 0;
+      webvtt_deliver_cue( self, cue );
+      continue;
+    }
+    webvtt_flush_cues( self );
+    if( ( result = self->error( self->userdata, e->line + line - 1,
+                                e->column, e->error ) ) < 0 ) {
+      return replay_segment( self, segment, line, i, result );
+    }
+  }
+  if( segment->events_lost ) {
+    webvtt_flush_cues( self );
+    self->error( self->userdata, line, 1, WEBVTT_ALLOCATION_FAILED );
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+  return segment->status;
+}
+
+static webvtt_uint
+processor_count( void )
+{
+#if WEBVTT_OS_WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo( &info );
+  return (webvtt_uint)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf( _SC_NPROCESSORS_ONLN );
+  return n > 0 ? (webvtt_uint)n : 1;
+#else
+  return 1;
+#endif
+}
+
+WEBVTT_INTERN webvtt_status
+webvtt_parse_parallel( webvtt_parser self, const char *b, webvtt_uint len,
+                       webvtt_uint threads, webvtt_uint min_segment )
+{
+  parallel_parse pp;
+  parallel_thread workers[ MAX_THREADS ];
+  webvtt_uint segment_size, pos, end, i, started = 0, line = 1;
+  webvtt_status status;
+
+  if( !threads ) {
+    threads = processor_count();
+  }
+  if( threads > MAX_THREADS ) {
+    threads = MAX_THREADS;
+  }
+  segment_size = len / ( threads * SEGMENTS_PER_THREAD );
+  if( segment_size < min_segment ) {
+    segment_size = min_segment;
+  }
+  if( !segment_size || len <= segment_size ) {
+    return webvtt_parse_complete( self, 0, b, len );
+  }
+
+  pp.self = self;
+  pp.count = 0;
+  pp.next = 1; /* the first segment is parsed by 'self' */
+  pp.segments = (parse_segment *)webvtt_alloc0( ( len / segment_size + 1 ) *
+                                                sizeof( *pp.segments ) );
+  if( !pp.segments ) {
+    return webvtt_parse_complete( self, 0, b, len );
+  }
+  for( pos = 0; pos < len; pos = end ) {
+    end = len - pos > segment_size ? find_split( b, pos + segment_size, len )
+                                   : len;
+    pp.segments[ pp.count ].data = b + pos;
+    pp.segments[ pp.count ].length = end - pos;
+    pp.count++;
+  }
+
+  MUTEX_INIT( &pp.mutex );
+  COND_INIT( &pp.cond );
+  if( pp.count > 1 ) {
+    for( ; started + 1 < threads && started + 1 < pp.count; ++started ) {
+      if( !THREAD_START( workers + started, &parallel_worker, &pp ) ) {
+        break;
+      }
+    }
+  }
+
+  /**
+   * The first segment (with the header) is parsed by 'self', and reports
+   * straight to the application. The others are reported in turn as they
+   * are done, helping to parse them while waiting.
+   */
+  status = webvtt_parse_complete( self, 0, pp.segments[ 0 ].data,
+                                  pp.segments[ 0 ].length );
+  line = self->line;
+  for( i = 1; i < pp.count && !WEBVTT_FAILED( status ); ++i ) {
+    parse_segment *segment = pp.segments + i;
+    MUTEX_LOCK( &pp.mutex );
+    while( !segment->done ) {
+      if( !parse_next_segment( &pp, self->interns ) ) {
+        COND_WAIT( &pp.cond, &pp.mutex );
+      }
+    }
+    MUTEX_UNLOCK( &pp.mutex );
+    status = report_segment( self, segment, line );
+    line += segment->lines;
+  }
+
+  webvtt_flush_cues( self );
+
+  /* Stop handing out segments, and drop whatever wasn't reported */
+  MUTEX_LOCK( &pp.mutex );
+  pp.next = pp.count;
+  MUTEX_UNLOCK( &pp.mutex );
+  while( started ) {
+    THREAD_JOIN( workers[ --started ] );
+  }
+  for( i = 0; i < pp.count; ++i ) {
+    release_events( pp.segments + i );
+  }
+  COND_DESTROY( &pp.cond );
+  MUTEX_DESTROY( &pp.mutex );
+  webvtt_free( pp.segments );
+  return status;
+}
+
+#else
+
+WEBVTT_INTERN webvtt_status
+webvtt_parse_parallel( webvtt_parser self, const char *b, webvtt_uint len,
+                       webvtt_uint threads, webvtt_uint min_segment )
+{
+  (void)threads;
+  (void)min_segment;
+  return webvtt_parse_complete( self, 0, b, len );
+}
+
+#endif
+
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_buffer_parallel( webvtt_parser self, const void *buffer,
+                              webvtt_uint len, webvtt_uint threads )
+{
+  if( !self || ( !buffer && len ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  /**
+   * Segment parsers start from the state after the header, so the parser
+   * mustn't have seen any input yet. Arenas can't be shared between threads,
+   * and in an HLS segment, only the first part would see the timestamp map.
+   */
+  if( self->alloc.arena || self->hls_segment || self->finished ||
+      self->top != self->stack || self->top->state != T_INITIAL ||
+      self->tstate != L_START || self->token_pos ) {
+    return webvtt_parse_buffer( self, buffer, len );
+  }
+#if HAVE_PARALLEL_PARSE
+  if( !threads ) {
+    threads = processor_count();
+  }
+#endif
+  /* With one thread, holding back later segments' cues only costs time */
+  if( threads == 1 ) {
+    return webvtt_parse_buffer( self, buffer, len );
+  }
+  return webvtt_parse_parallel( self, (const char *)buffer, len, threads,
+                                PARALLEL_MIN_SEGMENT );
+}
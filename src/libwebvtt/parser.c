@@ -28,6 +28,7 @@
 #include "parser_internal.h"
 #include "cuetext_internal.h"
 #include "cue_internal.h"
+#include "scan_internal.h"
 #include <string.h>
 
 #define _ERROR(X) do { if( skip_error == 0 ) { ERROR(X); } } while(0)
@@ -35,8 +36,6 @@
 static const char separator[] = {
   '-', '-', '>'
 };
-/* UTF8 encoding of U+FFFD REPLACEMENT CHAR */
-static const char replacement[] = { 0xEF, 0xBF, 0xBD };
 
 #define MSECS_PER_HOUR (3600000)
 #define MSECS_PER_MINUTE (60000)
@@ -44,23 +43,65 @@ static const char replacement[] = { 0xEF, 0xBF, 0xBD };
 #define BUFFER (self->buffer + self->position)
 #define MALFORMED_TIME ((webvtt_timestamp_t)-1.0)
 
+/**
+ * T_BODY flag: no blank line has been seen since the WEBVTT line, so in an
+ * HLS segment, a line without '-->' is still part of the header
+ */
+#define BODY_HEADER (1)
+
 static webvtt_status find_bytes( const char *buffer, webvtt_uint len,
                                  const char *sbytes, webvtt_uint slen );
+static webvtt_status read_header_line( webvtt_parser self,
+                                       webvtt_state *body,
+                                       webvtt_string *line );
+
+WEBVTT_EXPORT void
+webvtt_init_parser_config( webvtt_parser_config *config )
+{
+  if( config ) {
+    memset( config, 0, sizeof( *config ) );
+  }
+}
 
 WEBVTT_EXPORT webvtt_status
 webvtt_create_parser( webvtt_cue_fn on_read,
                       webvtt_error_fn on_error, void *
                       userdata,
                       webvtt_parser *ppout )
+{
+  return webvtt_create_parser_with_config( on_read, on_error, userdata, 0,
+                                           ppout );
+}
+
+/**
+ * Create a parser handing cues to 'on_read' one at a time, or to
+ * 'on_read_batch' in batches, or, if both are NULL, keeping them for
+ * webvtt_parser_next_cue()
+ */
+static webvtt_status
+create_parser( webvtt_cue_fn on_read, webvtt_cues_fn on_read_batch,
+               webvtt_error_fn on_error, void *userdata,
+               const webvtt_parser_config *config, webvtt_parser *ppout )
 {
   webvtt_parser p;
-  if( !on_read || !on_error || !ppout ) {
+  if( !on_error || !ppout ) {
     return WEBVTT_INVALID_PARAM;
   }
 
-  if( !( p = ( webvtt_parser )webvtt_alloc0( sizeof * p ) ) ) {
+  if( !( p = ( webvtt_parser )webvtt_alloc0_as( sizeof * p,
+                                                WEBVTT_MEM_PARSER ) ) ) {
     return WEBVTT_OUT_OF_MEMORY;
   }
+  if( on_read_batch ) {
+    p->read_batch = on_read_batch;
+    p->batch_size = config && config->batch_size ? config->batch_size
+                                                 : WEBVTT_DEFAULT_BATCH_SIZE;
+    if( !( p->batch = ( webvtt_cue ** )webvtt_alloc_as(
+             p->batch_size * sizeof( *p->batch ), WEBVTT_MEM_PARSER ) ) ) {
+      webvtt_free( p );
+      return WEBVTT_OUT_OF_MEMORY;
+    }
+  }
 
   memset( p->astack, 0, sizeof( p->astack ) );
   p->stack = p->astack;
@@ -73,11 +114,163 @@ webvtt_create_parser( webvtt_cue_fn on_read,
   p->column = p->line = 1;
   p->userdata = userdata;
   p->finished = 0;
+  p->projection = WEBVTT_PROJECT_ALL;
+  if( config ) {
+    if( config->projection ) {
+      p->projection = config->projection | WEBVTT_PROJECT_TIMINGS;
+    }
+    p->alloc.arena = config->arena;
+    p->flat_node_tree = config->flat_node_tree;
+    /* Nodes created after the fact couldn't be released from an arena */
+    p->lazy_cuetext = config->lazy_cuetext && !config->arena;
+    p->hls_segment = config->hls_segment;
+    p->mpegts_base = config->hls_mpegts_base;
+    if( config->pool_objects && !config->arena &&
+        WEBVTT_FAILED( webvtt_create_pool( &p->alloc.pool ) ) ) {
+      webvtt_free( p->batch );
+      webvtt_free( p );
+      return WEBVTT_OUT_OF_MEMORY;
+    }
+  }
+  if( config && !config->arena ) {
+    if( config->interns ) {
+      p->interns = config->interns;
+      webvtt_ref_intern_table( p->interns );
+    } else if( config->intern_cuetext &&
+               WEBVTT_FAILED( webvtt_create_intern_table( &p->interns ) ) ) {
+      webvtt_release_pool( &p->alloc.pool );
+      webvtt_free( p->batch );
+      webvtt_free( p );
+      return WEBVTT_OUT_OF_MEMORY;
+    }
+  }
   *ppout = p;
 
   return WEBVTT_SUCCESS;
 }
 
+WEBVTT_EXPORT webvtt_status
+webvtt_create_parser_with_config( webvtt_cue_fn on_read,
+                                  webvtt_error_fn on_error, void *userdata,
+                                  const webvtt_parser_config *config,
+                                  webvtt_parser *ppout )
+{
+  if( !on_read ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return create_parser( on_read, 0, on_error, userdata, config, ppout );
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_create_batch_parser( webvtt_cues_fn on_read, webvtt_error_fn on_error,
+                            void *userdata, const webvtt_parser_config *config,
+                            webvtt_parser *ppout )
+{
+  if( !on_read ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return create_parser( 0, on_read, on_error, userdata, config, ppout );
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_create_pull_parser( webvtt_error_fn on_error, void *userdata,
+                           const webvtt_parser_config *config,
+                           webvtt_parser *ppout )
+{
+  return create_parser( 0, 0, on_error, userdata, config, ppout );
+}
+
+/**
+ * Hand 'count' cues to the application's callback. Anything the application
+ * allocates in its callback belongs to the application, not to our arena or
+ * pool.
+ */
+static void
+read_cues( webvtt_parser self, webvtt_cue **cues, webvtt_uint count )
+{
+  webvtt_alloc_context ctx = { 0, 0 };
+  webvtt_swap_alloc_context( &ctx );
+  if( self->read_batch ) {
+    self->read_batch( self->userdata, cues, count );
+  } else {
+    self->read( self->userdata, *cues );
+  }
+  webvtt_swap_alloc_context( &ctx );
+}
+
+WEBVTT_INTERN void
+webvtt_flush_cues( webvtt_parser self )
+{
+  if( self->batch_count ) {
+    webvtt_uint count = self->batch_count;
+    self->batch_count = 0;
+    read_cues( self, self->batch, count );
+  }
+}
+
+/**
+ * Add a cue to the end of the ring, doubling its size when it is full
+ */
+static webvtt_status
+push_cue( webvtt_parser self, webvtt_cue *cue )
+{
+  if( self->ring_count == self->ring_alloc ) {
+    webvtt_uint alloc = self->ring_alloc ? self->ring_alloc * 2 : 8, i;
+    /* The ring belongs to the parser, not to its arena */
+    webvtt_alloc_context heap = { 0, 0 };
+    webvtt_cue **ring;
+    webvtt_swap_alloc_context( &heap );
+    ring = ( webvtt_cue ** )webvtt_alloc_as( alloc * sizeof( *ring ),
+                                             WEBVTT_MEM_PARSER );
+    webvtt_swap_alloc_context( &heap );
+    if( !ring ) {
+      return WEBVTT_OUT_OF_MEMORY;
+    }
+    for( i = 0; i < self->ring_count; ++i ) {
+      ring[ i ] = self->ring[ ( self->ring_head + i ) % self->ring_alloc ];
+    }
+    webvtt_free( self->ring );
+    self->ring = ring;
+    self->ring_head = 0;
+    self->ring_alloc = alloc;
+  }
+  self->ring[ ( self->ring_head + self->ring_count++ ) % self->ring_alloc ] =
+    cue;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_INTERN void
+webvtt_deliver_cue( webvtt_parser self, webvtt_cue *cue )
+{
+  if( self->read ) {
+    read_cues( self, &cue, 1 );
+  } else if( self->read_batch ) {
+    self->batch[ self->batch_count++ ] = cue;
+    if( self->batch_count == self->batch_size ) {
+      webvtt_flush_cues( self );
+    }
+  } else if( WEBVTT_FAILED( push_cue( self, cue ) ) ) {
+    webvtt_release_cue( &cue );
+    WARNING_AT( WEBVTT_ALLOCATION_FAILED, self->line, 1 );
+  }
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_parser_next_cue( webvtt_parser self, webvtt_cue **pcue )
+{
+  if( !self || !pcue || self->read || self->read_batch ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  if( !self->ring_count ) {
+    *pcue = 0;
+    return self->finished ? WEBVTT_SUCCESS : WEBVTT_UNFINISHED;
+  }
+  *pcue = self->ring[ self->ring_head ];
+  self->ring_head = ( self->ring_head + 1 ) % self->ring_alloc;
+  --self->ring_count;
+  return WEBVTT_SUCCESS;
+}
+
 /**
  * Helper to validate a cue and, if valid, notify the application that a cue has
  * been read.
@@ -94,7 +287,7 @@ finish_cue( webvtt_parser self, webvtt_cue **pcue )
     webvtt_cue *cue = *pcue;
     if( cue ) {
       if( webvtt_validate_cue( cue ) ) {
-        self->read( self->userdata, cue );
+        webvtt_deliver_cue( self, cue );
       } else {
         webvtt_release_cue( &cue );
       }
@@ -112,7 +305,22 @@ finish_cue( webvtt_parser self, webvtt_cue **pcue )
 WEBVTT_INTERN void
 cleanup_stack( webvtt_parser self )
 {
-  webvtt_state *st = self->top;
+  /**
+   * The frame just popped may still hold a value for the one below it, when
+   * parsing stopped between chunks before that took it
+   */
+  webvtt_state *st = self->top + 1;
+  if( st < self->stack + self->stack_alloc ) {
+    if( st->type == V_CUE ) {
+      webvtt_release_cue( &st->v.cue );
+    } else if( st->type == V_TEXT ) {
+      webvtt_release_string( &st->v.text );
+    }
+    st->type = V_NONE;
+    st->v.cue = NULL;
+  }
+
+  st = self->top;
   while( st >= self->stack ) {
     switch( st->type ) {
       case V_CUE:
@@ -151,11 +359,8 @@ cleanup_stack( webvtt_parser self )
   }
 }
 
-/**
- *
- */
-WEBVTT_EXPORT webvtt_status
-webvtt_finish_parsing( webvtt_parser self )
+static webvtt_status
+finish_parsing( webvtt_parser self )
 {
   webvtt_status status = WEBVTT_SUCCESS;
   const char buffer[] = "\0";
@@ -193,6 +398,12 @@ retry:
           (self->top+1)->type = V_NONE;
           (self->top+1)->state = 0;
           self->column = 1;
+          if( self->hls_segment && ( self->top - 1 )->flags & BODY_HEADER ) {
+            status = read_header_line( self, self->top - 1, &text );
+            if( status != WEBVTT_NO_MATCH_FOUND ) {
+              break;
+            }
+          }
           status = webvtt_proc_cueline( self, cue, &text );
           if( cue_is_incomplete( cue ) ) {
             ERROR( WEBVTT_CUE_INCOMPLETE );
@@ -217,18 +428,53 @@ retry:
         break;
     }
     cleanup_stack( self );
+    if( self->alloc.arena ) {
+      /**
+       * Don't hold on to arena memory past this point, so that the arena can
+       * safely be reset.
+       */
+      webvtt_release_string( &self->line_buffer );
+    }
   }
+  webvtt_flush_cues( self );
 
   return status;
 }
 
+/**
+ *
+ */
+WEBVTT_EXPORT webvtt_status
+webvtt_finish_parsing( webvtt_parser self )
+{
+  webvtt_status status;
+  webvtt_alloc_context ctx = self->alloc;
+  webvtt_swap_alloc_context( &ctx );
+  status = finish_parsing( self );
+  webvtt_swap_alloc_context( &ctx );
+  return status;
+}
+
 WEBVTT_EXPORT void
 webvtt_delete_parser( webvtt_parser self )
 {
   if( self ) {
     cleanup_stack( self );
 
+    while( self->batch_count ) {
+      webvtt_release_cue( &self->batch[ --self->batch_count ] );
+    }
+    webvtt_free( self->batch );
+    while( self->ring_count ) {
+      --self->ring_count;
+      webvtt_release_cue( &self->ring[ ( self->ring_head + self->ring_count )
+                                       % self->ring_alloc ] );
+    }
+    webvtt_free( self->ring );
     webvtt_release_string( &self->line_buffer );
+    webvtt_release_buffer( &self->body_source );
+    webvtt_release_pool( &self->alloc.pool );
+    webvtt_release_intern_table( &self->interns );
     webvtt_free( self );
   }
 }
@@ -248,14 +494,9 @@ webvtt_delete_parser( webvtt_parser self )
 static int
 find_newline( const char *buffer, webvtt_uint *pos, webvtt_uint len )
 {
-  while( *pos < len ) {
-    if( buffer[ *pos ] == '\r' || buffer[ *pos ] == '\n' ) {
-      return 1;
-    } else {
-      ( *pos )++;
-    }
-  }
-  return -1;
+  *pos = (webvtt_uint)( webvtt_scan_eol( buffer + *pos, buffer + len ) -
+                        buffer );
+  return *pos < len ? 1 : -1;
 }
 
 /**
@@ -303,8 +544,9 @@ do_push( webvtt_parser self, webvtt_uint token, webvtt_uint back,
 {
   if( STACK_SIZE + 1 >= self->stack_alloc ) {
     webvtt_state *stack =
-        ( webvtt_state * )webvtt_alloc0( sizeof( webvtt_state ) *
-                                         ( self->stack_alloc << 1 ) ), *tmp;
+        ( webvtt_state * )webvtt_alloc0_as( sizeof( webvtt_state ) *
+                                            ( self->stack_alloc << 1 ),
+                                            WEBVTT_MEM_PARSER_STACK ), *tmp;
     if( !stack ) {
       ERROR( WEBVTT_ALLOCATION_FAILED );
       return WEBVTT_OUT_OF_MEMORY;
@@ -362,6 +604,109 @@ do \
 } while(0)
 #define POPBACK() do_pop(self)
 
+#define MPEGTS_WRAP ( ( webvtt_uint64 )1 << 33 )
+
+/**
+ * Parse the value of an X-TIMESTAMP-MAP header, 'MPEGTS:<ticks>' and
+ * 'LOCAL:<timestamp>' in either order, separated by a comma, into the offset
+ * to add to every time in the segment
+ */
+static int
+parse_timestamp_map( webvtt_parser self, const char *text, webvtt_uint len,
+                     webvtt_int64 *offset )
+{
+  webvtt_uint64 ticks = 0;
+  webvtt_timestamp local = 0;
+  int have_ticks = 0, have_local = 0;
+  webvtt_uint pos = 0;
+
+  while( pos < len ) {
+    if( pos && text[ pos++ ] != ',' ) {
+      return 0;
+    }
+    if( len - pos > 7 && !memcmp( text + pos, "MPEGTS:", 7 ) ) {
+      webvtt_uint digits = 0;
+      pos += 7;
+      ticks = 0;
+      while( pos < len && webvtt_isdigit( text[ pos ] ) && digits < 18 ) {
+        ticks = ticks * 10 + ( text[ pos++ ] - '0' );
+        ++digits;
+      }
+      if( !digits || have_ticks ) {
+        return 0;
+      }
+      have_ticks = 1;
+    } else if( len - pos > 6 && !memcmp( text + pos, "LOCAL:", 6 ) ) {
+      int consumed = 0;
+      pos += 6;
+      if( have_local || !webvtt_parse_timestamp_n( text + pos, len - pos,
+                                                   &consumed, &local ) ) {
+        return 0;
+      }
+      pos += consumed;
+      have_local = 1;
+    } else {
+      return 0;
+    }
+  }
+  if( !have_ticks || !have_local ) {
+    return 0;
+  }
+
+  if( ticks < self->mpegts_base ) {
+    ticks += MPEGTS_WRAP;
+  }
+  *offset = ( webvtt_int64 )( ( ticks - self->mpegts_base ) / 90 ) -
+            ( webvtt_int64 )local;
+  return 1;
+}
+
+/**
+ * Handle 'line', read where a cue would begin in an HLS segment before the
+ * header has been closed by a blank line. Lines holding '-->' are cues
+ * missing that blank line, which are left to the caller after reporting
+ * WEBVTT_EXPECTED_EOL. Anything else is a header line, which is consumed.
+ */
+static webvtt_status
+read_header_line( webvtt_parser self, webvtt_state *body,
+                  webvtt_string *line )
+{
+  static const char map[] = "X-TIMESTAMP-MAP=";
+  const char *text = webvtt_string_text( line );
+  webvtt_uint len = webvtt_string_length( line );
+  webvtt_int64 offset;
+  int malformed = 0;
+
+  if( find_bytes( text, len, "-->", 3 ) == WEBVTT_SUCCESS ) {
+    body->flags &= ~BODY_HEADER;
+    ERROR_AT_COLUMN( WEBVTT_EXPECTED_EOL, 1 );
+    return WEBVTT_NO_MATCH_FOUND;
+  }
+
+  if( len >= sizeof( map ) - 1 && !memcmp( text, map, sizeof( map ) - 1 ) ) {
+    if( parse_timestamp_map( self, text + sizeof( map ) - 1,
+                             len - ( sizeof( map ) - 1 ), &offset ) ) {
+      self->time_offset = offset;
+    } else {
+      malformed = 1;
+    }
+  }
+  webvtt_release_string( line );
+  if( malformed ) {
+    ERROR_AT_COLUMN( WEBVTT_MALFORMED_TIMESTAMP_MAP, 1 );
+  }
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_INTERN webvtt_timestamp
+webvtt_offset_timestamp( webvtt_timestamp time, webvtt_int64 offset )
+{
+  if( offset < 0 && time < ( webvtt_timestamp )-offset ) {
+    return 0;
+  }
+  return time + ( webvtt_timestamp )offset;
+}
+
 /**
  * Read a timestamp into 'result' field, following the rules of the cue-times
  * section of the draft:
@@ -378,7 +723,9 @@ webvtt_collect_timestamp( webvtt_parser self, webvtt_timestamp *result,
   int column = self->column;
   int line = self->line;
   int len;
-  int rv = webvtt_parse_timestamp( webvtt_string_text(input) + *position, &len, result );
+  int rv = webvtt_parse_timestamp_n( webvtt_string_text( input ) + *position,
+                                     webvtt_string_length( input ) - *position,
+                                     &len, result );
   if( !rv ) {
     if( BAD_TIMESTAMP(*result) ) {
       ERROR_AT( WEBVTT_EXPECTED_TIMESTAMP, line, column );
@@ -388,6 +735,7 @@ webvtt_collect_timestamp( webvtt_parser self, webvtt_timestamp *result,
       ERROR_AT_OR( WEBVTT_MALFORMED_TIMESTAMP, line, column, WEBVTT_BAD_CUE );
     }
   }
+  *result = webvtt_offset_timestamp( *result, self->time_offset );
 
   /* Move column ahead */
   self->column += len;
@@ -405,7 +753,6 @@ webvtt_collect_timings_and_settings( webvtt_parser self,
                                      webvtt_cue *cue )
 {
   webvtt_status s;
-  webvtt_string settings;
 
   /* 1. Let input be the string being parsed. */
   const webvtt_string *input = line;
@@ -445,8 +792,8 @@ webvtt_collect_timings_and_settings( webvtt_parser self,
    * (>) then abort these steps and return failure. Otherwise, move position
    * forwards one character.
    */
-  if( strstr( webvtt_string_text( input ) + position, "-->" )
-      != webvtt_string_text( input ) + position ) {
+  if( webvtt_string_length( input ) - position < 3 ||
+      memcmp( webvtt_string_text( input ) + position, "-->", 3 ) ) {
     return WEBVTT_PARSE_ERROR;
   }
 
@@ -480,13 +827,16 @@ webvtt_collect_timings_and_settings( webvtt_parser self,
     ERROR( WEBVTT_EXPECTED_WHITESPACE );
   }
 
+  if( !( self->projection & WEBVTT_PROJECT_SETTINGS ) ) {
+    return WEBVTT_SUCCESS;
+  }
+
   /**
    * 11. Let remainder be the trailing substring of input starting at position.
+   * It is parsed where it lies, without copying it.
    */
-  webvtt_create_string_with_text( &settings,
-                                  webvtt_string_text( input ) + position, -1 );
-  webvtt_cue_validate_set_settings( self, cue, &settings );
-  webvtt_release_string( &settings );
+  webvtt_cue_apply_settings( self, cue, webvtt_string_text( input ) + position,
+                             webvtt_string_length( input ) - position );
 
   return WEBVTT_SUCCESS;
 }
@@ -537,11 +887,10 @@ webvtt_proc_cueline( webvtt_parser self, webvtt_cue *cue,
       webvtt_token token = UNFINISHED;
       self->column += length;
       self->cuetext_line = self->line;
-      if( WEBVTT_FAILED( webvtt_string_append( &cue->id, text,
-                                               length ) ) ) {
-        webvtt_release_string( line );
-        ERROR( WEBVTT_ALLOCATION_FAILED );
-        return WEBVTT_OUT_OF_MEMORY;
+      /* The line is ours, so the id can simply share it */
+      if( self->projection & WEBVTT_PROJECT_ID ) {
+        webvtt_release_string( &cue->id );
+        webvtt_copy_string( &cue->id, line );
       }
       cue->flags |= CUE_HAVE_ID;
 
@@ -579,8 +928,10 @@ parse_webvtt( webvtt_parser self, const char *buffer, webvtt_uint *ppos,
       DIE_IF( SP->type != V_TEXT );
       if( SP->flags == 0 ) {
         int v;
-        if( ( v = webvtt_string_getline( &SP->v.text, buffer, &pos, len, 0,
-                                         finish ) ) ) {
+        /* '\0' is replaced with u+fffd as the line is read */
+        if( ( v = webvtt_string_getline_replace_nul( &SP->v.text, buffer,
+                                                     &pos, len, 0,
+                                                     finish ) ) ) {
           if( v < 0 ) {
             webvtt_release_string( &SP->v.text );
             SP->type = V_NONE;
@@ -589,17 +940,6 @@ parse_webvtt( webvtt_parser self, const char *buffer, webvtt_uint *ppos,
             status = WEBVTT_OUT_OF_MEMORY;
             goto _finish;
           }
-          /* replace '\0' with u+fffd */
-          if( WEBVTT_FAILED( status = webvtt_string_replace_all( &SP->v.text,
-                                                                 "\0", 1,
-                                                                 replacement,
-                                                                 3 ) ) ) {
-            webvtt_release_string( &SP->v.text );
-            SP->type = V_NONE;
-            POP();
-            ERROR( WEBVTT_ALLOCATION_FAILED );
-            goto _finish;
-          }
           SP->flags = 1;
         }
       }
@@ -683,6 +1023,7 @@ _recheck:
           POPBACK();
           self->popped = 0;
           SP->state = T_BODY;
+          SP->flags = BODY_HEADER;
           PUSH0( T_EOL, 1, V_INTEGER );
           break;
         } else {
@@ -750,7 +1091,10 @@ _recheck:
 
       case T_BODY:
         if( self->popped && FRAMEUP( 1 )->state == T_EOL ) {
-          if( FRAMEUP( 1 )->v.value < 2 ) {
+          if( FRAMEUP( 1 )->v.value >= 2 ) {
+            SP->flags &= ~BODY_HEADER;
+          } else if( !( self->hls_segment && SP->flags & BODY_HEADER ) ) {
+            /* Segment header lines are told apart from cues in T_CUE */
             ERROR_AT_COLUMN( WEBVTT_EXPECTED_EOL, 1 );
           }
           FRAMEUP( 1 )->state = 0;
@@ -766,7 +1110,7 @@ _recheck:
             goto _finish;
           }
           if( WEBVTT_FAILED( status = webvtt_create_string_with_text( &tk,
-            self->token, self->token_pos ) ) ) {
+            webvtt_lex_token_text( self, buffer, pos ), self->token_pos ) ) ) {
             if( status == WEBVTT_OUT_OF_MEMORY ) {
               ERROR( WEBVTT_ALLOCATION_FAILED );
             }
@@ -804,6 +1148,18 @@ _recheck:
           goto _finish;
         }
 
+        if( self->hls_segment && FRAME( 1 )->flags & BODY_HEADER &&
+            read_header_line( self, FRAME( 1 ), &text ) == WEBVTT_SUCCESS ) {
+          /* Back to counting newlines in the body, as after 'WEBVTT' */
+          webvtt_release_cue( &cue );
+          SP->type = V_NONE;
+          POPBACK();
+          PUSH0( T_EOL, 1, V_INTEGER );
+          ++self->line;
+          self->column = 1;
+          break;
+        }
+
         status = webvtt_proc_cueline( self, cue, &text );
         ++self->line;
         if( self->mode != M_WEBVTT ) {
@@ -829,6 +1185,86 @@ _finish:
   return status;
 }
 
+/**
+ * Parts of a cue made from its text
+ */
+#define CUE_TEXT_PROJECTION ( WEBVTT_PROJECT_BODY | WEBVTT_PROJECT_NODES )
+
+/**
+ * Copy cue text which is still held as a view of the source buffer into the
+ * cue's body, so that more text can be appended to it
+ */
+static webvtt_status
+materialize_body( webvtt_parser self, webvtt_cue *cue )
+{
+  webvtt_status status = WEBVTT_SUCCESS;
+  if( self->body_source ) {
+    status = webvtt_string_append( &cue->body, self->body_source->data +
+                                   self->body_begin,
+                                   self->body_end - self->body_begin );
+    webvtt_release_buffer( &self->body_source );
+  }
+  return status;
+}
+
+/**
+ * Append the line at ['begin', 'end') of the source buffer to the cue text,
+ * extending the view of the buffer if the line directly follows it
+ */
+static webvtt_status
+append_body_view( webvtt_parser self, webvtt_cue *cue, webvtt_uint begin,
+                  webvtt_uint end )
+{
+  webvtt_status status;
+  const char *data = self->source->data;
+
+  if( self->body_source == self->source && begin == self->body_end + 1 &&
+      data[ self->body_end ] == '\n' ) {
+    self->body_end = end;
+    return WEBVTT_SUCCESS;
+  }
+
+  if( !self->body_source && webvtt_string_length( &cue->body ) == 0 ) {
+    self->body_source = self->source;
+    webvtt_ref_buffer( self->body_source );
+    self->body_begin = begin;
+    self->body_end = end;
+    return WEBVTT_SUCCESS;
+  }
+
+  if( WEBVTT_FAILED( status = materialize_body( self, cue ) ) ) {
+    return status;
+  }
+  if( webvtt_string_length( &cue->body ) &&
+      WEBVTT_FAILED( status = webvtt_string_putc( &cue->body, '\n' ) ) ) {
+    return status;
+  }
+  return webvtt_string_append( &cue->body, data + begin, end - begin );
+}
+
+/**
+ * Once the cue text is complete, turn a view of it into the cue's body
+ */
+static webvtt_status
+finish_body( webvtt_parser self, webvtt_cue *cue )
+{
+  webvtt_string view;
+  if( !self->body_source ) {
+    return WEBVTT_SUCCESS;
+  }
+  if( WEBVTT_FAILED( webvtt_create_string_view( self->body_source,
+                                                self->body_begin,
+                                                self->body_end -
+                                                self->body_begin,
+                                                &view ) ) ) {
+    return materialize_body( self, cue );
+  }
+  webvtt_release_string( &cue->body );
+  cue->body = view;
+  webvtt_release_buffer( &self->body_source );
+  return WEBVTT_SUCCESS;
+}
+
 WEBVTT_INTERN webvtt_status
 webvtt_read_cuetext( webvtt_parser self, const char *b,
                      webvtt_uint *ppos, webvtt_uint len, webvtt_bool finish )
@@ -854,24 +1290,68 @@ webvtt_read_cuetext( webvtt_parser self, const char *b,
   }
 
   do {
+    if( !flags && ( self->source || self->complete ) &&
+        !self->line_buffer.d ) {
+      /**
+       * Reading from a buffer, or from complete input: unless the line is
+       * incomplete, or contains NUL bytes which need replacing, take it
+       * straight out of the input rather than collecting it in line_buffer.
+       */
+      const char *s = b + pos, *n = b + len;
+      const char *e = webvtt_scan_line( s, n );
+      webvtt_bool last = finish || self->complete;
+      if( e < n && *e != '\0' && ( *e == '\n' || e + 1 < n || last ) ) {
+        pos = (webvtt_uint)( e - b );
+        webvtt_lex_newline( self, b, &pos, len, last );
+        self->token_pos = 0;
+        self->line++;
+
+        if( e == s ) {
+          finished = 1;
+        } else if( find_bytes( s, (webvtt_uint)( e - s ), separator,
+                               sizeof( separator ) ) == WEBVTT_SUCCESS ) {
+          /* See below */
+          do_push( self, 0, 0, T_CUEREAD, 0, V_NONE, self->line, self->column );
+          SP->type = V_TEXT;
+          if( WEBVTT_FAILED( status = webvtt_create_string_with_text(
+                               &SP->v.text, s, (int)( e - s ) ) ) ) {
+            SP->type = V_NONE;
+          }
+          POP();
+          finished = 1;
+        } else if( !( self->projection & CUE_TEXT_PROJECTION ) ) {
+          /* Nothing is made from the text */
+        } else if( self->source ) {
+          status = append_body_view( self, cue,
+                                     (webvtt_uint)( s - self->source->data ),
+                                     (webvtt_uint)( e - self->source->data ) );
+        } else {
+          if( webvtt_string_length( &cue->body ) ) {
+            status = webvtt_string_putc( &cue->body, '\n' );
+          }
+          if( !WEBVTT_FAILED( status ) ) {
+            status = webvtt_string_append( &cue->body, s, (int)( e - s ) );
+          }
+        }
+        if( WEBVTT_FAILED( status ) ) {
+          ERROR( WEBVTT_ALLOCATION_FAILED );
+          goto _finish;
+        }
+        continue;
+      }
+    }
     if( !flags ) {
       int v;
-      if( ( v = webvtt_string_getline( &self->line_buffer, b, &pos, len,
-                                       &self->truncate, finish ) ) ) {
+      /* '\0' is replaced with u+fffd as the line is read */
+      if( ( v = webvtt_string_getline_replace_nul( &self->line_buffer, b,
+                                                   &pos, len, &self->truncate,
+                                                   finish ) ) ) {
         if( v < 0 || WEBVTT_FAILED( webvtt_string_putc( &self->line_buffer,
                                                         '\n' ) ) ) {
           ERROR( WEBVTT_ALLOCATION_FAILED );
           status = WEBVTT_OUT_OF_MEMORY;
           goto _finish;
         }
-        /* replace '\0' with u+fffd */
-        if( WEBVTT_FAILED( status =
-                           webvtt_string_replace_all( &self->line_buffer,
-                                                      "\0", 1, replacement,
-                                                      3 ) ) ) {
-          ERROR( WEBVTT_ALLOCATION_FAILED );
-          goto _finish;
-        }
 
         flags = 1;
       }
@@ -910,14 +1390,18 @@ webvtt_read_cuetext( webvtt_parser self, const char *b,
         } else {
           /**
            * If it's not the end of a cue, simply append it to the cue's payload
-           * text.
+           * text, unless nothing is made from the text.
            */
-          if( webvtt_string_length( &cue->body ) &&
-              WEBVTT_FAILED( webvtt_string_putc( &cue->body, '\n' ) ) ) {
-            status = WEBVTT_OUT_OF_MEMORY;
-            goto _finish;
+          if( self->projection & CUE_TEXT_PROJECTION ) {
+            if( WEBVTT_FAILED( materialize_body( self, cue ) ) ||
+                ( webvtt_string_length( &cue->body ) &&
+                  WEBVTT_FAILED( webvtt_string_putc( &cue->body,
+                                                     '\n' ) ) ) ) {
+              status = WEBVTT_OUT_OF_MEMORY;
+              goto _finish;
+            }
+            webvtt_string_append_string( &cue->body, &self->line_buffer );
           }
-          webvtt_string_append_string( &cue->body, &self->line_buffer );
           webvtt_release_string( &self->line_buffer );
           flags = 0;
         }
@@ -929,6 +1413,13 @@ _finish:
   if( finish ) {
     finished = 1;
   }
+  if( finished ) {
+    if( WEBVTT_FAILED( status ) ) {
+      webvtt_release_buffer( &self->body_source );
+    } else if( WEBVTT_FAILED( status = finish_body( self, cue ) ) ) {
+      ERROR( WEBVTT_ALLOCATION_FAILED );
+    }
+  }
 
   /**
    * If we didn't encounter 2 successive EOLs, and it's not the final buffer in
@@ -956,10 +1447,22 @@ webvtt_proc_cuetext( webvtt_parser self, const char *b,
     if( self->mode != M_SKIP_CUE ) {
       /**
        * Once we've successfully read the cuetext into line_buffer, call the
-       * cuetext parser from cuetext.c
+       * cuetext parser from cuetext.c, or leave that to the first
+       * webvtt_cue_get_node_head() in lazy mode
        */
-      status = webvtt_parse_cuetext( self, cue, &cue->body,
-                                     self->finished );
+      if( !( self->projection & WEBVTT_PROJECT_NODES ) ) {
+        /* Nothing to parse */
+      } else if( self->lazy_cuetext && !self->time_offset ) {
+        cue->flags |= CUE_TEXT_PENDING |
+                      ( self->flat_node_tree ? CUE_TEXT_FLAT : 0 );
+      } else {
+        status = webvtt_parse_cuetext( self, cue, &cue->body,
+                                       self->finished );
+        if( !( self->projection & WEBVTT_PROJECT_BODY ) ) {
+          webvtt_release_string( &cue->body );
+          webvtt_init_string( &cue->body );
+        }
+      }
 
       /**
        * return the cue to the user, if possible.
@@ -991,12 +1494,11 @@ webvtt_proc_cuetext( webvtt_parser self, const char *b,
   return status;
 }
 
-WEBVTT_EXPORT webvtt_status
-webvtt_parse_chunk( webvtt_parser self, const void *buffer, webvtt_uint len )
+static webvtt_status
+parse_chunk( webvtt_parser self, const char *b, webvtt_uint len )
 {
   webvtt_status status;
   webvtt_uint pos = 0;
-  const char *b = ( const char * )buffer;
 
   while( pos < len ) {
     switch( self->mode ) {
@@ -1038,6 +1540,85 @@ webvtt_parse_chunk( webvtt_parser self, const void *buffer, webvtt_uint len )
   return WEBVTT_SUCCESS;
 }
 
+/**
+ * Let cue text point into 'source' while parsing. Views can't keep the buffer
+ * alive from inside an arena, so parsers with one copy their cue text.
+ */
+static void
+set_source( webvtt_parser self, webvtt_buffer *source )
+{
+  self->source = self->alloc.arena ? 0 : source;
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_chunk( webvtt_parser self, const void *buffer, webvtt_uint len )
+{
+  webvtt_status status;
+  webvtt_alloc_context ctx = self->alloc;
+  webvtt_swap_alloc_context( &ctx );
+  status = parse_chunk( self, ( const char * )buffer, len );
+  webvtt_swap_alloc_context( &ctx );
+  return status;
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_chunk_from_buffer( webvtt_parser self, webvtt_buffer *buffer,
+                                webvtt_uint offset, webvtt_uint len )
+{
+  webvtt_status status;
+  webvtt_alloc_context ctx;
+
+  if( !self || !buffer || offset > buffer->length ||
+      len > buffer->length - offset ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  set_source( self, buffer );
+  ctx = self->alloc;
+  webvtt_swap_alloc_context( &ctx );
+  status = parse_chunk( self, buffer->data + offset, len );
+  webvtt_swap_alloc_context( &ctx );
+  self->source = 0;
+  return status;
+}
+
+WEBVTT_INTERN webvtt_status
+webvtt_parse_complete( webvtt_parser self, webvtt_buffer *source,
+                       const char *b, webvtt_uint len )
+{
+  webvtt_status status, finish_status;
+  webvtt_alloc_context ctx;
+
+  set_source( self, source );
+  ctx = self->alloc;
+  webvtt_swap_alloc_context( &ctx );
+  self->complete = 1;
+  status = parse_chunk( self, b, len );
+  self->complete = 0;
+  self->source = 0;
+  finish_status = finish_parsing( self );
+  webvtt_swap_alloc_context( &ctx );
+  return WEBVTT_FAILED( status ) ? status : finish_status;
+}
+
+WEBVTT_INTERN void
+webvtt_parser_skip_header( webvtt_parser self, webvtt_uint line )
+{
+  /* This is where T_TAG leaves the parser, once T_EOL has counted the EOLs */
+  self->top->state = T_BODY;
+  self->line = line;
+  self->column = 1;
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_parse_buffer( webvtt_parser self, const void *buffer, webvtt_uint len )
+{
+  if( !self || ( !buffer && len ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return webvtt_parse_complete( self, 0, ( const char * )buffer, len );
+}
+
 #undef SP
 #undef AT_BOTTOM
 #undef ON_HEAP
@@ -1217,6 +1798,115 @@ not_timestamp:
   return 0;
 }
 
+/**
+ * SIMD-within-a-register timestamp parsing. The first 8 bytes of both
+ * "HH:MM:SS.mmm" and "MM:SS.mmm" are pairs of digits separated by single
+ * characters ("HH:MM:SS" or "MM:SS.mm"), which can be checked and converted
+ * as one little endian word.
+ */
+#if ( defined(__BYTE_ORDER__) && \
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ) || \
+    defined(__i386__) || defined(__x86_64__) || \
+    defined(_M_IX86) || defined(_M_X64)
+# define SWAR_TIMESTAMPS 1
+
+/* Bytes 0, 1, 3, 4, 6 and 7 of the word */
+# define PAIR_DIGITS_HIGH ( 0xF0F000F0F000F0F0 )
+# define PAIR_DIGITS_LOW ( 0x0F0F000F0F000F0F )
+# define PAIR_DIGITS_ZERO ( 0x3030003030003030 )
+# define PAIR_DIGITS_SIX ( 0x0606000606000606 )
+
+static int
+parse_timestamp_swar( const char *b, webvtt_uint len, int *tokenLength,
+                      webvtt_timestamp *result )
+{
+  webvtt_uint64 w, d, t;
+  webvtt_uint32 tail;
+  webvtt_uint hours, minutes, seconds, millis, n;
+
+  if( len < 9 ) {
+    return 0;
+  }
+  memcpy( &w, b, sizeof( w ) );
+
+  /**
+   * A byte is a digit if its high nibble is 3, and stays 3 after adding 6
+   * to it (which carries into the high nibble for anything above '9')
+   */
+  if( ( w & PAIR_DIGITS_HIGH ) != PAIR_DIGITS_ZERO ||
+      ( ( w + PAIR_DIGITS_SIX ) & PAIR_DIGITS_HIGH ) != PAIR_DIGITS_ZERO ||
+      ( ( w >> 16 ) & 0xFF ) != ':' ) {
+    return 0;
+  }
+
+  /**
+   * Byte k of 't' is 10 * digit k + digit k + 1, so bytes 0, 3 and 6 hold
+   * the values of the three pairs. None of them can carry into the next.
+   */
+  d = w & PAIR_DIGITS_LOW;
+  t = d * 10 + ( d >> 8 );
+
+  if( ( ( w >> 40 ) & 0xFF ) == ':' ) {
+    /* HH:MM:SS followed by ".mmm" */
+    if( len < 12 ) {
+      return 0;
+    }
+    memcpy( &tail, b + 8, sizeof( tail ) );
+    if( ( tail & 0xF0F0F0FF ) != 0x3030302E ||
+        ( ( tail + 0x06060600 ) & 0xF0F0F000 ) != 0x30303000 ) {
+      return 0;
+    }
+    hours = (webvtt_uint)( t & 0xFF );
+    minutes = (webvtt_uint)( ( t >> 24 ) & 0xFF );
+    seconds = (webvtt_uint)( ( t >> 48 ) & 0xFF );
+    millis = ( ( tail >> 8 ) & 0x0F ) * 100 + ( ( tail >> 16 ) & 0x0F ) * 10
+             + ( ( tail >> 24 ) & 0x0F );
+    n = 12;
+  } else if( ( ( w >> 40 ) & 0xFF ) == '.' && webvtt_isdigit( b[ 8 ] ) ) {
+    /* MM:SS.mm followed by the last digit of the milliseconds */
+    hours = 0;
+    minutes = (webvtt_uint)( t & 0xFF );
+    seconds = (webvtt_uint)( ( t >> 24 ) & 0xFF );
+    millis = (webvtt_uint)( ( t >> 48 ) & 0xFF ) * 10 + ( b[ 8 ] - '0' );
+    n = 9;
+  } else {
+    return 0;
+  }
+
+  /**
+   * Leave more digits, and out of range values (which are malformed, and
+   * carried into the next component), to the general routine
+   */
+  if( ( len > n && webvtt_isdigit( b[ n ] ) ) || minutes > 59 ||
+      seconds > 59 ) {
+    return 0;
+  }
+
+  *result = ( webvtt_timestamp )hours * MSECS_PER_HOUR
+            + ( webvtt_timestamp )minutes * MSECS_PER_MINUTE
+            + ( webvtt_timestamp )seconds * MSECS_PER_SECOND
+            + millis;
+  if( tokenLength ) {
+    *tokenLength = (int)n;
+  }
+  return 1;
+}
+#endif
+
+WEBVTT_INTERN int
+webvtt_parse_timestamp_n( const char *b, webvtt_uint len, int *tokenLength,
+                          webvtt_timestamp *result )
+{
+#if SWAR_TIMESTAMPS
+  if( parse_timestamp_swar( b, len, tokenLength, result ) ) {
+    return 1;
+  }
+#else
+  ( void )len;
+#endif
+  return webvtt_parse_timestamp( b, tokenLength, result );
+}
+
 WEBVTT_INTERN webvtt_bool
 token_in_list( webvtt_token token, const webvtt_token list[] )
 {
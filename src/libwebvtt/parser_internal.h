@@ -29,6 +29,7 @@
 # define __INTERN_PARSER_H__
 # include <webvtt/parser.h>
 # include "string_internal.h"
+# include "alloc_internal.h"
 # ifndef NDEBUG
 #   define NDEBUG
 # endif
@@ -129,7 +130,8 @@ webvtt_parse_state_t {
 typedef enum
 webvtt_lexer_state_t {
   L_START = 0, L_BOM0, L_BOM1, L_WEBVTT0, L_WEBVTT1, L_WEBVTT2, L_WEBVTT3,
-  L_WEBVTT4, L_NEWLINE0, L_WHITESPACE
+  L_WEBVTT4, L_NEWLINE0, L_WHITESPACE,
+  L_STATE_COUNT
 } webvtt_lexer_state;
 
 typedef struct
@@ -176,6 +178,23 @@ webvtt_parser_t {
   webvtt_uint column;
   webvtt_cue_fn read;
   webvtt_error_fn error;
+  /**
+   * With webvtt_create_batch_parser(), 'read' is NULL, and 'batch_count'
+   * cues wait in 'batch' to be handed to 'read_batch'
+   */
+  webvtt_cues_fn read_batch;
+  webvtt_cue **batch;
+  webvtt_uint batch_count;
+  webvtt_uint batch_size;
+  /**
+   * With webvtt_create_pull_parser(), neither callback is set, and
+   * 'ring_count' cues wait in 'ring', starting at 'ring_head', to be taken by
+   * webvtt_parser_next_cue()
+   */
+  webvtt_cue **ring;
+  webvtt_uint ring_head;
+  webvtt_uint ring_count;
+  webvtt_uint ring_alloc;
   void *userdata;
   webvtt_bool finished;
 
@@ -199,11 +218,66 @@ webvtt_parser_t {
   webvtt_uint line_pos;
   webvtt_string line_buffer;
 
+  /**
+   * Arena or object pool to allocate parse results from, if any
+   */
+  webvtt_alloc_context alloc;
+
+  /**
+   * Table interning tag names, classes and annotations (NULL unless asked for)
+   */
+  webvtt_intern_table *interns;
+
+  /**
+   * Build a webvtt_node_tree rather than webvtt_node objects for cue text
+   */
+  webvtt_bool flat_node_tree;
+
+  /**
+   * Leave cue text to be parsed on first access
+   */
+  webvtt_bool lazy_cuetext;
+
+  /**
+   * webvtt_projection flags of the cue parts to produce
+   */
+  webvtt_uint projection;
+
+  /**
+   * Parse an HLS segment, moving cue times by 'time_offset' once its
+   * X-TIMESTAMP-MAP header has been read
+   */
+  webvtt_bool hls_segment;
+  webvtt_uint64 mpegts_base;
+  webvtt_int64 time_offset;
+
+  /**
+   * Buffer being parsed by webvtt_parse_chunk_from_buffer(), if any, and the
+   * part of it holding the cue text read so far, while that's still one
+   * contiguous run of lines which can become a view rather than a copy
+   */
+  webvtt_buffer *source;
+  webvtt_buffer *body_source;
+  webvtt_uint body_begin;
+  webvtt_uint body_end;
+
+  /**
+   * Set while webvtt_parse_buffer() parses the rest of the input in one
+   * piece, so that no line is incomplete
+   */
+  webvtt_bool complete;
+
   /**
    * tokenizer
    */
   webvtt_lexer_state tstate;
+  /**
+   * Length of the current token. Its bytes are only copied into 'token'
+   * when it is split between chunks: 'token_saved' are held there, and the
+   * rest immediately precede the lexer's position in the current buffer.
+   */
   webvtt_uint token_pos;
+  webvtt_uint token_saved;
   char token[0x100];
 };
 
@@ -215,6 +289,68 @@ WEBVTT_INTERN webvtt_status
 webvtt_lex_word( webvtt_parser self, webvtt_string *pba, const char *buffer,
                  webvtt_uint *pos, webvtt_uint length, webvtt_bool finish );
 
+/**
+ * Text of the token just returned by webvtt_lex(), which ended at 'pos' in
+ * 'buffer'. It is self->token_pos bytes long, and only valid until the next
+ * call to the lexer.
+ */
+WEBVTT_INTERN const char *
+webvtt_lex_token_text( webvtt_parser self, const char *buffer,
+                       webvtt_uint pos );
+
+/**
+ * 'time' moved by 'offset' milliseconds, or 0 if that would be before 0
+ */
+WEBVTT_INTERN webvtt_timestamp
+webvtt_offset_timestamp( webvtt_timestamp time, webvtt_int64 offset );
+
+/**
+ * Release everything held by the state stack, and go back to the parser's
+ * own stack if it had to grow
+ */
+WEBVTT_INTERN void
+cleanup_stack( webvtt_parser self );
+
+/**
+ * Hand a finished cue to the application, or add it to the batch or ring
+ */
+WEBVTT_INTERN void
+webvtt_deliver_cue( webvtt_parser self, webvtt_cue *cue );
+
+/**
+ * Hand any cues waiting in the batch to the application. Done before
+ * reporting an error, so that the cues preceding it are seen first.
+ */
+WEBVTT_INTERN void
+webvtt_flush_cues( webvtt_parser self );
+
+/**
+ * Parse 'len' bytes at 'b', which are the whole of the remaining input, and
+ * finish parsing. If 'source' is not NULL, 'b' lies within it, and cue text
+ * may be left pointing into it, as with webvtt_parse_chunk_from_buffer().
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_parse_complete( webvtt_parser self, webvtt_buffer *source,
+                       const char *b, webvtt_uint len );
+
+/**
+ * Put a parser which hasn't been given any input yet into the state it would
+ * be in after reading the file header and a blank line, about to read line
+ * number 'line'. Used to parse the parts of a file which follow the header
+ * with parsers of their own.
+ */
+WEBVTT_INTERN void
+webvtt_parser_skip_header( webvtt_parser self, webvtt_uint line );
+
+/**
+ * Parse the 'len' bytes at 'b' as webvtt_parse_buffer() would, splitting
+ * them into segments of at least 'min_segment' bytes which are parsed on up
+ * to 'threads' threads. See webvtt_parse_buffer_parallel().
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_parse_parallel( webvtt_parser self, const char *b, webvtt_uint len,
+                       webvtt_uint threads, webvtt_uint min_segment );
+
 /* Tokenize newline sequence, without incrementing 'self->line'. Returns
  * BAD_TOKEN when a newline sequence is not found. */
 WEBVTT_INTERN webvtt_token
@@ -248,6 +384,16 @@ WEBVTT_INTERN int
 webvtt_parse_timestamp( const char *b, int *tokenLength,
                         webvtt_timestamp *result );
 
+/**
+ * webvtt_parse_timestamp() for text known to hold at least 'len' bytes.
+ * Well formed HH:MM:SS.mmm and MM:SS.mmm timestamps are converted with a few
+ * word sized operations; anything else is left to webvtt_parse_timestamp(),
+ * so the results are always the same.
+ */
+WEBVTT_INTERN int
+webvtt_parse_timestamp_n( const char *b, webvtt_uint len, int *tokenLength,
+                          webvtt_timestamp *result );
+
 WEBVTT_INTERN webvtt_status
 do_push( webvtt_parser self, webvtt_uint token, webvtt_uint back,
          webvtt_uint state, void *data, webvtt_state_value_type type,
@@ -358,6 +504,9 @@ if( !(condition) ) { \
 #define __ERROR_AT_OR(errno, line, column, __or) \
 do \
 { \
+  if( self->batch_count ) { \
+    webvtt_flush_cues( self ); \
+  } \
   if( !self->error \
     || self->error( (self->userdata), (line), (column), (errno) ) < 0 ) { \
     __or \
@@ -0,0 +1,396 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "scan_internal.h"
+
+#if !defined(WEBVTT_NO_SIMD) && ( WEBVTT_CC_GCC || WEBVTT_CC_MSVC ) && \
+    ( defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || \
+      ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+# define HAVE_SSE2 1
+# include <emmintrin.h>
+# if ( WEBVTT_CC_GCC && ( defined(__clang__) || __GNUC__ > 4 || \
+       ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 ) ) ) || \
+     ( WEBVTT_CC_MSVC && _MSC_VER >= 1800 )
+#   define HAVE_AVX2 1
+#   include <immintrin.h>
+# endif
+#endif
+
+#if WEBVTT_CC_MSVC
+# include <intrin.h>
+# define TARGET_AVX2
+static WEBVTT_INLINE unsigned
+ctz( unsigned x )
+{
+  unsigned long i;
+  _BitScanForward( &i, x );
+  return (unsigned)i;
+}
+#else
+# if HAVE_AVX2
+#   include <cpuid.h>
+# endif
+# define TARGET_AVX2 __attribute__(( target( "avx2" ) ))
+# define ctz( x ) ( (unsigned)__builtin_ctz( x ) )
+#endif
+
+#define IS_SPACE( c ) \
+  ( (c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r' || (c) == '\f' )
+
+/**
+ * Portable implementations, also used for whatever is left over at the end
+ * of a buffer by the vector ones.
+ */
+static const char *
+scalar_eol( const char *p, const char *end )
+{
+  while( p < end && *p != '\r' && *p != '\n' ) {
+    ++p;
+  }
+  return p;
+}
+
+static const char *
+scalar_line( const char *p, const char *end )
+{
+  while( p < end && *p != '\r' && *p != '\n' && *p != '\0' ) {
+    ++p;
+  }
+  return p;
+}
+
+static const char *
+scalar_markup( const char *p, const char *end )
+{
+  while( p < end && *p != '<' && *p != '&' && *p != '\0' ) {
+    ++p;
+  }
+  return p;
+}
+
+static const char *
+scalar_whitespace( const char *p, const char *end )
+{
+  while( p < end && IS_SPACE( *p ) ) {
+    ++p;
+  }
+  return p;
+}
+
+#if HAVE_SSE2
+/**
+ * SSE2: compare 16 bytes at a time, and find the first match from the mask
+ * of compare results.
+ */
+# define SSE2_EQ( v, c ) _mm_cmpeq_epi8( ( v ), _mm_set1_epi8( c ) )
+
+static WEBVTT_INLINE unsigned
+sse2_eol_mask( __m128i v )
+{
+  return (unsigned)_mm_movemask_epi8( _mm_or_si128( SSE2_EQ( v, '\r' ),
+                                                    SSE2_EQ( v, '\n' ) ) );
+}
+
+static WEBVTT_INLINE unsigned
+sse2_line_mask( __m128i v )
+{
+  return (unsigned)_mm_movemask_epi8(
+    _mm_or_si128( _mm_or_si128( SSE2_EQ( v, '\r' ), SSE2_EQ( v, '\n' ) ),
+                  SSE2_EQ( v, '\0' ) ) );
+}
+
+static WEBVTT_INLINE unsigned
+sse2_markup_mask( __m128i v )
+{
+  return (unsigned)_mm_movemask_epi8(
+    _mm_or_si128( _mm_or_si128( SSE2_EQ( v, '<' ), SSE2_EQ( v, '&' ) ),
+                  SSE2_EQ( v, '\0' ) ) );
+}
+
+static WEBVTT_INLINE unsigned
+sse2_non_space_mask( __m128i v )
+{
+  __m128i space = _mm_or_si128(
+    _mm_or_si128( SSE2_EQ( v, ' ' ), SSE2_EQ( v, '\t' ) ),
+    _mm_or_si128( _mm_or_si128( SSE2_EQ( v, '\n' ), SSE2_EQ( v, '\r' ) ),
+                  SSE2_EQ( v, '\f' ) ) );
+  return ~(unsigned)_mm_movemask_epi8( space ) & 0xFFFF;
+}
+
+static const char *
+sse2_eol( const char *p, const char *end )
+{
+  unsigned m;
+  for( ; end - p >= 16; p += 16 ) {
+    if( ( m = sse2_eol_mask( _mm_loadu_si128( (const __m128i *)p ) ) ) ) {
+      return p + ctz( m );
+    }
+  }
+  return scalar_eol( p, end );
+}
+
+static const char *
+sse2_line( const char *p, const char *end )
+{
+  unsigned m;
+  for( ; end - p >= 16; p += 16 ) {
+    if( ( m = sse2_line_mask( _mm_loadu_si128( (const __m128i *)p ) ) ) ) {
+      return p + ctz( m );
+    }
+  }
+  return scalar_line( p, end );
+}
+
+static const char *
+sse2_markup( const char *p, const char *end )
+{
+  unsigned m;
+  for( ; end - p >= 16; p += 16 ) {
+    if( ( m = sse2_markup_mask( _mm_loadu_si128( (const __m128i *)p ) ) ) ) {
+      return p + ctz( m );
+    }
+  }
+  return scalar_markup( p, end );
+}
+
+static const char *
+sse2_whitespace( const char *p, const char *end )
+{
+  unsigned m;
+  for( ; end - p >= 16; p += 16 ) {
+    if( ( m = sse2_non_space_mask( _mm_loadu_si128( (const __m128i *)p ) ) ) ) {
+      return p + ctz( m );
+    }
+  }
+  return scalar_whitespace( p, end );
+}
+#endif
+
+#if HAVE_AVX2
+/**
+ * AVX2: as for SSE2, 32 bytes at a time
+ */
+# define AVX2_EQ( v, c ) _mm256_cmpeq_epi8( ( v ), _mm256_set1_epi8( c ) )
+
+static TARGET_AVX2 WEBVTT_INLINE unsigned
+avx2_markup_mask( __m256i v )
+{
+  return (unsigned)_mm256_movemask_epi8(
+    _mm256_or_si256( _mm256_or_si256( AVX2_EQ( v, '<' ), AVX2_EQ( v, '&' ) ),
+                     AVX2_EQ( v, '\0' ) ) );
+}
+
+static TARGET_AVX2 const char *
+avx2_eol( const char *p, const char *end )
+{
+  unsigned m;
+  __m256i v;
+  for( ; end - p >= 32; p += 32 ) {
+    v = _mm256_loadu_si256( (const __m256i *)p );
+    if( ( m = (unsigned)_mm256_movemask_epi8(
+                _mm256_or_si256( AVX2_EQ( v, '\r' ), AVX2_EQ( v, '\n' ) ) ) ) ) {
+      return p + ctz( m );
+    }
+  }
+  return sse2_eol( p, end );
+}
+
+static TARGET_AVX2 const char *
+avx2_line( const char *p, const char *end )
+{
+  unsigned m;
+  __m256i v;
+  for( ; end - p >= 32; p += 32 ) {
+    v = _mm256_loadu_si256( (const __m256i *)p );
+    if( ( m = (unsigned)_mm256_movemask_epi8(
+                _mm256_or_si256( _mm256_or_si256( AVX2_EQ( v, '\r' ),
+                                                  AVX2_EQ( v, '\n' ) ),
+                                 AVX2_EQ( v, '\0' ) ) ) ) ) {
+      return p + ctz( m );
+    }
+  }
+  return sse2_line( p, end );
+}
+
+static TARGET_AVX2 const char *
+avx2_markup( const char *p, const char *end )
+{
+  unsigned m;
+  for( ; end - p >= 32; p += 32 ) {
+    if( ( m = avx2_markup_mask(
+                _mm256_loadu_si256( (const __m256i *)p ) ) ) ) {
+      return p + ctz( m );
+    }
+  }
+  return sse2_markup( p, end );
+}
+
+static TARGET_AVX2 const char *
+avx2_whitespace( const char *p, const char *end )
+{
+  unsigned m;
+  __m256i v, space;
+  for( ; end - p >= 32; p += 32 ) {
+    v = _mm256_loadu_si256( (const __m256i *)p );
+    space = _mm256_or_si256(
+      _mm256_or_si256( AVX2_EQ( v, ' ' ), AVX2_EQ( v, '\t' ) ),
+      _mm256_or_si256( _mm256_or_si256( AVX2_EQ( v, '\n' ),
+                                        AVX2_EQ( v, '\r' ) ),
+                       AVX2_EQ( v, '\f' ) ) );
+    if( ( m = ~(unsigned)_mm256_movemask_epi8( space ) ) ) {
+      return p + ctz( m );
+    }
+  }
+  return sse2_whitespace( p, end );
+}
+
+static int
+cpu_has_avx2( void )
+{
+# if WEBVTT_CC_MSVC
+  int info[ 4 ];
+  __cpuid( info, 0 );
+  if( info[ 0 ] < 7 ) {
+    return 0;
+  }
+  __cpuid( info, 1 );
+  /* The OS must save the YMM registers, as well as the CPU having AVX2 */
+  if( !( info[ 2 ] & ( 1 << 27 ) ) || ( _xgetbv( 0 ) & 6 ) != 6 ) {
+    return 0;
+  }
+  __cpuidex( info, 7, 0 );
+  return ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+# else
+  unsigned a, b, c, d, xcr0;
+  if( __get_cpuid_max( 0, 0 ) < 7 || !__get_cpuid( 1, &a, &b, &c, &d ) ) {
+    return 0;
+  }
+  /* The OS must save the YMM registers, as well as the CPU having AVX2 */
+  if( !( c & ( 1 << 27 ) ) ) {
+    return 0;
+  }
+  __asm__ __volatile__( ".byte 0x0f, 0x01, 0xd0" /* xgetbv */
+                        : "=a" ( xcr0 ), "=d" ( d ) : "c" ( 0 ) );
+  if( ( xcr0 & 6 ) != 6 ) {
+    return 0;
+  }
+  __cpuid_count( 7, 0, a, b, c, d );
+  return ( b & ( 1 << 5 ) ) != 0;
+# endif
+}
+#endif
+
+/**
+ * Runtime dispatch
+ */
+typedef struct
+scan_kernels_t {
+  const char *( *eol )( const char *p, const char *end );
+  const char *( *line )( const char *p, const char *end );
+  const char *( *markup )( const char *p, const char *end );
+  const char *( *whitespace )( const char *p, const char *end );
+} scan_kernels;
+
+static const scan_kernels kernels_by_level[] = {
+  { scalar_eol, scalar_line, scalar_markup, scalar_whitespace },
+#if HAVE_SSE2
+  { sse2_eol, sse2_line, sse2_markup, sse2_whitespace },
+#endif
+#if HAVE_AVX2
+  { avx2_eol, avx2_line, avx2_markup, avx2_whitespace },
+#endif
+};
+
+/**
+ * Chosen on first use. Threads racing to choose will all choose the same.
+ */
+static const scan_kernels *kernels;
+
+static webvtt_scan_level
+best_level( void )
+{
+#if HAVE_AVX2
+  if( cpu_has_avx2() ) {
+    return WEBVTT_SCAN_AVX2;
+  }
+#endif
+#if HAVE_SSE2
+  /* Always there on the targets HAVE_SSE2 is defined for */
+  return WEBVTT_SCAN_SSE2;
+#else
+  return WEBVTT_SCAN_SCALAR;
+#endif
+}
+
+static WEBVTT_INLINE const scan_kernels *
+get_kernels( void )
+{
+  if( !kernels ) {
+    kernels = kernels_by_level + best_level();
+  }
+  return kernels;
+}
+
+WEBVTT_INTERN webvtt_scan_level
+webvtt_scan_get_level( void )
+{
+  return (webvtt_scan_level)( get_kernels() - kernels_by_level );
+}
+
+WEBVTT_INTERN webvtt_bool
+webvtt_scan_set_level( webvtt_scan_level level )
+{
+  if( level > best_level() ) {
+    return 0;
+  }
+  kernels = kernels_by_level + level;
+  return 1;
+}
+
+WEBVTT_INTERN const char *
+webvtt_scan_eol( const char *p, const char *end )
+{
+  return get_kernels()->eol( p, end );
+}
+
+WEBVTT_INTERN const char *
+webvtt_scan_line( const char *p, const char *end )
+{
+  return get_kernels()->line( p, end );
+}
+
+WEBVTT_INTERN const char *
+webvtt_scan_markup( const char *p, const char *end )
+{
+  return get_kernels()->markup( p, end );
+}
+
+WEBVTT_INTERN const char *
+webvtt_scan_whitespace( const char *p, const char *end )
+{
+  return get_kernels()->whitespace( p, end );
+}
@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __INTERN_SCAN_H__
+# define __INTERN_SCAN_H__
+# include <webvtt/util.h>
+
+/**
+ * Character class scanning.
+ *
+ * Each routine returns a pointer to the first character in [p, end) of the
+ * class it looks for, or 'end' if there is none. They are implemented with
+ * SSE2 or AVX2 where the CPU supports it, chosen the first time one of them
+ * is called, and with plain loops otherwise.
+ */
+
+/**
+ * Find the next CR or LF
+ */
+WEBVTT_INTERN const char *
+webvtt_scan_eol( const char *p, const char *end );
+
+/**
+ * Find the next CR, LF or NUL
+ */
+WEBVTT_INTERN const char *
+webvtt_scan_line( const char *p, const char *end );
+
+/**
+ * Find the next '<', '&' or NUL
+ */
+WEBVTT_INTERN const char *
+webvtt_scan_markup( const char *p, const char *end );
+
+/**
+ * Find the end of a run of whitespace: the first character which isn't a
+ * space, tab, form feed, CR or LF.
+ */
+WEBVTT_INTERN const char *
+webvtt_scan_whitespace( const char *p, const char *end );
+
+/**
+ * Implementations available. Which one is used can be changed for testing
+ * and benchmarking with webvtt_scan_set_level(), which fails if the CPU (or
+ * the compiler) doesn't support the requested level.
+ */
+typedef enum
+webvtt_scan_level_t {
+  WEBVTT_SCAN_SCALAR = 0,
+  WEBVTT_SCAN_SSE2,
+  WEBVTT_SCAN_AVX2
+} webvtt_scan_level;
+
+WEBVTT_INTERN webvtt_scan_level
+webvtt_scan_get_level( void );
+
+WEBVTT_INTERN webvtt_bool
+webvtt_scan_set_level( webvtt_scan_level level );
+
+#endif
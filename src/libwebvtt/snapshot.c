@@ -0,0 +1,466 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "parser_internal.h"
+#include <string.h>
+
+/**
+ * A snapshot starts with SNAPSHOT_MAGIC and the version of its layout, which
+ * must be changed whenever the layout is. Everything after that is unsigned
+ * integers, stored as 7 bits per byte, least significant first, with the top
+ * bit set on every byte but the last, and byte strings, stored as their
+ * length and then their bytes. The last 4 bytes are an FNV-1a hash of the
+ * rest, least significant first, so that a damaged snapshot is turned away
+ * rather than leaving the parser in a state it could never have reached.
+ */
+static const char snapshot_magic[] = { 'W', 'V', 'T', 'S' };
+#define SNAPSHOT_VERSION ( 2 )
+
+/**
+ * Deepest state stack accepted by webvtt_parser_restore(). The parser itself
+ * never gets anywhere near this deep.
+ */
+#define MAX_SNAPSHOT_DEPTH ( 0x10000 )
+
+typedef struct
+snapshot_writer_t {
+  unsigned char *data;
+  webvtt_uint size;
+  webvtt_uint length; /* including whatever didn't fit */
+  webvtt_uint32 hash;
+} snapshot_writer;
+
+typedef struct
+snapshot_reader_t {
+  const unsigned char *p;
+  const unsigned char *end;
+  webvtt_bool bad;
+} snapshot_reader;
+
+#define FNV_OFFSET ( 2166136261U )
+
+static webvtt_uint32
+fnv1a( webvtt_uint32 h, const unsigned char *bytes, webvtt_uint length )
+{
+  while( length-- ) {
+    h = ( h ^ *bytes++ ) * 16777619U;
+  }
+  return h;
+}
+
+static void
+write_bytes( snapshot_writer *w, const void *bytes, webvtt_uint length )
+{
+  if( w->length + length <= w->size ) {
+    memcpy( w->data + w->length, bytes, length );
+  }
+  w->length += length;
+  w->hash = fnv1a( w->hash, (const unsigned char *)bytes, length );
+}
+
+static void
+write_uint( snapshot_writer *w, webvtt_uint64 value )
+{
+  unsigned char bytes[ 10 ];
+  webvtt_uint n = 0;
+  while( value >= 0x80 ) {
+    bytes[ n++ ] = (unsigned char)( value | 0x80 );
+    value >>= 7;
+  }
+  bytes[ n++ ] = (unsigned char)value;
+  write_bytes( w, bytes, n );
+}
+
+/**
+ * Strings are stored as their length plus one, or 0 for a string with no
+ * data at all, as the parser tells those apart from empty strings
+ */
+static void
+write_string( snapshot_writer *w, const webvtt_string *str,
+              const char *text, webvtt_uint length )
+{
+  if( !text && !str->d ) {
+    write_uint( w, 0 );
+    return;
+  }
+  if( !text ) {
+    /* Views aren't NUL terminated, but only the length is needed here */
+    text = str->d->text;
+    length = webvtt_string_length( str );
+  }
+  write_uint( w, (webvtt_uint64)length + 1 );
+  write_bytes( w, text, length );
+}
+
+static void
+write_cue( webvtt_parser self, snapshot_writer *w, const webvtt_cue *cue )
+{
+  write_uint( w, cue->flags );
+  write_uint( w, cue->from );
+  write_uint( w, cue->until );
+  write_uint( w, cue->settings.vertical );
+  /* 'line' may be negative, or WEBVTT_AUTO */
+  write_uint( w, (webvtt_uint)cue->settings.line );
+  write_uint( w, cue->settings.position );
+  write_uint( w, cue->settings.size );
+  write_uint( w, cue->settings.align );
+  write_uint( w, cue->snap_to_lines );
+  write_string( w, &cue->id, 0, 0 );
+  /**
+   * Cue text read so far may still be a view of the buffer being parsed,
+   * which won't be there when parsing resumes, so store the text itself
+   */
+  if( self->body_source && cue == self->top->v.cue ) {
+    write_string( w, &cue->body, self->body_source->data + self->body_begin,
+                  self->body_end - self->body_begin );
+  } else {
+    write_string( w, &cue->body, 0, 0 );
+  }
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_parser_snapshot( webvtt_parser self, void *buffer, webvtt_uint size,
+                        webvtt_uint *length )
+{
+  snapshot_writer w;
+  webvtt_state *st;
+  webvtt_uint saved;
+  unsigned char hash[ 4 ];
+
+  if( !self || !length || ( !buffer && size ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  /* Snapshots are taken between chunks, not from within a callback */
+  if( self->source ) {
+    return WEBVTT_UNFINISHED;
+  }
+  webvtt_flush_cues( self );
+
+  w.data = (unsigned char *)buffer;
+  w.size = size;
+  w.length = 0;
+  w.hash = FNV_OFFSET;
+  write_bytes( &w, snapshot_magic, sizeof( snapshot_magic ) );
+  write_uint( &w, SNAPSHOT_VERSION );
+  write_uint( &w, self->state );
+  write_uint( &w, self->bytes );
+  write_uint( &w, self->line );
+  write_uint( &w, self->column );
+  write_uint( &w, self->finished );
+  write_uint( &w, self->cuetext_line );
+  write_uint( &w, self->mode );
+  write_uint( &w, self->popped );
+  write_uint( &w, (webvtt_uint)self->truncate );
+  write_uint( &w, self->line_pos );
+  write_uint( &w, (webvtt_uint64)self->time_offset );
+  write_string( &w, &self->line_buffer, 0, 0 );
+  /* Only a token split between chunks has saved bytes worth keeping */
+  saved = self->tstate == L_START ? 0 : self->token_saved;
+  write_uint( &w, self->tstate );
+  write_uint( &w, saved );
+  write_bytes( &w, self->token, saved );
+
+  /**
+   * The frame above the top of the stack is included, as the parser looks at
+   * the one it has just popped
+   */
+  write_uint( &w, (webvtt_uint)( self->top - self->stack ) );
+  for( st = self->stack; st <= self->top + 1; ++st ) {
+    write_uint( &w, st->state );
+    write_uint( &w, st->flags );
+    write_uint( &w, (webvtt_uint)( st->token - BADTOKEN ) );
+    write_uint( &w, st->back );
+    write_uint( &w, st->line );
+    write_uint( &w, st->column );
+    write_uint( &w, st->type );
+    switch( st->type ) {
+      case V_NONE:
+        break;
+      case V_INTEGER:
+        write_uint( &w, st->v.value );
+        break;
+      case V_TEXT:
+        write_string( &w, &st->v.text, 0, 0 );
+        break;
+      case V_CUE:
+        write_uint( &w, st->v.cue != 0 );
+        if( st->v.cue ) {
+          write_cue( self, &w, st->v.cue );
+        }
+        break;
+      default:
+        /* The parser doesn't use the other kinds of value */
+        return WEBVTT_NOT_SUPPORTED;
+    }
+  }
+
+  hash[ 0 ] = (unsigned char)w.hash;
+  hash[ 1 ] = (unsigned char)( w.hash >> 8 );
+  hash[ 2 ] = (unsigned char)( w.hash >> 16 );
+  hash[ 3 ] = (unsigned char)( w.hash >> 24 );
+  write_bytes( &w, hash, sizeof( hash ) );
+
+  *length = w.length;
+  return w.length <= size ? WEBVTT_SUCCESS : WEBVTT_OUT_OF_MEMORY;
+}
+
+static webvtt_uint64
+read_uint64( snapshot_reader *r )
+{
+  webvtt_uint64 value = 0;
+  int shift = 0;
+  while( r->p < r->end && shift < 64 ) {
+    unsigned char byte = *r->p++;
+    value |= (webvtt_uint64)( byte & 0x7F ) << shift;
+    if( !( byte & 0x80 ) ) {
+      return value;
+    }
+    shift += 7;
+  }
+  r->bad = 1;
+  return 0;
+}
+
+/**
+ * Read an unsigned integer, which must be no more than 'max'
+ */
+static webvtt_uint
+read_uint( snapshot_reader *r, webvtt_uint max )
+{
+  webvtt_uint64 value = read_uint64( r );
+  if( value > max ) {
+    r->bad = 1;
+    return 0;
+  }
+  return (webvtt_uint)value;
+}
+
+static webvtt_status
+read_string( snapshot_reader *r, webvtt_string *str )
+{
+  webvtt_uint length = read_uint( r, 0x7FFFFFFF );
+  if( r->bad || !length ) {
+    return WEBVTT_SUCCESS;
+  }
+  if( --length > (webvtt_uint)( r->end - r->p ) ) {
+    r->bad = 1;
+    return WEBVTT_SUCCESS;
+  }
+  webvtt_release_string( str );
+  if( !length ) {
+    webvtt_init_string( str );
+    return WEBVTT_SUCCESS;
+  }
+  r->p += length;
+  return webvtt_create_string_with_text( str, (const char *)r->p - length,
+                                         (int)length );
+}
+
+static webvtt_status
+read_cue( snapshot_reader *r, webvtt_cue **pcue )
+{
+  webvtt_status status;
+  webvtt_cue *cue;
+
+  if( WEBVTT_FAILED( status = webvtt_create_cue( pcue ) ) ) {
+    return status;
+  }
+  cue = *pcue;
+  cue->flags = read_uint( r, 0xFFFFFFFF );
+  cue->from = read_uint64( r );
+  cue->until = read_uint64( r );
+  cue->settings.vertical =
+    (webvtt_vertical_type)read_uint( r, WEBVTT_VERTICAL_RL );
+  cue->settings.line = (int)read_uint( r, 0xFFFFFFFF );
+  cue->settings.position = read_uint( r, 0xFFFFFFFF );
+  cue->settings.size = read_uint( r, 0xFFFFFFFF );
+  cue->settings.align = (webvtt_align_type)read_uint( r, WEBVTT_ALIGN_RIGHT );
+  cue->snap_to_lines = read_uint( r, 1 );
+  if( WEBVTT_FAILED( status = read_string( r, &cue->id ) ) ) {
+    return status;
+  }
+  return read_string( r, &cue->body );
+}
+
+/**
+ * Give a parser whose state couldn't be restored the state of a new one
+ */
+static void
+reset_parser( webvtt_parser self )
+{
+  cleanup_stack( self );
+  /* which may have swapped a grown stack for the fixed one */
+  self->top = self->stack;
+  memset( self->stack, 0, self->stack_alloc * sizeof( *self->stack ) );
+  self->top->state = T_INITIAL;
+  webvtt_release_string( &self->line_buffer );
+  self->state = self->bytes = self->cuetext_line = self->line_pos = 0;
+  self->line = self->column = 1;
+  self->finished = self->popped = 0;
+  self->truncate = 0;
+  self->time_offset = 0;
+  self->mode = M_WEBVTT;
+  self->tstate = L_START;
+  self->token_pos = self->token_saved = 0;
+}
+
+static webvtt_status
+restore_state( webvtt_parser self, snapshot_reader *r )
+{
+  webvtt_status status;
+  webvtt_uint depth, i;
+
+  self->state = read_uint( r, 0xFFFFFFFF );
+  self->bytes = read_uint( r, 0xFFFFFFFF );
+  self->line = read_uint( r, 0xFFFFFFFF );
+  self->column = read_uint( r, 0xFFFFFFFF );
+  self->finished = read_uint( r, 1 );
+  self->cuetext_line = read_uint( r, 0xFFFFFFFF );
+  self->mode = (webvtt_parse_mode)read_uint( r, M_SKIP_CUE );
+  self->popped = read_uint( r, 1 );
+  self->truncate = (int)read_uint( r, 0x7FFFFFFF );
+  self->line_pos = read_uint( r, 0xFFFFFFFF );
+  self->time_offset = (webvtt_int64)read_uint64( r );
+  if( WEBVTT_FAILED( status = read_string( r, &self->line_buffer ) ) ) {
+    return status;
+  }
+  self->tstate = (webvtt_lexer_state)read_uint( r, L_STATE_COUNT - 1 );
+  self->token_saved = read_uint( r, sizeof( self->token ) - 1 );
+  if( r->bad || self->token_saved > (webvtt_uint)( r->end - r->p ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  memcpy( self->token, r->p, self->token_saved );
+  self->token[ self->token_saved ] = 0;
+  self->token_pos = self->token_saved;
+  r->p += self->token_saved;
+
+  depth = read_uint( r, MAX_SNAPSHOT_DEPTH );
+  if( r->bad ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  if( depth + 2 > self->stack_alloc ) {
+    webvtt_uint alloc = self->stack_alloc;
+    webvtt_state *stack;
+    while( depth + 2 > alloc ) {
+      alloc <<= 1;
+    }
+    if( !( stack = (webvtt_state *)webvtt_alloc0_as(
+             alloc * sizeof( *stack ), WEBVTT_MEM_PARSER_STACK ) ) ) {
+      return WEBVTT_OUT_OF_MEMORY;
+    }
+    self->stack = stack;
+    self->stack_alloc = alloc;
+  }
+  self->top = self->stack + depth;
+
+  for( i = 0; i <= depth + 1 && !r->bad; ++i ) {
+    webvtt_state *st = self->stack + i;
+    st->state = (webvtt_parse_state)read_uint( r, T_SKIP_SETTING );
+    st->flags = read_uint( r, 0xFFFFFFFF );
+    st->token = (webvtt_token)( (int)read_uint( r, WHITESPACE - BADTOKEN ) +
+                                BADTOKEN );
+    /* Popping a frame mustn't go below the bottom of the stack */
+    st->back = read_uint( r, i );
+    st->line = read_uint( r, 0xFFFFFFFF );
+    st->column = read_uint( r, 0xFFFFFFFF );
+    switch( read_uint( r, V_TOKEN ) ) {
+      case V_NONE:
+        break;
+      case V_INTEGER:
+        st->type = V_INTEGER;
+        st->v.value = read_uint( r, 0xFFFFFFFF );
+        break;
+      case V_TEXT:
+        st->type = V_TEXT;
+        if( WEBVTT_FAILED( status = read_string( r, &st->v.text ) ) ) {
+          return status;
+        }
+        break;
+      case V_CUE:
+        st->type = V_CUE;
+        if( read_uint( r, 1 ) &&
+            WEBVTT_FAILED( status = read_cue( r, &st->v.cue ) ) ) {
+          return status;
+        }
+        break;
+      default:
+        return WEBVTT_INVALID_PARAM;
+    }
+  }
+  if( r->bad || r->p != r->end ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_parser_restore( webvtt_parser self, const void *snapshot,
+                       webvtt_uint length )
+{
+  snapshot_reader r;
+  webvtt_alloc_context ctx;
+  webvtt_status status;
+  webvtt_uint32 hash;
+
+  if( !self || !snapshot ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  /* The parser mustn't have been given any input yet */
+  if( self->finished || self->top != self->stack ||
+      self->top->state != T_INITIAL || self->tstate != L_START ||
+      self->token_pos || self->line_buffer.d ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  r.p = (const unsigned char *)snapshot;
+  r.end = r.p + length;
+  r.bad = 0;
+  if( length < sizeof( snapshot_magic ) + 5 ||
+      memcmp( r.p, snapshot_magic, sizeof( snapshot_magic ) ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+  r.p += sizeof( snapshot_magic );
+  r.end -= 4;
+  if( read_uint( &r, 0xFFFFFFFF ) != SNAPSHOT_VERSION ) {
+    return WEBVTT_NOT_SUPPORTED;
+  }
+  hash = fnv1a( FNV_OFFSET, (const unsigned char *)snapshot, length - 4 );
+  if( r.end[ 0 ] != (unsigned char)hash ||
+      r.end[ 1 ] != (unsigned char)( hash >> 8 ) ||
+      r.end[ 2 ] != (unsigned char)( hash >> 16 ) ||
+      r.end[ 3 ] != (unsigned char)( hash >> 24 ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  /* Restored cue parts come from the parser's arena or pool, if any */
+  ctx = self->alloc;
+  webvtt_swap_alloc_context( &ctx );
+  if( WEBVTT_FAILED( status = restore_state( self, &r ) ) ) {
+    reset_parser( self );
+  }
+  webvtt_swap_alloc_context( &ctx );
+  return status;
+}
@@ -26,6 +26,8 @@
  */
 
 #include "string_internal.h"
+#include "alloc_internal.h"
+#include "scan_internal.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -66,11 +68,117 @@ memmem(const void *l, size_t l_len, const void *s, size_t s_len)
 
 static webvtt_string_data empty_string = {
   { 1 }, /* init refcount */
-  0, /* length */
   0, /* capacity */
-  empty_string.array, /* text */
-  { '\0' } /* array */
+  0, /* length */
+  empty_string.u.array, /* text */
+  { { '\0' } } /* array */
+};
+
+/**
+ * Immortal one character strings. Tag names such as "b", "i" and "v", and
+ * many ids and classes, are a single printable ASCII character, so strings
+ * consisting of just one such character share these rather than allocating a
+ * block of their own. Like empty_string, they start out with one reference
+ * that is never released, and have no spare capacity, so that any attempt to
+ * modify them makes a private copy first.
+ */
+#define SINGLE_CHAR_FIRST ( 0x20 )
+#define SINGLE_CHAR_COUNT ( 0x60 )
+#define IS_SINGLE_CHAR(c) \
+  ( (unsigned char)(c) >= SINGLE_CHAR_FIRST && \
+    (unsigned char)(c) < SINGLE_CHAR_FIRST + SINGLE_CHAR_COUNT )
+
+#define TEXT(c) { (char)(c), '\0' }
+#define TEXT4(c) TEXT(c), TEXT((c)+1), TEXT((c)+2), TEXT((c)+3)
+#define TEXT16(c) TEXT4(c), TEXT4((c)+4), TEXT4((c)+8), TEXT4((c)+12)
+static char single_char_text[ SINGLE_CHAR_COUNT ][ 2 ] = {
+  TEXT16(0x20), TEXT16(0x30), TEXT16(0x40),
+  TEXT16(0x50), TEXT16(0x60), TEXT16(0x70)
+};
+
+#define DATA(c) \
+  { { 1 }, 1, 1, single_char_text[ (c) - SINGLE_CHAR_FIRST ], \
+    { { (char)(c) } } }
+#define DATA4(c) DATA(c), DATA((c)+1), DATA((c)+2), DATA((c)+3)
+#define DATA16(c) DATA4(c), DATA4((c)+4), DATA4((c)+8), DATA4((c)+12)
+static webvtt_string_data single_chars[ SINGLE_CHAR_COUNT ] = {
+  DATA16(0x20), DATA16(0x30), DATA16(0x40),
+  DATA16(0x50), DATA16(0x60), DATA16(0x70)
 };
+#undef TEXT
+#undef TEXT4
+#undef TEXT16
+#undef DATA
+#undef DATA4
+#undef DATA16
+
+/**
+ * String views, along with the NUL terminated copy of their text made by the
+ * first webvtt_string_text()
+ */
+typedef struct
+webvtt_string_view_t {
+  webvtt_string_data d;
+  char *volatile terminated;
+} webvtt_string_view;
+
+/**
+ * Drop a reference to string data, freeing it (and releasing the buffer it
+ * points into, if it's a view) once it's no longer used
+ */
+static void
+release_data( webvtt_string_data *d )
+{
+  if( d && webvtt_deref( &d->refs ) == 0 ) {
+    if( WEBVTT_STRING_IS_VIEW( d ) ) {
+      webvtt_free( ( (webvtt_string_view *)d )->terminated );
+      webvtt_release_buffer( &d->u.owner );
+    }
+    webvtt_free( d );
+  }
+}
+
+/**
+ * The text of a view, NUL terminated. Views may be shared between threads,
+ * so whichever thread gets there first publishes its copy, and the others
+ * use that one.
+ */
+static const char *
+view_text( webvtt_string_data *d )
+{
+  webvtt_string_view *v = (webvtt_string_view *)d;
+  webvtt_alloc_context heap = { 0, 0 };
+  char *copy;
+
+  if( v->terminated ) {
+    return v->terminated;
+  }
+  /* The copy lives as long as the view, so it mustn't come from an arena */
+  webvtt_swap_alloc_context( &heap );
+  copy = (char *)webvtt_alloc_as( d->length + 1, WEBVTT_MEM_STRING );
+  webvtt_swap_alloc_context( &heap );
+  if( !copy ) {
+    return 0;
+  }
+  memcpy( copy, d->text, d->length );
+  copy[ d->length ] = 0;
+  if( !ATOMIC_CAS_PTR( &v->terminated, (char *)0, copy ) ) {
+    webvtt_free( copy );
+  }
+  return v->terminated;
+}
+
+/**
+ * Point 'str' at the shared string for the single character 'c'
+ */
+static void
+set_single_char( webvtt_string *str, char c )
+{
+  webvtt_string_data *d = str->d;
+  str->d = single_chars + ( (unsigned char)c - SINGLE_CHAR_FIRST );
+  webvtt_ref( &str->d->refs );
+  release_data( d );
+}
 
 WEBVTT_EXPORT void
 webvtt_init_string( webvtt_string *result )
@@ -98,8 +206,9 @@ webvtt_create_string( webvtt_uint32 alloc, webvtt_string *result )
     return WEBVTT_INVALID_PARAM;
   }
 
-  d = ( webvtt_string_data * )webvtt_alloc( sizeof( webvtt_string_data ) +
-                                            ( alloc * sizeof( char ) ) );
+  d = ( webvtt_string_data * )webvtt_alloc_as( sizeof( webvtt_string_data ) +
+                                               ( alloc * sizeof( char ) ),
+                                               WEBVTT_MEM_STRING );
 
   if( !d ) {
     return WEBVTT_OUT_OF_MEMORY;
@@ -108,7 +217,7 @@ webvtt_create_string( webvtt_uint32 alloc, webvtt_string *result )
   d->refs.value = 1;
   d->alloc = alloc;
   d->length = 0;
-  d->text = d->array;
+  d->text = d->u.array;
   d->text[0] = 0;
 
   result->d = d;
@@ -142,12 +251,49 @@ webvtt_create_string_with_text( webvtt_string *out, const char *init_text,
     return WEBVTT_SUCCESS;
   }
 
+  if( len == 1 && IS_SINGLE_CHAR( *init_text ) ) {
+    set_single_char( out, *init_text );
+    return WEBVTT_SUCCESS;
+  }
+
   /**
    * append the appropriate data to the empty string
    */
   return webvtt_string_append( out, init_text, len );
 }
 
+WEBVTT_INTERN webvtt_status
+webvtt_create_string_view( webvtt_buffer *buffer, webvtt_uint offset,
+                           webvtt_uint len, webvtt_string *result )
+{
+  webvtt_string_data *d;
+
+  webvtt_string_view *v;
+
+  if( !buffer || !result || offset > buffer->length ||
+      len > buffer->length - offset ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  v = ( webvtt_string_view * )webvtt_alloc_as( sizeof( webvtt_string_view ),
+                                               WEBVTT_MEM_STRING );
+  if( !v ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+
+  d = &v->d;
+  d->refs.value = 1;
+  d->alloc = 0;
+  d->length = len;
+  d->text = buffer->data + offset;
+  d->u.owner = buffer;
+  v->terminated = 0;
+  webvtt_ref_buffer( buffer );
+
+  result->d = d;
+  return WEBVTT_SUCCESS;
+}
+
 /**
  * reference counting
  */
@@ -168,46 +314,46 @@ webvtt_release_string( webvtt_string *str )
   if( str ) {
     webvtt_string_data *d = str->d;
     str->d = 0;
-    if( d && webvtt_deref( &d->refs ) == 0 ) {
-      webvtt_free( d );
-    }
+    release_data( d );
   }
 }
 
 /**
  * "Detach" a shared string, so that it's safely mutable
  */
+static webvtt_status grow( webvtt_string *str, webvtt_uint need );
+
 WEBVTT_EXPORT webvtt_status
 webvtt_string_detach( /* in, out */ webvtt_string *str )
 {
-  webvtt_string_data *d, *q;
-
   if( !str ) {
     return WEBVTT_INVALID_PARAM;
   }
 
-  q = str->d;
-
-  if( q->refs.value == 1 ) {
-    return WEBVTT_SUCCESS;
-  }
-
-  d = ( webvtt_string_data * )webvtt_alloc( sizeof( webvtt_string_data ) +
-                                           ( sizeof( char ) * str->d->alloc ) );
+  /* grow() makes a private copy of shared data */
+  return grow( str, 0 );
+}
 
-  d->refs.value = 1;
-  d->text = d->array;
-  d->alloc = q->alloc;
-  d->length = q->length;
-  memcpy( d->text, q->text, q->length );
+WEBVTT_INTERN webvtt_status
+webvtt_string_reset( webvtt_string *str, webvtt_uint capacity )
+{
+  webvtt_string_data *d;
 
-  str->d = d;
+  if( !str ) {
+    return WEBVTT_INVALID_PARAM;
+  }
 
-  if( webvtt_deref( &q->refs ) == 0 ) {
-    webvtt_free( q );
+  d = str->d;
+  if( d && d->refs.value == 1 && d->text == d->u.array &&
+      d->alloc >= capacity ) {
+    d->length = 0;
+    d->text[ 0 ] = 0;
+    return WEBVTT_SUCCESS;
   }
 
-  return WEBVTT_SUCCESS;
+  webvtt_release_string( str );
+  webvtt_init_string( str );
+  return capacity ? grow( str, capacity ) : WEBVTT_SUCCESS;
 }
 
 WEBVTT_EXPORT void
@@ -231,6 +377,9 @@ webvtt_string_text(const webvtt_string *str)
     return 0;
   }
 
+  if( WEBVTT_STRING_IS_VIEW( str->d ) ) {
+    return view_text( str->d );
+  }
   return str->d->text;
 }
 
@@ -258,12 +407,18 @@ webvtt_string_capacity(const webvtt_string *str)
 
 /**
  * Reallocate string.
- * Grow to at least 'need' characters. Power of 2 growth.
+ * Grow to at least 'need' more characters, making a private copy if the data
+ * is shared. Power of 2 growth.
  */
 static webvtt_status
 grow( webvtt_string *str, webvtt_uint need )
 {
-  static const webvtt_uint page = 0x1000;
+  /**
+   * Size blocks so that, together with the allocator's own header, they fill
+   * a power of two exactly. The smallest block holds strings of up to 16
+   * characters on 64 bit targets.
+   */
+  static const webvtt_uint overhead = sizeof( webvtt_alloc_header );
   webvtt_uint32 n;
   webvtt_string_data *p, *d;
   webvtt_uint32 grow;
@@ -273,7 +428,8 @@ grow( webvtt_string *str, webvtt_uint need )
     return WEBVTT_INVALID_PARAM;
   }
 
-  if( ( str->d->length + need ) <= str->d->alloc )
+  if( ( str->d->length + need ) <= str->d->alloc &&
+      str->d->refs.value == 1 )
   {
     return WEBVTT_SUCCESS;
   }
@@ -281,24 +437,13 @@ grow( webvtt_string *str, webvtt_uint need )
   p = d = str->d;
   grow = sizeof( *d ) + ( sizeof( char ) * ( d->length + need ) );
 
-  if( grow < page ) {
-    n = page;
-    do {
-      n = n / 2;
-    } while( n > grow );
-    if( n < 1 << 6 ) {
-      n = 1 << 6;
-    } else {
-      n = n * 2;
-    }
-  } else {
-    n = page;
-    do {
-      n = n * 2;
-    } while ( n < grow );
+  n = 1 << 6;
+  while( n - overhead < grow ) {
+    n = n * 2;
   }
+  n -= overhead;
 
-  p = ( webvtt_string_data * )webvtt_alloc( n );
+  p = ( webvtt_string_data * )webvtt_alloc_as( n, WEBVTT_MEM_STRING );
 
   if( !p ) {
     return WEBVTT_OUT_OF_MEMORY;
@@ -307,29 +452,50 @@ grow( webvtt_string *str, webvtt_uint need )
   p->refs.value = 1;
   p->alloc = ( n - sizeof( *p ) ) / sizeof( char );
   p->length = d->length;
-  p->text = p->array;
+  p->text = p->u.array;
   memcpy( p->text, d->text, sizeof( char ) * p->length );
   p->text[ p->length ] = 0;
   str->d = p;
 
-  if( webvtt_deref( &d->refs ) == 0 ) {
-    webvtt_free( d );
-  }
+  release_data( d );
 
   return WEBVTT_SUCCESS;
 }
 
-WEBVTT_EXPORT int
-webvtt_string_getline( webvtt_string *src, const char *buffer,
-                       webvtt_uint *pos, int len, int *truncate,
-                       webvtt_bool finish )
+/**
+ * UTF-8 encoding of U+FFFD REPLACEMENT CHARACTER, which replaces NUL bytes
+ */
+static const char nul_replacement[] = { (char)0xEF, (char)0xBF, (char)0xBD };
+#define NUL_REPLACEMENT_LENGTH ( sizeof( nul_replacement ) )
+
+/**
+ * Copy the bytes from 's' to 'end' to 'out', replacing each NUL with U+FFFD
+ */
+static void
+copy_replacing_nul( char *out, const char *s, const char *end )
+{
+  const char *nul;
+  while( ( nul = (const char *)memchr( s, 0, end - s ) ) ) {
+    memcpy( out, s, nul - s );
+    out += nul - s;
+    memcpy( out, nul_replacement, NUL_REPLACEMENT_LENGTH );
+    out += NUL_REPLACEMENT_LENGTH;
+    s = nul + 1;
+  }
+  memcpy( out, s, end - s );
+}
+
+static int
+getline_impl( webvtt_string *str, const char *buffer, webvtt_uint *pos,
+              int len, int *truncate, webvtt_bool finish,
+              webvtt_bool replace_nul )
 {
   int ret = 0;
-  webvtt_string *str = src;
   webvtt_string_data *d = 0;
   const char *s = buffer + *pos;
   const char *p = s;
-  const char *n;
+  const char *n, *nul = 0;
+  webvtt_uint out_len;
 
   /**
    *if this is public now, maybe we should return webvtt_status so we can
@@ -352,8 +518,18 @@ webvtt_string_getline( webvtt_string *src, const char *buffer,
   }
   n = buffer + len;
 
-  while( p < n && *p != '\r' && *p != '\n' ) {
-    ++p;
+  if( replace_nul ) {
+    /**
+     * Look for NUL bytes while finding the end of the line, so that lines
+     * without any (almost all of them) are copied as they are.
+     */
+    p = webvtt_scan_line( p, n );
+    if( p < n && *p == '\0' ) {
+      nul = p;
+      p = webvtt_scan_eol( p, n );
+    }
+  } else {
+    p = webvtt_scan_eol( p, n );
   }
 
   if( p < n || finish ) {
@@ -361,12 +537,22 @@ webvtt_string_getline( webvtt_string *src, const char *buffer,
   }
   len = (webvtt_uint)( p - s );
   *pos += len;
-  if( d->length + len + 1 >= d->alloc ) {
+
+  out_len = len;
+  if( nul ) {
+    const char *q = nul;
+    while( q && q < p ) {
+      out_len += NUL_REPLACEMENT_LENGTH - 1;
+      q = (const char *)memchr( q + 1, 0, p - q - 1 );
+    }
+  }
+
+  if( d->length + out_len + 1 >= d->alloc ) {
     if( truncate && d->alloc >= WEBVTT_MAX_LINE ) {
       /* truncate. */
       (*truncate)++;
     } else {
-      if( grow( str, len + 1 ) == WEBVTT_OUT_OF_MEMORY ) {
+      if( grow( str, out_len + 1 ) == WEBVTT_OUT_OF_MEMORY ) {
         ret = -1;
       }
       d = str->d;
@@ -374,15 +560,36 @@ webvtt_string_getline( webvtt_string *src, const char *buffer,
   }
 
   /* Copy everything in */
-  if( len && ret >= 0 && d->length + len < d->alloc ) {
-    memcpy( d->text + d->length, s, len );
-    d->length += len;
+  if( len && ret >= 0 && d->length + out_len < d->alloc ) {
+    if( nul ) {
+      memcpy( d->text + d->length, s, nul - s );
+      copy_replacing_nul( d->text + d->length + ( nul - s ), nul, p );
+    } else {
+      memcpy( d->text + d->length, s, len );
+    }
+    d->length += out_len;
     d->text[ d->length ] = 0;
   }
 
   return ret;
 }
 
+WEBVTT_EXPORT int
+webvtt_string_getline( webvtt_string *src, const char *buffer,
+                       webvtt_uint *pos, int len, int *truncate,
+                       webvtt_bool finish )
+{
+  return getline_impl( src, buffer, pos, len, truncate, finish, 0 );
+}
+
+WEBVTT_INTERN int
+webvtt_string_getline_replace_nul( webvtt_string *str, const char *buffer,
+                                   webvtt_uint *pos, int len, int *truncate,
+                                   webvtt_bool finish )
+{
+  return getline_impl( str, buffer, pos, len, truncate, finish, 1 );
+}
+
 WEBVTT_EXPORT webvtt_status
 webvtt_string_putc( webvtt_string *str, char to_append )
 {
@@ -392,8 +599,9 @@ webvtt_string_putc( webvtt_string *str, char to_append )
     return WEBVTT_INVALID_PARAM;
   }
 
-  if( WEBVTT_FAILED( result = webvtt_string_detach( str ) ) ) {
-    return result;
+  if( str->d == &empty_string && IS_SINGLE_CHAR( to_append ) ) {
+    set_single_char( str, to_append );
+    return WEBVTT_SUCCESS;
   }
 
   if( !WEBVTT_FAILED( result = grow( str, 1 ) ) )
@@ -421,7 +629,7 @@ webvtt_string_is_equal( const webvtt_string *str, const char *to_compare,
     return 0;
   }
 
-  return memcmp( webvtt_string_text( str ), to_compare, len ) == 0;
+  return memcmp( str->d->text, to_compare, len ) == 0;
 }
 
 WEBVTT_EXPORT webvtt_status
@@ -444,7 +652,7 @@ webvtt_string_append( webvtt_string *str, const char *buffer, int len )
     return WEBVTT_SUCCESS;
   }
 
-  if( !WEBVTT_FAILED( result = grow( str, str->d->length + len ) ) ) {
+  if( !WEBVTT_FAILED( result = grow( str, len ) ) ) {
     memcpy( str->d->text + str->d->length, buffer, len );
     str->d->length += len;
     /* null-terminate string */
@@ -543,7 +751,8 @@ webvtt_create_stringlist( webvtt_stringlist **result )
     return WEBVTT_INVALID_PARAM;
   }
 
-  list = ( webvtt_stringlist * )webvtt_alloc0( sizeof( *list ) );
+  list = ( webvtt_stringlist * )webvtt_alloc0_as( sizeof( *list ),
+                                                  WEBVTT_MEM_STRINGLIST );
 
   if( !list ) {
     return WEBVTT_OUT_OF_MEMORY;
@@ -609,8 +818,9 @@ webvtt_stringlist_push( webvtt_stringlist *list, webvtt_string *str )
     webvtt_string *arr, *old;
 
     list->alloc = list->alloc == 0 ? 8 : list->alloc * 2;
-    arr = ( webvtt_string * )webvtt_alloc0( sizeof( webvtt_string ) *
-                                            list->alloc );
+    arr = ( webvtt_string * )webvtt_alloc0_as( sizeof( webvtt_string ) *
+                                               list->alloc,
+                                               WEBVTT_MEM_STRINGLIST );
 
     if( !arr ) {
       return WEBVTT_OUT_OF_MEMORY;
@@ -675,23 +885,304 @@ WEBVTT_EXPORT int
 webvtt_string_skip_whitespace( const webvtt_string *buffer, int *pos )
 {
   int i;
+  const char *text;
   if( !buffer || !pos ) {
     return 0;
   }
 
-  if( *pos < 0 ) {
+  if( *pos < 0 || (unsigned)*pos >= webvtt_string_length( buffer ) ) {
     return 0;
   }
 
   /* Skip spaces */
-  for( i=0 ; (unsigned)*pos < webvtt_string_length( buffer )
-       && (unsigned)webvtt_isspace( webvtt_string_text( buffer )[ *pos ] ) ;
-       ++(*pos), ++i );
+  text = webvtt_string_text( buffer );
+  i = (int)( webvtt_scan_whitespace( text + *pos,
+                                     text + webvtt_string_length( buffer ) ) -
+             ( text + *pos ) );
+  *pos += i;
 
   /* Return the number of spaces which were skipped */
   return i;
 }
 
+WEBVTT_EXPORT webvtt_status
+webvtt_create_buffer( char *data, webvtt_uint length,
+                      webvtt_buffer_free_fn free_fn, void *userdata,
+                      webvtt_buffer **ppout )
+{
+  webvtt_buffer *buffer;
+
+  if( !ppout || ( !data && length ) ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  buffer = ( webvtt_buffer * )webvtt_alloc0( sizeof( *buffer ) );
+  if( !buffer ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+
+  buffer->refs.value = 1;
+  buffer->data = data;
+  buffer->length = length;
+  buffer->free_fn = free_fn;
+  buffer->userdata = userdata;
+  *ppout = buffer;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_EXPORT void
+webvtt_ref_buffer( webvtt_buffer *buffer )
+{
+  if( buffer ) {
+    webvtt_ref( &buffer->refs );
+  }
+}
+
+WEBVTT_EXPORT void
+webvtt_release_buffer( webvtt_buffer **pbuffer )
+{
+  webvtt_buffer *buffer;
+
+  if( !pbuffer || !*pbuffer ) {
+    return;
+  }
+  buffer = *pbuffer;
+  *pbuffer = 0;
+
+  if( webvtt_deref( &buffer->refs ) == 0 ) {
+    if( buffer->free_fn ) {
+      buffer->free_fn( buffer->userdata, buffer->data, buffer->length );
+    }
+    webvtt_free( buffer );
+  }
+}
+
+WEBVTT_EXPORT char *
+webvtt_buffer_data( const webvtt_buffer *buffer )
+{
+  return buffer ? buffer->data : 0;
+}
+
+WEBVTT_EXPORT webvtt_uint
+webvtt_buffer_length( const webvtt_buffer *buffer )
+{
+  return buffer ? buffer->length : 0;
+}
+
+WEBVTT_EXPORT webvtt_bool
+webvtt_string_is_same( const webvtt_string *a, const webvtt_string *b )
+{
+  if( !a || !b ) {
+    return 0;
+  }
+  return a->d == b->d;
+}
+
+/**
+ * Intern table tuning. Only strings of up to INTERN_MAX_LENGTH bytes are
+ * interned, and a table stops taking new strings once it holds
+ * INTERN_MAX_ENTRIES of them, so that a file full of unique annotations can't
+ * make it grow without bounds. Entries are only dropped when the table is
+ * deleted.
+ */
+#define INTERN_MAX_LENGTH ( 64 )
+#define INTERN_MAX_ENTRIES ( 4096 )
+#define INTERN_MIN_CAPACITY ( 64 )
+
+typedef struct
+webvtt_intern_entry_t {
+  webvtt_uint32 hash;
+  webvtt_string_data *d;
+} webvtt_intern_entry;
+
+struct
+webvtt_intern_table_t {
+  struct webvtt_refcount_t refs;
+  volatile webvtt_uint lock;
+  webvtt_uint capacity; /* always a power of two */
+  webvtt_uint length;
+  webvtt_intern_entry *entries;
+};
+
+/**
+ * FNV-1a
+ */
+static webvtt_uint32
+intern_hash( const char *text, webvtt_uint32 len )
+{
+  webvtt_uint32 h = 2166136261U;
+  while( len-- ) {
+    h = ( h ^ (unsigned char)*text++ ) * 16777619U;
+  }
+  return h;
+}
+
+/**
+ * Find the slot holding 'text', or the empty slot where it belongs
+ */
+static webvtt_intern_entry *
+intern_find( webvtt_intern_entry *entries, webvtt_uint capacity,
+             webvtt_uint32 hash, const char *text, webvtt_uint32 len )
+{
+  webvtt_uint mask = capacity - 1;
+  webvtt_uint i = hash & mask;
+  for( ;; i = ( i + 1 ) & mask ) {
+    webvtt_intern_entry *e = entries + i;
+    if( !e->d || ( e->hash == hash && e->d->length == len &&
+                   memcmp( e->d->text, text, len ) == 0 ) ) {
+      return e;
+    }
+  }
+}
+
+static webvtt_status
+intern_grow( webvtt_intern_table *table )
+{
+  webvtt_uint capacity = table->capacity ? table->capacity * 2
+                                         : INTERN_MIN_CAPACITY;
+  webvtt_intern_entry *entries;
+  webvtt_uint i;
+
+  entries = ( webvtt_intern_entry * )webvtt_alloc0_as( capacity *
+                                                       sizeof( *entries ),
+                                                       WEBVTT_MEM_INTERN );
+  if( !entries ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+
+  for( i = 0; i < table->capacity; i++ ) {
+    webvtt_intern_entry *e = table->entries + i;
+    if( e->d ) {
+      *intern_find( entries, capacity, e->hash, e->d->text,
+                    e->d->length ) = *e;
+    }
+  }
+
+  webvtt_free( table->entries );
+  table->entries = entries;
+  table->capacity = capacity;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_create_intern_table( webvtt_intern_table **ppout )
+{
+  webvtt_intern_table *table;
+
+  if( !ppout ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  table = ( webvtt_intern_table * )webvtt_alloc0_as( sizeof( *table ),
+                                                     WEBVTT_MEM_INTERN );
+  if( !table ) {
+    return WEBVTT_OUT_OF_MEMORY;
+  }
+
+  table->refs.value = 1;
+  *ppout = table;
+  return WEBVTT_SUCCESS;
+}
+
+WEBVTT_EXPORT void
+webvtt_ref_intern_table( webvtt_intern_table *table )
+{
+  if( table ) {
+    webvtt_ref( &table->refs );
+  }
+}
+
+WEBVTT_EXPORT void
+webvtt_release_intern_table( webvtt_intern_table **ptable )
+{
+  webvtt_intern_table *table;
+  webvtt_uint i;
+
+  if( !ptable || !*ptable ) {
+    return;
+  }
+  table = *ptable;
+  *ptable = 0;
+
+  if( webvtt_deref( &table->refs ) == 0 ) {
+    for( i = 0; i < table->capacity; i++ ) {
+      webvtt_string_data *d = table->entries[ i ].d;
+      release_data( d );
+    }
+    webvtt_free( table->entries );
+    webvtt_free( table );
+  }
+}
+
+WEBVTT_EXPORT webvtt_status
+webvtt_intern_string( webvtt_intern_table *table, webvtt_string *str )
+{
+  webvtt_string_data *d;
+  webvtt_intern_entry *e;
+  webvtt_uint32 hash;
+  webvtt_status status = WEBVTT_SUCCESS;
+
+  if( !table || !str || !str->d ) {
+    return WEBVTT_INVALID_PARAM;
+  }
+
+  d = str->d;
+  /**
+   * Empty and single character strings are already shared, and arena strings
+   * can't be referenced from a table which may outlive the arena.
+   */
+  if( d->length <= 1 || d->length > INTERN_MAX_LENGTH ||
+      d == &empty_string || webvtt_is_arena_owned( d ) ) {
+    return WEBVTT_SUCCESS;
+  }
+
+  /**
+   * A view in the table would keep its whole buffer alive, however little of
+   * it the view covers, so it's copied first.
+   */
+  if( WEBVTT_STRING_IS_VIEW( d ) ) {
+    if( WEBVTT_FAILED( status = grow( str, 0 ) ) ) {
+      return status;
+    }
+    d = str->d;
+  }
+
+  hash = intern_hash( d->text, d->length );
+
+  SPIN_LOCK( &table->lock );
+  if( table->capacity ) {
+    e = intern_find( table->entries, table->capacity, hash, d->text,
+                     d->length );
+    if( e->d ) {
+      str->d = e->d;
+      webvtt_ref( &str->d->refs );
+      SPIN_UNLOCK( &table->lock );
+      release_data( d );
+      return WEBVTT_SUCCESS;
+    }
+  }
+
+  /**
+   * Not there yet: 'str' becomes the shared instance, unless the table is full
+   */
+  if( table->length < INTERN_MAX_ENTRIES ) {
+    if( ( table->length + 1 ) * 4 > table->capacity * 3 ) {
+      status = intern_grow( table );
+    }
+    if( status == WEBVTT_SUCCESS ) {
+      e = intern_find( table->entries, table->capacity, hash, d->text,
+                       d->length );
+      e->hash = hash;
+      e->d = d;
+      webvtt_ref( &d->refs );
+      table->length++;
+    }
+  }
+  SPIN_UNLOCK( &table->lock );
+
+  return status;
+}
+
 WEBVTT_EXPORT webvtt_bool
 webvtt_next_utf8( const char **begin, const char *end )
 {
@@ -66,9 +66,56 @@ webvtt_string_data_t {
   webvtt_uint32 alloc;
   webvtt_uint32 length;
   char *text;
-  char array[1];
+  union {
+    char array[1];
+    webvtt_buffer *owner; /* string views: the buffer 'text' points into */
+  } u;
 };
 
+/**
+ * String views have no storage of their own: 'text' points into their owner
+ */
+# define WEBVTT_STRING_IS_VIEW(d) \
+  ( (d)->alloc == 0 && (d)->text != (d)->u.array )
+
+struct
+webvtt_buffer_t {
+  struct webvtt_refcount_t refs;
+  char *data;
+  webvtt_uint length;
+  webvtt_buffer_free_fn free_fn;
+  void *userdata;
+};
+
+/**
+ * Create a string whose text is the 'len' bytes at 'offset' in 'buffer',
+ * without copying them. The buffer is never written to, so the text of a view
+ * isn't NUL terminated: webvtt_string_text() makes a terminated copy the
+ * first time it's asked for one, while code which goes by the string's length
+ * can read 'd->text' directly. Views are never modified in place: any change
+ * makes a private copy first.
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_create_string_view( webvtt_buffer *buffer, webvtt_uint offset,
+                           webvtt_uint len, webvtt_string *result );
+
+/**
+ * Empty 'str', ready to hold at least 'capacity' characters. Storage which
+ * nothing else references is kept and reused, rather than being released and
+ * allocated again.
+ */
+WEBVTT_INTERN webvtt_status
+webvtt_string_reset( webvtt_string *str, webvtt_uint capacity );
+
+/**
+ * Like webvtt_string_getline(), replacing any NUL bytes in the line with
+ * U+FFFD REPLACEMENT CHARACTER as it is copied
+ */
+WEBVTT_INTERN int
+webvtt_string_getline_replace_nul( webvtt_string *str, const char *buffer,
+                                   webvtt_uint *pos, int len, int *truncate,
+                                   webvtt_bool finish );
+
 static __WEBVTT_STRING_INLINE  int
 webvtt_isalpha( char ch )
 {
@@ -31,11 +31,20 @@
 namespace WebVTT
 {
 
-AbstractParser::AbstractParser()
+AbstractParser::AbstractParser( webvtt_uint batchSize )
 {
   webvtt_status status;
-  if(WEBVTT_FAILED(status = webvtt_create_parser( &__parsedCue, &__reportError,
-                                                  this, &parser ) ) ) {
+  if( batchSize ) {
+    webvtt_parser_config config;
+    webvtt_init_parser_config( &config );
+    config.batch_size = batchSize;
+    status = webvtt_create_batch_parser( &__parsedCues, &__reportError, this,
+                                         &config, &parser );
+  } else {
+    status = webvtt_create_parser( &__parsedCue, &__reportError, this,
+                                   &parser );
+  }
+  if( WEBVTT_FAILED( status ) ) {
     /**
      * TODO: Throw error
      */
@@ -59,6 +68,25 @@ AbstractParser::parseChunk( const void *chunk, webvtt_uint length )
   return webvtt_parse_chunk( parser, chunk, length );
 }
 
+::webvtt_status
+AbstractParser::parseBuffer( const void *buffer, webvtt_uint length )
+{
+  return webvtt_parse_buffer( parser, buffer, length );
+}
+
+::webvtt_status
+AbstractParser::parseBufferParallel( const void *buffer, webvtt_uint length,
+                                     webvtt_uint threads )
+{
+  return webvtt_parse_buffer_parallel( parser, buffer, length, threads );
+}
+
+::webvtt_status
+AbstractParser::parseFile( const char *path )
+{
+  return webvtt_parse_file( parser, path );
+}
+
 void WEBVTT_CALLBACK
 AbstractParser::__parsedCue( void *userdata, webvtt_cue *pcue )
 {
@@ -72,6 +100,44 @@ AbstractParser::__parsedCue( void *userdata, webvtt_cue *pcue )
   self->parsedCue( cue );
 }
 
+void
+AbstractParser::parsedCues( std::vector<Cue> &cues )
+{
+  for( std::vector<Cue>::size_type i = 0; i < cues.size(); ++i ) {
+    parsedCue( cues[ i ] );
+  }
+}
+
+void WEBVTT_CALLBACK
+AbstractParser::__parsedCues( void *userdata, webvtt_cue **pcues,
+                              webvtt_uint count )
+{
+  AbstractParser *self = reinterpret_cast<AbstractParser *>( userdata );
+  std::vector<Cue> &cues = self->batch;
+  webvtt_uint adopted = 0;
+  try {
+    cues.reserve( count );
+    while( adopted < count ) {
+      /**
+       * Take over the parser's reference, rather than adding one and
+       * releasing it again
+       */
+      Cue cue( pcues[ adopted++ ], Cue::Adopt );
+      cues.push_back( cue );
+    }
+  } catch( ... ) {
+    /* Cues already adopted are released by their Cue objects */
+    while( adopted < count ) {
+      webvtt_cue *pcue = pcues[ adopted++ ];
+      webvtt_release_cue( &pcue );
+    }
+    cues.clear();
+    throw;
+  }
+  self->parsedCues( cues );
+  cues.clear();
+}
+
 int WEBVTT_CALLBACK
 AbstractParser::__reportError( void *userdata, webvtt_uint line,
                                webvtt_uint col, webvtt_error error )
@@ -46,34 +46,12 @@ cue( void *userdata, webvtt_cue *cue )
   (void)cue;
 }
 
-int
-parse_fh(FILE *fh, webvtt_parser vtt)
-{
-  /**
-   * Try to parse the file.
-   */
-  int finished;
-  webvtt_status result;
-  do {
-    char buffer[0x1000];
-    webvtt_uint n_read = (webvtt_uint)fread( buffer, 1, sizeof(buffer), fh );
-    finished = feof( fh );
-    if( WEBVTT_FAILED(result = webvtt_parse_chunk( vtt, buffer, n_read )) ) {
-      return 1;
-    }
-  } while( !finished && result == WEBVTT_SUCCESS );
-  webvtt_finish_parsing( vtt );
-  
-  return 0;
-}
-
 int
 main( int argc, char **argv )
 {
   const char *input_file = 0;
   webvtt_status result;
   webvtt_parser vtt;
-  FILE *fh;
   int i;
   int ret = 0;
   for( i = 0; i < argc; ++i ) {
@@ -107,24 +85,25 @@ main( int argc, char **argv )
     return 1;
   }
 
-  fh = fopen(input_file, "rb");
-  if( !fh ) {
+  if( ( result = webvtt_create_parser( &cue, &error, (void *)input_file, &vtt ) ) != WEBVTT_SUCCESS ) {
+    fprintf( stderr, "error: failed to create VTT parser.\n" );
+    return 1;
+  }
+
+  /**
+   * Try to parse the file, mapped into memory as one buffer.
+   */
+  result = webvtt_parse_file( vtt, input_file );
+  if( result == WEBVTT_UNSUCCESSFUL ) {
     fprintf( stderr, "error: failed to open `%s'"
              ": %s"
              "\n", input_file,
              strerror(errno)
            );
-    return 1;
+    ret = 1;
+  } else if( WEBVTT_FAILED( result ) ) {
+    ret = 1;
   }
-
-  if( ( result = webvtt_create_parser( &cue, &error, (void *)input_file, &vtt ) ) != WEBVTT_SUCCESS ) {
-    fprintf( stderr, "error: failed to create VTT parser.\n" );
-    fclose( fh );
-    return 1;
-  }
-
-  ret = parse_fh( fh, vtt );
   webvtt_delete_parser( vtt );
-  fclose( fh );
   return ret;
 }
@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Measures the throughput of the cue text tokenizer on a payload mixing
+ * plain text, escapes, tags with classes and annotations, and time stamps,
+ * and on a text heavy payload more like most real cues.
+ */
+#include "libwebvtt/parser_internal.h"
+#include "libwebvtt/cuetext_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS ( 200000 )
+
+static const char markup_payload[] =
+  "<v.loud.first Roger Bingham>We are in New York City</v>\n"
+  "<c.yellow.bg_blue>Everything</c> is <i>fine</i> &amp; <b>good</b>\n"
+  "<ruby>Kanji<rt>reading</rt></ruby> <00:00:01.500>karaoke "
+  "<00:00:02.000>style <lang en-GB>colour</lang> and a longer run of plain "
+  "text that has no markup in it at all, as most cues do";
+
+static const char text_payload[] =
+  "<v Narrator>It was the best of times, it was the worst of times, it was "
+  "the age of wisdom, it was the age of foolishness,</v>\nit was the epoch "
+  "of belief, it was the epoch of incredulity, it was the season of Light, "
+  "it was the season of <i>Darkness</i>, it was the spring of hope, it was "
+  "the winter of despair";
+
+/**
+ * Tokenize 'payload' 'n' times, reusing one token throughout as the cue text
+ * parser does, and print the throughput
+ */
+static int
+run( const char *name, const char *payload, size_t length, unsigned long n )
+{
+  unsigned long i, tokens = 0;
+  const char *position;
+  webvtt_cuetext_token *token = 0;
+  clock_t start, end;
+  double seconds;
+
+  start = clock();
+  for( i = 0; i < n; ++i ) {
+    position = payload;
+    while( *position != '\0' ) {
+      if( WEBVTT_FAILED( webvtt_cuetext_tokenizer( &position,
+                                                   payload + length, &token,
+                                                   0 ) ) ) {
+        fprintf( stderr, "tokenizer failed\n" );
+        webvtt_delete_token( &token );
+        return 1;
+      }
+      ++tokens;
+    }
+  }
+  end = clock();
+  webvtt_delete_token( &token );
+
+  seconds = (double)( end - start ) / CLOCKS_PER_SEC;
+  printf( "webvtt_cuetext_tokenizer (%s): %7.1f MB/s, %6.1f ns/token\n",
+          name, (double)length * n / seconds / 1e6,
+          seconds * 1e9 / (double)tokens );
+  return 0;
+}
+
+int
+main( int argc, char **argv )
+{
+  unsigned long n = DEFAULT_ITERATIONS;
+
+  if( argc > 1 ) {
+    n = strtoul( argv[ 1 ], 0, 10 );
+  }
+
+  if( run( "markup", markup_payload, sizeof( markup_payload ) - 1, n ) ||
+      run( "text", text_payload, sizeof( text_payload ) - 1, n ) ) {
+    return 1;
+  }
+  return 0;
+}
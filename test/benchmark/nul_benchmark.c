@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Measures parsing of cue text dense with NUL bytes, which are replaced with
+ * U+FFFD as lines are read. The cost per byte should not depend on how long
+ * the lines are, i.e. the replacement should be linear. A clean input of the
+ * same size is parsed for comparison.
+ */
+#include <webvtt/parser.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_SIZE ( 8 << 20 )
+
+static void WEBVTT_CALLBACK
+on_read( void *userdata, webvtt_cue *cue )
+{
+  ++*(unsigned long *)userdata;
+  webvtt_release_cue( &cue );
+}
+
+static int WEBVTT_CALLBACK
+on_error( void *userdata, webvtt_uint line, webvtt_uint col,
+          webvtt_error error )
+{
+  (void)userdata;
+  (void)line;
+  (void)col;
+  (void)error;
+  return 1;
+}
+
+/**
+ * Build a file of about 'size' bytes, made of cues with one line of
+ * 'line_length' bytes each, every other one of which is NUL if 'nul' is set
+ */
+static char *
+build( unsigned long size, unsigned long line_length, int nul,
+       unsigned long *length )
+{
+  static const char timing[] = "00:00.000 --> 00:01.000\n";
+  unsigned long cue_length = sizeof( timing ) - 1 + line_length + 2;
+  unsigned long cues = size / cue_length + 1, i, j;
+  char *text = (char *)malloc( 8 + cues * cue_length );
+  char *p = text;
+
+  if( !text ) {
+    return 0;
+  }
+  memcpy( p, "WEBVTT\n\n", 8 );
+  p += 8;
+  for( i = 0; i < cues; ++i ) {
+    memcpy( p, timing, sizeof( timing ) - 1 );
+    p += sizeof( timing ) - 1;
+    for( j = 0; j < line_length; ++j ) {
+      *p++ = ( nul && ( j & 1 ) ) ? '\0' : 'a';
+    }
+    *p++ = '\n';
+    *p++ = '\n';
+  }
+  *length = (unsigned long)( p - text );
+  return text;
+}
+
+static int
+run( unsigned long size, unsigned long line_length, int nul )
+{
+  unsigned long length, cues = 0;
+  char *text = build( size, line_length, nul, &length );
+  webvtt_parser parser;
+  clock_t start, end;
+
+  if( !text || webvtt_create_parser( &on_read, &on_error, &cues,
+                                     &parser ) != WEBVTT_SUCCESS ) {
+    fprintf( stderr, "out of memory\n" );
+    free( text );
+    return 1;
+  }
+
+  start = clock();
+  webvtt_parse_chunk( parser, text, length );
+  webvtt_finish_parsing( parser );
+  end = clock();
+
+  printf( "%-5s %6lu byte lines: %6.2f ns/byte (%lu cues)\n",
+          nul ? "nul" : "clean", line_length,
+          ( (double)( end - start ) / CLOCKS_PER_SEC ) * 1e9 / (double)length,
+          cues );
+  webvtt_delete_parser( parser );
+  free( text );
+  return 0;
+}
+
+int
+main( int argc, char **argv )
+{
+  unsigned long size = DEFAULT_SIZE, line_length;
+
+  if( argc > 1 ) {
+    size = strtoul( argv[ 1 ], 0, 10 );
+  }
+
+  for( line_length = 64; line_length <= 16384; line_length *= 4 ) {
+    if( run( size, line_length, 0 ) || run( size, line_length, 1 ) ) {
+      return 1;
+    }
+  }
+  return 0;
+}
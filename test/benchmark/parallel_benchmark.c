@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Measures webvtt_parse_buffer_parallel() on a large file of short cues,
+ * with 1, 2, 4 and 8 threads, against webvtt_parse_buffer(). Times are wall
+ * clock times, as CPU time would add up the time of every thread.
+ */
+#include <webvtt/parser.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define DEFAULT_SIZE ( 64 << 20 )
+
+static void WEBVTT_CALLBACK
+on_read( void *userdata, webvtt_cue *cue )
+{
+  ++*(unsigned long *)userdata;
+  webvtt_release_cue( &cue );
+}
+
+static int WEBVTT_CALLBACK
+on_error( void *userdata, webvtt_uint line, webvtt_uint col,
+          webvtt_error error )
+{
+  (void)userdata;
+  (void)line;
+  (void)col;
+  (void)error;
+  return 1;
+}
+
+static double
+now( void )
+{
+  struct timeval tv;
+  gettimeofday( &tv, 0 );
+  return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+}
+
+/**
+ * Build a file of about 'size' bytes, of numbered cues with a little markup
+ */
+static char *
+build( unsigned long size, unsigned long *length )
+{
+  static const char cue[] = "00:01.000 --> 00:02.000 align:start\n"
+                            "<v Speaker>Some <i>cue</i> text</v>\n"
+                            "and a second line\n\n";
+  unsigned long cues = size / ( sizeof( cue ) - 1 ) + 1, i;
+  char *text = (char *)malloc( 8 + cues * ( sizeof( cue ) - 1 ) );
+  char *p = text;
+
+  if( !text ) {
+    return 0;
+  }
+  memcpy( p, "WEBVTT\n\n", 8 );
+  p += 8;
+  for( i = 0; i < cues; ++i ) {
+    memcpy( p, cue, sizeof( cue ) - 1 );
+    p += sizeof( cue ) - 1;
+  }
+  *length = (unsigned long)( p - text );
+  return text;
+}
+
+/**
+ * Parse 'text' on 'threads' threads, or with webvtt_parse_buffer() if
+ * 'threads' is 0
+ */
+static int
+run( const char *text, unsigned long length, webvtt_uint threads )
+{
+  unsigned long cues = 0;
+  webvtt_parser parser;
+  double start, end;
+
+  if( webvtt_create_parser( &on_read, &on_error, &cues,
+                            &parser ) != WEBVTT_SUCCESS ) {
+    fprintf( stderr, "out of memory\n" );
+    return 1;
+  }
+
+  start = now();
+  if( threads ) {
+    webvtt_parse_buffer_parallel( parser, text, length, threads );
+  } else {
+    webvtt_parse_buffer( parser, text, length );
+  }
+  end = now();
+
+  if( threads ) {
+    printf( "%u threads: ", threads );
+  } else {
+    printf( "sequential: " );
+  }
+  printf( "%8.2f MB/s (%lu cues)\n",
+          (double)length / ( end - start ) / 1e6, cues );
+  webvtt_delete_parser( parser );
+  return 0;
+}
+
+int
+main( int argc, char **argv )
+{
+  unsigned long size = DEFAULT_SIZE, length;
+  webvtt_uint threads;
+  char *text;
+
+  if( argc > 1 ) {
+    size = strtoul( argv[ 1 ], 0, 10 );
+  }
+  if( !( text = build( size, &length ) ) ) {
+    fprintf( stderr, "out of memory\n" );
+    return 1;
+  }
+
+  if( run( text, length, 0 ) ) {
+    free( text );
+    return 1;
+  }
+  for( threads = 1; threads <= 8; threads *= 2 ) {
+    if( run( text, length, threads ) ) {
+      free( text );
+      return 1;
+    }
+  }
+  free( text );
+  return 0;
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Measures the cost of webvtt_ref_string()/webvtt_release_string(), which
+ * cuetext.c calls for nearly every token, against a plain non-atomic
+ * counter. Build the library with and without --disable-atomic-refcount to
+ * compare the two reference counting modes.
+ */
+#include <webvtt/string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS ( 20000000 )
+
+static double
+elapsed_ns( clock_t start, clock_t end, unsigned long n )
+{
+  return ( (double)( end - start ) / CLOCKS_PER_SEC ) * 1e9 / (double)n;
+}
+
+int
+main( int argc, char **argv )
+{
+  unsigned long i, n = DEFAULT_ITERATIONS;
+  volatile int plain = 1;
+  webvtt_string str, copy;
+  clock_t start, end;
+
+  if( argc > 1 ) {
+    n = strtoul( argv[ 1 ], 0, 10 );
+  }
+
+  if( webvtt_create_string_with_text( &str, "benchmark", -1 )
+      != WEBVTT_SUCCESS ) {
+    fprintf( stderr, "failed to create string\n" );
+    return 1;
+  }
+
+  start = clock();
+  for( i = 0; i < n; ++i ) {
+    ++plain;
+    --plain;
+  }
+  end = clock();
+  printf( "plain counter:         %6.2f ns/iteration\n",
+          elapsed_ns( start, end, n ) );
+
+  start = clock();
+  for( i = 0; i < n; ++i ) {
+    webvtt_copy_string( &copy, &str );
+    webvtt_release_string( &copy );
+  }
+  end = clock();
+  printf( "ref/release string:    %6.2f ns/iteration (%s)\n",
+          elapsed_ns( start, end, n ),
+#ifdef WEBVTT_NO_ATOMICS
+          "non-atomic"
+#else
+          "atomic"
+#endif
+        );
+
+  webvtt_release_string( &str );
+  return 0;
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2013 Mozilla Foundation and Contributors
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  - Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Compares the fast path of webvtt_parse_timestamp_n(), which converts
+ * canonical timestamps a word at a time, with the general digit by digit
+ * webvtt_parse_timestamp(), on cue timings and cue text time stamps.
+ */
+#include "libwebvtt/parser_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS ( 20000000 )
+#define TIMESTAMPS ( 256 )
+
+static double
+elapsed_ns( clock_t start, clock_t end, unsigned long n )
+{
+  return ( (double)( end - start ) / CLOCKS_PER_SEC ) * 1e9 / (double)n;
+}
+
+int
+main( int argc, char **argv )
+{
+  static char text[ TIMESTAMPS ][ 32 ];
+  static webvtt_uint length[ TIMESTAMPS ];
+  unsigned long i, n = DEFAULT_ITERATIONS;
+  webvtt_timestamp ts, sum_general = 0, sum_fast = 0;
+  int len;
+  clock_t start, end;
+
+  if( argc > 1 ) {
+    n = strtoul( argv[ 1 ], 0, 10 );
+  }
+
+  /* A mix of both canonical layouts, as found in cue timings */
+  for( i = 0; i < TIMESTAMPS; ++i ) {
+    if( i & 1 ) {
+      sprintf( text[ i ], "%02lu:%02lu:%02lu.%03lu --> ", i % 24, i % 60,
+               ( i * 7 ) % 60, ( i * 37 ) % 1000 );
+    } else {
+      sprintf( text[ i ], "%02lu:%02lu.%03lu --> ", i % 60, ( i * 7 ) % 60,
+               ( i * 37 ) % 1000 );
+    }
+    length[ i ] = (webvtt_uint)strlen( text[ i ] );
+  }
+
+  start = clock();
+  for( i = 0; i < n; ++i ) {
+    webvtt_parse_timestamp( text[ i % TIMESTAMPS ], &len, &ts );
+    sum_general += ts;
+  }
+  end = clock();
+  printf( "webvtt_parse_timestamp:   %6.2f ns/timestamp\n",
+          elapsed_ns( start, end, n ) );
+
+  start = clock();
+  for( i = 0; i < n; ++i ) {
+    webvtt_parse_timestamp_n( text[ i % TIMESTAMPS ],
+                              length[ i % TIMESTAMPS ], &len, &ts );
+    sum_fast += ts;
+  }
+  end = clock();
+  printf( "webvtt_parse_timestamp_n: %6.2f ns/timestamp\n",
+          elapsed_ns( start, end, n ) );
+
+  if( sum_general != sum_fast ) {
+    fprintf( stderr, "results differ\n" );
+    return 1;
+  }
+  return 0;
+}
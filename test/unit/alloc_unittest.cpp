@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#if GTEST_HAS_PTHREAD
+# include <pthread.h>
+#endif
+extern "C" {
+#include "libwebvtt/alloc_internal.h"
+#include "libwebvtt/parser_internal.h"
+}
+
+static int customBlocks = 0;
+
+static void *WEBVTT_CALLBACK
+customAlloc( void *userdata, webvtt_uint nb )
+{
+  ++*static_cast<int *>( userdata );
+  return malloc( nb );
+}
+
+static void WEBVTT_CALLBACK
+customFree( void *userdata, void *ptr )
+{
+  --*static_cast<int *>( userdata );
+  free( ptr );
+}
+
+/**
+ * The allocator can only be replaced while nothing is allocated, and says
+ * whether it was
+ */
+TEST(Alloc, SetAllocator)
+{
+  void *a = webvtt_alloc( 24 );
+  ASSERT_TRUE( a != 0 );
+  EXPECT_EQ( WEBVTT_UNSUCCESSFUL,
+             webvtt_set_allocator( &customAlloc, &customFree,
+                                   &customBlocks ) );
+  webvtt_free( a );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_set_allocator( &customAlloc, 0, &customBlocks ) );
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_set_allocator( &customAlloc, &customFree,
+                                   &customBlocks ) );
+  a = webvtt_alloc( 24 );
+  EXPECT_EQ( 1, customBlocks );
+  webvtt_free( a );
+  EXPECT_EQ( WEBVTT_SUCCESS, webvtt_set_allocator( 0, 0, 0 ) );
+  EXPECT_EQ( 0, customBlocks );
+}
+
+/**
+ * Small blocks released on a thread are handed out again to the same thread
+ */
+TEST(Alloc, ReusesCachedBlocks)
+{
+  void *a = webvtt_alloc( 24 );
+  void *b;
+  ASSERT_TRUE( a != 0 );
+  webvtt_free( a );
+  b = webvtt_alloc( 20 );
+  EXPECT_EQ( a, b );
+  webvtt_free( b );
+  webvtt_flush_alloc_cache();
+}
+
+TEST(Alloc, Alloc0ClearsCachedBlocks)
+{
+  char *a = (char *)webvtt_alloc( 32 );
+  ASSERT_TRUE( a != 0 );
+  memset( a, 0xFF, 32 );
+  webvtt_free( a );
+  a = (char *)webvtt_alloc0( 32 );
+  ASSERT_TRUE( a != 0 );
+  for( int i = 0; i < 32; ++i ) {
+    EXPECT_EQ( 0, a[ i ] );
+  }
+  webvtt_free( a );
+}
+
+#if GTEST_HAS_PTHREAD
+static void WEBVTT_CALLBACK
+onRead( void *userdata, webvtt_cue *cue )
+{
+  ++*static_cast<int *>( userdata );
+  webvtt_release_cue( &cue );
+}
+
+static int WEBVTT_CALLBACK
+onError( void *, webvtt_uint, webvtt_uint, webvtt_error )
+{
+  return -1;
+}
+
+static void *
+parseMany( void *arg )
+{
+  static const char text[] = "WEBVTT\n\n"
+                             "00:00.000 --> 00:01.000 align:start\n"
+                             "Hello <b.loud>world</b> &amp; <v Bob>friends\n";
+  int *cues = static_cast<int *>( arg );
+  for( int i = 0; i < 200; ++i ) {
+    webvtt_parser parser;
+    if( webvtt_create_parser( &onRead, &onError, cues, &parser ) ) {
+      break;
+    }
+    webvtt_parse_chunk( parser, text, sizeof( text ) - 1 );
+    webvtt_finish_parsing( parser );
+    webvtt_delete_parser( parser );
+  }
+  return 0;
+}
+
+/**
+ * One parser per thread, all sharing the global allocator
+ */
+TEST(Alloc, ParsersOnSeveralThreads)
+{
+  const int nthreads = 4;
+  pthread_t threads[ nthreads ];
+  int cues[ nthreads ] = { 0 };
+  for( int i = 0; i < nthreads; ++i ) {
+    ASSERT_EQ( 0, pthread_create( threads + i, 0, &parseMany, cues + i ) );
+  }
+  for( int i = 0; i < nthreads; ++i ) {
+    pthread_join( threads[ i ], 0 );
+    EXPECT_EQ( 200, cues[ i ] );
+  }
+}
+#endif
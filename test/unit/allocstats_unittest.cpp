@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include <string>
+extern "C" {
+#include "libwebvtt/alloc_internal.h"
+#include "libwebvtt/parser_internal.h"
+}
+
+class AllocStats : public ::testing::Test
+{
+public:
+  virtual void SetUp() {
+    webvtt_enable_alloc_stats( 1 );
+    webvtt_get_alloc_stats( &before );
+  }
+
+  virtual void TearDown() {
+    webvtt_enable_alloc_stats( 0 );
+  }
+
+  const webvtt_mem_stat &delta( webvtt_mem_category category ) {
+    webvtt_get_alloc_stats( &after );
+    diff.count = after.category[ category ].count
+               - before.category[ category ].count;
+    diff.bytes = after.category[ category ].bytes
+               - before.category[ category ].bytes;
+    diff.peak_bytes = after.category[ category ].peak_bytes;
+    return diff;
+  }
+
+  static void WEBVTT_CALLBACK onRead( void *userdata, webvtt_cue *cue ) {
+    AllocStats *self = static_cast<AllocStats *>( userdata );
+    EXPECT_EQ( 1U, self->delta( WEBVTT_MEM_CUE ).count );
+    EXPECT_LT( 0U, self->delta( WEBVTT_MEM_NODE ).count );
+    EXPECT_LT( 0U, self->delta( WEBVTT_MEM_STRING ).bytes );
+    webvtt_release_cue( &cue );
+  }
+
+  static int WEBVTT_CALLBACK onError( void *, webvtt_uint, webvtt_uint,
+                                      webvtt_error ) {
+    return -1;
+  }
+
+protected:
+  webvtt_alloc_stats before;
+  webvtt_alloc_stats after;
+  webvtt_mem_stat diff;
+};
+
+TEST_F(AllocStats, CountsByCategory)
+{
+  void *p = webvtt_alloc( 100 );
+  EXPECT_EQ( 1U, delta( WEBVTT_MEM_OTHER ).count );
+  EXPECT_EQ( 100U, delta( WEBVTT_MEM_OTHER ).bytes );
+  EXPECT_LE( 100U, delta( WEBVTT_MEM_OTHER ).peak_bytes );
+  webvtt_free( p );
+  EXPECT_EQ( 0U, delta( WEBVTT_MEM_OTHER ).count );
+  EXPECT_EQ( 0U, delta( WEBVTT_MEM_OTHER ).bytes );
+}
+
+TEST_F(AllocStats, PeakSurvivesFree)
+{
+  void *p;
+  webvtt_reset_alloc_peaks();
+  webvtt_get_alloc_stats( &before );
+  p = webvtt_alloc( 0x10000 );
+  webvtt_free( p );
+  webvtt_get_alloc_stats( &after );
+  EXPECT_LE( before.total.bytes + 0x10000, after.total.peak_bytes );
+}
+
+/**
+ * Blocks allocated while disabled are not subtracted when freed
+ */
+TEST_F(AllocStats, BlocksFromBeforeEnabling)
+{
+  void *p;
+  webvtt_enable_alloc_stats( 0 );
+  p = webvtt_alloc( 64 );
+  webvtt_enable_alloc_stats( 1 );
+  webvtt_free( p );
+  EXPECT_EQ( 0U, delta( WEBVTT_MEM_OTHER ).count );
+}
+
+TEST_F(AllocStats, ParserCategories)
+{
+  static const char text[] = "WEBVTT\n\n00:00.000 --> 00:01.000\n"
+                             "Hello <c.a.b>world</c>\n\n";
+  webvtt_parser parser;
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_create_parser( &onRead, &onError, this, &parser ) );
+  EXPECT_EQ( 1U, delta( WEBVTT_MEM_PARSER ).count );
+  webvtt_parse_chunk( parser, text, sizeof( text ) - 1 );
+  webvtt_finish_parsing( parser );
+  webvtt_delete_parser( parser );
+
+  EXPECT_EQ( 0U, delta( WEBVTT_MEM_PARSER ).count );
+  EXPECT_EQ( 0U, delta( WEBVTT_MEM_CUE ).count );
+  EXPECT_EQ( 0U, delta( WEBVTT_MEM_NODE ).count );
+  EXPECT_EQ( 0U, delta( WEBVTT_MEM_STRINGLIST ).count );
+  EXPECT_LT( 0U, delta( WEBVTT_MEM_STRINGLIST ).peak_bytes );
+}
@@ -0,0 +1,141 @@
+#include "output_testfixture"
+
+class Arena : public CueCollectorTest
+{
+public:
+  Arena() : arena(0), parser(0), count(0), heap_in_callback(0) {}
+
+  virtual void SetUp() {
+    ASSERT_EQ( WEBVTT_SUCCESS, webvtt_create_arena( 0, &arena ) );
+  }
+
+  virtual void TearDown() {
+    CueCollectorTest::TearDown();
+    if( parser ) {
+      webvtt_delete_parser( parser );
+    }
+    webvtt_delete_arena( &arena );
+  }
+
+  /**
+   * Make webvtt_alloc() allocate from the arena, until uninstall()
+   */
+  void install() {
+    ctx.arena = arena;
+    ctx.pool = 0;
+    webvtt_swap_alloc_context( &ctx );
+  }
+
+  void uninstall() {
+    webvtt_swap_alloc_context( &ctx );
+  }
+
+  /**
+   * Parse 'text' with a parser allocating from the arena, which is kept
+   * until the test ends or deletes it
+   */
+  void parse( const std::string &text ) {
+    webvtt_parser_config config;
+    webvtt_init_parser_config( &config );
+    config.arena = arena;
+    ASSERT_TRUE( ( parser = createParser( &config ) ) != 0 );
+    webvtt_parse_chunk( parser, text.data(), text.size() );
+    webvtt_finish_parsing( parser );
+  }
+
+  /**
+   * Cues aren't kept, as they don't outlive a reset of the arena
+   */
+  virtual void read( webvtt_cue *cue ) {
+    void *p;
+    EXPECT_TRUE( webvtt_is_arena_owned( cue ) );
+    EXPECT_TRUE( webvtt_is_arena_owned( cue->body.d ) );
+    EXPECT_TRUE( webvtt_is_arena_owned( cue->node_head ) );
+
+    /* Allocations made by the application go to the heap */
+    p = webvtt_alloc( 16 );
+    if( p && !webvtt_is_arena_owned( p ) ) {
+      ++heap_in_callback;
+    }
+    webvtt_free( p );
+
+    /* Does nothing for arena-owned cues */
+    webvtt_release_cue( &cue );
+    EXPECT_EQ( 0, cue );
+    ++count;
+  }
+
+protected:
+  webvtt_alloc_context ctx;
+  webvtt_arena *arena;
+  webvtt_parser parser;
+  int count;
+  int heap_in_callback;
+};
+
+TEST_F(Arena, AllocatesFromCurrentArena)
+{
+  void *p;
+  install();
+  p = webvtt_alloc( 100 );
+  uninstall();
+
+  ASSERT_TRUE( p != 0 );
+  EXPECT_TRUE( webvtt_is_arena_owned( p ) );
+  webvtt_free( p );
+
+  p = webvtt_alloc( 100 );
+  ASSERT_TRUE( p != 0 );
+  EXPECT_FALSE( webvtt_is_arena_owned( p ) );
+  webvtt_free( p );
+}
+
+/**
+ * Small chunks freed while parsing should be handed out again, rather than
+ * using up more of the arena
+ */
+TEST_F(Arena, RecyclesFreedChunks)
+{
+  void *a, *b;
+  install();
+  a = webvtt_alloc( 40 );
+  webvtt_free( a );
+  b = webvtt_alloc( 33 );
+  uninstall();
+
+  EXPECT_EQ( a, b );
+}
+
+TEST_F(Arena, LargeAllocation)
+{
+  char *p;
+  install();
+  p = (char *)webvtt_alloc0( 0x40000 );
+  uninstall();
+
+  ASSERT_TRUE( p != 0 );
+  EXPECT_EQ( 0, p[ 0 ] );
+  EXPECT_EQ( 0, p[ 0x3FFFF ] );
+  EXPECT_TRUE( webvtt_is_arena_owned( p ) );
+}
+
+TEST_F(Arena, ParserAllocatesCuesFromArena)
+{
+  parse( "WEBVTT\n\n"
+         "00:00.000 --> 00:01.000\nHello <b>world</b>\n\n"
+         "00:01.000 --> 00:02.000 align:start\nSecond cue\n" );
+  EXPECT_EQ( 2, count );
+  EXPECT_EQ( 2, heap_in_callback );
+}
+
+TEST_F(Arena, ResetAfterFinish)
+{
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n" );
+  EXPECT_EQ( 1, count );
+  webvtt_reset_arena( arena );
+  webvtt_delete_parser( parser );
+  parser = 0;
+
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nTwo\n" );
+  EXPECT_EQ( 2, count );
+}
@@ -0,0 +1,188 @@
+#include "output_testfixture"
+#include <vector>
+#include <webvttxx/abstract_parser>
+
+/**
+ * Parsers created with webvtt_create_batch_parser() hand over cues several at
+ * a time, without reordering them relative to errors
+ */
+class BatchParser : public ParserOutputTest
+{
+public:
+  static void WEBVTT_CALLBACK onBatch( void *userdata, webvtt_cue **cues,
+                                       webvtt_uint count ) {
+    std::ostringstream &out = *static_cast<std::ostringstream *>( userdata );
+    out << "batch " << count << "\n";
+    for( webvtt_uint i = 0; i < count; ++i ) {
+      writeCue( out, cues[ i ] );
+      webvtt_release_cue( &cues[ i ] );
+    }
+  }
+
+  webvtt_parser create( webvtt_uint batchSize ) {
+    webvtt_parser_config config;
+    webvtt_parser parser = 0;
+    webvtt_init_parser_config( &config );
+    config.batch_size = batchSize;
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_batch_parser( &onBatch, &onError, &out, &config,
+                                           &parser ) );
+    return parser;
+  }
+
+  /**
+   * The lines written for the cues and errors in 'text' by a parser which
+   * hands over cues one at a time. None of the cues here span several lines.
+   */
+  static std::vector<std::string> lines( const std::string &text ) {
+    std::ostringstream out;
+    std::vector<std::string> result;
+    std::string line;
+    webvtt_parser parser;
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_parser( &onRead, &onError, &out, &parser ) );
+    webvtt_parse_buffer( parser, text.data(), text.size() );
+    webvtt_delete_parser( parser );
+    std::istringstream in( out.str() );
+    while( std::getline( in, line ) ) {
+      result.push_back( line + "\n" );
+    }
+    return result;
+  }
+
+  static std::string cues( int count ) {
+    std::ostringstream text;
+    text << "WEBVTT\n\n";
+    for( int i = 0; i < count; ++i ) {
+      text << "00:00.000 --> 00:01.000\n" << i << "\n\n";
+    }
+    return text.str();
+  }
+
+protected:
+  std::ostringstream out;
+};
+
+TEST_F(BatchParser, Batches)
+{
+  std::string text = cues( 7 );
+  std::vector<std::string> cue = lines( text );
+  ASSERT_EQ( 7U, cue.size() );
+  webvtt_parser parser = create( 3 );
+  webvtt_parse_chunk( parser, text.data(), text.size() );
+  std::string expected = "batch 3\n" + cue[ 0 ] + cue[ 1 ] + cue[ 2 ] +
+                         "batch 3\n" + cue[ 3 ] + cue[ 4 ] + cue[ 5 ];
+  EXPECT_EQ( expected, out.str() );
+  webvtt_finish_parsing( parser );
+  webvtt_delete_parser( parser );
+  EXPECT_EQ( expected + "batch 1\n" + cue[ 6 ], out.str() );
+}
+
+TEST_F(BatchParser, DefaultBatchSize)
+{
+  std::string text = cues( WEBVTT_DEFAULT_BATCH_SIZE + 1 );
+  webvtt_parser parser = create( 0 );
+  webvtt_parse_buffer( parser, text.data(), text.size() );
+  webvtt_delete_parser( parser );
+  std::ostringstream first, second;
+  first << "batch " << WEBVTT_DEFAULT_BATCH_SIZE << "\n";
+  second << "batch 1\n" << lines( text ).back();
+  EXPECT_EQ( 0U, out.str().find( first.str() ) );
+  EXPECT_EQ( out.str().size() - second.str().size(),
+             out.str().find( second.str() ) );
+}
+
+/**
+ * The cues before an error are delivered before it is reported
+ */
+TEST_F(BatchParser, ErrorsInOrder)
+{
+  std::string text( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n\n"
+                    "00:01.000 --> 00:02.000\nTwo\n\n"
+                    "00:02.000 --> 00:03.000 line:x\nThree\n\n"
+                    "00:03.000 --> 00:04.000\nFour\n" );
+  webvtt_parser parser = create( 8 );
+  webvtt_parse_buffer( parser, text.data(), text.size() );
+  webvtt_delete_parser( parser );
+  std::vector<std::string> line = lines( text );
+  ASSERT_EQ( 5U, line.size() );
+  std::ostringstream error;
+  error << "error 9:25 " << WEBVTT_LINE_BAD_VALUE << "\n";
+  EXPECT_EQ( error.str(), line[ 2 ] );
+  EXPECT_EQ( "batch 2\n" + line[ 0 ] + line[ 1 ] + line[ 2 ] +
+             "batch 2\n" + line[ 3 ] + line[ 4 ], out.str() );
+}
+
+TEST_F(BatchParser, Parallel)
+{
+  std::string text = cues( 100 );
+  webvtt_parser parser = create( 16 );
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_parse_parallel( parser, text.data(), text.size(), 2, 64 ) );
+  webvtt_delete_parser( parser );
+  std::string result = out.str();
+  std::vector<std::string> cue = lines( text );
+  std::string expected;
+  for( size_t i = 0; i < cue.size(); ++i ) {
+    expected += cue[ i ];
+  }
+  std::string::size_type pos;
+  while( ( pos = result.find( "batch " ) ) != std::string::npos ) {
+    result.erase( pos, result.find( '\n', pos ) + 1 - pos );
+  }
+  EXPECT_EQ( expected, result );
+}
+
+/**
+ * Cues still waiting for their batch to fill are released with the parser
+ */
+TEST_F(BatchParser, DeleteWithoutFinishing)
+{
+  std::string text = cues( 2 );
+  webvtt_parser parser = create( 8 );
+  webvtt_parse_chunk( parser, text.data(), text.size() );
+  webvtt_delete_parser( parser );
+  EXPECT_EQ( "", out.str() );
+}
+
+TEST_F(BatchParser, InvalidParams)
+{
+  webvtt_parser parser;
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_create_batch_parser( 0, &onError, &out, 0, &parser ) );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_create_parser_with_config( 0, &onError, &out, 0,
+                                               &parser ) );
+}
+
+class CueBatches : public WebVTT::AbstractParser
+{
+public:
+  CueBatches( webvtt_uint batchSize ) : AbstractParser( batchSize ) {}
+
+  virtual bool reportError( const WebVTT::Error & ) { return true; }
+  virtual void parsedCue( WebVTT::Cue &cue ) { cues.push_back( cue ); }
+  virtual void parsedCues( std::vector<WebVTT::Cue> &batch ) {
+    sizes.push_back( batch.size() );
+    AbstractParser::parsedCues( batch );
+  }
+
+  ::webvtt_status parse( const std::string &text ) {
+    return parseBuffer( text.data(), text.size() );
+  }
+
+  std::vector<WebVTT::Cue> cues;
+  std::vector<size_t> sizes;
+};
+
+TEST_F(BatchParser, AbstractParser)
+{
+  CueBatches parser( 4 );
+  EXPECT_EQ( WEBVTT_SUCCESS, parser.parse( cues( 6 ) ) );
+  ASSERT_EQ( 2U, parser.sizes.size() );
+  EXPECT_EQ( 4U, parser.sizes[ 0 ] );
+  EXPECT_EQ( 2U, parser.sizes[ 1 ] );
+  ASSERT_EQ( 6U, parser.cues.size() );
+  EXPECT_STREQ( "0", parser.cues[ 0 ].body().utf8() );
+  EXPECT_STREQ( "5", parser.cues[ 5 ].body().utf8() );
+}
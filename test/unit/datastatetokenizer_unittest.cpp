@@ -6,7 +6,8 @@ class DataStateTokenizerTest : public CueTextTokenizerTest
     void dataTokenize( const char *text ) {
       token_state = DATA;
       pos = start = text;
-      current_status = webvtt_data_state( &pos, &token_state, &res );
+      current_status = webvtt_data_state( &pos, pos + strlen( pos ), &token_state,
+                                          &res );
     }
 };
 
@@ -158,3 +158,22 @@ TEST_F(EscapeStateTokenizerTest, ExtraAmpersand)
   EXPECT_EQ( DATA, state() );
   EXPECT_STREQ( "&am&", parsedText() );
 }
+
+/*
+ * Tests that names sharing a length and first character with a valid escape
+ * sequence, or differing from one only in case, are preserved as they are.
+ */
+TEST_F(EscapeStateTokenizerTest, NearMissesArePreserved)
+{
+  const char *names[] = { "lrn; ", "ampx; ", "AMP; ", "nbs; ", "ls; ", "t; " };
+  for( size_t i = 0; i < sizeof( names ) / sizeof( *names ); ++i ) {
+    webvtt_release_string( &res );
+    webvtt_init_string( &res );
+    escapeTokenize( names[ i ] );
+    EXPECT_EQ( WEBVTT_UNFINISHED, status() );
+    EXPECT_EQ( DATA, state() );
+    std::string expected = std::string( "&" ) + names[ i ];
+    expected.erase( expected.size() - 1 );
+    EXPECT_EQ( expected, parsedText() );
+  }
+}
@@ -0,0 +1,188 @@
+#include "output_testfixture"
+
+/**
+ * Parsers with 'hls_segment' set move every time in the segment by the offset
+ * given in its X-TIMESTAMP-MAP header, as the segment is parsed
+ */
+class HlsSegment : public CueCollectorTest
+{
+public:
+  HlsSegment() : segment( true ), flat( false ), lazy( false ), base( 0 ) {
+    stopOnError = false;
+  }
+
+  /**
+   * Parse 'text', 'chunk' bytes at a time, returning the start and end of
+   * each cue
+   */
+  std::string parse( const std::string &text, size_t chunk = 0 ) {
+    webvtt_parser_config config;
+    std::ostringstream out;
+    releaseCues();
+    webvtt_init_parser_config( &config );
+    config.hls_segment = segment;
+    config.hls_mpegts_base = base;
+    config.flat_node_tree = flat;
+    config.lazy_cuetext = lazy;
+    CueCollectorTest::parse( &config, text, chunk );
+    for( size_t i = 0; i < cues.size(); ++i ) {
+      out << cues[ i ]->from << "-" << cues[ i ]->until << " ";
+    }
+    return out.str();
+  }
+
+  /**
+   * Time of the first node of cue 'i', which must be a timestamp tag
+   */
+  webvtt_timestamp tagTime( size_t i ) {
+    if( flat ) {
+      webvtt_node_tree *tree = webvtt_cue_get_node_tree( cues[ i ] );
+      webvtt_uint node = webvtt_node_tree_first_child( tree, 0 );
+      EXPECT_EQ( WEBVTT_TIME_STAMP, webvtt_node_tree_kind( tree, node ) );
+      return webvtt_node_tree_timestamp( tree, node );
+    }
+    webvtt_node *head = webvtt_cue_get_node_head( cues[ i ] );
+    webvtt_node *node = head->data.internal_data->children[ 0 ];
+    EXPECT_EQ( WEBVTT_TIME_STAMP, node->kind );
+    return node->data.timestamp;
+  }
+
+protected:
+  bool segment, flat, lazy;
+  webvtt_uint64 base;
+};
+
+static const char segmentText[] =
+  "WEBVTT\nX-TIMESTAMP-MAP=MPEGTS:900000,LOCAL:00:00:01.000\n\n"
+  "00:01.000 --> 00:02.000\n<00:01.500>One\n\n"
+  "id\n00:02.000 --> 00:03.000 align:start\n<00:02.500>Two\n";
+
+/**
+ * 900000 ticks is 10 seconds, so LOCAL 1 second becomes 10 seconds
+ */
+TEST_F(HlsSegment, Offset)
+{
+  EXPECT_EQ( "10000-11000 11000-12000 ", parse( segmentText ) );
+  EXPECT_EQ( "", errors.str() );
+  EXPECT_EQ( 10500U, tagTime( 0 ) );
+  EXPECT_EQ( 11500U, tagTime( 1 ) );
+}
+
+TEST_F(HlsSegment, FlatTree)
+{
+  flat = true;
+  EXPECT_EQ( "10000-11000 11000-12000 ", parse( segmentText ) );
+  EXPECT_EQ( 10500U, tagTime( 0 ) );
+  EXPECT_EQ( 11500U, tagTime( 1 ) );
+}
+
+/**
+ * Cue text of a rebased segment is parsed straight away, so that lazily made
+ * nodes don't need to know about the offset
+ */
+TEST_F(HlsSegment, LazyCueText)
+{
+  lazy = true;
+  EXPECT_EQ( "10000-11000 11000-12000 ", parse( segmentText ) );
+  EXPECT_EQ( 10500U, tagTime( 0 ) );
+  lazy = flat = true;
+  EXPECT_EQ( "10000-11000 11000-12000 ", parse( segmentText ) );
+  EXPECT_EQ( 11500U, tagTime( 1 ) );
+}
+
+TEST_F(HlsSegment, Chunks)
+{
+  std::string expected = parse( segmentText );
+  for( size_t chunk = 1; chunk < 16; ++chunk ) {
+    SCOPED_TRACE( ::testing::Message() << chunk << " byte chunks" );
+    EXPECT_EQ( expected, parse( segmentText, chunk ) );
+    EXPECT_EQ( "", errors.str() );
+    EXPECT_EQ( 11500U, tagTime( 1 ) );
+  }
+}
+
+TEST_F(HlsSegment, LocalFirst)
+{
+  EXPECT_EQ( "2000-3000 ",
+             parse( "WEBVTT\nX-TIMESTAMP-MAP=LOCAL:00:00.000,MPEGTS:180000\n"
+                    "\n00:00.000 --> 00:01.000\nx\n" ) );
+  EXPECT_EQ( "", errors.str() );
+}
+
+/**
+ * MPEGTS is measured from 'hls_mpegts_base', wrapping around at 2^33
+ */
+TEST_F(HlsSegment, Base)
+{
+  base = 900000;
+  EXPECT_EQ( "1000-2000 ",
+             parse( "WEBVTT\nX-TIMESTAMP-MAP=MPEGTS:990000,LOCAL:00:00:00.000"
+                    "\n\n00:00.000 --> 00:01.000\nx\n" ) );
+  base = ( (webvtt_uint64)1 << 33 ) - 90000;
+  EXPECT_EQ( "2000-3000 ",
+             parse( "WEBVTT\nX-TIMESTAMP-MAP=MPEGTS:90000,LOCAL:00:00:00.000"
+                    "\n\n00:00.000 --> 00:01.000\nx\n" ) );
+}
+
+/**
+ * Times which would end up before the start of the stream become 0
+ */
+TEST_F(HlsSegment, NegativeOffset)
+{
+  EXPECT_EQ( "0-1000 ",
+             parse( "WEBVTT\nX-TIMESTAMP-MAP=MPEGTS:0,LOCAL:00:00:05.000\n\n"
+                    "00:02.000 --> 00:06.000\nx\n" ) );
+}
+
+TEST_F(HlsSegment, MalformedMap)
+{
+  std::ostringstream expected;
+  ParserOutputTest::writeError( expected, 2, 1,
+                                WEBVTT_MALFORMED_TIMESTAMP_MAP );
+  const char *maps[] = { "MPEGTS:abc,LOCAL:00:00.000", "MPEGTS:90000",
+                         "LOCAL:00:00.000", "MPEGTS:1;LOCAL:00:00.000",
+                         "MPEGTS:1,LOCAL:00:00.000,MPEGTS:2",
+                         "MPEGTS:1234567890123456789,LOCAL:00:00.000" };
+  for( size_t i = 0; i < sizeof( maps ) / sizeof( maps[ 0 ] ); ++i ) {
+    SCOPED_TRACE( maps[ i ] );
+    EXPECT_EQ( "2000-3000 ",
+               parse( std::string( "WEBVTT\nX-TIMESTAMP-MAP=" ) + maps[ i ] +
+                      "\n\n00:02.000 --> 00:03.000\nx\n" ) );
+    EXPECT_EQ( expected.str(), errors.str() );
+  }
+}
+
+/**
+ * Other header lines are skipped, and without a map, times are unchanged
+ */
+TEST_F(HlsSegment, NoMap)
+{
+  EXPECT_EQ( "2000-3000 ",
+             parse( "WEBVTT\nKind: captions\n\n00:02.000 --> 00:03.000\n"
+                    "x\n" ) );
+  EXPECT_EQ( "", errors.str() );
+}
+
+/**
+ * A cue straight after the header is still missing its blank line
+ */
+TEST_F(HlsSegment, CueInHeader)
+{
+  std::ostringstream expected;
+  ParserOutputTest::writeError( expected, 3, 1, WEBVTT_EXPECTED_EOL );
+  EXPECT_EQ( "12000-13000 ",
+             parse( "WEBVTT\nX-TIMESTAMP-MAP=MPEGTS:900000,LOCAL:00:00.000\n"
+                    "00:02.000 --> 00:03.000\nx\n" ) );
+  EXPECT_EQ( expected.str(), errors.str() );
+}
+
+/**
+ * Other parsers treat the header line as a broken cue, as before
+ */
+TEST_F(HlsSegment, NotSegment)
+{
+  segment = false;
+  EXPECT_EQ( "1000-2000 2000-3000 ", parse( segmentText ) );
+  EXPECT_NE( "", errors.str() );
+  EXPECT_EQ( 1500U, tagTime( 0 ) );
+}
@@ -0,0 +1,177 @@
+#include <vector>
+#include "output_testfixture"
+
+class InternTable : public ::testing::Test
+{
+public:
+  InternTable() : table(0) {}
+
+  virtual void SetUp() {
+    ASSERT_EQ( WEBVTT_SUCCESS, webvtt_create_intern_table( &table ) );
+  }
+
+  virtual void TearDown() {
+    webvtt_release_intern_table( &table );
+  }
+
+  webvtt_string intern( const char *text ) {
+    webvtt_string str;
+    webvtt_create_string_with_text( &str, text, -1 );
+    EXPECT_EQ( WEBVTT_SUCCESS, webvtt_intern_string( table, &str ) );
+    return str;
+  }
+
+protected:
+  webvtt_intern_table *table;
+};
+
+TEST_F(InternTable, SameTextIsSame)
+{
+  webvtt_string a = intern( "yellow" );
+  webvtt_string b = intern( "yellow" );
+  webvtt_string c = intern( "blue" );
+  EXPECT_TRUE( webvtt_string_is_same( &a, &b ) );
+  EXPECT_FALSE( webvtt_string_is_same( &a, &c ) );
+  EXPECT_STREQ( "yellow", webvtt_string_text( &b ) );
+  webvtt_release_string( &a );
+  webvtt_release_string( &b );
+  webvtt_release_string( &c );
+}
+
+/**
+ * Interned strings outlive the table, and modifying one doesn't affect the
+ * other users of the shared instance
+ */
+TEST_F(InternTable, InternedStringsAreImmutable)
+{
+  webvtt_string a = intern( "Speaker" );
+  webvtt_string b = intern( "Speaker" );
+  webvtt_release_intern_table( &table );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_string_putc( &b, 's' ) );
+  EXPECT_FALSE( webvtt_string_is_same( &a, &b ) );
+  EXPECT_STREQ( "Speaker", webvtt_string_text( &a ) );
+  EXPECT_STREQ( "Speakers", webvtt_string_text( &b ) );
+  webvtt_release_string( &a );
+  webvtt_release_string( &b );
+}
+
+TEST_F(InternTable, LongStringsAreNotInterned)
+{
+  std::string text( 200, 'x' );
+  webvtt_string a = intern( text.c_str() );
+  webvtt_string b = intern( text.c_str() );
+  EXPECT_FALSE( webvtt_string_is_same( &a, &b ) );
+  webvtt_release_string( &a );
+  webvtt_release_string( &b );
+}
+
+TEST_F(InternTable, ManyStrings)
+{
+  std::vector<webvtt_string> strings;
+  char text[ 16 ];
+  for( int i = 0; i < 1000; ++i ) {
+    sprintf( text, "class%d", i );
+    strings.push_back( intern( text ) );
+  }
+  for( int i = 0; i < 1000; ++i ) {
+    sprintf( text, "class%d", i );
+    webvtt_string again = intern( text );
+    EXPECT_TRUE( webvtt_string_is_same( &strings[ i ], &again ) );
+    webvtt_release_string( &again );
+  }
+  for( size_t i = 0; i < strings.size(); ++i ) {
+    webvtt_release_string( &strings[ i ] );
+  }
+}
+
+static void WEBVTT_CALLBACK
+onFreeBuffer( void *userdata, char *, webvtt_uint )
+{
+  *static_cast<int *>( userdata ) += 1;
+}
+
+/**
+ * An interned view doesn't keep the buffer it points into alive
+ */
+TEST_F(InternTable, ViewsAreCopied)
+{
+  char data[] = "<c.yellow>";
+  int freed = 0;
+  webvtt_buffer *buffer;
+  webvtt_string view;
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_create_buffer( data, sizeof( data ) - 1, &onFreeBuffer,
+                                   &freed, &buffer ) );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_create_string_view( buffer, 3, 6, &view ) );
+  webvtt_release_buffer( &buffer );
+  EXPECT_EQ( 0, freed );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_intern_string( table, &view ) );
+  EXPECT_EQ( 1, freed );
+  EXPECT_FALSE( WEBVTT_STRING_IS_VIEW( view.d ) );
+  webvtt_string copy = intern( "yellow" );
+  EXPECT_TRUE( webvtt_string_is_same( &view, &copy ) );
+  webvtt_release_string( &view );
+  webvtt_release_string( &copy );
+}
+
+/**
+ * Tag names, classes, voice annotations and languages repeated in cue text
+ * share one instance, when the parser is asked to intern them
+ */
+class InternCueText : public CueCollectorTest
+{
+public:
+  webvtt_internal_node_data *tag( size_t cue ) {
+    return cues[ cue ]->node_head->data.internal_data->children[ 0 ]
+             ->data.internal_data;
+  }
+};
+
+TEST_F(InternCueText, RepeatedValuesAreShared)
+{
+  webvtt_parser_config config;
+  webvtt_init_parser_config( &config );
+  config.intern_cuetext = 1;
+  parse( &config,
+         "WEBVTT\n\n"
+         "00:00.000 --> 00:01.000\n<v Speaker><c.loud>One</c></v>\n\n"
+         "00:01.000 --> 00:02.000\n<v Speaker><c.loud>Two</c></v>\n\n"
+         "00:02.000 --> 00:03.000\n<lang en-GB><i>Three</i></lang>\n\n"
+         "00:03.000 --> 00:04.000\n<lang en-GB>Four</lang>\n" );
+  ASSERT_EQ( 4U, cues.size() );
+  EXPECT_TRUE( webvtt_string_is_same( &tag( 0 )->annotation,
+                                      &tag( 1 )->annotation ) );
+  EXPECT_STREQ( "Speaker", webvtt_string_text( &tag( 1 )->annotation ) );
+  webvtt_internal_node_data *c0 =
+    tag( 0 )->children[ 0 ]->data.internal_data;
+  webvtt_internal_node_data *c1 =
+    tag( 1 )->children[ 0 ]->data.internal_data;
+  EXPECT_TRUE( webvtt_string_is_same( c0->css_classes->items,
+                                      c1->css_classes->items ) );
+  EXPECT_TRUE( webvtt_string_is_same( &tag( 2 )->lang, &tag( 3 )->lang ) );
+  EXPECT_TRUE( webvtt_string_is_same( &tag( 2 )->lang,
+                                      &tag( 2 )->children[ 0 ]
+                                        ->data.internal_data->lang ) );
+}
+
+TEST_F(InternCueText, NotInternedByDefault)
+{
+  parse( 0, "WEBVTT\n\n00:00.000 --> 00:01.000\n<c.yellow>One</c>\n\n"
+            "00:01.000 --> 00:02.000\n<c.yellow>Two</c>\n" );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_FALSE( webvtt_string_is_same( tag( 0 )->css_classes->items,
+                                       tag( 1 )->css_classes->items ) );
+}
+
+TEST_F(InternCueText, SharedTable)
+{
+  webvtt_parser_config config;
+  webvtt_init_parser_config( &config );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_create_intern_table( &config.interns ) );
+  parse( &config, "WEBVTT\n\n00:00.000 --> 00:01.000\n<c.yellow>One</c>\n" );
+  parse( &config, "WEBVTT\n\n00:00.000 --> 00:01.000\n<c.yellow>Two</c>\n" );
+  webvtt_release_intern_table( &config.interns );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_TRUE( webvtt_string_is_same( tag( 0 )->css_classes->items,
+                                      tag( 1 )->css_classes->items ) );
+}
@@ -0,0 +1,73 @@
+#include "output_testfixture"
+extern "C" {
+#include "libwebvtt/cue_internal.h"
+}
+
+class LazyCueText : public CueCollectorTest
+{
+public:
+  void parse( const std::string &text, bool flat = false ) {
+    webvtt_parser_config config;
+    webvtt_init_parser_config( &config );
+    config.lazy_cuetext = 1;
+    config.flat_node_tree = flat;
+    CueCollectorTest::parse( &config, text );
+  }
+};
+
+TEST_F(LazyCueText, ParsedOnFirstAccess)
+{
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\n<b>Hello</b> world\n" );
+  ASSERT_EQ( 1U, cues.size() );
+  EXPECT_TRUE( cues[ 0 ]->node_head == 0 );
+  EXPECT_STREQ( "<b>Hello</b> world", webvtt_string_text( &cues[ 0 ]->body ) );
+
+  webvtt_node *head = webvtt_cue_get_node_head( cues[ 0 ] );
+  ASSERT_TRUE( head != 0 );
+  EXPECT_EQ( WEBVTT_HEAD_NODE, head->kind );
+  ASSERT_EQ( 2U, head->data.internal_data->length );
+  EXPECT_EQ( WEBVTT_BOLD, head->data.internal_data->children[ 0 ]->kind );
+
+  /* The result is kept on the cue */
+  EXPECT_EQ( head, cues[ 0 ]->node_head );
+  EXPECT_EQ( head, webvtt_cue_get_node_head( cues[ 0 ] ) );
+  EXPECT_TRUE( webvtt_cue_get_node_tree( cues[ 0 ] ) == 0 );
+}
+
+TEST_F(LazyCueText, FlatTree)
+{
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\n<i>Hi</i>\n", true );
+  ASSERT_EQ( 1U, cues.size() );
+  EXPECT_TRUE( CUE_EXT( cues[ 0 ] )->node_tree == 0 );
+  webvtt_node_tree *tree = webvtt_cue_get_node_tree( cues[ 0 ] );
+  ASSERT_TRUE( tree != 0 );
+  EXPECT_EQ( 3U, webvtt_node_tree_size( tree ) );
+  EXPECT_EQ( WEBVTT_ITALIC, webvtt_node_tree_kind( tree, 1 ) );
+  EXPECT_EQ( tree, webvtt_cue_get_node_tree( cues[ 0 ] ) );
+  EXPECT_TRUE( webvtt_cue_get_node_head( cues[ 0 ] ) == 0 );
+}
+
+/**
+ * Cues whose text is never asked for are never tokenized
+ */
+TEST_F(LazyCueText, UnusedTextIsNotParsed)
+{
+  webvtt_alloc_stats before, after;
+  webvtt_enable_alloc_stats( 1 );
+  webvtt_get_alloc_stats( &before );
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\n<c.a>One</c>\n\n"
+         "00:01.000 --> 00:02.000\n<v Two>Two</v>\n" );
+  webvtt_get_alloc_stats( &after );
+  webvtt_enable_alloc_stats( 0 );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_EQ( before.category[ WEBVTT_MEM_NODE ].count,
+             after.category[ WEBVTT_MEM_NODE ].count );
+  EXPECT_EQ( before.category[ WEBVTT_MEM_TOKEN ].peak_bytes,
+             after.category[ WEBVTT_MEM_TOKEN ].peak_bytes );
+}
+
+TEST_F(LazyCueText, NullCue)
+{
+  EXPECT_TRUE( webvtt_cue_get_node_head( 0 ) == 0 );
+  EXPECT_TRUE( webvtt_cue_get_node_tree( 0 ) == 0 );
+}
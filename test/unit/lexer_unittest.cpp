@@ -32,6 +32,11 @@ public:
     return self->tstate;
   }
 
+  std::string tokenText( const std::string &str, webvtt_uint pos ) {
+    return std::string( webvtt_lex_token_text( self, str.c_str(), pos ),
+                        self->token_pos );
+  }
+
 private:
   static int WEBVTT_CALLBACK dummyerr( void *userdata, webvtt_uint
                                        line, webvtt_uint col,
@@ -171,3 +176,49 @@ TEST_F(Lexer,LexWEBVTT)
   EXPECT_EQ( L_START, lexerState() );
 }
 
+
+/**
+ * Test that a token split between two buffers is recognized, and that its
+ * text can still be recovered
+ */
+TEST_F(Lexer,LexWEBVTTSplit)
+{
+  webvtt_uint pos = 0;
+  EXPECT_EQ( UNFINISHED, lex( "WEB", pos, false ) );
+  EXPECT_EQ( 3, pos );
+  EXPECT_EQ( L_WEBVTT2, lexerState() );
+  pos = 0;
+  EXPECT_EQ( WEBVTT, lex( "VTT\n", pos ) );
+  EXPECT_EQ( 3, pos );
+  EXPECT_EQ( "WEBVTT", tokenText( "VTT\n", pos ) );
+  EXPECT_EQ( L_START, lexerState() );
+}
+
+/**
+ * Test that a partial token followed by an unexpected byte backs up to that
+ * byte, keeping the text read so far
+ */
+TEST_F(Lexer,LexPartialWEBVTT)
+{
+  webvtt_uint pos = 0;
+  EXPECT_EQ( BADTOKEN, lex( "WEBx", pos ) );
+  EXPECT_EQ( 3, pos );
+  EXPECT_EQ( "WEB", tokenText( "WEBx", pos ) );
+  EXPECT_EQ( L_START, lexerState() );
+}
+
+/**
+ * Test that whitespace is returned up to the point it no longer fits in the
+ * token buffer, and that the rest of it starts a new token
+ */
+TEST_F(Lexer,LexLongWhitespace)
+{
+  std::string blank( 300, ' ' );
+  blank += "x";
+  webvtt_uint pos = 0;
+  EXPECT_EQ( WHITESPACE, lex( blank, pos ) );
+  EXPECT_EQ( 255, pos );
+  EXPECT_EQ( WHITESPACE, lex( blank, pos ) );
+  EXPECT_EQ( 300, pos );
+  EXPECT_EQ( std::string( 45, ' ' ), tokenText( blank, pos ) );
+}
@@ -0,0 +1,174 @@
+#include <webvttxx/node>
+#include "output_testfixture"
+extern "C" {
+#include "libwebvtt/cue_internal.h"
+}
+
+class NodeTree : public CueCollectorTest
+{
+public:
+  virtual void TearDown() {
+    CueCollectorTest::TearDown();
+    for( size_t i = 0; i < nodeCues.size(); ++i ) {
+      webvtt_release_cue( &nodeCues[ i ] );
+    }
+  }
+
+  void parse( bool flat, const std::string &text ) {
+    webvtt_parser_config config;
+    webvtt_init_parser_config( &config );
+    config.flat_node_tree = flat;
+    CueCollectorTest::parse( &config, text );
+  }
+
+  /**
+   * Parse 'payload' as the text of a single cue into a flat tree, and also
+   * into a tree of nodes to compare it with
+   */
+  const webvtt_node_tree *parsePayload( const std::string &payload ) {
+    std::string text = "WEBVTT\n\n00:00.000 --> 00:01.000\n" + payload + "\n";
+    parse( false, text );
+    nodeCues.swap( cues );
+    parse( true, text );
+    EXPECT_EQ( 1U, cues.size() );
+    EXPECT_EQ( 1U, nodeCues.size() );
+    EXPECT_TRUE( cues.empty() || cues[ 0 ]->node_head == 0 );
+    return cues.empty() ? 0 : CUE_EXT( cues[ 0 ] )->node_tree;
+  }
+
+  void expectSame( const WebVTT::Node &a, const WebVTT::Node &b ) {
+    ASSERT_EQ( a.kind(), b.kind() );
+    switch( a.kind() ) {
+      case WebVTT::Node::Text:
+        EXPECT_STREQ( a.text().utf8(), b.text().utf8() );
+        break;
+      case WebVTT::Node::TimeStamp:
+        EXPECT_EQ( a.timeStamp().value(), b.timeStamp().value() );
+        break;
+      default:
+        EXPECT_STREQ( a.annotation().utf8(), b.annotation().utf8() );
+        EXPECT_STREQ( a.lang().utf8(), b.lang().utf8() );
+        ASSERT_EQ( a.cssClassCount(), b.cssClassCount() );
+        for( int i = 0; i < a.cssClassCount(); ++i ) {
+          EXPECT_STREQ( a.cssClass( i ).utf8(), b.cssClass( i ).utf8() );
+        }
+        ASSERT_EQ( a.childCount(), b.childCount() );
+        for( int i = 0; i < a.childCount(); ++i ) {
+          expectSame( a[ i ], b[ i ] );
+        }
+    }
+  }
+
+  /**
+   * The flat tree has the same shape and contents as the tree of nodes
+   */
+  void expectSameAsNodes() {
+    ASSERT_EQ( 1U, cues.size() );
+    expectSame( WebVTT::Node( CUE_EXT( cues[ 0 ] )->node_tree, 0 ),
+                WebVTT::Node( nodeCues[ 0 ]->node_head ) );
+  }
+
+protected:
+  std::vector<webvtt_cue *> nodeCues;
+};
+
+TEST_F(NodeTree, PlainText)
+{
+  const webvtt_node_tree *tree = parsePayload( "Hello\nWorld" );
+  ASSERT_TRUE( tree != 0 );
+  ASSERT_EQ( 2U, webvtt_node_tree_size( tree ) );
+  EXPECT_EQ( WEBVTT_HEAD_NODE, webvtt_node_tree_kind( tree, 0 ) );
+  EXPECT_EQ( 1U, webvtt_node_tree_child_count( tree, 0 ) );
+  EXPECT_EQ( WEBVTT_TEXT, webvtt_node_tree_kind( tree, 1 ) );
+  webvtt_uint len;
+  EXPECT_STREQ( "Hello\nWorld", webvtt_node_tree_text( tree, 1, &len ) );
+  EXPECT_EQ( 11U, len );
+  EXPECT_EQ( 0U, webvtt_node_tree_parent( tree, 1 ) );
+  EXPECT_EQ( WEBVTT_NO_NODE, webvtt_node_tree_next_sibling( tree, 1 ) );
+  EXPECT_EQ( WEBVTT_NO_NODE, webvtt_node_tree_first_child( tree, 1 ) );
+  expectSameAsNodes();
+}
+
+/**
+ * Nodes are stored in document order, children directly after their parent
+ */
+TEST_F(NodeTree, Preorder)
+{
+  const webvtt_node_tree *tree =
+    parsePayload( "<b>One <i>two</i></b> <00:00.500>three" );
+  ASSERT_TRUE( tree != 0 );
+  const webvtt_node_kind kinds[] = { WEBVTT_HEAD_NODE, WEBVTT_BOLD,
+    WEBVTT_TEXT, WEBVTT_ITALIC, WEBVTT_TEXT, WEBVTT_TEXT, WEBVTT_TIME_STAMP,
+    WEBVTT_TEXT };
+  const webvtt_uint parents[] = { WEBVTT_NO_NODE, 0, 1, 1, 3, 0, 0, 0 };
+  ASSERT_EQ( 8U, webvtt_node_tree_size( tree ) );
+  for( webvtt_uint i = 0; i < 8; ++i ) {
+    EXPECT_EQ( kinds[ i ], webvtt_node_tree_kind( tree, i ) );
+    EXPECT_EQ( parents[ i ], webvtt_node_tree_parent( tree, i ) );
+  }
+  EXPECT_EQ( 4U, webvtt_node_tree_child_count( tree, 0 ) );
+  EXPECT_EQ( 5U, webvtt_node_tree_next_sibling( tree, 1 ) );
+  EXPECT_EQ( 3U, webvtt_node_tree_next_sibling( tree, 2 ) );
+  EXPECT_EQ( 500U, webvtt_node_tree_timestamp( tree, 6 ) );
+  EXPECT_EQ( WEBVTT_EMPTY_NODE, webvtt_node_tree_kind( tree, 8 ) );
+  expectSameAsNodes();
+}
+
+TEST_F(NodeTree, ClassesAnnotationsAndLanguages)
+{
+  const webvtt_node_tree *tree =
+    parsePayload( "<v Esme><c.loud.red>Hi</c></v><lang en-GB><i.x>Hello</i>"
+                  "</lang>" );
+  ASSERT_TRUE( tree != 0 );
+  webvtt_uint len;
+  EXPECT_STREQ( "Esme", webvtt_node_tree_annotation( tree, 1, &len ) );
+  EXPECT_EQ( 4U, len );
+  ASSERT_EQ( 2U, webvtt_node_tree_class_count( tree, 2 ) );
+  EXPECT_STREQ( "loud", webvtt_node_tree_class( tree, 2, 0, 0 ) );
+  EXPECT_STREQ( "red", webvtt_node_tree_class( tree, 2, 1, 0 ) );
+  EXPECT_STREQ( "", webvtt_node_tree_class( tree, 2, 2, &len ) );
+  EXPECT_EQ( 0U, len );
+  EXPECT_EQ( WEBVTT_LANG, webvtt_node_tree_kind( tree, 4 ) );
+  EXPECT_STREQ( "en-GB", webvtt_node_tree_lang( tree, 4, 0 ) );
+  EXPECT_STREQ( "", webvtt_node_tree_annotation( tree, 4, 0 ) );
+  EXPECT_STREQ( "en-GB", webvtt_node_tree_lang( tree, 5, 0 ) );
+  expectSameAsNodes();
+}
+
+/**
+ * Unknown tags, stray end tags and ruby text outside ruby are dropped, as
+ * they are from a tree of nodes
+ */
+TEST_F(NodeTree, MatchesNodesForMalformedText)
+{
+  parsePayload( "</b>a<foo>b</foo><rt>c</rt><ruby>d<rt>e</ruby>f</i>&amp;"
+                "<b><u>unclosed" );
+  expectSameAsNodes();
+}
+
+/**
+ * Cues with more nodes, classes and text than the builder keeps on the stack
+ */
+TEST_F(NodeTree, LargeCue)
+{
+  std::string payload;
+  for( int i = 0; i < 100; ++i ) {
+    payload += "<c.first.second.third>some text in a class</c> ";
+  }
+  const webvtt_node_tree *tree = parsePayload( payload );
+  ASSERT_TRUE( tree != 0 );
+  EXPECT_EQ( 301U, webvtt_node_tree_size( tree ) );
+  expectSameAsNodes();
+}
+
+TEST_F(NodeTree, RefCount)
+{
+  parsePayload( "<b>bold</b>" );
+  ASSERT_EQ( 1U, cues.size() );
+  webvtt_node_tree *tree = CUE_EXT( cues[ 0 ] )->node_tree;
+  webvtt_ref_node_tree( tree );
+  releaseCues();
+  EXPECT_STREQ( "bold", webvtt_node_tree_text( tree, 2, 0 ) );
+  webvtt_release_node_tree( &tree );
+  EXPECT_TRUE( tree == 0 );
+}
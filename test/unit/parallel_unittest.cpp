@@ -0,0 +1,170 @@
+#include "output_testfixture"
+
+/**
+ * webvtt_parse_parallel() reports the same cues and errors, in the same
+ * order, as webvtt_parse_buffer(), however the input is split
+ */
+class ParseParallel : public ParserOutputTest
+{
+public:
+  struct Output {
+    Output( int abortAt ) : abortAt( abortAt ), errors( 0 ) {}
+    std::ostringstream out;
+    int abortAt;
+    int errors;
+  };
+
+  static void WEBVTT_CALLBACK onRead( void *userdata, webvtt_cue *cue ) {
+    writeCue( static_cast<Output *>( userdata )->out, cue );
+    webvtt_release_cue( &cue );
+  }
+
+  static int WEBVTT_CALLBACK onError( void *userdata, webvtt_uint line,
+                                      webvtt_uint col, webvtt_error error ) {
+    Output &output = *static_cast<Output *>( userdata );
+    writeError( output.out, line, col, error );
+    return ++output.errors == output.abortAt ? -1 : 0;
+  }
+
+  std::string parseBuffer( const std::string &text, int abortAt,
+                           webvtt_status *status ) {
+    Output output( abortAt );
+    webvtt_parser parser;
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_parser( &onRead, &onError, &output, &parser ) );
+    *status = webvtt_parse_buffer( parser, text.data(), text.size() );
+    webvtt_delete_parser( parser );
+    return output.out.str();
+  }
+
+  std::string parseParallel( const std::string &text, int abortAt,
+                             webvtt_uint threads, webvtt_uint minSegment,
+                             webvtt_status *status,
+                             const webvtt_parser_config *config = 0 ) {
+    Output output( abortAt );
+    webvtt_parser parser;
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_parser_with_config( &onRead, &onError, &output,
+                                                 config, &parser ) );
+    *status = webvtt_parse_parallel( parser, text.data(), text.size(),
+                                     threads, minSegment );
+    webvtt_delete_parser( parser );
+    return output.out.str();
+  }
+
+  /**
+   * Compare with every thread count up to 4, and segments as small as the
+   * input allows. After stopping at an error, the status may be a different
+   * failure.
+   */
+  void expectSame( const std::string &text, int abortAt = 0,
+                   const webvtt_parser_config *config = 0 ) {
+    webvtt_status expectedStatus, status;
+    std::string expected = parseBuffer( text, abortAt, &expectedStatus );
+    EXPECT_NE( "", expected );
+    for( webvtt_uint threads = 1; threads <= 4; ++threads ) {
+      for( webvtt_uint minSegment = 1; minSegment <= 64; minSegment *= 4 ) {
+        SCOPED_TRACE( ::testing::Message() << threads << " threads, "
+                      << minSegment << " byte segments" );
+        EXPECT_EQ( expected, parseParallel( text, abortAt, threads,
+                                            minSegment, &status, config ) );
+        if( abortAt ) {
+          EXPECT_EQ( WEBVTT_FAILED( expectedStatus ),
+                     WEBVTT_FAILED( status ) );
+        } else {
+          EXPECT_EQ( expectedStatus, status );
+        }
+      }
+    }
+  }
+};
+
+TEST_F(ParseParallel, Cues)
+{
+  expectSame( "WEBVTT\n\nid\n00:00.000 --> 00:01.000 align:start\nOne\nTwo\n\n"
+              "00:01.000 --> 00:02.000\n<b>Three</b>\n\n"
+              "NOTE a comment\n\n"
+              "00:02.000 --> 00:03.000\n<v Speaker>Four\n\n\n"
+              "00:03.000 --> 00:04.000\r\nFive\r\n\r\n"
+              "00:04.000 --> 00:05.000\nSix" );
+}
+
+/**
+ * Errors in later segments are reported with the line numbers they have in
+ * the whole file
+ */
+TEST_F(ParseParallel, Errors)
+{
+  expectSame( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n"
+              "00:01.000 --> 00:02.000\nTwo\n\n"
+              "id\nBody before timings\n\n"
+              "00:03.000 --> 00:02.000 vertical:sideways\nThree\n\n"
+              "00:04.000 --> 00:05.000 line:x\nFour\n\n"
+              "00:05.000 --> " );
+}
+
+/**
+ * Once the application asks to stop, nothing after that error is reported,
+ * wherever it is
+ */
+TEST_F(ParseParallel, StopAtError)
+{
+  std::string text( "WEBVTT\n\n00:00.000 --> 00:01.000 line:x\nOne\n\n"
+                    "00:01.000 --> 00:02.000\nTwo\n\n"
+                    "00:03.000 --> 00:02.000\nThree\n\n"
+                    "00:03.000 --> 00:04.000 size:x\nFour\n\n"
+                    "00:04.000 --> 00:05.000\nFive\n" );
+  for( int abortAt = 1; abortAt <= 3; ++abortAt ) {
+    SCOPED_TRACE( ::testing::Message() << "stopping at error " << abortAt );
+    expectSame( text, abortAt );
+  }
+}
+
+TEST_F(ParseParallel, ManyCues)
+{
+  std::ostringstream text;
+  text << "WEBVTT\n\n";
+  for( int i = 0; i < 500; ++i ) {
+    text << i << "\n00:" << ( 10 + i % 50 ) << ".000 --> 00:"
+         << ( 10 + i % 50 ) << ".500\n<c.c" << i % 7 << ">Cue " << i
+         << "</c>\n\n";
+  }
+  expectSame( text.str() );
+}
+
+/**
+ * Each thread interns with a table of its own
+ */
+TEST_F(ParseParallel, Interned)
+{
+  std::ostringstream text;
+  webvtt_parser_config config;
+  webvtt_init_parser_config( &config );
+  config.intern_cuetext = 1;
+  text << "WEBVTT\n\n";
+  for( int i = 0; i < 200; ++i ) {
+    text << "00:01.000 --> 00:02.000\n<v Speaker><c.c" << i % 3 << ">Cue "
+         << i << "</c></v>\n\n";
+  }
+  expectSame( text.str(), 0, &config );
+}
+
+/**
+ * The public entry point parses small inputs on the calling thread
+ */
+TEST_F(ParseParallel, Public)
+{
+  std::string text( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n" );
+  webvtt_status status;
+  std::string expected = parseBuffer( text, 0, &status );
+  Output output( 0 );
+  webvtt_parser parser;
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_create_parser( &onRead, &onError, &output, &parser ) );
+  EXPECT_EQ( status, webvtt_parse_buffer_parallel( parser, text.data(),
+                                                   text.size(), 0 ) );
+  webvtt_delete_parser( parser );
+  EXPECT_EQ( expected, output.out.str() );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_parse_buffer_parallel( 0, "WEBVTT", 6, 0 ) );
+}
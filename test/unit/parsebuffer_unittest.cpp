@@ -0,0 +1,91 @@
+#include "output_testfixture"
+#include <vector>
+
+/**
+ * webvtt_parse_buffer() produces the same cues and errors as feeding the same
+ * input to webvtt_parse_chunk() and webvtt_finish_parsing()
+ */
+class ParseBuffer : public ParserOutputTest
+{
+public:
+  /**
+   * Stop at the first error
+   */
+  static int WEBVTT_CALLBACK onError( void *userdata, webvtt_uint line,
+                                      webvtt_uint col, webvtt_error error ) {
+    ParserOutputTest::onError( userdata, line, col, error );
+    return -1;
+  }
+
+  std::string parseChunks( const std::string &text ) {
+    std::ostringstream out;
+    webvtt_parser parser;
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_parser( &onRead, &onError, &out, &parser ) );
+    webvtt_parse_chunk( parser, text.data(), text.size() );
+    webvtt_finish_parsing( parser );
+    webvtt_delete_parser( parser );
+    return out.str();
+  }
+
+  std::string parseBuffer( const std::string &text ) {
+    std::ostringstream out;
+    webvtt_parser parser;
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_parser( &onRead, &onError, &out, &parser ) );
+    webvtt_parse_buffer( parser, text.data(), text.size() );
+    webvtt_delete_parser( parser );
+    return out.str();
+  }
+
+  void expectSame( const std::string &text ) {
+    std::string expected = parseChunks( text );
+    EXPECT_NE( "", expected );
+    EXPECT_EQ( expected, parseBuffer( text ) );
+  }
+};
+
+TEST_F(ParseBuffer, Cues)
+{
+  expectSame( "WEBVTT\n\nid\n00:00.000 --> 00:01.000 align:start\nOne\nTwo\n\n"
+              "00:01.000 --> 00:02.000\n<b>Three</b>\n\n"
+              "00:02.000 --> 00:03.000\n<v Speaker>Four\n" );
+}
+
+TEST_F(ParseBuffer, LineTerminators)
+{
+  expectSame( "WEBVTT\r\n\r\n00:00.000 --> 00:01.000\r\nOne\r\nTwo\r\n\r\n"
+              "00:01.000 --> 00:02.000\rThree\rFour\r" );
+  expectSame( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\nTwo" );
+  expectSame( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\r" );
+}
+
+TEST_F(ParseBuffer, NulIsReplaced)
+{
+  expectSame( std::string( "WEBVTT\n\n00:00.000 --> 00:01.000\nA\0B\nC\n",
+                           38 ) );
+}
+
+/**
+ * Errors are reported at the same positions, including those found when
+ * finishing
+ */
+TEST_F(ParseBuffer, Errors)
+{
+  expectSame( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n"
+              "00:01.000 --> 00:02.000\nTwo\n\n"
+              "id\nBody before timings\n\n"
+              "00:03.000 --> 00:02.000 vertical:sideways\nThree\n\n"
+              "00:04.000 --> " );
+}
+
+TEST_F(ParseBuffer, Empty)
+{
+  std::ostringstream out;
+  webvtt_parser parser;
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_create_parser( &onRead, &onError, &out, &parser ) );
+  EXPECT_EQ( WEBVTT_SUCCESS, webvtt_parse_buffer( parser, 0, 0 ) );
+  webvtt_delete_parser( parser );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM, webvtt_parse_buffer( 0, "WEBVTT", 6 ) );
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <webvttxx/mapped_file_parser>
+#include <webvttxx/cue>
+#include "output_testfixture"
+
+class ParseFile : public CueCollectorTest
+{
+public:
+  ParseFile() : path( "parsefile_unittest.vtt" ) {}
+
+  virtual void TearDown() {
+    CueCollectorTest::TearDown();
+    remove( path );
+  }
+
+  void write( const std::string &text ) {
+    FILE *fh = fopen( path, "wb" );
+    ASSERT_TRUE( fh != 0 );
+    fwrite( text.data(), 1, text.size(), fh );
+    fclose( fh );
+  }
+
+  webvtt_status parse( const char *file ) {
+    webvtt_parser parser = createParser();
+    webvtt_status status = webvtt_parse_file( parser, file );
+    webvtt_delete_parser( parser );
+    return status;
+  }
+
+protected:
+  const char *path;
+};
+
+TEST_F(ParseFile, Cues)
+{
+  write( "WEBVTT\n\nid\n00:00.000 --> 00:01.000\nOne\nTwo\n\n"
+         "00:01.000 --> 00:02.000\n<b>Three</b>" );
+  EXPECT_EQ( WEBVTT_SUCCESS, parse( path ) );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_STREQ( "id", webvtt_string_text( &cues[ 0 ]->id ) );
+  EXPECT_STREQ( "One\nTwo", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_EQ( 1000U, cues[ 1 ]->from );
+  EXPECT_STREQ( "<b>Three</b>", webvtt_string_text( &cues[ 1 ]->body ) );
+}
+
+/**
+ * Cue text in a mapped file points into the mapping, which outlives the
+ * file
+ */
+TEST_F(ParseFile, BodyPointsIntoMapping)
+{
+  write( "WEBVTT\n\n00:00.000 --> 00:01.000\nHello\nWorld\n\n" );
+  EXPECT_EQ( WEBVTT_SUCCESS, parse( path ) );
+  remove( path );
+  ASSERT_EQ( 1U, cues.size() );
+#if defined(HAVE_MMAP)
+  EXPECT_TRUE( WEBVTT_STRING_IS_VIEW( cues[ 0 ]->body.d ) );
+#endif
+  EXPECT_STREQ( "Hello\nWorld", webvtt_string_text( &cues[ 0 ]->body ) );
+}
+
+TEST_F(ParseFile, EmptyFile)
+{
+  write( "" );
+  parse( path );
+  EXPECT_EQ( 0U, cues.size() );
+}
+
+TEST_F(ParseFile, MissingFile)
+{
+  EXPECT_EQ( WEBVTT_UNSUCCESSFUL, parse( "parsefile_unittest_missing.vtt" ) );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM, webvtt_parse_file( 0, path ) );
+}
+
+class CueCollector : public WebVTT::MappedFileParser
+{
+public:
+  CueCollector( const char *path ) : MappedFileParser( path ) {}
+
+  virtual bool reportError( const WebVTT::Error & ) { return true; }
+  virtual void parsedCue( WebVTT::Cue &cue ) { cues.push_back( cue ); }
+
+  std::vector<WebVTT::Cue> cues;
+};
+
+TEST_F(ParseFile, MappedFileParser)
+{
+  write( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n\n"
+         "00:01.000 --> 00:02.000\nTwo\n" );
+  std::vector<WebVTT::Cue> parsed;
+  {
+    CueCollector parser( path );
+    EXPECT_TRUE( parser.parse() );
+    parsed = parser.cues;
+  }
+  remove( path );
+  ASSERT_EQ( 2U, parsed.size() );
+  EXPECT_STREQ( "One", parsed[ 0 ].body().utf8() );
+  EXPECT_STREQ( "Two", parsed[ 1 ].body().utf8() );
+}
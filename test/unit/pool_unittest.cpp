@@ -0,0 +1,82 @@
+#include "output_testfixture"
+
+class Pool : public CueCollectorTest
+{
+public:
+  Pool() : parser(0), keep(false) {}
+
+  virtual void SetUp() {
+    webvtt_parser_config config;
+    webvtt_init_parser_config( &config );
+    config.pool_objects = 1;
+    ASSERT_TRUE( ( parser = createParser( &config ) ) != 0 );
+  }
+
+  virtual void TearDown() {
+    webvtt_delete_parser( parser );
+    CueCollectorTest::TearDown();
+  }
+
+  void parse( const std::string &text ) {
+    webvtt_parse_chunk( parser, text.data(), text.size() );
+  }
+
+  /**
+   * Cues are only kept if 'keep' is set, so that the pool can reuse them
+   */
+  virtual void read( webvtt_cue *cue ) {
+    seen.push_back( cue );
+    nodes.push_back( cue->node_head );
+    if( keep ) {
+      cues.push_back( cue );
+    } else {
+      webvtt_release_cue( &cue );
+    }
+  }
+
+protected:
+  webvtt_parser parser;
+  bool keep;
+  std::vector<webvtt_cue *> seen;
+  std::vector<webvtt_node *> nodes;
+};
+
+/**
+ * A cue released by the application is reused for the next cue
+ */
+TEST_F(Pool, ReusesReleasedCues)
+{
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n\n" );
+  parse( "00:01.000 --> 00:02.000\nTwo\n\n" );
+  parse( "00:02.000 --> 00:03.000\nThree\n\n" );
+  ASSERT_EQ( 3U, seen.size() );
+  EXPECT_EQ( seen[ 0 ], seen[ 1 ] );
+  EXPECT_EQ( seen[ 1 ], seen[ 2 ] );
+  EXPECT_EQ( nodes[ 0 ], nodes[ 1 ] );
+}
+
+TEST_F(Pool, CuesComeFromPool)
+{
+  keep = true;
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n\n"
+         "00:01.000 --> 00:02.000\nTwo\n\n" );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_TRUE( WEBVTT_ALLOC_HEADER( cues[ 0 ] )->h.flags & WEBVTT_ALLOC_POOL );
+  EXPECT_TRUE( WEBVTT_ALLOC_HEADER( cues[ 0 ]->node_head )->h.flags
+               & WEBVTT_ALLOC_POOL );
+  EXPECT_NE( cues[ 0 ], cues[ 1 ] );
+}
+
+/**
+ * Cues may outlive the parser that created them
+ */
+TEST_F(Pool, ReleaseAfterParserDeleted)
+{
+  keep = true;
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne <b>bold</b>\n\n" );
+  webvtt_finish_parsing( parser );
+  webvtt_delete_parser( parser );
+  parser = 0;
+  ASSERT_EQ( 1U, cues.size() );
+  EXPECT_STREQ( "One <b>bold</b>", webvtt_string_text( &cues[ 0 ]->body ) );
+}
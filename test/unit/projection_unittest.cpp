@@ -0,0 +1,116 @@
+#include "output_testfixture"
+
+class Projection : public CueCollectorTest
+{
+public:
+  Projection() {
+    stopOnError = false;
+  }
+
+  void parse( webvtt_uint projection, const std::string &text,
+              bool fromBuffer = false ) {
+    webvtt_parser parser;
+    webvtt_parser_config config;
+    webvtt_init_parser_config( &config );
+    config.projection = projection;
+    if( !fromBuffer ) {
+      CueCollectorTest::parse( &config, text );
+      return;
+    }
+    webvtt_buffer *buffer;
+    data = std::vector<char>( text.begin(), text.end() );
+    ASSERT_EQ( WEBVTT_SUCCESS, webvtt_create_buffer( &data[ 0 ],
+                                 data.size(), 0, 0, &buffer ) );
+    ASSERT_TRUE( ( parser = createParser( &config ) ) != 0 );
+    webvtt_parse_chunk_from_buffer( parser, buffer, 0, data.size() );
+    webvtt_release_buffer( &buffer );
+    webvtt_finish_parsing( parser );
+    webvtt_delete_parser( parser );
+  }
+
+protected:
+  std::vector<char> data;
+};
+
+static const char text[] =
+  "WEBVTT\n\n"
+  "one\n00:00.000 --> 00:01.000 align:start line:10%\n<b>Hello</b>\nWorld\n\n"
+  "two\n00:01.000 --> 00:02.000 size:50%\nAgain\n";
+
+TEST_F(Projection, Everything)
+{
+  parse( 0, text );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_STREQ( "one", webvtt_string_text( &cues[ 0 ]->id ) );
+  EXPECT_EQ( WEBVTT_ALIGN_START, cues[ 0 ]->settings.align );
+  EXPECT_STREQ( "<b>Hello</b>\nWorld", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_TRUE( cues[ 0 ]->node_head != 0 );
+}
+
+TEST_F(Projection, TimingsOnly)
+{
+  parse( WEBVTT_PROJECT_TIMINGS, text );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_EQ( 0U, cues[ 0 ]->from );
+  EXPECT_EQ( 1000U, cues[ 0 ]->until );
+  EXPECT_EQ( 1000U, cues[ 1 ]->from );
+  EXPECT_EQ( 2000U, cues[ 1 ]->until );
+  for( int i = 0; i < 2; ++i ) {
+    EXPECT_TRUE( webvtt_string_is_empty( &cues[ i ]->id ) );
+    EXPECT_TRUE( webvtt_string_is_empty( &cues[ i ]->body ) );
+    EXPECT_TRUE( cues[ i ]->node_head == 0 );
+    EXPECT_EQ( WEBVTT_ALIGN_MIDDLE, cues[ i ]->settings.align );
+    EXPECT_EQ( 100U, cues[ i ]->settings.size );
+  }
+}
+
+TEST_F(Projection, TimingsOnlyFromBuffer)
+{
+  parse( WEBVTT_PROJECT_TIMINGS, text, true );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_TRUE( webvtt_string_is_empty( &cues[ 0 ]->body ) );
+  EXPECT_EQ( 2000U, cues[ 1 ]->until );
+}
+
+TEST_F(Projection, SettingsWithoutText)
+{
+  parse( WEBVTT_PROJECT_SETTINGS, text );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_EQ( WEBVTT_ALIGN_START, cues[ 0 ]->settings.align );
+  EXPECT_EQ( 10, cues[ 0 ]->settings.line );
+  EXPECT_EQ( 50U, cues[ 1 ]->settings.size );
+  EXPECT_TRUE( webvtt_string_is_empty( &cues[ 0 ]->id ) );
+  EXPECT_TRUE( webvtt_string_is_empty( &cues[ 0 ]->body ) );
+}
+
+TEST_F(Projection, BodyWithoutNodes)
+{
+  parse( WEBVTT_PROJECT_ID | WEBVTT_PROJECT_BODY, text );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_STREQ( "two", webvtt_string_text( &cues[ 1 ]->id ) );
+  EXPECT_STREQ( "<b>Hello</b>\nWorld", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_TRUE( cues[ 0 ]->node_head == 0 );
+}
+
+TEST_F(Projection, NodesWithoutBody)
+{
+  parse( WEBVTT_PROJECT_NODES, text );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_TRUE( webvtt_string_is_empty( &cues[ 0 ]->body ) );
+  ASSERT_TRUE( cues[ 0 ]->node_head != 0 );
+  EXPECT_EQ( WEBVTT_BOLD, cues[ 0 ]->node_head->data.internal_data
+                            ->children[ 0 ]->kind );
+}
+
+/**
+ * Settings which aren't parsed can't be reported as bad
+ */
+TEST_F(Projection, SkippedSettingsAreNotReported)
+{
+  const char bad[] = "WEBVTT\n\n00:00.000 --> 00:01.000 align:nowhere\nx\n";
+  parse( 0, bad );
+  EXPECT_NE( "", errors.str() );
+  errors.str( "" );
+  parse( WEBVTT_PROJECT_BODY, bad );
+  EXPECT_EQ( "", errors.str() );
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+extern "C" {
+#include "libwebvtt/parser_internal.h"
+}
+
+/**
+ * Parsers created with webvtt_create_pull_parser() keep their cues until the
+ * application asks for them with webvtt_parser_next_cue()
+ */
+class PullParser : public ::testing::Test
+{
+public:
+  PullParser() : parser( 0 ) {}
+
+  virtual void SetUp() {
+    ASSERT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_pull_parser( &onError, &errors, 0, &parser ) );
+  }
+
+  virtual void TearDown() {
+    webvtt_delete_parser( parser );
+  }
+
+  static int WEBVTT_CALLBACK onError( void *userdata, webvtt_uint line,
+                                      webvtt_uint, webvtt_error ) {
+    static_cast<std::vector<webvtt_uint> *>( userdata )->push_back( line );
+    return 0;
+  }
+
+  void feed( const std::string &text ) {
+    webvtt_parse_chunk( parser, text.data(), text.size() );
+  }
+
+  /**
+   * Take every cue that is ready, returning their bodies, one per line
+   */
+  std::string take( webvtt_status expected ) {
+    std::ostringstream out;
+    webvtt_cue *cue;
+    webvtt_status status;
+    while( ( status = webvtt_parser_next_cue( parser, &cue ) ) ==
+           WEBVTT_SUCCESS && cue ) {
+      out << webvtt_string_text( &cue->body ) << "\n";
+      webvtt_release_cue( &cue );
+    }
+    EXPECT_EQ( expected, status );
+    EXPECT_EQ( 0, cue );
+    return out.str();
+  }
+
+  static std::string cues( int first, int count ) {
+    std::ostringstream text;
+    for( int i = first; i < first + count; ++i ) {
+      text << "00:00.000 --> 00:01.000\n" << i << "\n\n";
+    }
+    return text.str();
+  }
+
+protected:
+  webvtt_parser parser;
+  std::vector<webvtt_uint> errors;
+};
+
+TEST_F(PullParser, Chunks)
+{
+  EXPECT_EQ( "", take( WEBVTT_UNFINISHED ) );
+  feed( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n\n00:01.000 --> 00:02" );
+  EXPECT_EQ( "One\n", take( WEBVTT_UNFINISHED ) );
+  feed( ".000\nTwo\n\n00:02.000 --> 00:03.000\nThree" );
+  EXPECT_EQ( "Two\n", take( WEBVTT_UNFINISHED ) );
+  webvtt_finish_parsing( parser );
+  EXPECT_EQ( "Three\n", take( WEBVTT_SUCCESS ) );
+  EXPECT_EQ( "", take( WEBVTT_SUCCESS ) );
+}
+
+/**
+ * However many cues a chunk yields, they are all kept, in order, including
+ * when some are taken between chunks
+ */
+TEST_F(PullParser, ManyCues)
+{
+  feed( "WEBVTT\n\n" + cues( 0, 5 ) );
+  EXPECT_EQ( "0\n1\n2\n3\n4\n", take( WEBVTT_UNFINISHED ) );
+  feed( cues( 5, 6 ) );
+  webvtt_cue *cue;
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_parser_next_cue( parser, &cue ) );
+  EXPECT_STREQ( "5", webvtt_string_text( &cue->body ) );
+  webvtt_release_cue( &cue );
+  feed( cues( 11, 100 ) );
+  webvtt_finish_parsing( parser );
+  std::ostringstream expected;
+  for( int i = 6; i < 111; ++i ) {
+    expected << i << "\n";
+  }
+  EXPECT_EQ( expected.str(), take( WEBVTT_SUCCESS ) );
+}
+
+TEST_F(PullParser, ParseBuffer)
+{
+  std::string text( "WEBVTT\n\n" + cues( 0, 3 ) +
+                    "00:03.000 --> 00:04.000 line:x\nBad line\n" );
+  webvtt_parse_buffer( parser, text.data(), text.size() );
+  EXPECT_EQ( "0\n1\n2\nBad line\n", take( WEBVTT_SUCCESS ) );
+  ASSERT_EQ( 1U, errors.size() );
+  EXPECT_EQ( 12U, errors[ 0 ] );
+}
+
+/**
+ * Cues which were never taken are released with the parser
+ */
+TEST_F(PullParser, DeleteWithCues)
+{
+  feed( "WEBVTT\n\n" + cues( 0, 20 ) );
+}
+
+TEST_F(PullParser, InvalidParams)
+{
+  webvtt_cue *cue;
+  webvtt_parser other;
+  EXPECT_EQ( WEBVTT_INVALID_PARAM, webvtt_parser_next_cue( 0, &cue ) );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM, webvtt_parser_next_cue( parser, 0 ) );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_create_pull_parser( 0, 0, 0, &other ) );
+}
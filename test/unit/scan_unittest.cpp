@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+extern "C" {
+#include "libwebvtt/scan_internal.h"
+}
+
+/**
+ * Every implementation the CPU supports gives the same answers as the
+ * portable one
+ */
+class Scan : public ::testing::TestWithParam<webvtt_scan_level>
+{
+public:
+  virtual void SetUp() {
+    previous = webvtt_scan_get_level();
+    supported = webvtt_scan_set_level( GetParam() );
+  }
+
+  virtual void TearDown() {
+    webvtt_scan_set_level( previous );
+  }
+
+  /**
+   * Random text drawn from the first 'alen' characters of 'alphabet'
+   */
+  static std::string random( const char *alphabet, size_t alen, size_t len ) {
+    std::string text( len, ' ' );
+    for( size_t i = 0; i < len; ++i ) {
+      text[ i ] = alphabet[ rand() % alen ];
+    }
+    return text;
+  }
+
+  static const char *refEol( const char *p, const char *end ) {
+    while( p < end && *p != '\r' && *p != '\n' ) ++p;
+    return p;
+  }
+
+  static const char *refLine( const char *p, const char *end ) {
+    while( p < end && *p != '\r' && *p != '\n' && *p ) ++p;
+    return p;
+  }
+
+  static const char *refMarkup( const char *p, const char *end ) {
+    while( p < end && *p != '<' && *p != '&' && *p ) ++p;
+    return p;
+  }
+
+  static const char *refWhitespace( const char *p, const char *end ) {
+    while( p < end && ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ||
+                        *p == '\f' ) ) ++p;
+    return p;
+  }
+
+protected:
+  webvtt_scan_level previous;
+  bool supported;
+};
+
+static const char alphabet[] = "abcdefghij \t\f\r\n<&\0\xE2\x80\x8E";
+
+TEST_P(Scan, MatchesReference)
+{
+  if( !supported ) {
+    return;
+  }
+  srand( 1 );
+  for( int iteration = 0; iteration < 2000; ++iteration ) {
+    /* Mostly uninteresting characters, so that matches are far apart */
+    size_t len = rand() % 150;
+    size_t alen = rand() % 4 ? 10 : sizeof( alphabet ) - 1;
+    std::string text = random( alphabet, alen, len );
+    if( len ) {
+      text[ rand() % len ] = alphabet[ rand() % ( sizeof( alphabet ) - 1 ) ];
+    }
+    std::vector<char> buf( text.begin(), text.end() );
+    const char *p = buf.empty() ? 0 : &buf[ 0 ];
+    const char *end = p + buf.size();
+    for( size_t offset = 0; offset <= std::min<size_t>( len, 40 ); ++offset ) {
+      const char *s = p + offset;
+      ASSERT_EQ( refEol( s, end ), webvtt_scan_eol( s, end ) );
+      ASSERT_EQ( refLine( s, end ), webvtt_scan_line( s, end ) );
+      ASSERT_EQ( refMarkup( s, end ), webvtt_scan_markup( s, end ) );
+      ASSERT_EQ( refWhitespace( s, end ), webvtt_scan_whitespace( s, end ) );
+    }
+  }
+}
+
+TEST_P(Scan, LongRuns)
+{
+  if( !supported ) {
+    return;
+  }
+  std::string spaces( 1000, ' ' );
+  spaces += "x";
+  const char *s = spaces.data(), *end = s + spaces.size();
+  EXPECT_EQ( end - 1, webvtt_scan_whitespace( s, end ) );
+  EXPECT_EQ( end - 1, webvtt_scan_whitespace( s + 7, end ) );
+  EXPECT_EQ( end, webvtt_scan_eol( s, end ) );
+  EXPECT_EQ( end, webvtt_scan_markup( s + 3, end ) );
+
+  std::string line = std::string( 999, 'a' ) + "\r\n";
+  EXPECT_EQ( line.data() + 999,
+             webvtt_scan_line( line.data(), line.data() + line.size() ) );
+}
+
+INSTANTIATE_TEST_CASE_P(Levels, Scan,
+                        ::testing::Values( WEBVTT_SCAN_SCALAR,
+                                           WEBVTT_SCAN_SSE2,
+                                           WEBVTT_SCAN_AVX2 ));
+
+TEST(ScanLevel, UnsupportedLevelIsRefused)
+{
+  webvtt_scan_level level = webvtt_scan_get_level();
+  EXPECT_TRUE( webvtt_scan_set_level( WEBVTT_SCAN_SCALAR ) );
+  EXPECT_EQ( WEBVTT_SCAN_SCALAR, webvtt_scan_get_level() );
+  EXPECT_FALSE( webvtt_scan_set_level( (webvtt_scan_level)( 99 ) ) );
+  EXPECT_TRUE( webvtt_scan_set_level( level ) );
+}
@@ -244,3 +244,29 @@ TEST_F(SetCueSetting, NoWhitespace)
 }
 
 
+
+/**
+ * Keywords are told apart by their first letter, so names sharing it, or
+ * other names mapping to the same slot, must still be rejected
+ */
+TEST_F(SetCueSetting, UnknownKeyword)
+{
+  EXPECT_EQ(WEBVTT_BAD_CUESETTING, set("alignment:start"));
+  EXPECT_EQ(WEBVTT_BAD_CUESETTING, set("l:5"));
+  EXPECT_EQ(WEBVTT_BAD_CUESETTING, set("xize:10%"));
+  EXPECT_EQ(WEBVTT_BAD_CUESETTING, set("Vertical:rl"));
+}
+
+/**
+ * Settings are read in place, each ending at the whitespace after it
+ */
+TEST_F(SetCueSetting, Multiple)
+{
+  EXPECT_EQ(WEBVTT_SUCCESS, setMulti("line:-1 position:10%\tsize:20% "
+                                     "align:end vertical:lr"));
+  EXPECT_EQ(-1, line());
+  EXPECT_EQ(10, position());
+  EXPECT_EQ(20, size());
+  EXPECT_EQ(WEBVTT_ALIGN_END, align());
+  EXPECT_EQ(WEBVTT_VERTICAL_LR, vertical());
+}
@@ -0,0 +1,178 @@
+#include "output_testfixture"
+#include <vector>
+
+/**
+ * A parser restored from webvtt_parser_snapshot() carries on exactly where
+ * the one the snapshot was taken from left off
+ */
+class ParserSnapshot : public ParserOutputTest
+{
+public:
+  webvtt_parser create() {
+    webvtt_parser parser = 0;
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_parser( &onRead, &onError, &out, &parser ) );
+    return parser;
+  }
+
+  std::vector<char> snapshot( webvtt_parser parser ) {
+    webvtt_uint length = 0;
+    EXPECT_EQ( WEBVTT_OUT_OF_MEMORY,
+               webvtt_parser_snapshot( parser, 0, 0, &length ) );
+    std::vector<char> data( length );
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_parser_snapshot( parser, &data[ 0 ], length,
+                                       &length ) );
+    EXPECT_EQ( data.size(), length );
+    return data;
+  }
+
+  std::string parse( const std::string &text ) {
+    webvtt_parser parser = create();
+    webvtt_parse_chunk( parser, text.data(), text.size() );
+    webvtt_finish_parsing( parser );
+    webvtt_delete_parser( parser );
+    std::string result = out.str();
+    out.str( "" );
+    return result;
+  }
+
+  /**
+   * Parse the text up to 'split', then the rest with a new parser restored
+   * from a snapshot of the first
+   */
+  std::string resume( const std::string &text, size_t split ) {
+    webvtt_parser parser = create();
+    webvtt_parse_chunk( parser, text.data(), split );
+    std::vector<char> data = snapshot( parser );
+    webvtt_delete_parser( parser );
+
+    parser = create();
+    EXPECT_EQ( WEBVTT_SUCCESS,
+               webvtt_parser_restore( parser, &data[ 0 ], data.size() ) );
+    webvtt_parse_chunk( parser, text.data() + split, text.size() - split );
+    webvtt_finish_parsing( parser );
+    webvtt_delete_parser( parser );
+    std::string result = out.str();
+    out.str( "" );
+    return result;
+  }
+
+protected:
+  std::ostringstream out;
+};
+
+/**
+ * Snapshots taken anywhere, including partway through the header, a
+ * timestamp, a setting or a line of cue text, resume identically
+ */
+TEST_F(ParserSnapshot, Resume)
+{
+  std::string text( "\xEF\xBB\xBFWEBVTT\n\nid\n00:00.000 --> 00:01.000 "
+                    "align:start\nOne\nTwo\n\n00:01.000 --> 00:00.500\n"
+                    "<b>Three</b>\n\nNOTE hi\n\n00:0x.000 --> 00:01.000\n"
+                    "Four\n\n00:02.000 --> 00:03.000 line:x\r\nFive\r\n" );
+  std::string expected = parse( text );
+  EXPECT_NE( "", expected );
+  for( size_t split = 0; split <= text.size(); ++split ) {
+    SCOPED_TRACE( ::testing::Message() << "snapshot after " << split
+                  << " bytes" );
+    EXPECT_EQ( expected, resume( text, split ) );
+  }
+}
+
+/**
+ * Cue text which is still a view of the caller's buffer is saved as text
+ */
+TEST_F(ParserSnapshot, BufferView)
+{
+  std::string text( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\nTwo" );
+  webvtt_buffer *buffer;
+  webvtt_parser parser = create();
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_create_buffer( &text[ 0 ], text.size(), 0, 0,
+                                   &buffer ) );
+  webvtt_parse_chunk_from_buffer( parser, buffer, 0, text.size() );
+  std::vector<char> data = snapshot( parser );
+  webvtt_delete_parser( parser );
+  webvtt_release_buffer( &buffer );
+  text.assign( text.size(), 'x' );
+
+  parser = create();
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_parser_restore( parser, &data[ 0 ], data.size() ) );
+  webvtt_parse_chunk( parser, "\nThree\n", 7 );
+  webvtt_finish_parsing( parser );
+  webvtt_delete_parser( parser );
+  std::ostringstream expected;
+  expected << "cue 0 1000 " << WEBVTT_ALIGN_MIDDLE
+           << " [] [One\nTwo\nThree] 1\n";
+  EXPECT_EQ( expected.str(), out.str() );
+}
+
+TEST_F(ParserSnapshot, SmallBuffer)
+{
+  webvtt_parser parser = create();
+  webvtt_parse_chunk( parser, "WEBVTT\n\n00:00", 13 );
+  std::vector<char> data = snapshot( parser );
+  webvtt_uint length = 0;
+  EXPECT_EQ( WEBVTT_OUT_OF_MEMORY,
+             webvtt_parser_snapshot( parser, &data[ 0 ], data.size() - 1,
+                                     &length ) );
+  EXPECT_EQ( data.size(), length );
+  webvtt_delete_parser( parser );
+}
+
+/**
+ * Damaged snapshots are turned away, and the parser can still be used
+ */
+TEST_F(ParserSnapshot, Damaged)
+{
+  std::string text( "WEBVTT\n\n00:00.000 --> 00:01.000\nOne\n" );
+  std::string expected = parse( text );
+  webvtt_parser parser = create();
+  webvtt_parse_chunk( parser, text.data(), 20 );
+  std::vector<char> data = snapshot( parser );
+  webvtt_delete_parser( parser );
+
+  for( size_t i = 0; i < data.size(); ++i ) {
+    SCOPED_TRACE( ::testing::Message() << "byte " << i );
+    std::vector<char> damaged( data );
+    damaged[ i ] ^= 0x20;
+    parser = create();
+    webvtt_status status = webvtt_parser_restore( parser, &damaged[ 0 ],
+                                                  damaged.size() );
+    if( i == 4 ) {
+      EXPECT_EQ( WEBVTT_NOT_SUPPORTED, status );
+    } else {
+      EXPECT_EQ( WEBVTT_INVALID_PARAM, status );
+    }
+    EXPECT_EQ( WEBVTT_INVALID_PARAM,
+               webvtt_parser_restore( parser, &data[ 0 ], i ) );
+    webvtt_parse_chunk( parser, text.data(), text.size() );
+    webvtt_finish_parsing( parser );
+    webvtt_delete_parser( parser );
+    EXPECT_EQ( expected, out.str() );
+    out.str( "" );
+  }
+}
+
+/**
+ * Only a parser which hasn't been given any input can be restored
+ */
+TEST_F(ParserSnapshot, InvalidParams)
+{
+  webvtt_uint length;
+  webvtt_parser parser = create();
+  webvtt_parse_chunk( parser, "WEBVTT\n\n", 8 );
+  std::vector<char> data = snapshot( parser );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_parser_restore( parser, &data[ 0 ], data.size() ) );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_parser_snapshot( parser, 0, 10, &length ) );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_parser_snapshot( parser, 0, 0, 0 ) );
+  EXPECT_EQ( WEBVTT_INVALID_PARAM,
+             webvtt_parser_restore( 0, &data[ 0 ], data.size() ) );
+  webvtt_delete_parser( parser );
+}
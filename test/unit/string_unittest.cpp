@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 #include <webvttxx/string>
+extern "C" {
+#include "libwebvtt/string_internal.h"
+}
 
 using namespace WebVTT;
 
@@ -401,3 +404,110 @@ TEST(String,ReplaceAllStrlen)
   EXPECT_STREQ( expectedOutput, webvtt_string_text( &str ) );
   webvtt_release_string( &str );
 }
+
+/**
+ * Single character strings share immortal data rather than allocating
+ */
+TEST(String,SingleCharShared)
+{
+  webvtt_string a, b;
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_create_string_with_text( &a, "b", 1 ) );
+  webvtt_init_string( &b );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_string_putc( &b, 'b' ) );
+  EXPECT_EQ( a.d, b.d );
+  EXPECT_EQ( 1, webvtt_string_length( &b ) );
+  EXPECT_STREQ( "b", webvtt_string_text( &b ) );
+
+  /* Modifying one of them must not affect the other */
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_string_putc( &b, 'r' ) );
+  EXPECT_NE( a.d, b.d );
+  EXPECT_STREQ( "b", webvtt_string_text( &a ) );
+  EXPECT_STREQ( "br", webvtt_string_text( &b ) );
+  webvtt_release_string( &a );
+  webvtt_release_string( &b );
+}
+
+TEST(String,AppendToSharedCopies)
+{
+  webvtt_string a, b;
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_create_string_with_text( &a, "ab", 2 ) );
+  webvtt_copy_string( &b, &a );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_string_append( &b, "cd", 2 ) );
+  EXPECT_STREQ( "ab", webvtt_string_text( &a ) );
+  EXPECT_STREQ( "abcd", webvtt_string_text( &b ) );
+  webvtt_release_string( &a );
+  webvtt_release_string( &b );
+}
+
+/**
+ * Short strings get the smallest block the allocator hands out
+ */
+TEST(String,ShortStringCapacity)
+{
+  webvtt_string str;
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_create_string_with_text( &str, "yellow",
+                                                             -1 ) );
+  EXPECT_LE( 16U, webvtt_string_capacity( &str ) );
+  EXPECT_GT( 32U, webvtt_string_capacity( &str ) );
+  webvtt_release_string( &str );
+}
+
+/**
+ * NUL bytes are replaced with U+FFFD as the line is read, and the line ends
+ * at CR or LF, not at a NUL
+ */
+TEST(String,GetLineReplaceNul)
+{
+  const char text[] = "\0A\0\0B\0\nC";
+  webvtt_uint pos = 0;
+  webvtt_string str;
+  webvtt_init_string( &str );
+  ASSERT_LT( 0, webvtt_string_getline_replace_nul( &str, text, &pos,
+                                                   sizeof( text ) - 1, 0,
+                                                   0 ) );
+  EXPECT_EQ( 6, pos );
+  EXPECT_STREQ( "\xEF\xBF\xBD" "A\xEF\xBF\xBD\xEF\xBF\xBD" "B\xEF\xBF\xBD",
+                webvtt_string_text( &str ) );
+  EXPECT_EQ( 14, webvtt_string_length( &str ) );
+  webvtt_release_string( &str );
+}
+
+/**
+ * Lines without NUL bytes are read as they are
+ */
+TEST(String,GetLineReplaceNulClean)
+{
+  webvtt_uint pos = 0;
+  webvtt_string str;
+  webvtt_init_string( &str );
+  ASSERT_LT( 0, webvtt_string_getline_replace_nul( &str, "Hello world\r",
+                                                   &pos, 12, 0, 1 ) );
+  EXPECT_EQ( 11, pos );
+  EXPECT_STREQ( "Hello world", webvtt_string_text( &str ) );
+  webvtt_release_string( &str );
+}
+
+/**
+ * Resetting a string which nothing else references keeps its storage, while
+ * a shared string is left alone and replaced with one of the requested size
+ */
+TEST(String,Reset)
+{
+  webvtt_string str, other;
+  const char *text;
+  ASSERT_EQ( WEBVTT_SUCCESS,
+             webvtt_create_string_with_text( &str, "Hello world", -1 ) );
+  text = webvtt_string_text( &str );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_string_reset( &str, 4 ) );
+  EXPECT_EQ( text, webvtt_string_text( &str ) );
+  EXPECT_STREQ( "", webvtt_string_text( &str ) );
+
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_string_append( &str, "Again", 5 ) );
+  webvtt_copy_string( &other, &str );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_string_reset( &str, 100 ) );
+  EXPECT_STREQ( "Again", webvtt_string_text( &other ) );
+  EXPECT_EQ( 0U, webvtt_string_length( &str ) );
+  EXPECT_LE( 100U, webvtt_string_capacity( &str ) );
+  webvtt_release_string( &other );
+  webvtt_release_string( &str );
+}
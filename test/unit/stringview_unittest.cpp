@@ -0,0 +1,158 @@
+#include "output_testfixture"
+
+class StringView : public CueCollectorTest
+{
+public:
+  StringView() : buffer(0), freed(0) {}
+
+  virtual void TearDown() {
+    CueCollectorTest::TearDown();
+    webvtt_release_buffer( &buffer );
+    EXPECT_EQ( 1, freed );
+  }
+
+  /**
+   * Parse 'text' from a buffer, in chunks of 'chunk' bytes
+   */
+  void parse( const std::string &text, webvtt_uint chunk = 0 ) {
+    webvtt_parser parser;
+    data = std::vector<char>( text.begin(), text.end() );
+    ASSERT_EQ( WEBVTT_SUCCESS,
+               webvtt_create_buffer( &data[ 0 ], data.size(), &onFree, this,
+                                     &buffer ) );
+    ASSERT_TRUE( ( parser = createParser() ) != 0 );
+    if( !chunk ) {
+      chunk = data.size();
+    }
+    for( webvtt_uint pos = 0; pos < data.size(); pos += chunk ) {
+      webvtt_uint n = std::min<webvtt_uint>( chunk, data.size() - pos );
+      webvtt_parse_chunk_from_buffer( parser, buffer, pos, n );
+    }
+    webvtt_finish_parsing( parser );
+    webvtt_delete_parser( parser );
+  }
+
+  bool isView( const webvtt_string &str ) {
+    return WEBVTT_STRING_IS_VIEW( str.d ) && str.d->u.owner == buffer;
+  }
+
+  static void WEBVTT_CALLBACK onFree( void *userdata, char *, webvtt_uint ) {
+    static_cast<StringView *>( userdata )->freed++;
+  }
+
+protected:
+  std::vector<char> data;
+  webvtt_buffer *buffer;
+  int freed;
+};
+
+/**
+ * A cue body read in one piece points into the buffer, and a text node
+ * spanning the whole body shares it
+ */
+TEST_F(StringView, BodyIsView)
+{
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nHello\nWorld\n\n" );
+  ASSERT_EQ( 1U, cues.size() );
+  EXPECT_STREQ( "Hello\nWorld", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_TRUE( isView( cues[ 0 ]->body ) );
+  ASSERT_EQ( 1U, cues[ 0 ]->node_head->data.internal_data->length );
+  EXPECT_TRUE( webvtt_string_is_same( &cues[ 0 ]->body,
+                 &cues[ 0 ]->node_head->data.internal_data->children[ 0 ]
+                   ->data.text ) );
+}
+
+/**
+ * The buffer stays alive for as long as a view of it does
+ */
+TEST_F(StringView, ViewPinsBuffer)
+{
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nHello\n\n" );
+  ASSERT_EQ( 1U, cues.size() );
+  webvtt_release_buffer( &buffer );
+  EXPECT_EQ( 0, freed );
+  EXPECT_STREQ( "Hello", webvtt_string_text( &cues[ 0 ]->body ) );
+}
+
+/**
+ * Modifying a view copies it, leaving the buffer alone
+ */
+TEST_F(StringView, ViewIsImmutable)
+{
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nHello\n\n" );
+  ASSERT_EQ( 1U, cues.size() );
+  webvtt_string body;
+  webvtt_copy_string( &body, &cues[ 0 ]->body );
+  ASSERT_EQ( WEBVTT_SUCCESS, webvtt_string_putc( &body, '!' ) );
+  EXPECT_FALSE( isView( body ) );
+  EXPECT_STREQ( "Hello!", webvtt_string_text( &body ) );
+  EXPECT_STREQ( "Hello", webvtt_string_text( &cues[ 0 ]->body ) );
+  webvtt_release_string( &body );
+}
+
+/**
+ * Lines separated by CRLF can't be one view, because the body joins them
+ * with LF
+ */
+TEST_F(StringView, CRLFBodyIsCopied)
+{
+  parse( "WEBVTT\r\n\r\n00:00.000 --> 00:01.000\r\nHello\r\nWorld\r\n\r\n"
+         "00:01.000 --> 00:02.000\r\nAgain\r\n" );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_STREQ( "Hello\nWorld", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_FALSE( isView( cues[ 0 ]->body ) );
+  EXPECT_STREQ( "Again", webvtt_string_text( &cues[ 1 ]->body ) );
+  EXPECT_TRUE( isView( cues[ 1 ]->body ) );
+}
+
+TEST_F(StringView, NulIsReplaced)
+{
+  parse( std::string( "WEBVTT\n\n00:00.000 --> 00:01.000\nA\0B\n\n", 37 ) );
+  ASSERT_EQ( 1U, cues.size() );
+  EXPECT_STREQ( "A\xEF\xBF\xBD" "B", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_FALSE( isView( cues[ 0 ]->body ) );
+}
+
+/**
+ * A last line without a line terminator isn't known to be complete until
+ * parsing finishes, by which time it has been collected in a copy
+ */
+TEST_F(StringView, UnterminatedBodyIsCopied)
+{
+  parse( "WEBVTT\n\n00:00.000 --> 00:01.000\nHello" );
+  ASSERT_EQ( 1U, cues.size() );
+  EXPECT_STREQ( "Hello", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_FALSE( isView( cues[ 0 ]->body ) );
+}
+
+/**
+ * Parsing never writes to the buffer, including when the text of a view is
+ * asked for
+ */
+TEST_F(StringView, BufferUnchanged)
+{
+  std::string text( "WEBVTT\n\n00:00.000 --> 00:01.000\nHello\nWorld\n\n"
+                    "00:01.000 --> 00:02.000\n<b>Again</b>\n" );
+  parse( text );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_EQ( text, std::string( data.begin(), data.end() ) );
+  EXPECT_STREQ( "Hello\nWorld", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_STREQ( "<b>Again</b>", webvtt_string_text( &cues[ 1 ]->body ) );
+  EXPECT_TRUE( isView( cues[ 0 ]->body ) );
+  EXPECT_EQ( text, std::string( data.begin(), data.end() ) );
+}
+
+/**
+ * Parsing a buffer in several chunks gives the same cues
+ */
+TEST_F(StringView, Chunked)
+{
+  parse( "WEBVTT\n\nid\n00:00.000 --> 00:01.000\nOne\nTwo\n\n"
+         "00:01.000 --> 00:02.000\n<b>Three</b>\n\n", 5 );
+  ASSERT_EQ( 2U, cues.size() );
+  EXPECT_STREQ( "id", webvtt_string_text( &cues[ 0 ]->id ) );
+  EXPECT_STREQ( "One\nTwo", webvtt_string_text( &cues[ 0 ]->body ) );
+  EXPECT_STREQ( "<b>Three</b>", webvtt_string_text( &cues[ 1 ]->body ) );
+  EXPECT_EQ( WEBVTT_BOLD, cues[ 1 ]->node_head->data.internal_data
+                            ->children[ 0 ]->kind );
+}
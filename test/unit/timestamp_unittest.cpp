@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <stdlib.h>
+extern "C" {
+#include "libwebvtt/parser_internal.h"
+}
+
+/**
+ * webvtt_parse_timestamp_n() gives exactly the same results as
+ * webvtt_parse_timestamp(), whether or not it takes its fast path
+ */
+static void
+expectSame( const std::string &text )
+{
+  webvtt_timestamp expected, actual;
+  int expectedLength = -1, actualLength = -1;
+  int expectedRv = webvtt_parse_timestamp( text.c_str(), &expectedLength,
+                                           &expected );
+  int actualRv = webvtt_parse_timestamp_n( text.c_str(), text.size(),
+                                           &actualLength, &actual );
+  EXPECT_EQ( expectedRv, actualRv ) << '"' << text << '"';
+  EXPECT_EQ( expected, actual ) << '"' << text << '"';
+  EXPECT_EQ( expectedLength, actualLength ) << '"' << text << '"';
+}
+
+TEST(Timestamp, Canonical)
+{
+  webvtt_timestamp ts;
+  int len;
+  EXPECT_EQ( 1, webvtt_parse_timestamp_n( "01:02:03.456", 12, &len, &ts ) );
+  EXPECT_EQ( 3723456U, ts );
+  EXPECT_EQ( 12, len );
+  EXPECT_EQ( 1, webvtt_parse_timestamp_n( "59:58.999 -->", 13, &len, &ts ) );
+  EXPECT_EQ( 3598999U, ts );
+  EXPECT_EQ( 9, len );
+  EXPECT_EQ( 1, webvtt_parse_timestamp_n( "99:00:00.000", 12, &len, &ts ) );
+  EXPECT_EQ( 356400000U, ts );
+}
+
+TEST(Timestamp, SameAsGeneralRoutine)
+{
+  const char *cases[] = {
+    "00:00.000", "00:00:00.000", "12:34:56.789 align:start", "59:59.999",
+    "60:00.000", "00:60.000", "00:00:60.000", "00:60:00.000",
+    "00:00.0000", "00:00:00.0000", "00:00.00", "0:00.000", "000:00:00.000",
+    "00:00:00.00", "00:00:00,000", "00:00;00.000", "00.00.000", "00:00:00.",
+    "00:00.", "00:00", "00:00:00", "1:02:03.004", "123:00:00.000",
+    "00:0a.000", "0/:00.000", "00:00.00:", "00:00.000\n", "00:00.999\t",
+    "-1:00.000", "00:00:00.000-->", "", ":", "0"
+  };
+  for( size_t i = 0; i < sizeof( cases ) / sizeof( cases[ 0 ] ); ++i ) {
+    expectSame( cases[ i ] );
+  }
+}
+
+TEST(Timestamp, RandomInput)
+{
+  const char alphabet[] = "0123456789:.0123456789:.-/;x ";
+  srand( 7 );
+  for( int i = 0; i < 200000; ++i ) {
+    std::string text( "00:00:00.000" );
+    int edits = rand() % 3;
+    for( int e = 0; e < edits; ++e ) {
+      size_t pos = rand() % ( text.size() + 1 );
+      char ch = alphabet[ rand() % ( sizeof( alphabet ) - 1 ) ];
+      switch( rand() % 3 ) {
+        case 0:
+          if( pos < text.size() ) {
+            text[ pos ] = ch;
+          }
+          break;
+        case 1:
+          text.insert( pos, 1, ch );
+          break;
+        default:
+          if( pos < text.size() ) {
+            text.erase( pos, 1 );
+          }
+      }
+    }
+    for( size_t d = 0; d < text.size(); ++d ) {
+      if( text[ d ] >= '0' && text[ d ] <= '9' ) {
+        text[ d ] = '0' + rand() % 10;
+      }
+    }
+    expectSame( text );
+    expectSame( text.substr( 3 ) );
+  }
+}